@@ -0,0 +1,255 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+// Compares the entity BVH against a linear scan over the same boxes: build,
+// refit after moving a fraction of them, and frustum, range and ray queries.
+// Also times picking rays against a triangle BVH over a heightfield mesh.
+// Query results are checked against the scan.
+//
+// usage: bvh_bench [--count N] [--queries N] [--moved fraction]
+//                  [--triangles N] [--seed N]
+
+struct BenchOptions {
+  uint32_t count = 100000;
+  uint32_t queries = 1000;
+  float moved = 0.01f;
+  uint32_t triangles = 2000000;
+  uint32_t seed = 1;
+};
+
+// scene is a cube of this half extent, objects up to a few units big
+constexpr float WORLD_SIZE = 500.0f;
+
+bool parseOptions(int argc, char **argv, BenchOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "--count") && hasValue)
+      opts.count = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--queries") && hasValue)
+      opts.queries = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--moved") && hasValue)
+      opts.moved = static_cast<float>(atof(argv[++i]));
+    else if (!strcmp(argv[i], "--triangles") && hasValue)
+      opts.triangles = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--seed") && hasValue)
+      opts.seed = atoi(argv[++i]);
+    else {
+      std::cerr << "unknown argument " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return opts.count > 0 && opts.queries > 0;
+}
+
+template <typename F> double timeMs(F &&f) {
+  const auto begin = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - begin)
+      .count();
+}
+
+void report(const char *name, double bvhMs, double linearMs, uint32_t runs) {
+  std::cout << name << ": bvh " << bvhMs / runs << " ms, linear "
+            << linearMs / runs << " ms, x" << linearMs / bvhMs << std::endl;
+}
+
+// the bvh returns ids in traversal order
+bool sameIds(std::vector<uint32_t> a, std::vector<uint32_t> b) {
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+  return a == b;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions opts;
+  if (!parseOptions(argc, argv, opts))
+    return 2;
+
+  std::mt19937 rng(opts.seed);
+  std::uniform_real_distribution<float> position(-WORLD_SIZE, WORLD_SIZE);
+  std::uniform_real_distribution<float> extent(0.25f, 4.0f);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  auto randomBox = [&](glm::vec3 center) {
+    const glm::vec3 half(extent(rng), extent(rng), extent(rng));
+    AABB box;
+    box.min = center - half;
+    box.max = center + half;
+    return box;
+  };
+
+  std::vector<AABB> boxes(opts.count);
+  for (auto &box : boxes)
+    box = randomBox(glm::vec3(position(rng), position(rng), position(rng)));
+
+  BVH bvh;
+  const double buildMs = timeMs([&] { bvh.build(boxes); });
+  std::cout << opts.count << " boxes, build " << buildMs << " ms" << std::endl;
+
+  // nudge some of them the way a moved entity would, then refit vs rebuild
+  const uint32_t moved = std::max(1u, (uint32_t)(opts.count * opts.moved));
+  std::vector<uint32_t> movedIds(moved);
+  for (auto &id : movedIds) {
+    id = rng() % opts.count;
+    const glm::vec3 offset(unit(rng), unit(rng), unit(rng));
+    boxes[id].min += offset;
+    boxes[id].max += offset;
+  }
+  const double refitMs = timeMs([&] {
+    for (uint32_t id : movedIds)
+      bvh.refit(id, boxes[id]);
+  });
+  BVH rebuilt;
+  const double rebuildMs = timeMs([&] { rebuilt.build(boxes); });
+  std::cout << moved << " moved, refit " << refitMs << " ms, rebuild "
+            << rebuildMs << " ms" << std::endl;
+
+  uint32_t mismatches = 0;
+  std::vector<uint32_t> fromBvh, fromScan;
+
+  // frustum queries from random cameras inside the world
+  {
+    const glm::mat4 proj =
+        glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+    std::vector<glm::mat4> viewProjs(opts.queries);
+    for (auto &viewProj : viewProjs) {
+      const glm::vec3 eye(position(rng), position(rng), position(rng));
+      const glm::vec3 dir(unit(rng), unit(rng), unit(rng));
+      viewProj =
+          proj * glm::lookAt(eye, eye + dir, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    double bvhMs = 0.0, linearMs = 0.0;
+    for (const auto &viewProj : viewProjs) {
+      glm::vec4 planes[6];
+      extractFrustumPlanes(viewProj, planes);
+      fromBvh.clear();
+      fromScan.clear();
+      bvhMs += timeMs([&] { bvh.queryFrustum(planes, fromBvh); });
+      linearMs += timeMs([&] {
+        for (uint32_t i = 0; i < boxes.size(); i++)
+          if (intersectFrustumAABB(planes, boxes[i]))
+            fromScan.emplace_back(i);
+      });
+      mismatches += !sameIds(fromBvh, fromScan);
+    }
+    report("frustum", bvhMs, linearMs, opts.queries);
+  }
+
+  // range queries, boxes of 10 to 50 units around random points
+  {
+    std::uniform_real_distribution<float> radius(5.0f, 25.0f);
+    double bvhMs = 0.0, linearMs = 0.0;
+    for (uint32_t q = 0; q < opts.queries; q++) {
+      const glm::vec3 center(position(rng), position(rng), position(rng));
+      const glm::vec3 half(radius(rng));
+      AABB range;
+      range.min = center - half;
+      range.max = center + half;
+      fromBvh.clear();
+      fromScan.clear();
+      bvhMs += timeMs([&] { bvh.queryRange(range, fromBvh); });
+      linearMs += timeMs([&] {
+        for (uint32_t i = 0; i < boxes.size(); i++)
+          if (boxes[i].overlaps(range))
+            fromScan.emplace_back(i);
+      });
+      mismatches += !sameIds(fromBvh, fromScan);
+    }
+    report("range", bvhMs, linearMs, opts.queries);
+  }
+
+  // nearest box hit by rays from outside the world through random points
+  {
+    double bvhMs = 0.0, linearMs = 0.0;
+    for (uint32_t q = 0; q < opts.queries; q++) {
+      const glm::vec3 target(position(rng), position(rng), position(rng));
+      const glm::vec3 origin = glm::normalize(glm::vec3(
+                                   unit(rng), unit(rng), unit(rng))) *
+                               WORLD_SIZE * 2.0f;
+      const glm::vec3 dir = glm::normalize(target - origin);
+
+      RayHit hit, scan;
+      bvhMs += timeMs([&] { hit = bvh.raycast(origin, dir); });
+      linearMs += timeMs([&] {
+        const glm::vec3 invDir = 1.0f / dir;
+        for (uint32_t i = 0; i < boxes.size(); i++) {
+          float t;
+          if (intersectRayAABB(origin, invDir, boxes[i], scan.t, t) &&
+              t < scan.t) {
+            scan.t = t;
+            scan.id = i;
+          }
+        }
+      });
+      mismatches += hit.t != scan.t;
+    }
+    report("raycast", bvhMs, linearMs, opts.queries);
+  }
+
+  // picking rays against a bumpy grid, two triangles per cell
+  if (opts.triangles > 0) {
+    const uint32_t cells =
+        std::max(1u, (uint32_t)sqrtf(opts.triangles * 0.5f));
+    const float cellSize = 2.0f * WORLD_SIZE / cells;
+    std::uniform_real_distribution<float> height(0.0f, 2.0f);
+
+    std::vector<glm::vec3> positions;
+    positions.reserve((cells + 1) * (cells + 1));
+    for (uint32_t z = 0; z <= cells; z++)
+      for (uint32_t x = 0; x <= cells; x++)
+        positions.emplace_back(-WORLD_SIZE + x * cellSize, height(rng),
+                               -WORLD_SIZE + z * cellSize);
+    std::vector<uint32_t> indices;
+    indices.reserve(cells * cells * 6);
+    for (uint32_t z = 0; z < cells; z++)
+      for (uint32_t x = 0; x < cells; x++) {
+        const uint32_t i = z * (cells + 1) + x;
+        for (uint32_t idx : {i, i + cells + 1, i + 1, i + 1, i + cells + 1,
+                             i + cells + 2})
+          indices.emplace_back(idx);
+      }
+
+    TriangleBVH mesh;
+    const double meshMs = timeMs([&] { mesh.build(positions, indices); });
+    std::cout << mesh.triangleCount() << " triangles, build " << meshMs
+              << " ms" << std::endl;
+
+    double bvhMs = 0.0, linearMs = 0.0;
+    for (uint32_t q = 0; q < opts.queries; q++) {
+      const glm::vec3 origin(position(rng), 50.0f, position(rng));
+      const glm::vec3 target(position(rng), 0.0f, position(rng));
+      const glm::vec3 dir = glm::normalize(target - origin);
+
+      float t = -1.0f, scan = FLT_MAX;
+      bvhMs += timeMs([&] { t = mesh.raycast(origin, dir); });
+      linearMs += timeMs([&] {
+        for (uint32_t i = 0; i < indices.size(); i += 3) {
+          const float hit = intersectRayTriangle(
+              origin, dir, positions[indices[i]], positions[indices[i + 1]],
+              positions[indices[i + 2]]);
+          if (hit >= 0.0f && hit < scan)
+            scan = hit;
+        }
+      });
+      mismatches += (t < 0.0f ? FLT_MAX : t) != scan;
+    }
+    report("triangles", bvhMs, linearMs, opts.queries);
+  }
+
+  if (mismatches > 0) {
+    std::cerr << mismatches << " queries disagree with the linear scan"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
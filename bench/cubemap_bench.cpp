@@ -0,0 +1,123 @@
+#include "UtilsCubemap.h"
+#include "jobSystem.h"
+#include "stbi_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+// Compares the equirectangular to cube faces conversion through the
+// vertical cross against the direct one, single threaded and on the job
+// system, for every hdr in resources/skybox. The direct faces are checked
+// against the cross ones.
+//
+// usage: cubemap_bench [--runs N] [--workers N] [--tolerance 0.01]
+
+namespace fs = std::filesystem;
+
+struct BenchOptions {
+  uint32_t runs = 5;
+  // 0 is one per hardware thread
+  uint32_t workers = 0;
+  // relative difference allowed per channel, the direct path uses a
+  // polynomial atan2
+  float tolerance = 0.01f;
+};
+
+bool parseOptions(int argc, char **argv, BenchOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "--runs") && hasValue)
+      opts.runs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--workers") && hasValue)
+      opts.workers = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--tolerance") && hasValue)
+      opts.tolerance = static_cast<float>(atof(argv[++i]));
+    else {
+      std::cerr << "unknown argument " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return opts.runs > 0;
+}
+
+// best of runs, in ms
+template <typename F> double bestMs(uint32_t runs, F &&f) {
+  double best = 0.0;
+  for (uint32_t run = 0; run < runs; run++) {
+    const auto begin = std::chrono::steady_clock::now();
+    f();
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count();
+    best = run == 0 ? ms : std::min(best, ms);
+  }
+  return best;
+}
+
+// channels further apart than tolerance, relative to the reference
+size_t countMismatches(const Bitmap &reference, const Bitmap &faces,
+                       float tolerance) {
+  if (reference.data_.size() != faces.data_.size())
+    return reference.data_.size() / sizeof(float);
+  const float *a = reinterpret_cast<const float *>(reference.data_.data());
+  const float *b = reinterpret_cast<const float *>(faces.data_.data());
+  size_t mismatches = 0;
+  for (size_t i = 0; i < reference.data_.size() / sizeof(float); i++)
+    if (std::fabs(a[i] - b[i]) > tolerance * (std::fabs(a[i]) + 1e-3f))
+      mismatches++;
+  return mismatches;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions opts;
+  if (!parseOptions(argc, argv, opts))
+    return 2;
+
+  JobSystem jobs(opts.workers);
+  std::cout << jobs.getWorkerCount() << " workers" << std::endl;
+
+  uint32_t failures = 0;
+  for (const auto &entry : fs::directory_iterator(RESOURCES_PATH "skybox")) {
+    const std::string path = entry.path();
+    if (entry.path().extension() != ".hdr")
+      continue;
+
+    int w, h;
+    float *img = stbi_loadf(path.c_str(), &w, &h, nullptr, 4);
+    if (!img) {
+      std::cerr << "failed to load " << path << std::endl;
+      failures++;
+      continue;
+    }
+    const Bitmap in(w, h, 4, eBitmapFormat_Float, img);
+    stbi_image_free(img);
+
+    Bitmap reference, faces;
+    const double crossMs = bestMs(opts.runs, [&] {
+      reference = convertVerticalCrossToCubeMapFaces(
+          convertEquirectangularMapToVerticalCross(in));
+    });
+    const double directMs = bestMs(opts.runs, [&] {
+      faces = convertEquirectangularMapToCubeMapFaces(in);
+    });
+    const double jobsMs = bestMs(opts.runs, [&] {
+      faces = convertEquirectangularMapToCubeMapFaces(in, &jobs);
+    });
+
+    const size_t mismatches =
+        countMismatches(reference, faces, opts.tolerance);
+    if (mismatches)
+      failures++;
+    std::cout << entry.path().filename().string() << " " << w << "x" << h
+              << ": cross " << crossMs << " ms, direct " << directMs
+              << " ms (x" << crossMs / directMs << "), jobs " << jobsMs
+              << " ms (x" << crossMs / jobsMs << "), " << mismatches
+              << " mismatches" << std::endl;
+  }
+  return failures ? 1 : 0;
+}
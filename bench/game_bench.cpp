@@ -0,0 +1,299 @@
+#include "entities.h"
+#include "json.hpp"
+#include "maiApp.h"
+#include "profiler.h"
+#include "skybox.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Replays a scripted camera flight through the main.cpp scene with a fixed
+// time step and records per frame timings.
+//
+// usage: game_bench [--frames N] [--warmup N] [--dt seconds] [--csv path]
+//                   [--json path] [--baseline summary.json]
+//                   [--tolerance 0.1] [--window] [--trace trace.json]
+
+using json = nlohmann::json;
+
+struct BenchOptions {
+  uint32_t frames = 600;
+  uint32_t warmup = 60;
+  float dt = 1.0f / 60.0f;
+  const char *csvPath = "bench_frames.csv";
+  const char *jsonPath = "bench_summary.json";
+  const char *baselinePath = nullptr;
+  const char *tracePath = nullptr;
+  float tolerance = 0.10f;
+  bool window = false;
+};
+
+struct CameraKey {
+  float time;
+  glm::vec3 pos;
+  float yaw;
+  float pitch;
+};
+
+// a loop around the origin, looping after the last key
+const std::vector<CameraKey> cameraPath = {
+    {0.0f, glm::vec3(0.0f, 2.0f, 8.0f), -90.0f, -10.0f},
+    {2.5f, glm::vec3(8.0f, 3.0f, 0.0f), -180.0f, -15.0f},
+    {5.0f, glm::vec3(0.0f, 6.0f, -8.0f), -270.0f, -30.0f},
+    {7.5f, glm::vec3(-8.0f, 3.0f, 0.0f), -360.0f, -15.0f},
+    {10.0f, glm::vec3(0.0f, 2.0f, 8.0f), -450.0f, -10.0f},
+};
+
+CameraKey sampleCameraPath(float time) {
+  const float duration = cameraPath.back().time;
+  time = fmodf(time, duration);
+
+  size_t i = 0;
+  while (i + 2 < cameraPath.size() && cameraPath[i + 1].time < time)
+    i++;
+
+  const CameraKey &a = cameraPath[i];
+  const CameraKey &b = cameraPath[i + 1];
+  const float t = glm::clamp((time - a.time) / (b.time - a.time), 0.0f, 1.0f);
+  return {
+      .time = time,
+      .pos = glm::mix(a.pos, b.pos, t),
+      .yaw = glm::mix(a.yaw, b.yaw, t),
+      .pitch = glm::mix(a.pitch, b.pitch, t),
+  };
+}
+
+struct FrameSample {
+  double cpuMs;
+  double waitMs;
+  double submitMs;
+  double gpuMs;
+};
+
+json summarize(std::vector<double> values) {
+  if (values.empty())
+    return json::object();
+
+  std::sort(values.begin(), values.end());
+  auto percentile = [&](double p) {
+    const size_t rank = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(rank, values.size() - 1)];
+  };
+  double sum = 0.0;
+  for (double v : values)
+    sum += v;
+
+  return {
+      {"mean", sum / values.size()},
+      {"p50", percentile(0.50)},
+      {"p95", percentile(0.95)},
+      {"p99", percentile(0.99)},
+      {"max", values.back()},
+  };
+}
+
+bool parseOptions(int argc, char **argv, BenchOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "--frames") && hasValue)
+      opts.frames = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--warmup") && hasValue)
+      opts.warmup = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--dt") && hasValue)
+      opts.dt = static_cast<float>(atof(argv[++i]));
+    else if (!strcmp(argv[i], "--csv") && hasValue)
+      opts.csvPath = argv[++i];
+    else if (!strcmp(argv[i], "--json") && hasValue)
+      opts.jsonPath = argv[++i];
+    else if (!strcmp(argv[i], "--baseline") && hasValue)
+      opts.baselinePath = argv[++i];
+    else if (!strcmp(argv[i], "--trace") && hasValue)
+      opts.tracePath = argv[++i];
+    else if (!strcmp(argv[i], "--tolerance") && hasValue)
+      opts.tolerance = static_cast<float>(atof(argv[++i]));
+    else if (!strcmp(argv[i], "--window"))
+      opts.window = true;
+    else {
+      std::cerr << "unknown argument " << argv[i] << std::endl;
+      return false;
+    }
+  }
+  return opts.frames > 0 && opts.dt > 0.0f;
+}
+
+// compares p50/p95 of every metric against a previous summary, returns the
+// number of metrics that got slower than the tolerance allows
+uint32_t compareBaseline(const json &summary, const char *baselinePath,
+                         float tolerance) {
+  std::ifstream file(baselinePath);
+  if (!file.is_open()) {
+    std::cerr << "failed to open baseline " << baselinePath << std::endl;
+    return 1;
+  }
+  json baseline = json::parse(file);
+
+  uint32_t regressions = 0;
+  for (auto &[metric, stats] : summary["metrics"].items()) {
+    if (!baseline["metrics"].contains(metric))
+      continue;
+    for (const char *key : {"p50", "p95"}) {
+      if (!stats.contains(key) || !baseline["metrics"][metric].contains(key))
+        continue;
+      const double current = stats[key];
+      const double previous = baseline["metrics"][metric][key];
+      if (current > previous * (1.0 + tolerance)) {
+        std::cerr << "regression: " << metric << " " << key << " " << previous
+                  << " ms -> " << current << " ms" << std::endl;
+        regressions++;
+      }
+    }
+  }
+  return regressions;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions opts;
+  if (!parseOptions(argc, argv, opts))
+    return 2;
+
+  if (opts.tracePath) {
+    MAI_PROFILE_THREAD("main");
+    Profiler::setEnabled(true);
+  }
+
+  MaiApp *mai = new MaiApp(!opts.window);
+  VkFormat format = mai->depthTexture->getDeptFormat();
+
+  Skybox *skybox = new Skybox(mai->ren, mai->jobs, mai->pipelines, format);
+  Entities *entities = new Entities(mai->ren, mai->jobs, mai->pipelines,
+                                    mai->window, format);
+
+  // gpu times arrive MAX_FRAMES_IN_FLIGHT frames late, so render a few extra
+  // frames at the end to collect them
+  const uint32_t totalFrames = opts.warmup + opts.frames + MAX_FRAMES_IN_FLIGHT;
+  std::vector<FrameSample> samples(totalFrames);
+  uint32_t frame = 0;
+
+  auto draw = [&](MAI::CommandBuffer *buff, uint32_t width, uint32_t height,
+                  float ratio, float deltaSecond) {
+    glm::mat4 p = glm::perspective(glm::radians(60.0f), ratio, 0.1f, 1000.0f);
+    p[1][1] *= -1;
+    const glm::mat4 view = mai->camera->GetViewMatrix();
+
+    {
+      MAI::GpuZone zone(buff, "skybox");
+      skybox->draw({
+          .buff = buff,
+          .ratio = ratio,
+          .proj = p,
+          .view = view,
+          .cameraPos = mai->camera->Position,
+      });
+    }
+
+    MAI::GpuZone zone(buff, "entities");
+    buff->cmdBindDepthState({
+        .depthWriteEnable = true,
+        .compareOp = MAI::CompareOp::Less,
+    });
+    entities->draw({
+        .buff = buff,
+        .proj = p,
+        .view = view,
+        .cameraPos = mai->camera->Position,
+        .mouse_state = {},
+    });
+  };
+
+  auto beforeDraw = [&](MAI::CommandBuffer *buff, uint32_t width,
+                        uint32_t height, float ratio, float deltaSecond) {
+    if (frame >= MAX_FRAMES_IN_FLIGHT)
+      samples[frame - MAX_FRAMES_IN_FLIGHT].gpuMs =
+          mai->ren->getGpuFrameTime();
+
+    const CameraKey key = sampleCameraPath(frame * opts.dt);
+    mai->camera->Position = key.pos;
+    mai->camera->SetOrientation(key.yaw, key.pitch);
+
+    glm::mat4 p = glm::perspective(glm::radians(60.0f), ratio, 0.1f, 1000.0f);
+    p[1][1] *= -1;
+    entities->cull({
+        .buff = buff,
+        .proj = p,
+        .view = mai->camera->GetViewMatrix(),
+    });
+  };
+
+  auto afterDraw = [&](MAI::CommandBuffer *buff, uint32_t width,
+                       uint32_t height, float ratio, float deltaSecond) {
+    samples[frame].cpuMs = mai->frameTimings.cpuMs;
+    samples[frame].waitMs = mai->frameTimings.waitMs;
+    samples[frame].submitMs = mai->frameTimings.submitMs;
+    frame++;
+  };
+
+  if (opts.window) {
+    // the windowed loop has no frame limit, stop it once we have enough
+    auto stopAfterDraw = [&](MAI::CommandBuffer *buff, uint32_t width,
+                             uint32_t height, float ratio, float deltaSecond) {
+      afterDraw(buff, width, height, ratio, deltaSecond);
+      if (frame == totalFrames)
+        glfwSetWindowShouldClose(mai->window, GLFW_TRUE);
+    };
+    mai->run(draw, beforeDraw, stopAfterDraw);
+  } else
+    mai->runHeadless(totalFrames, opts.dt, draw, beforeDraw, afterDraw);
+
+  // drop warmup and the extra frames
+  samples.erase(samples.begin(), samples.begin() + opts.warmup);
+  samples.resize(opts.frames);
+
+  std::ofstream csv(opts.csvPath);
+  csv << "frame,cpu_ms,wait_ms,submit_ms,gpu_ms\n";
+  std::vector<double> cpu, wait, submit, gpu;
+  for (size_t i = 0; i < samples.size(); i++) {
+    const FrameSample &s = samples[i];
+    csv << i << "," << s.cpuMs << "," << s.waitMs << "," << s.submitMs << ","
+        << s.gpuMs << "\n";
+    cpu.push_back(s.cpuMs);
+    wait.push_back(s.waitMs);
+    submit.push_back(s.submitMs);
+    if (s.gpuMs > 0.0)
+      gpu.push_back(s.gpuMs);
+  }
+
+  json summary = {
+      {"frames", opts.frames},
+      {"warmup", opts.warmup},
+      {"dt", opts.dt},
+      {"headless", !opts.window},
+      {"metrics",
+       {
+           {"cpu_ms", summarize(cpu)},
+           {"wait_ms", summarize(wait)},
+           {"submit_ms", summarize(submit)},
+           {"gpu_ms", summarize(gpu)},
+       }},
+  };
+
+  std::ofstream(opts.jsonPath) << summary.dump(2) << std::endl;
+  std::cout << summary.dump(2) << std::endl;
+
+  if (opts.tracePath && !Profiler::dump(opts.tracePath))
+    std::cerr << "failed to write trace " << opts.tracePath << std::endl;
+
+  int result = 0;
+  if (opts.baselinePath &&
+      compareBaseline(summary, opts.baselinePath, opts.tolerance) > 0)
+    result = 1;
+
+  delete entities;
+  delete skybox;
+  delete mai;
+
+  return result;
+}
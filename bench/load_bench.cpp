@@ -0,0 +1,134 @@
+#include "assets.h"
+#include "jobSystem.h"
+#include "maiApp.h"
+#include "profiler.h"
+#include "skybox.h"
+#include "textures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+// Loads every asset, texture and skybox directory the way main.cpp does,
+// once per worker count, and reports the startup time against a single
+// worker. A first load warms the caches so every run takes the same path.
+//
+// usage: load_bench [--workers 1,2,4,...] [--runs N] [--trace trace.json]
+
+namespace fs = std::filesystem;
+
+struct BenchOptions {
+  std::vector<uint32_t> workers;
+  uint32_t runs = 3;
+  const char *tracePath = nullptr;
+};
+
+bool parseOptions(int argc, char **argv, BenchOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "--workers") && hasValue) {
+      std::stringstream list(argv[++i]);
+      std::string count;
+      while (std::getline(list, count, ','))
+        opts.workers.emplace_back(atoi(count.c_str()));
+    } else if (!strcmp(argv[i], "--runs") && hasValue)
+      opts.runs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--trace") && hasValue)
+      opts.tracePath = argv[++i];
+    else {
+      std::cerr << "unknown argument " << argv[i] << std::endl;
+      return false;
+    }
+  }
+
+  // powers of two up to one worker per hardware thread
+  if (opts.workers.empty()) {
+    const uint32_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    for (uint32_t count = 1; count < hardware; count *= 2)
+      opts.workers.emplace_back(count);
+    opts.workers.emplace_back(hardware);
+  }
+  for (uint32_t count : opts.workers)
+    if (count == 0)
+      return false;
+  return opts.runs > 0;
+}
+
+uint32_t countEntries(const char *path) {
+  uint32_t count = 0;
+  for (const auto &entry : fs::directory_iterator(path))
+    count++;
+  return count;
+}
+
+// loads everything in parallel and waits for the uploads, returns ms
+double loadAll(MAI::Renderer *ren, JobSystem *jobs, VkFormat format) {
+  Assets *assets = nullptr;
+  Textures *textures = nullptr;
+  Skybox *skybox = nullptr;
+
+  const auto begin = std::chrono::steady_clock::now();
+  // pipelines compile on the jobs being measured, through the driver cache
+  PipelineRegistry pipelines(ren, jobs);
+  JobHandle loadAssets = jobs->submit([&] { assets = new Assets(ren, jobs); });
+  JobHandle loadTextures =
+      jobs->submit([&] { textures = new Textures(ren, jobs); });
+  JobHandle loadSkybox =
+      jobs->submit([&] { skybox = new Skybox(ren, jobs, &pipelines, format); });
+  jobs->wait({loadAssets, loadTextures, loadSkybox});
+  ren->waitDeviceIdle();
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+
+  delete skybox;
+  delete textures;
+  delete assets;
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions opts;
+  if (!parseOptions(argc, argv, opts))
+    return 2;
+
+  if (opts.tracePath) {
+    MAI_PROFILE_THREAD("main");
+    Profiler::setEnabled(true);
+  }
+
+  MaiApp *mai = new MaiApp(true);
+  VkFormat format = mai->depthTexture->getDeptFormat();
+
+  std::cout << "directories: " << countEntries(RESOURCES_PATH "assets")
+            << " assets, " << countEntries(RESOURCES_PATH "textures")
+            << " textures, " << countEntries(RESOURCES_PATH "skybox")
+            << " skybox entries" << std::endl;
+
+  std::cout << "warming caches: " << loadAll(mai->ren, mai->jobs, format)
+            << " ms" << std::endl;
+
+  double baseline = 0.0;
+  for (uint32_t workerCount : opts.workers) {
+    JobSystem jobs(workerCount);
+    double best = 0.0;
+    for (uint32_t run = 0; run < opts.runs; run++) {
+      const double ms = loadAll(mai->ren, &jobs, format);
+      best = run == 0 ? ms : std::min(best, ms);
+    }
+    if (baseline == 0.0)
+      baseline = best;
+    std::cout << workerCount << " workers: " << best << " ms, x"
+              << baseline / best << std::endl;
+  }
+
+  if (opts.tracePath && !Profiler::dump(opts.tracePath))
+    std::cerr << "failed to write trace " << opts.tracePath << std::endl;
+
+  delete mai;
+  return 0;
+}
@@ -1,15 +1,69 @@
 #pragma once
 
+#include <array>
+#include <cassert>
 #include <string.h>
+#include <type_traits>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "pixelConvert.h"
+
 enum eBitmapType { eBitmapType_2D, eBitmapType_Cube };
 
 enum eBitmapFormat {
   eBitmapFormat_UnsignedByte,
   eBitmapFormat_Float,
+  // IEEE half floats, viewed as uint16_t
+  eBitmapFormat_Half,
+};
+
+// components of a view as floats and back, kernels written once over T
+// work on every format. Bytes keep their 0-255 range
+inline float loadComponent(uint8_t value) { return value; }
+inline float loadComponent(uint16_t value) { return unpackHalf(value); }
+inline float loadComponent(float value) { return value; }
+template <typename T> T storeComponent(float value) {
+  if constexpr (std::is_same_v<T, uint16_t>)
+    return packHalf(value);
+  else
+    return T(value);
+}
+
+/// Typed pixel access for loops that would pay a format switch and a vec4
+/// round trip per texel through getPixel/setPixel. T is uint8_t, uint16_t
+/// for halves or float, const for reading, and Comp the components per
+/// pixel. Rows are tightly packed and the faces of a cube follow each other,
+/// so the whole image is also one span of size() components for the bulk
+/// conversions
+template <typename T, int Comp> struct BitmapView {
+  using Type = T;
+  static constexpr int COMP = Comp;
+
+  T *data = nullptr;
+  int w = 0;
+  int h = 0;
+  int d = 1;
+
+  T *row(int y, int face = 0) const {
+    return data + ((size_t)face * h + y) * w * Comp;
+  }
+  T *pixel(int x, int y, int face = 0) const {
+    return row(y, face) + (size_t)x * Comp;
+  }
+  size_t size() const { return (size_t)w * h * d * Comp; }
+  BitmapView face(int f) const { return {row(0, f), w, h, 1}; }
+
+  void fill(const std::array<std::remove_const_t<T>, Comp> &value) const {
+    for (T *p = data, *end = data + size(); p != end; p += Comp)
+      memcpy(p, value.data(), sizeof(value));
+  }
+  // src has the same size
+  void copy(BitmapView<const std::remove_const_t<T>, Comp> src) const {
+    assert(src.size() == size());
+    memcpy(data, src.data, size() * sizeof(T));
+  }
 };
 
 /// R/RG/RGB/RGBA bitmaps
@@ -17,18 +71,13 @@ struct Bitmap {
   Bitmap() = default;
   Bitmap(int w, int h, int comp, eBitmapFormat fmt)
       : w_(w), h_(h), comp_(comp), fmt_(fmt),
-        data_(w * h * comp * getBytesPerComponent(fmt)) {
-    initGetSetFuncs();
-  }
+        data_(w * h * comp * getBytesPerComponent(fmt)) {}
   Bitmap(int w, int h, int d, int comp, eBitmapFormat fmt)
       : w_(w), h_(h), d_(d), comp_(comp), fmt_(fmt),
-        data_(w * h * d * comp * getBytesPerComponent(fmt)) {
-    initGetSetFuncs();
-  }
+        data_(w * h * d * comp * getBytesPerComponent(fmt)) {}
   Bitmap(int w, int h, int comp, eBitmapFormat fmt, const void *ptr)
       : w_(w), h_(h), comp_(comp), fmt_(fmt),
         data_(w * h * comp * getBytesPerComponent(fmt)) {
-    initGetSetFuncs();
     memcpy(data_.data(), ptr, data_.size());
   }
   int w_ = 0;
@@ -44,32 +93,101 @@ struct Bitmap {
       return 1;
     if (fmt == eBitmapFormat_Float)
       return 4;
+    if (fmt == eBitmapFormat_Half)
+      return 2;
     return 0;
   }
 
-  void setPixel(int x, int y, const glm::vec4 &c) {
-    (*this.*setPixelFunc)(x, y, c);
+  template <typename T, int Comp> bool isViewOf() const {
+    using U = std::remove_const_t<T>;
+    if (Comp != comp_)
+      return false;
+    switch (fmt_) {
+    case eBitmapFormat_UnsignedByte:
+      return std::is_same_v<U, uint8_t>;
+    case eBitmapFormat_Float:
+      return std::is_same_v<U, float>;
+    case eBitmapFormat_Half:
+      return std::is_same_v<U, uint16_t>;
+    }
+    return false;
   }
-  glm::vec4 getPixel(int x, int y) const {
-    return ((*this.*getPixelFunc)(x, y));
+  template <typename T, int Comp> BitmapView<T, Comp> view() {
+    assert((isViewOf<T, Comp>()));
+    return {reinterpret_cast<T *>(data_.data()), w_, h_, d_};
+  }
+  template <typename T, int Comp> BitmapView<const T, Comp> view() const {
+    assert((isViewOf<T, Comp>()));
+    return {reinterpret_cast<const T *>(data_.data()), w_, h_, d_};
   }
 
-private:
-  using setPixel_t = void (Bitmap::*)(int, int, const glm::vec4 &);
-  using getPixel_t = glm::vec4 (Bitmap::*)(int, int) const;
-  setPixel_t setPixelFunc = &Bitmap::setPixelUnsignedByte;
-  getPixel_t getPixelFunc = &Bitmap::getPixelUnsignedByte;
+  // calls fn with the view matching the format, picked once per image
+  template <typename F> void visit(F &&fn) {
+    switch (fmt_) {
+    case eBitmapFormat_UnsignedByte:
+      return visitComp<uint8_t>(fn);
+    case eBitmapFormat_Float:
+      return visitComp<float>(fn);
+    case eBitmapFormat_Half:
+      return visitComp<uint16_t>(fn);
+    }
+  }
+  template <typename F> void visit(F &&fn) const {
+    switch (fmt_) {
+    case eBitmapFormat_UnsignedByte:
+      return visitComp<uint8_t>(fn);
+    case eBitmapFormat_Float:
+      return visitComp<float>(fn);
+    case eBitmapFormat_Half:
+      return visitComp<uint16_t>(fn);
+    }
+  }
 
-  void initGetSetFuncs() {
+  void setPixel(int x, int y, const glm::vec4 &c) {
+    switch (fmt_) {
+    case eBitmapFormat_UnsignedByte:
+      return setPixelUnsignedByte(x, y, c);
+    case eBitmapFormat_Float:
+      return setPixelFloat(x, y, c);
+    case eBitmapFormat_Half:
+      return setPixelHalf(x, y, c);
+    }
+  }
+  glm::vec4 getPixel(int x, int y) const {
     switch (fmt_) {
     case eBitmapFormat_UnsignedByte:
-      setPixelFunc = &Bitmap::setPixelUnsignedByte;
-      getPixelFunc = &Bitmap::getPixelUnsignedByte;
-      break;
+      return getPixelUnsignedByte(x, y);
     case eBitmapFormat_Float:
-      setPixelFunc = &Bitmap::setPixelFloat;
-      getPixelFunc = &Bitmap::getPixelFloat;
-      break;
+      return getPixelFloat(x, y);
+    case eBitmapFormat_Half:
+      return getPixelHalf(x, y);
+    }
+    return glm::vec4(0.0f);
+  }
+
+private:
+  template <typename T, typename F> void visitComp(F &fn) {
+    switch (comp_) {
+    case 1:
+      return fn(view<T, 1>());
+    case 2:
+      return fn(view<T, 2>());
+    case 3:
+      return fn(view<T, 3>());
+    case 4:
+      return fn(view<T, 4>());
+    }
+  }
+  template <typename T, typename F> void visitComp(F &fn) const {
+    switch (comp_) {
+    case 1:
+      return fn(view<T, 1>());
+    case 2:
+      return fn(view<T, 2>());
+    case 3:
+      return fn(view<T, 3>());
+    case 4:
+      return fn(view<T, 4>());
     }
   }
 
@@ -93,6 +211,21 @@ private:
         comp_ > 2 ? data[ofs + 2] : 0.0f, comp_ > 3 ? data[ofs + 3] : 0.0f);
   }
 
+  void setPixelHalf(int x, int y, const glm::vec4 &c) {
+    const int ofs = comp_ * (y * w_ + x);
+    uint16_t *data = reinterpret_cast<uint16_t *>(data_.data());
+    for (int i = 0; i < comp_ && i < 4; i++)
+      data[ofs + i] = packHalf(c[i]);
+  }
+  glm::vec4 getPixelHalf(int x, int y) const {
+    const int ofs = comp_ * (y * w_ + x);
+    const uint16_t *data = reinterpret_cast<const uint16_t *>(data_.data());
+    glm::vec4 c(0.0f);
+    for (int i = 0; i < comp_ && i < 4; i++)
+      c[i] = unpackHalf(data[ofs + i]);
+    return c;
+  }
+
   void setPixelUnsignedByte(int x, int y, const glm::vec4 &c) {
     const int ofs = comp_ * (y * w_ + x);
     if (comp_ > 0)
@@ -112,3 +245,7 @@ private:
                      comp_ > 3 ? float(data_[ofs + 3]) / 255.0f : 0.0f);
   }
 };
+
+// in pixelConvert.cpp. The bitmap in another format, srgb decodes or encodes
+// the color components of bytes on the way. Halves and bytes go through float
+Bitmap convertBitmap(const Bitmap &b, eBitmapFormat fmt, bool srgb = false);
@@ -76,6 +76,12 @@ struct Camera {
     updateCameraView();
   }
 
+  void SetOrientation(float yaw, float pitch) {
+    Yaw = yaw;
+    Pitch = pitch;
+    updateCameraView();
+  }
+
   void ProcessMouseScroll(float yoffset) {
     Zoom -= yoffset;
     if (Zoom < 1.0f)
@@ -4,10 +4,13 @@
 
 #include "Bitmap.h"
 
+struct JobSystem;
+
 Bitmap convertEquirectangularMapToVerticalCross(const Bitmap &b);
 Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap &b);
 
-inline Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap &b) {
-  return convertVerticalCrossToCubeMapFaces(
-      convertEquirectangularMapToVerticalCross(b));
-}
+// the two conversions above in one pass, without the cross in between. RGBA
+// float maps are sampled with SIMD (AVX2 when the CPU has it) and split by
+// rows over jobs when given some, other formats go through the cross
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap &b,
+                                               JobSystem *jobs = nullptr);
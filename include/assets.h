@@ -1,7 +1,12 @@
 #pragma once
+#include "fileWatcher.h"
+#include "jobSystem.h"
 #include "mai_config.h"
 #include "mai_vk.h"
 #include "model.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 struct ModelInfo {
   uint32_t id;
@@ -9,13 +14,24 @@ struct ModelInfo {
 };
 
 struct Assets {
-  Assets(MAI::Renderer *ren, VkFormat format);
+  // one job per model directory
+  Assets(MAI::Renderer *ren, JobSystem *jobs);
   ~Assets();
 
   // void drawModels(MAI::CommandBuffer *buffer, glm::mat4 proj, glm::mat4 view,
   //                 uint32_t id);
 
+  // re-imports the model directories changed on disk, new ones included
+  void watch();
+  // once a frame before recording. Starts importing the changed models on
+  // jobs and swaps in the ones done, they keep the id of the model they
+  // replace. The replaced ones go to the renderer's deferred deletes. True
+  // when models changed
+  bool update();
+
   std::vector<ModelInfo> getModelInfos();
+  // vertices and indices of every model
+  MeshPool *getMeshPool() { return meshPool; }
 
   Model *getModel(uint32_t id) {
     Model *model = nullptr;
@@ -26,9 +42,27 @@ struct Assets {
   }
 
 private:
+  struct ImportedModel {
+    std::string dir;
+    Model *model;
+  };
+
+  // the model directory path is in, false for the caches loads write
+  bool getModelDir(const std::string &path, std::string &dir) const;
+  void import(const std::string &dir);
+
   MAI::Renderer *ren_;
+  JobSystem *jobs_;
   std::vector<Model *> models;
-  MAI::Pipeline *pipeline_ = nullptr;
+  // directory of every model
+  std::vector<std::string> dirs;
+  MeshPool *meshPool = nullptr;
 
-  void preparePipeline(VkFormat format);
+  FileWatcher *watcher = nullptr;
+  // last import of each directory, imports of one run in order
+  std::unordered_map<std::string, JobHandle> imports;
+  std::mutex importMutex;
+  std::vector<ImportedModel> imported;
+  // set by the deferred delete of a replaced model
+  std::atomic<bool> rangesFreed = false;
 };
@@ -0,0 +1,117 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct AABB {
+  glm::vec3 min = glm::vec3(FLT_MAX);
+  glm::vec3 max = glm::vec3(-FLT_MAX);
+
+  bool empty() const { return min.x > max.x; }
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  void grow(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  void grow(const AABB &box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+  float area() const {
+    if (empty())
+      return 0.0f;
+    const glm::vec3 d = max - min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+  bool overlaps(const AABB &box) const {
+    return min.x <= box.max.x && max.x >= box.min.x && min.y <= box.max.y &&
+           max.y >= box.min.y && min.z <= box.max.z && max.z >= box.min.z;
+  }
+  AABB transformed(const glm::mat4 &m) const;
+};
+
+struct RayHit {
+  uint32_t id = UINT32_MAX;
+  float t = FLT_MAX;
+};
+
+// slab test, returns the entry distance in tNear. invDir is 1 / direction
+bool intersectRayAABB(const glm::vec3 &origin, const glm::vec3 &invDir,
+                      const AABB &box, float maxT, float &tNear);
+// Moller-Trumbore, distance along dir or a negative value on a miss
+float intersectRayTriangle(const glm::vec3 &origin, const glm::vec3 &dir,
+                           const glm::vec3 &v0, const glm::vec3 &v1,
+                           const glm::vec3 &v2);
+
+// normalized planes of a view projection matrix, pointing inwards
+void extractFrustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6]);
+// planes point inwards, xyz normal and w distance
+bool intersectFrustumAABB(const glm::vec4 planes[6], const AABB &box);
+
+// Bounding volume hierarchy over boxes addressed by id. build() does a binned
+// SAH split, refit() updates one box in place and only touches its ancestors,
+// so moving objects doesn't need a rebuild until the tree quality drops.
+// Empty boxes are kept out of the tree.
+struct BVH {
+  void build(const std::vector<AABB> &boxes);
+  // false when id isn't in the tree (it was empty at build time), rebuild then
+  bool refit(uint32_t id, const AABB &box);
+  // refits made the tree noticeably worse than the one build() produced
+  bool needsRebuild() const;
+
+  const AABB &getBox(uint32_t id) const { return boxes_[id]; }
+  uint32_t size() const { return (uint32_t)boxes_.size(); }
+
+  void queryFrustum(const glm::vec4 planes[6],
+                    std::vector<uint32_t> &out) const;
+  void queryRange(const AABB &range, std::vector<uint32_t> &out) const;
+  // nearest hit along the ray. intersect is called for every id whose box the
+  // ray enters before the current best hit and returns the exact distance or
+  // a negative value on a miss. Without it the box entry distance is used
+  RayHit raycast(const glm::vec3 &origin, const glm::vec3 &dir,
+                 float maxT = FLT_MAX,
+                 const std::function<float(uint32_t id, float maxT)>
+                     &intersect = nullptr) const;
+
+private:
+  struct Node {
+    AABB box;
+    // first child for inner nodes, the right one is left + 1. First index
+    // into primIds_ for leaves
+    uint32_t left = 0;
+    // primitives in a leaf, 0 for inner nodes
+    uint32_t count = 0;
+    uint32_t parent = UINT32_MAX;
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> primIds_;
+  std::vector<AABB> boxes_;
+  std::vector<uint32_t> leafOf_;
+  float builtArea = 0.0f;
+
+  // build time copy of a box, kept contiguous so partitioning stays in cache
+  struct BuildPrim;
+  void subdivide(uint32_t nodeIdx, std::vector<BuildPrim> &prims,
+                 uint32_t depth);
+  void updateBounds(uint32_t nodeIdx);
+};
+
+// triangles of a mesh kept on the CPU for picking, in model space
+struct TriangleBVH {
+  // indices are absolute, three per triangle
+  void build(std::vector<glm::vec3> positions, std::vector<uint32_t> indices);
+  // closest hit distance along dir or a negative value. dir doesn't need to
+  // be normalized, distances are in units of its length
+  float raycast(const glm::vec3 &origin, const glm::vec3 &dir,
+                float maxT = FLT_MAX) const;
+  uint32_t triangleCount() const { return (uint32_t)indices_.size() / 3; }
+
+private:
+  BVH bvh_;
+  std::vector<glm::vec3> positions_;
+  std::vector<uint32_t> indices_;
+};
@@ -1,8 +1,10 @@
 #pragma once
 #include "assets.h"
+#include "bvh.h"
 #include "imgui.h"
 #include "mai_config.h"
 #include "mai_vk.h"
+#include "pipelineRegistry.h"
 #include "shapes.h"
 #include "textures.h"
 #include "utils.h"
@@ -39,6 +41,37 @@ struct Action {
   EntityData data;
 };
 
+// per-instance data read by model.vert and shap.vert through gl_InstanceIndex
+struct InstanceData {
+  glm::mat4 model;
+  float tiling;
+  uint32_t tex;
+  uint32_t pad[2];
+};
+
+// one (draw command, instance) pair tested by cull.comp
+struct CullItem {
+  uint32_t command;
+  uint32_t instance;
+};
+
+// consecutive instances sharing the same mesh and pipeline, drawn with
+// commandCount indirect commands starting at firstCommand
+struct InstanceBatch {
+  EntityType type;
+  uint32_t addId;
+  uint32_t firstInstance;
+  uint32_t instanceCount;
+  uint32_t firstCommand;
+  uint32_t commandCount;
+};
+
+struct EntityCullInfo {
+  MAI::CommandBuffer *buff;
+  glm::mat4 proj;
+  glm::mat4 view;
+};
+
 struct EntityDrawInfo {
   MAI::CommandBuffer *buff;
   glm::mat4 proj;
@@ -48,23 +81,35 @@ struct EntityDrawInfo {
 };
 
 struct Entities {
-  Entities(MAI::Renderer *ren, GLFWwindow *window, VkFormat formt);
+  // assets, textures, shapes and the pipelines load in parallel on jobs
+  Entities(MAI::Renderer *ren, JobSystem *jobs, PipelineRegistry *pipelines,
+           GLFWwindow *window, VkFormat formt);
   ~Entities();
 
+  // reloads the models and textures changed on disk while running, cull
+  // swaps them in
+  void watchResources();
   void guiWidget();
   void entityWidget();
+  // culls and compacts this frame's draws on the GPU, has to be recorded
+  // before cmdBeginRendering and before draw
+  void cull(const EntityCullInfo &info);
   void draw(EntityDrawInfo info);
   void undoCheck();
   void saveEntity();
   void resetEntity();
   void loadEntity();
+  // world space bounds of entities, ids are indices into the entity list
+  const BVH &getBVH() const { return bvh; }
 
 private:
   GLFWwindow *window;
   MAI::Renderer *ren_;
   VkFormat format;
+  // owned by the PipelineRegistry
   MAI::Pipeline *pipeline_;
   MAI::Pipeline *ShapePipeline_;
+  MAI::Pipeline *cullPipeline_;
   Assets *assets;
   Textures *textures;
   Shapes *shapes;
@@ -75,7 +120,55 @@ private:
   std::vector<Action> actions;
   std::vector<Entity> entities;
 
-  void preparePipelines();
+  // instances are rebuilt only when an entity changes, and each frame slot
+  // re-uploads them once it sees a newer version
+  bool instancesDirty = true;
+  uint32_t instancesVersion = 0;
+  uint32_t meshGeneration = 0;
+  std::vector<InstanceData> instances;
+  std::vector<InstanceBatch> batches;
+  // commands start with zero instances, firstInstance is where cull.comp
+  // writes the ids of their visible instances
+  std::vector<MAI::DrawIndexedIndirectCommand> drawCommands;
+  std::vector<glm::vec4> commandBounds;
+  std::vector<CullItem> cullItems;
+  bool frustumCulling = true;
+
+  // refit on moves, rebuilt when entities come and go or the tree degrades
+  BVH bvh;
+  std::vector<AABB> entityBounds;
+  // clicks test the triangles of the entities under the cursor, not only
+  // their bounds
+  bool pickTriangles = true;
+  bool mouseWasPressed = false;
+
+  struct SlotBuffer {
+    MAI::Buffer *buffer = nullptr;
+    uint32_t capacity = 0;
+  };
+  struct InstanceFrame {
+    // host visible, written when the version changes
+    SlotBuffer instances;
+    SlotBuffer commands;
+    SlotBuffer bounds;
+    SlotBuffer items;
+    // device local, written by cull.comp every frame
+    SlotBuffer draws;
+    SlotBuffer visible;
+    uint32_t version = 0;
+  };
+  InstanceFrame instanceFrames_[MAX_FRAMES_IN_FLIGHT] = {};
+  // slot culled this frame, consumed by draw
+  InstanceFrame *culled = nullptr;
+
+  void preparePipelines(PipelineRegistry *pipelines);
+  void rebuildInstances();
+  void updateBVH();
+  InstanceFrame *uploadInstances();
+  void reserveBuffer(SlotBuffer &slot, uint32_t size, MAIFlags usage,
+                     MAI::BufferStorage storage);
+  void uploadBuffer(SlotBuffer &slot, const void *data, uint32_t size,
+                    MAIFlags usage);
   void actionAdd(uint32_t id, ActionType type = ADD, EntityData data = {});
   void checkMouseClick();
 };
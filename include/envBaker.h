@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Bitmap.h"
+
+// Image based lighting cooked on the CPU from the skybox cube faces: a
+// diffuse irradiance cube (the cosine convolution through 9 SH
+// coefficients), a GGX prefiltered specular cube whose levels go from
+// roughness 0 to 1, and the split sum BRDF LUT shared by every skybox.
+//
+// The cubes are cached as BC6H next to the hdr (<source>.irradiance.ktx2
+// and <source>.specular.ktx2), the LUT as BC5 in the skybox directory.
+
+struct JobSystem;
+
+// bump when a bake changes so old caches get re-cooked
+constexpr uint32_t ENV_BAKE_VERSION = 1;
+constexpr uint32_t ENV_IRRADIANCE_SIZE = 32;
+constexpr uint32_t ENV_SPECULAR_SIZE = 256;
+// 256 down to 8, roughness level / (ENV_SPECULAR_LEVELS - 1)
+constexpr uint32_t ENV_SPECULAR_LEVELS = 6;
+constexpr uint32_t ENV_BRDF_LUT_SIZE = 128;
+constexpr const char *ENV_IRRADIANCE_EXTENSION = ".irradiance.ktx2";
+constexpr const char *ENV_SPECULAR_EXTENSION = ".specular.ktx2";
+constexpr const char *ENV_BRDF_LUT_NAME = "brdf_lut.ktx2";
+
+// RGBA float cube, levels[i] holds the 6 faces of mip i back to back in
+// the +X -X +Y -Y +Z -Z order of the image layers
+struct EnvCube {
+  uint32_t size = 0;
+  std::vector<std::vector<float>> levels;
+};
+
+// irradiance / pi, so shading multiplies it by the albedo
+EnvCube bakeIrradiance(const Bitmap &faces, JobSystem *jobs = nullptr);
+EnvCube bakeSpecular(const Bitmap &faces, JobSystem *jobs = nullptr);
+// scale and bias of F0 by n.v (x) and roughness (y), RG pairs
+std::vector<float> bakeBrdfLut(uint32_t size, JobSystem *jobs = nullptr);
+
+// BC6H blocks of every level, faces back to back like the KTX2 levels
+std::vector<std::vector<uint8_t>> encodeEnvCube(const EnvCube &cube,
+                                                JobSystem *jobs = nullptr);
+// BC5 blocks of the LUT, a single level
+std::vector<uint8_t> encodeBrdfLut(const std::vector<float> &lut,
+                                   uint32_t size);
+
+// source hash of the baked caches, derived from the hash of the skybox
+// cache (hashTextureSource) so the hdr is only read once
+uint64_t hashEnvSource(uint64_t cubeHash);
+// the LUT has no source, only the bake settings
+uint64_t hashBrdfLut();
+
+bool writeEnvCube(const std::string &path, uint64_t sourceHash,
+                  const EnvCube &cube,
+                  const std::vector<std::vector<uint8_t>> &levels);
+bool writeBrdfLut(const std::string &path, const std::vector<uint8_t> &blocks);
+
+// bake and write the caches without a renderer, valid ones are kept unless
+// forced. false when the hdr can't be read or a write failed
+bool cookEnvironment(const std::string &path, JobSystem *jobs = nullptr,
+                     bool force = false);
+bool cookBrdfLut(const std::string &path, JobSystem *jobs = nullptr,
+                 bool force = false);
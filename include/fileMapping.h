@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// read only mmap of a whole file, for the on disk caches
+struct MappedFile {
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  // false for missing or empty files
+  bool open(const std::string &path);
+  void close();
+
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+};
+
+// FNV-1a, used to tell whether cached files are older than their sources
+constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash = HASH_SEED);
+// hash of the file contents, a missing file leaves hash unchanged
+uint64_t hashFile(const std::string &path, uint64_t hash = HASH_SEED);
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// inotify watch of the files of a directory, polled without blocking so
+// the frame loop can check it every frame
+struct FileWatcher {
+  // recursive watches the subdirectories too, ones created later included
+  FileWatcher(const std::string &dir, bool recursive = false);
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+  ~FileWatcher();
+
+  // false when inotify isn't available, poll never reports anything then
+  bool isWatching() const { return fd >= 0; }
+  // paths of the files written or moved into the directory since the last
+  // poll, each once. Editors saving through a temporary file show up as
+  // the rename, not the write. The files of a new subdirectory are
+  // reported when it's found, they may have been copied in before
+  std::vector<std::string> poll();
+
+private:
+  // dir ends with '/', changed gets the files already in it
+  void addWatch(const std::string &dir, std::vector<std::string> *changed);
+
+  int fd = -1;
+  bool recursive_ = false;
+  // watch descriptor -> directory
+  std::unordered_map<int, std::string> dirs;
+};
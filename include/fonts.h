@@ -2,6 +2,7 @@
 
 #include "mai_config.h"
 #include "mai_vk.h"
+#include "pipelineRegistry.h"
 
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
@@ -35,7 +36,8 @@ struct DynamicText {
 };
 
 struct FontRenderer {
-  FontRenderer(MAI::Renderer *ren, uint32_t width, uint32_t height,
+  FontRenderer(MAI::Renderer *ren, PipelineRegistry *pipelines,
+               uint32_t width, uint32_t height,
                VkFormat formt = VK_FORMAT_UNDEFINED);
   ~FontRenderer();
 
@@ -45,20 +47,18 @@ struct FontRenderer {
                        const char *id, glm::vec2 pos,
                        glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f));
   void draw(MAI::CommandBuffer *buff);
-  void clearGarbge();
 
 private:
   uint32_t screenWidht;
   uint32_t screenHeight;
   VkFormat format;
   MAI::Renderer *ren_;
+  PipelineRegistry *pipelines_;
+  // owned by pipelines_
   MAI::Pipeline *pipeline_;
-  MAI::Shader *vert_;
-  MAI::Shader *frag_;
   MAI::Texture *texture;
   MAI::Buffer *buffer_ = nullptr;
   std::map<const char *, DynamicText> dynamicBuffers;
-  std::vector<MAI::Buffer *> garbeBuffers;
 
   std::vector<FontVertex> verticesAll;
 
@@ -1,14 +1,16 @@
 #pragma once
 #include "mai_config.h"
 #include "mai_vk.h"
+#include "pipelineRegistry.h"
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 
 struct ImGuiRenderer {
-  ImGuiRenderer(MAI::Renderer *ren, GLFWwindow *win,
-                VkFormat format = VK_FORMAT_UNDEFINED, float fontSize = 24.0f);
+  ImGuiRenderer(MAI::Renderer *ren, PipelineRegistry *pipelines,
+                GLFWwindow *win, VkFormat format = VK_FORMAT_UNDEFINED,
+                float fontSize = 24.0f);
   ~ImGuiRenderer();
 
   void beginFrame(const MAI::Dimissions &dim);
@@ -20,7 +22,10 @@ private:
   void createPipeline();
 
   MAI::Renderer *ren_ = nullptr;
+  PipelineRegistry *pipelines_ = nullptr;
   GLFWwindow *window = nullptr;
+  // compiled in the background from the constructor on, owned by pipelines_
+  PipelineEntry *pipelineEntry_ = nullptr;
   MAI::Pipeline *pipeline_ = nullptr;
   struct ImGuiRendererImpl *pimpl_ = nullptr;
   VkFormat format;
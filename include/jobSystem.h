@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads, each with its own deque of ready jobs.
+// Workers pop their newest job and steal the oldest one of another worker
+// when they run dry, so a loader that fans out keeps every core busy
+// without a thread per file. Jobs only become ready once every job they
+// depend on has finished.
+//
+// Waiting runs other jobs in the meantime, so jobs can wait on the jobs
+// they spawn without tying up a worker.
+
+struct Job;
+
+struct JobHandle {
+  std::shared_ptr<Job> job;
+
+  bool valid() const { return job != nullptr; }
+  bool isDone() const;
+};
+
+struct JobSystem {
+  // 0 uses one worker per hardware thread but the calling one
+  JobSystem(uint32_t workerCount = 0);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // fn runs after every valid job in deps finished
+  JobHandle submit(std::function<void()> fn,
+                   const std::vector<JobHandle> &deps = {});
+  void wait(const JobHandle &handle);
+  void wait(const std::vector<JobHandle> &handles);
+  // calls fn(begin, end) over [0, count) in chunks of at most grain, the
+  // calling thread takes part and returns once every chunk ran
+  void parallelFor(uint32_t count, uint32_t grain,
+                   const std::function<void(uint32_t, uint32_t)> &fn);
+
+  uint32_t getWorkerCount() const { return (uint32_t)workers.size(); }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<Job>> jobs;
+  };
+
+  void workerLoop(uint32_t index);
+  void schedule(std::shared_ptr<Job> job);
+  void finish(const std::shared_ptr<Job> &job);
+  // runs one ready job if there is any, own queue first
+  bool runOne(int32_t index);
+  std::shared_ptr<Job> pop(int32_t index);
+
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<Queue>> queues;
+  // jobs from threads outside the pool are spread over the queues
+  std::atomic<uint32_t> nextQueue = 0;
+
+  // workers sleep while nothing is queued
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  std::atomic<uint32_t> queued = 0;
+  bool stopping = false;
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include "fileMapping.h"
+#include "mai_config.h"
+#include "mai_vk.h"
+#include <string>
+#include <vector>
+
+// Minimal KTX2 reader/writer for the cooked texture caches: block
+// compressed formats only, no supercompression, 2D or cube.
+//
+// The hash of the sources is stored in the key/value data under
+// KTX2_SOURCE_HASH_KEY so a cache can be checked without decoding anything.
+constexpr const char *KTX2_SOURCE_HASH_KEY = "MAIsourceHash";
+
+struct Ktx2Desc {
+  MAI::TextureFormat format;
+  uint32_t width;
+  uint32_t height;
+  // 1 for 2D textures, 6 for cubes
+  uint32_t faceCount = 1;
+  uint32_t levelCount = 1;
+  uint64_t sourceHash = 0;
+};
+
+// levels[i] holds every face of mip i, faces packed back to back
+bool writeKtx2(const std::string &path, const Ktx2Desc &desc,
+               const std::vector<std::vector<uint8_t>> &levels);
+
+struct Ktx2View {
+  Ktx2View() = default;
+  Ktx2View(const Ktx2View &) = delete;
+  Ktx2View &operator=(const Ktx2View &) = delete;
+  ~Ktx2View() { close(); }
+
+  // false when the file is missing, malformed, in a format we don't cook or
+  // doesn't carry sourceHash
+  bool open(const std::string &path, uint64_t sourceHash);
+  void close();
+
+  // all faces of the level, valid until close()
+  const uint8_t *level(uint32_t index) const { return levels[index].data; }
+  size_t levelSize(uint32_t index) const { return levels[index].size; }
+
+  Ktx2Desc desc{};
+
+private:
+  struct Level {
+    const uint8_t *data;
+    size_t size;
+  };
+  std::vector<Level> levels;
+  MappedFile file;
+};
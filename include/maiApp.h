@@ -1,10 +1,14 @@
 #pragma once
 #include "Camera.h"
+#include "fileWatcher.h"
 #include "imguiRenderer.h"
+#include "jobSystem.h"
 #include "mai_config.h"
 #include "mai_vk.h"
+#include "pipelineRegistry.h"
 #include "utils.h"
 #include <array>
+#include <chrono>
 #include <functional>
 
 using DrawFrameFunc =
@@ -29,25 +33,48 @@ public:
   float currentFPS_ = 0.0f;
 };
 
+struct FrameTimings {
+  double cpuMs = 0.0;    // frame recording, without the two below
+  double waitMs = 0.0;   // acquireCommandBuffer: fence wait and image acquire
+  double submitMs = 0.0; // Renderer::submit: queue submit and present
+};
+
 struct MaiApp {
-  MaiApp();
+  MaiApp(bool headless = false);
   ~MaiApp();
 
   MAI::WindowInfo windowInfo;
   MAI::Renderer *ren = nullptr;
+  // worker pool for loading, sized to the machine
+  JobSystem *jobs = nullptr;
+  // every pipeline of the app, compiled on jobs
+  PipelineRegistry *pipelines = nullptr;
+  // shaders/, edited shaders are reloaded while running. Not headless
+  FileWatcher *shaderWatcher = nullptr;
   GLFWwindow *window = nullptr;
   MAI::Texture *depthTexture = nullptr;
   Camera *camera = nullptr;
   ImGuiRenderer *imgui;
   MouseState mouse_state;
   float currentFPS;
+  bool headless = false;
+  FrameTimings frameTimings;
 
   void run(DrawFrameFunc drawFrame, DrawFrameFunc beforeDraw,
            DrawFrameFunc afterDraw);
+  // renders frameCount frames offscreen with a fixed time step
+  void runHeadless(uint32_t frameCount, float deltaSecond,
+                   DrawFrameFunc drawFrame, DrawFrameFunc beforeDraw,
+                   DrawFrameFunc afterDraw);
 
   static std::array<bool, 2> getMods();
 
 private:
   void setMouseConfig();
   void updateMouseMovement();
+  void renderFrame(uint32_t width, uint32_t height, float deltaSecond,
+                   DrawFrameFunc &drawFrame, DrawFrameFunc &beforeDraw,
+                   DrawFrameFunc &afterDraw);
+
+  FPS fps;
 };
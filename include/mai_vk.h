@@ -10,12 +10,19 @@
 //
 // To use VMA in MAI add
 // #define MAI_USE_VMA
+//
+// To time the blocking calls (fence waits, submit, present) define
+// MAI_VK_PROFILE_SCOPE(name) to your own scoped profiler macro
 
 #include <cstdint>
 #include <vulkan/vulkan_core.h>
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <vector>
 
 #ifdef MAI_USE_VMA
@@ -28,9 +35,14 @@
 
 #define MAIFlags uint32_t
 
+#ifndef MAI_VK_PROFILE_SCOPE
+#define MAI_VK_PROFILE_SCOPE(name)
+#endif
+
 constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 constexpr uint32_t MAX_TEXTURES = 4060;
 constexpr uint32_t GENERAL_PUSHCONSTANT_SIZE = 256;
+constexpr uint32_t MAX_GPU_ZONES = 64;
 
 namespace MAI {
 
@@ -117,6 +129,14 @@ enum TextureFormat : uint8_t {
   Format_Z_F32 = 0x01,
   Format_RGBA_S8 = 0x02,
   Format_RGBA_F32 = 0x04,
+  // block compressed, 4x4 texels per 16 bytes. Sampled textures only
+  Format_BC7_S = 0x08,
+  Format_BC5 = 0x10,
+  Format_BC6H_UF = 0x20,
+  // hdr at half and a quarter of the size of RGBA_F32, B10G11R11 has no
+  // alpha
+  Format_RGBA_F16 = 0x40,
+  Format_B10G11R11_UF = 0x80,
 };
 
 enum TextureUsage : uint8_t {
@@ -187,12 +207,49 @@ enum DescriptorBinding : uint8_t {
 
 struct RendererDefault {
   bool defaultDescriptorPool = true;
+  // pipelines are created through a VkPipelineCache, which is kept in
+  // pipelineCachePath between runs when it's set
   bool enablePipelineCache = false;
+  const char *pipelineCachePath = nullptr;
+  // directory GLSL shaders are cached in as SPIR-V, keyed on the source
+  // after includes, the stage and the glslang limits. Compiled every time
+  // without it
+  const char *shaderCachePath = nullptr;
+  // ring the upload manager stages buffer and texture data in, bigger
+  // uploads get a staging buffer of their own
+  VkDeviceSize uploadStagingSize = 64ull << 20;
+  // staging CommandBuffer::update copies from, per frame in flight
+  VkDeviceSize frameStagingSize = 4ull << 20;
+};
+
+// point on the upload timeline, the upload is done once the timeline reached
+// it. value 0 means nothing was uploaded
+struct UploadTicket {
+  uint64_t value = 0;
+};
+
+struct GpuZoneResult {
+  const char *name;
+  uint32_t depth;
+  double ms;
+};
+
+// persistently mapped host visible buffer uploads are copied out of
+struct StagingBuffer {
+  VkBuffer buffer = VK_NULL_HANDLE;
+#ifdef MAI_USE_VMA
+  VmaAllocation allocation = VK_NULL_HANDLE;
+#else
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+#endif
+  uint8_t *mapped = nullptr;
 };
 
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphcisFamily;
   std::optional<uint32_t> presentFamily;
+  // a transfer only family when the device has one, otherwise graphics
+  std::optional<uint32_t> transferFamily;
   bool isComplete() const {
     return graphcisFamily.has_value() && presentFamily.has_value();
   }
@@ -201,17 +258,22 @@ struct QueueFamilyIndices {
 struct VulkanContext {
   VulkanContext(GLFWwindow *window, const char *appName,
                 const RendererDefault &defaults);
+  // headless context: renders into offscreen images instead of a swapchain
+  VulkanContext(const struct WindowInfo &info, const RendererDefault &defaults);
   ~VulkanContext();
 
   GLFWwindow *window = nullptr;
   const char *appName;
   uint32_t frameIndex = 0;
   uint32_t imageIndex = 0;
+  uint32_t lastSubmittedFrame = 0;
   uint32_t minImageCount;
+  bool headless = false;
+  bool textureCompressionBC = false;
   struct RendererDefault defaults;
 
   VkInstance instance;
-  VkPhysicalDevice physicalDevice;
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
 
 #ifdef MAI_USE_VMA
@@ -220,7 +282,8 @@ struct VulkanContext {
 
   VkQueue graphicsQueue;
   VkQueue presentQueue;
-  VkSurfaceKHR surface;
+  VkQueue transferQueue;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
   QueueFamilyIndices indices;
   VkDebugUtilsMessengerEXT debugMessenger;
 
@@ -233,10 +296,42 @@ struct VulkanContext {
   VkDescriptorSetLayout descriptorSetLayout;
   VkDescriptorPool descriptorPool;
   std::vector<VkDescriptorSet> descriptorSets;
+  // sampler 0 of the bindless set, the one the shaders sample with
+  VkSampler defaultSampler = VK_NULL_HANDLE;
+
+  struct UploadManager *uploads = nullptr;
+
+  // one slice per frame in flight, reused once the frame's fence signaled.
+  // Updates that don't fit get a buffer that lives as long as the slice
+  StagingBuffer frameStaging;
+  VkDeviceSize frameStagingSize = 0;
+  VkDeviceSize frameStagingOffset = 0;
+  std::vector<StagingBuffer> frameStagingOverflow[MAX_FRAMES_IN_FLIGHT];
+
+  // frames acquired so far, deletes queued while it was N run once frame
+  // N + MAX_FRAMES_IN_FLIGHT is acquired, its fence wait covers frame N
+  struct DeferredDelete {
+    std::function<void()> destroy;
+    uint64_t frame;
+  };
+  uint64_t frameCount = 0;
+  std::mutex deletionMutex;
+  std::deque<DeferredDelete> deletionQueue;
+  // all runs every queued delete, the GPU has to be idle
+  void runDeferredDeletes(bool all);
+  // copies out of the frame staging, submitted ahead of the frame
+  std::vector<VkCommandBuffer> updateCommandBuffers;
+  bool updatesRecorded = false;
 
   std::vector<VkImage> swapChainImages;
   std::vector<VkImageView> swapChainImageViews;
 
+#ifdef MAI_USE_VMA
+  std::vector<VmaAllocation> offscreenAllocations;
+#else
+  std::vector<VkDeviceMemory> offscreenMemory;
+#endif
+
   std::vector<VkSemaphore> imageAvailableSemaphore;
   std::vector<VkSemaphore> computeFinishSemaphore;
   std::vector<VkSemaphore> renderFinishSemaphore;
@@ -244,30 +339,60 @@ struct VulkanContext {
 
   std::vector<VkCommandBuffer> commandBuffers;
 
+  // every frame in flight owns MAX_GPU_ZONES begin/end timestamp pairs,
+  // zone 0 brackets the whole frame command buffer
+  VkQueryPool timestampPool = VK_NULL_HANDLE;
+  // internally synchronized, pipelines can be created on any thread
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  float timestampPeriod = 0.0f;
+  struct GpuZoneRecord {
+    const char *name;
+    uint32_t depth;
+    uint32_t query;
+  };
+  std::vector<GpuZoneRecord> gpuZones[MAX_FRAMES_IN_FLIGHT];
+  std::vector<uint32_t> gpuZoneStack;
+
+  void beginGpuZone(const char *name);
+  void endGpuZone();
+
   VkShaderModule createShaderModule(uint32_t codeSize, const void *code);
   VkPipelineLayout
   createPipelineLayout(uint32_t pushConstantSize,
                        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE);
   VkPipeline createGraphicePipeline(VkGraphicsPipelineCreateInfo &info);
+  // writes the cache to defaults.pipelineCachePath, done on destruction
+  void savePipelineCache();
 
 #ifdef MAI_USE_VMA
   void createBuffer(const struct BufferDesc &info, VkBuffer &buffer,
                     VmaAllocation &allocation, VmaAllocationInfo &allocInfo);
-  void updateBuffer(VkBufferUsageFlags usage, VkBuffer &buffer,
-                    VmaAllocation &alloc, size_t size, const void *data);
+  // copies into host visible memory
+  void updateBuffer(VmaAllocation &alloc, size_t size, const void *data);
   void createImage(const struct ImageDesc &info, VkImage &image,
                    VmaAllocation &alloc);
 #else
   void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                     VkMemoryPropertyFlags properties, VkBuffer &buffer,
                     VkDeviceMemory &bufferMemory);
-  void updateBuffer(VkBufferUsageFlags usage, VkBuffer &buffer,
-                    VkDeviceMemory &deviceMemory, size_t size,
+  // copies into host visible memory
+  void updateBuffer(VkDeviceMemory &deviceMemory, size_t size,
                     const void *data);
   void createImage(const struct ImageDesc &info, VkImage &image,
                    VkDeviceMemory &imageMemory);
 #endif
 
+  StagingBuffer createStagingBuffer(VkDeviceSize size);
+  void destroyStagingBuffer(StagingBuffer &staging);
+  // makes host writes visible to the device when the memory isn't coherent
+  void flushStagingBuffer(const StagingBuffer &staging, VkDeviceSize offset,
+                          VkDeviceSize size);
+  // valid until the frame slot comes around again
+  StagingBuffer allocateFrameStaging(VkDeviceSize size, VkDeviceSize &offset);
+  VkCommandBuffer getUpdateCommandBuffer();
+  // VK_NULL_HANDLE when the frame recorded no updates
+  VkCommandBuffer endUpdateCommandBuffer();
+
   void createImageView(const struct ImageViewDesc &info, VkImage &image,
                        VkImageView &view);
   void createSampler(const struct SamplerDesc &samplerInfo, VkSampler &sampler);
@@ -290,9 +415,21 @@ struct VulkanContext {
 
   void transitionImageLayout(VkImage image, VkFormat format,
                              VkImageLayout oldLayout, VkImageLayout newLayout,
-                             uint32_t layerCount);
-  void copyBuffeToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                        uint32_t height, bool isCube);
+                             uint32_t layerCount, uint32_t levelCount = 1);
+  // levels are packed one after another from bufferOffset starting at
+  // level 0, each with all its layers
+  void recordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer,
+                               VkDeviceSize bufferOffset, VkImage image,
+                               TextureFormat format, uint32_t width,
+                               uint32_t height, uint32_t layerCount,
+                               uint32_t levelCount);
+  // filter to blit mips of format with, throws when it can't be blitted
+  VkFilter getMipmapFilter(VkFormat format);
+  // blits level 0 down the chain, every level has to be in
+  // TRANSFER_DST_OPTIMAL and ends up SHADER_READ_ONLY_OPTIMAL
+  void recordMipmaps(VkCommandBuffer commandBuffer, VkImage image,
+                     VkFilter filter, uint32_t width, uint32_t height,
+                     uint32_t layerCount, uint32_t levelCount);
   void copyBuffeToImage(VkBuffer buffer, VkImage image, VkRect2D imageRegion,
                         uint32_t bufferRowLength);
   void updateDescriptorImageWrite(VkImageView imageView, VkSampler sampler,
@@ -313,9 +450,15 @@ private:
   void createSwapChainImageViews();
   void cleanupSwapChain();
 
+  void createOffscreenImages();
+  void cleanupOffscreenImages();
+
   void createSyncObj();
   void createCommandBuffer();
   void createCommandPool();
+  void createTimestampPool();
+  void createPipelineCache();
+  void createFrameStaging();
 
   void createDescriptorPool();
   void createDescriptorSetLayout();
@@ -325,6 +468,71 @@ private:
                           VkMemoryPropertyFlags properties);
 };
 
+// Uploads buffer and texture data without waiting on the GPU. Data is
+// staged in a persistently mapped ring and the copies are recorded into an
+// open batch that many uploads share, the batch is submitted once per frame
+// or when the ring runs out of space. When the device has a transfer only
+// queue family the copies run there and ownership is handed over to the
+// graphics queue, which does the layout changes and mip blits. Every batch
+// signals the upload timeline with its value, frames wait on the last one
+// flushed so anything created before a submit is ready when it's drawn.
+struct UploadManager {
+  UploadManager(struct VulkanContext *ctx, VkDeviceSize stagingSize);
+  ~UploadManager();
+
+  UploadTicket uploadBuffer(VkBuffer buffer, const void *data,
+                            VkDeviceSize size, VkDeviceSize dstOffset = 0);
+  // whole image, levels without data in info are blitted from level 0.
+  // Every level ends up SHADER_READ_ONLY_OPTIMAL
+  UploadTicket uploadImage(VkImage image, VkFormat format,
+                           const struct TextureInfo &info,
+                           uint32_t layerCount, uint32_t mipLevels);
+
+  // submits the open batch, returns the value of the last submitted one
+  uint64_t flush();
+  bool isComplete(UploadTicket ticket);
+  // flushes first when the ticket is still in the open batch
+  void wait(UploadTicket ticket);
+  VkSemaphore getTimeline() const { return uploadTimeline; }
+
+private:
+  struct Batch {
+    uint64_t value = 0;
+    VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+    VkCommandBuffer graphicsCmd = VK_NULL_HANDLE;
+    bool usesRing = false;
+    // ring head after the last reservation of this batch
+    VkDeviceSize ringEnd = 0;
+    std::vector<StagingBuffer> dedicated;
+  };
+
+  StagingBuffer reserve(VkDeviceSize size, VkDeviceSize &offset);
+  bool reserveRing(VkDeviceSize size, VkDeviceSize &offset);
+  Batch &openBatch();
+  void submitBatch();
+  void retireBatches();
+  bool separateTransfer() const { return transferPool != VK_NULL_HANDLE; }
+
+  struct VulkanContext *ctx;
+  std::mutex mutex;
+
+  VkCommandPool graphicsPool = VK_NULL_HANDLE;
+  VkCommandPool transferPool = VK_NULL_HANDLE;
+  // signaled by the transfer queue, the graphics half of a batch waits on it
+  VkSemaphore transferTimeline = VK_NULL_HANDLE;
+  VkSemaphore uploadTimeline = VK_NULL_HANDLE;
+
+  StagingBuffer ring;
+  VkDeviceSize ringSize = 0;
+  VkDeviceSize ringHead = 0;
+  VkDeviceSize ringTail = 0;
+
+  Batch recording;
+  std::deque<Batch> pending;
+  uint64_t nextValue = 1;
+  uint64_t submittedValue = 0;
+};
+
 struct Renderer {
   Renderer(struct VulkanContext *ctx, const struct RendererDefault &defaults);
   ~Renderer();
@@ -342,15 +550,70 @@ struct Renderer {
   void waitDeviceIdle();
   void submit();
 
+  // deletes once the frames recorded up to now finished, without waiting
+  // on the GPU. For resources a frame in flight may still use, from any
+  // thread. The callback is for anything else such frames read, it runs
+  // on the thread acquiring command buffers
+  void deferDelete(struct Buffer *buffer);
+  // its bindless slot is reused by textures created afterwards
+  void deferDelete(struct Texture *texture);
+  void deferDelete(struct Pipeline *pipeline);
+  void deferDelete(std::function<void()> destroy);
+  // waits for the GPU and runs every queued delete, for owners of what a
+  // deferred callback uses before they go away
+  void flushDeferredDeletes();
+
+  // uploads done by createBuffer and createImage are only submitted with
+  // the next frame, flush to start them earlier
+  void flushUploads();
+  bool isUploadComplete(UploadTicket ticket);
+  void waitUpload(UploadTicket ticket);
+  // writes a range of a StorageType_Device buffer through the upload batch
+  UploadTicket uploadBuffer(struct Buffer *buffer, const void *data,
+                            VkDeviceSize size, VkDeviceSize dstOffset = 0);
+  // blocking copy between device buffers, both can be destroyed once it
+  // returns
+  void copyBuffer(struct Buffer *src, struct Buffer *dst,
+                  const VkBufferCopy *regions, uint32_t regionCount);
+
   uint64_t gpuAddress(struct Buffer *buffer);
   void *getMappedPtr(struct Buffer *buffer, uint32_t size = 0);
   void flushMappedMemeory(struct Buffer *buffer, VkDeviceSize offset,
                           VkDeviceSize size);
   struct VulkanContext *getVulkanContext() { return ctx; }
 
+  bool isHeadless() const { return ctx->headless; }
+  // BC formats can only be created when this is true
+  bool supportsBlockCompression() const { return ctx->textureCompressionBC; }
+  // frame slot being recorded, for per-frame host visible buffers
+  uint32_t getFrameIndex() const { return ctx->frameIndex; }
+  // GPU timings of the frame that last used the current frame slot, i.e. the
+  // frame submitted MAX_FRAMES_IN_FLIGHT frames ago. 0 without timestamps
+  double getGpuFrameTime() const { return gpuFrameTime; }
+  const std::vector<GpuZoneResult> &getGpuZones() const {
+    return gpuZoneResults;
+  }
+  // copies the last submitted frame into pixels as tightly packed RGBA8
+  void readbackFrame(std::vector<uint8_t> &pixels);
+
 private:
+  // createImage runs on jobs, the slots and the writes to the bindless
+  // sets are taken under descriptorMutex
+  std::mutex descriptorMutex;
   uint32_t lastTextureCount = 0;
   uint32_t lastCubemapCount = 0;
+  // slots of deleted textures, handed out again before new ones. Reloads
+  // replace textures for as long as the app runs
+  std::vector<uint32_t> freeTextureSlots;
+  std::vector<uint32_t> freeCubemapSlots;
+  // bindless slot for texture, written into every frame's set
+  uint32_t writeBindlessSlot(struct Texture *texture, bool isCubemap);
+  // back to the free list, once no frame samples the texture
+  void releaseBindlessSlot(struct Texture *texture);
+  double gpuFrameTime = 0.0;
+  std::vector<GpuZoneResult> gpuZoneResults;
+
+  void resolveGpuZones();
   struct RendererDefault defaults;
   struct VulkanContext *ctx = nullptr;
 };
@@ -379,13 +642,37 @@ struct CommandBuffer {
   void cmdDrawIndex(uint32_t indexCount, uint32_t instanceCount = 1,
                     uint32_t firstIndex = 0, int32_t vertexOffset = 0,
                     uint32_t firstInstance = 0);
+  // offsets are in bytes, commands are read from an IndirectBuffer
+  void cmdDrawIndirect(Buffer *buffer, VkDeviceSize offset, uint32_t drawCount,
+                       uint32_t stride = sizeof(DrawIndirectCommand));
+  void cmdDrawIndexedIndirect(
+      Buffer *buffer, VkDeviceSize offset, uint32_t drawCount,
+      uint32_t stride = sizeof(DrawIndexedIndirectCommand));
+  // the draw count is read from countBuffer on the GPU, clamped to maxDrawCount
+  void cmdDrawIndexedIndirectCount(
+      Buffer *buffer, VkDeviceSize offset, Buffer *countBuffer,
+      VkDeviceSize countOffset, uint32_t maxDrawCount,
+      uint32_t stride = sizeof(DrawIndexedIndirectCommand));
   void cmdBindDepthState(const struct DepthState &depthInfo);
   void cmdBindViewport(const struct Viewport &viewport);
   void cmdBindScissorRect(const VkRect2D &scissor);
   void cmdPushConstant(const void *push,
                        uint32_t size = GENERAL_PUSHCONSTANT_SIZE);
   void cmdDispatchThreadGroups(const struct DispatchThreadInfo &info);
-
+  // transfers, only valid outside cmdBeginRendering/cmdEndRendering
+  void cmdCopyBuffer(Buffer *src, Buffer *dst, VkDeviceSize size,
+                     VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+  void cmdFillBuffer(Buffer *buffer, VkDeviceSize offset, VkDeviceSize size,
+                     uint32_t data);
+  void cmdBufferBarrier(Buffer *buffer, VkPipelineStageFlags2 srcStage,
+                        VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage,
+                        VkAccessFlags2 dstAccess);
+  // named GPU timing zones, they nest and the name has to outlive the frame
+  void cmdBeginGpuZone(const char *name);
+  void cmdEndGpuZone();
+
+  // device buffers and textures are copied through the frame's staging
+  // ahead of the frame's commands, so updates can be made while rendering
   void update(struct Buffer *buffer, const void *data, size_t size);
   void update(struct Texture *texture, const struct TextureRangeDesc &range,
               const void *data, uint32_t bufferRowLength);
@@ -397,6 +684,16 @@ private:
   VulkanContext *ctx;
 };
 
+struct GpuZone {
+  GpuZone(CommandBuffer *buff, const char *name) : buff(buff) {
+    buff->cmdBeginGpuZone(name);
+  }
+  ~GpuZone() { buff->cmdEndGpuZone(); }
+
+private:
+  CommandBuffer *buff;
+};
+
 struct BeginInfo {
   float clearColor[4] = {0.05f, 0.05f, 0.05f, 1.0f};
   struct Texture *texture = nullptr;
@@ -414,6 +711,27 @@ struct Viewport {
   float height;
 };
 
+// same layout as VkDrawIndirectCommand/VkDrawIndexedIndirectCommand, so an
+// array of them can be uploaded as is into an IndirectBuffer
+struct DrawIndirectCommand {
+  uint32_t vertexCount;
+  uint32_t instanceCount = 1;
+  uint32_t firstVertex = 0;
+  uint32_t firstInstance = 0;
+};
+
+struct DrawIndexedIndirectCommand {
+  uint32_t indexCount;
+  uint32_t instanceCount = 1;
+  uint32_t firstIndex = 0;
+  int32_t vertexOffset = 0;
+  uint32_t firstInstance = 0;
+};
+
+static_assert(sizeof(DrawIndirectCommand) == sizeof(VkDrawIndirectCommand));
+static_assert(sizeof(DrawIndexedIndirectCommand) ==
+              sizeof(VkDrawIndexedIndirectCommand));
+
 struct DispatchThreadInfo {
   uint32_t width = 1;
   uint32_t height = 1;
@@ -522,6 +840,12 @@ struct TextureInfo {
   const void *data;
   TextureUsage usage;
   bool updateDescriptor = true;
+  // sampled textures only, 0 builds the full chain down to 1x1
+  uint32_t mipLevels = 1;
+  // one pointer per level with every layer of it packed back to back.
+  // Without it data is level 0 and the rest are blitted on the GPU, which
+  // block compressed formats can't do
+  const void *const *mipData = nullptr;
 };
 
 struct PoolSize {
@@ -581,6 +905,7 @@ struct ImageViewDesc {
   VkImageViewType viewType;
   VkImageAspectFlags aspect;
   uint32_t layerCount = 1;
+  uint32_t levelCount = 1;
 };
 
 struct SamplerDesc {
@@ -592,6 +917,7 @@ struct SamplerDesc {
   SamplerWrap wrapW = SamplerWrap::Repeat;
   CompareOp depthCompareOp = CompareOp::Always;
   bool depthCompareEnabled = false;
+  float maxLod = VK_LOD_CLAMP_NONE;
 };
 
 struct commandBufferInfo {
@@ -604,9 +930,11 @@ struct commandBufferInfo {
 #ifdef MAI_USE_VMA
 struct Buffer {
   Buffer(VmaAllocator &allocator, VkBuffer buffer, VmaAllocation allocation,
-         VmaAllocationInfo allocaInfo, VkBufferUsageFlags flags)
+         VmaAllocationInfo allocaInfo, VkBufferUsageFlags flags,
+         bool hostVisible)
       : allocator(allocator), buf_(buffer), alloc_(allocation),
-        allocaInfo_(allocaInfo), usageFlags(flags) {}
+        allocaInfo_(allocaInfo), usageFlags(flags),
+        hostVisible_(hostVisible) {}
 
   ~Buffer() {
     if (buf_ != VK_NULL_HANDLE)
@@ -617,6 +945,11 @@ struct Buffer {
   VmaAllocation &getAllocation() { return alloc_; }
   VmaAllocationInfo getAllocaInfo() { return allocaInfo_; }
   VkBufferUsageFlags getBufferUsage() const { return usageFlags; }
+  // written by the host, otherwise through a staging copy
+  bool isHostVisible() const { return hostVisible_; }
+  // upload of the data the buffer was created with
+  UploadTicket getUpload() const { return upload_; }
+  void setUpload(UploadTicket ticket) { upload_ = ticket; }
 
 private:
   VmaAllocator &allocator;
@@ -624,13 +957,16 @@ private:
   VmaAllocation alloc_;
   VmaAllocationInfo allocaInfo_;
   VkBufferUsageFlags usageFlags;
+  bool hostVisible_;
+  UploadTicket upload_;
 };
 
 #else
 struct Buffer {
   Buffer(VkDevice &device, VkBuffer buffer, VkDeviceMemory bufMemory,
-         VkBufferUsageFlags flags)
-      : device(device), buf_(buffer), bufMem_(bufMemory), usageFlags(flags) {}
+         VkBufferUsageFlags flags, bool hostVisible)
+      : device(device), buf_(buffer), bufMem_(bufMemory), usageFlags(flags),
+        hostVisible_(hostVisible) {}
   ~Buffer() {
     if (bufMem_ != VK_NULL_HANDLE)
       vkFreeMemory(device, bufMem_, nullptr);
@@ -641,12 +977,19 @@ struct Buffer {
   VkBuffer &getBuffer() { return buf_; }
   VkDeviceMemory &getBufferMem() { return bufMem_; }
   VkBufferUsageFlags getBufferUsage() const { return usageFlags; }
+  // written by the host, otherwise through a staging copy
+  bool isHostVisible() const { return hostVisible_; }
+  // upload of the data the buffer was created with
+  UploadTicket getUpload() const { return upload_; }
+  void setUpload(UploadTicket ticket) { upload_ = ticket; }
 
 private:
   VkDevice &device;
   VkBuffer buf_ = VK_NULL_HANDLE;
   VkDeviceMemory bufMem_ = VK_NULL_HANDLE;
   VkBufferUsageFlags usageFlags;
+  bool hostVisible_;
+  UploadTicket upload_;
 };
 #endif
 
@@ -671,8 +1014,15 @@ struct Texture {
   VkFormat &getDeptFormat() { return format_; }
   VkSampler &getSampler() { return sampler_; }
 
-  void setTextureIndex(uint32_t index) { index_ = index; }
+  void setTextureIndex(uint32_t index, bool isCubemap = false) {
+    index_ = index;
+    cubemap_ = isCubemap;
+  }
   uint32_t &getIndex() { return index_; }
+  // index is a slot of the cubemap array of the bindless set
+  bool isCubemap() const { return cubemap_; }
+  UploadTicket getUpload() const { return upload_; }
+  void setUpload(UploadTicket ticket) { upload_ = ticket; }
 
 private:
   VkDevice &device;
@@ -683,6 +1033,8 @@ private:
   VkImageView view_ = VK_NULL_HANDLE;
   VkSampler sampler_ = VK_NULL_HANDLE;
   uint32_t index_ = -1;
+  bool cubemap_ = false;
+  UploadTicket upload_;
 };
 #else
 struct Texture {
@@ -706,8 +1058,15 @@ struct Texture {
   VkFormat &getDeptFormat() { return format_; }
   VkSampler &getSampler() { return sampler_; }
 
-  void setTextureIndex(uint32_t index) { index_ = index; }
+  void setTextureIndex(uint32_t index, bool isCubemap = false) {
+    index_ = index;
+    cubemap_ = isCubemap;
+  }
   uint32_t &getIndex() { return index_; }
+  // index is a slot of the cubemap array of the bindless set
+  bool isCubemap() const { return cubemap_; }
+  UploadTicket getUpload() const { return upload_; }
+  void setUpload(UploadTicket ticket) { upload_ = ticket; }
 
 private:
   VkDevice &device;
@@ -717,6 +1076,8 @@ private:
   VkImageView view_ = VK_NULL_HANDLE;
   VkSampler sampler_ = VK_NULL_HANDLE;
   uint32_t index_ = -1;
+  bool cubemap_ = false;
+  UploadTicket upload_;
 };
 #endif
 
@@ -730,6 +1091,13 @@ struct Pipeline {
 
   VkPipeline &getPipeline() { return pipeline_; }
   VkPipelineLayout &getPipelineLayout() { return layout_; }
+  // exchanges the Vulkan objects, whoever holds this pipeline draws with
+  // other's from now on. Only between frames, other still has to outlive
+  // the command buffers recorded with the old ones
+  void swap(Pipeline &other) {
+    std::swap(pipeline_, other.pipeline_);
+    std::swap(layout_, other.layout_);
+  }
 
 private:
   VkDevice &device;
@@ -763,6 +1131,35 @@ GLFWwindow *initWindow(const WindowInfo &info);
 Renderer *initVulkanWithSwapChain(GLFWwindow *window = nullptr,
                                   const char *appName = nullptr,
                                   const struct RendererDefault &defaults = {});
+Renderer *initVulkanHeadless(const WindowInfo &info,
+                             const struct RendererDefault &defaults = {});
+
+// bytes of one layer of a width x height image in this format
+VkDeviceSize getTextureSize(TextureFormat format, uint32_t width,
+                            uint32_t height);
+// levels of a full mip chain down to 1x1
+uint32_t getMipLevelCount(uint32_t width, uint32_t height);
+
+ShaderStage getShaderStageFromFile(const char *filename);
+// GLSL source with every #include <file> line replaced by the file, which
+// is looked up next to the one including it. Empty when a file is missing
+// or includes itself. includes gets the path of every included file
+std::string readShaderFile(const char *filename,
+                           std::vector<std::string> *includes = nullptr);
+// the limits every Vulkan 1.3 device has, to compile shaders without one
+VkPhysicalDeviceLimits getMinimumDeviceLimits();
+
+#ifdef MAI_INCLUDE_GLSLANG
+// false with the log printed when the source doesn't compile, safe to call
+// from several threads
+bool compileShaderGlslang(ShaderStage stage, const char *code,
+                          std::vector<uint8_t> *outSPIRV,
+                          const glslang_resource_t *glslLangResource);
+glslang_resource_t getGLSLangResources(const VkPhysicalDeviceLimits &limits);
+// name a shader is cached under in RendererDefault::shaderCachePath
+uint64_t hashShaderSource(ShaderStage stage, const std::string &code,
+                          const glslang_resource_t &resource);
+#endif
 
 }; // namespace MAI
 
@@ -770,6 +1167,10 @@ Renderer *initVulkanWithSwapChain(GLFWwindow *window = nullptr,
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <mutex>
@@ -784,6 +1185,19 @@ std::mutex mtx;
 constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 2;
 constexpr uint32_t MAX_TEXTURES = 1024;
 constexpr uint32_t GENERAL_PUSHCONSTANT_SIZE = 256;
+// covers the texel block size of every format copied out of staging memory
+constexpr VkDeviceSize UPLOAD_ALIGNMENT = 16;
+
+// written in front of the driver's pipeline cache data. Drivers don't all
+// check what they are given, a cache from another driver version or a
+// truncated file is dropped before it reaches them
+struct PipelineCacheFileHeader {
+  uint32_t magic;
+  uint32_t driverVersion;
+  uint64_t dataSize;
+  uint64_t dataHash;
+};
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x4350494d; // "MIPC"
 
 struct SwapChainSupportDetails {
   VkSurfaceCapabilitiesKHR capabilities;
@@ -803,6 +1217,13 @@ const std::vector<const char *> deviceExtensions = {
     VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
 };
 
+const std::vector<const char *> headlessDeviceExtensions = {
+    VK_KHR_DYNAMIC_RENDERING_LOCAL_READ_EXTENSION_NAME,
+    VK_KHR_SPIRV_1_4_EXTENSION_NAME,
+    VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+    VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+};
+
 #ifdef _DEBUG
 constexpr bool enableValidation = true;
 #else
@@ -810,7 +1231,7 @@ constexpr bool enableValidation = false;
 #endif
 
 bool checkValidation();
-std::vector<const char *> getRequiredExtensions();
+std::vector<const char *> getRequiredExtensions(bool headless);
 static VKAPI_ATTR VkBool32 VKAPI_CALL
 debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
               VkDebugUtilsMessageTypeFlagsEXT type,
@@ -838,9 +1259,13 @@ VkExtent2D chooseSwapChainExtent(VkSurfaceCapabilitiesKHR &capabilities,
 SwapChainSupportDetails querrySwapChainSupport(VkPhysicalDevice device,
                                                VkSurfaceKHR surface);
 void endsWidth();
-ShaderStage getShaderStageFromFile(const char *filename);
-std::string readShaderFile(const char *filename);
 std::vector<char> readShaderBinaryFile(const char *filename);
+uint64_t hashPipelineCacheData(const char *data, size_t size);
+// the driver's data out of a cache file, empty when it was written by
+// another device or driver
+std::vector<char>
+readPipelineCacheFile(const char *path,
+                      const VkPhysicalDeviceProperties &properties);
 VkShaderStageFlags getShaderStage(MAIFlags stages);
 VkShaderStageFlagBits getShaderStageBits(ShaderStage stage);
 
@@ -852,6 +1277,14 @@ VkPolygonMode getPolygonMode(PolygonMode mode);
 VkPrimitiveTopology getPrimitiveTopology(PrimitiveTopology topology);
 VkBufferUsageFlags getBufferUsageFlags(MAIFlags usages);
 VkFormat getFormat(TextureFormat format);
+void recordBarrier(VkCommandBuffer commandBuffer,
+                   const VkMemoryBarrier2 &barrier);
+void recordBarrier(VkCommandBuffer commandBuffer,
+                   const VkBufferMemoryBarrier2 &barrier);
+void recordBarrier(VkCommandBuffer commandBuffer,
+                   const VkImageMemoryBarrier2 &barrier);
+void copyTextureLevels(uint8_t *dst, const struct TextureInfo &info,
+                       uint32_t layerCount, uint32_t levelCount);
 VkImageUsageFlags getImageUsage(TextureUsage usage);
 VkFilter getSamplerFilter(SamplerFilter filter);
 VkSamplerMipmapMode getSamplerMipmapMode(SamplerMipmap mode);
@@ -865,16 +1298,18 @@ VkDescriptorSetLayoutCreateFlags
 getDescriptorSetLayoutCreateFlags(MAIFlags layoutFlags);
 
 #ifdef MAI_INCLUDE_GLSLANG
-void compileShaderGlslang(ShaderStage stage, const char *code,
-                          std::vector<uint8_t> *outSPIRV,
-                          const glslang_resource_t *glslLangResource);
-glslang_resource_t getGLSLangResources(const VkPhysicalDeviceLimits &limits);
+// SPIR-V of code, out of the cache when it has it
+std::vector<uint8_t> compileShaderCached(const char *cacheDir,
+                                         ShaderStage stage,
+                                         const std::string &code,
+                                         const glslang_resource_t &resource);
 #endif
 
 Renderer::Renderer(VulkanContext *ctx, const struct RendererDefault &defaults)
     : ctx(ctx), defaults(defaults) {}
 
 struct CommandBuffer *Renderer::acquireCommandBuffer() {
+  MAI_VK_PROFILE_SCOPE("Renderer::acquireCommandBuffer");
   ctx->acquireSwapChainIndex();
 
   VkCommandBuffer &commandBuffer = ctx->commandBuffers[ctx->frameIndex];
@@ -887,10 +1322,47 @@ struct CommandBuffer *Renderer::acquireCommandBuffer() {
   if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
     throw std::runtime_error("failed to begin command buffer");
 
+  if (ctx->timestampPool != VK_NULL_HANDLE) {
+    resolveGpuZones();
+    vkCmdResetQueryPool(commandBuffer, ctx->timestampPool,
+                        ctx->frameIndex * MAX_GPU_ZONES * 2, MAX_GPU_ZONES * 2);
+    ctx->beginGpuZone("frame");
+  }
+
   CommandBuffer *cmd = new CommandBuffer(ctx);
   return cmd;
 }
 
+void Renderer::resolveGpuZones() {
+  // the fence of this slot was waited on, so its queries are available
+  std::vector<VulkanContext::GpuZoneRecord> &zones =
+      ctx->gpuZones[ctx->frameIndex];
+  if (zones.empty())
+    return;
+
+  const uint32_t firstQuery = ctx->frameIndex * MAX_GPU_ZONES * 2;
+  const uint32_t queryCount = static_cast<uint32_t>(zones.size()) * 2;
+  std::vector<uint64_t> timestamps(queryCount);
+
+  if (vkGetQueryPoolResults(ctx->device, ctx->timestampPool, firstQuery,
+                            queryCount, timestamps.size() * sizeof(uint64_t),
+                            timestamps.data(), sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+    gpuZoneResults.clear();
+    for (const auto &zone : zones) {
+      const uint32_t begin = zone.query - firstQuery;
+      gpuZoneResults.emplace_back(GpuZoneResult{
+          .name = zone.name,
+          .depth = zone.depth,
+          .ms = double(timestamps[begin + 1] - timestamps[begin]) *
+                ctx->timestampPeriod * 1e-6,
+      });
+    }
+    gpuFrameTime = gpuZoneResults.front().ms;
+  }
+  zones.clear();
+}
+
 struct Shader *Renderer::createShader(const char *filename, ShaderStage stage) {
   VkShaderStageFlagBits shaderStage;
   if (stage == ShaderStage::NONE)
@@ -902,14 +1374,20 @@ struct Shader *Renderer::createShader(const char *filename, ShaderStage stage) {
   VkShaderModule sm_;
   if (!isSPV) {
     std::string code = readShaderFile(filename);
+    if (code.empty())
+      throw std::runtime_error(std::string("failed to read shader ") +
+                               filename);
 #ifdef MAI_INCLUDE_GLSLANG
-    std::vector<uint8_t> buffer;
     VkPhysicalDeviceProperties properties;
     vkGetPhysicalDeviceProperties(ctx->physicalDevice, &properties);
     const glslang_resource_t glslangResource =
         getGLSLangResources(properties.limits);
 
-    compileShaderGlslang(stage, code.c_str(), &buffer, &glslangResource);
+    const std::vector<uint8_t> buffer = compileShaderCached(
+        defaults.shaderCachePath, stage, code, glslangResource);
+    if (buffer.empty())
+      throw std::runtime_error(std::string("failed to compile shader ") +
+                               filename);
     sm_ = ctx->createShaderModule((uint32_t)buffer.size(), buffer.data());
 #else
     throw std::runtime_error(
@@ -1211,8 +1689,9 @@ Renderer::createComputePipeline(const struct ComputePipelineInfo &info) {
   };
 
   VkPipeline pipeline;
-  if (vkCreateComputePipelines(ctx->device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                               nullptr, &pipeline) != VK_SUCCESS)
+  if (vkCreateComputePipelines(ctx->device, ctx->pipelineCache, 1,
+                               &pipelineInfo, nullptr,
+                               &pipeline) != VK_SUCCESS)
     throw std::runtime_error("failed to create compute pipeline");
 
   Pipeline *pm = new Pipeline(ctx->device, pipeline, layout);
@@ -1220,10 +1699,11 @@ Renderer::createComputePipeline(const struct ComputePipelineInfo &info) {
 }
 
 struct Buffer *Renderer::createBuffer(const struct BufferInfo &info) {
+  // a copy source so buffers can be moved or resized, a destination for
+  // the ones written through staging. That's decided by the memory they
+  // get, not by these bits
   VkBufferUsageFlags usageFlags =
-      info.storage == BufferStorage::StorageType_Device
-          ? VK_BUFFER_USAGE_TRANSFER_DST_BIT
-          : VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
   if (info.usage & BufferUsage::VertexBuffer)
     usageFlags |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
@@ -1236,6 +1716,11 @@ struct Buffer *Renderer::createBuffer(const struct BufferInfo &info) {
     usageFlags |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
                   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  // storage too, so compute shaders can write draw commands
+  if (info.usage & BufferUsage::IndirectBuffer)
+    usageFlags |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 
 #ifdef MAI_USE_VMA
   VkBuffer buffer;
@@ -1248,48 +1733,69 @@ struct Buffer *Renderer::createBuffer(const struct BufferInfo &info) {
       .memoryUsage = VMA_MEMORY_USAGE_AUTO,
   };
 
-  if (info.storage == BufferStorage::StorageType_Device)
-    bufferInfo.allocflags |= VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-  else
+  // device buffers are placed in VMA's shared blocks
+  if (info.storage != BufferStorage::StorageType_Device)
     bufferInfo.allocflags |=
         VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
         VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT |
         VMA_ALLOCATION_CREATE_MAPPED_BIT;
 
   ctx->createBuffer(bufferInfo, buffer, allocation, allocInfo);
+  // host buffers may get device local memory when VMA prefers a transfer
+  VkMemoryPropertyFlags memoryFlags;
+  vmaGetAllocationMemoryProperties(ctx->allocator, allocation, &memoryFlags);
+  const bool hostVisible = memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
 
+  UploadTicket upload;
   if (info.data) {
-    ctx->updateBuffer(usageFlags, buffer, allocation, info.size, info.data);
+    if (hostVisible)
+      ctx->updateBuffer(allocation, info.size, info.data);
+    else
+      upload = ctx->uploads->uploadBuffer(buffer, info.data, info.size);
   }
 
-  Buffer *bufferModule =
-      new Buffer(ctx->allocator, buffer, allocation, allocInfo, usageFlags);
+  Buffer *bufferModule = new Buffer(ctx->allocator, buffer, allocation,
+                                    allocInfo, usageFlags, hostVisible);
+  bufferModule->setUpload(upload);
   return bufferModule;
 
 #else
   VkBuffer buffer;
   VkDeviceMemory bufferMemory;
+  const bool hostVisible = info.storage != BufferStorage::StorageType_Device;
   ctx->createBuffer(info.size, usageFlags,
-                    info.storage == BufferStorage::StorageType_Device
-                        ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-                        : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    hostVisible ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                                : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                     buffer, bufferMemory);
 
+  UploadTicket upload;
   if (info.data) {
-    ctx->updateBuffer(usageFlags, buffer, bufferMemory, info.size, info.data);
+    if (hostVisible)
+      ctx->updateBuffer(bufferMemory, info.size, info.data);
+    else
+      upload = ctx->uploads->uploadBuffer(buffer, info.data, info.size);
   }
   Buffer *bufferModule =
-      new Buffer(ctx->device, buffer, bufferMemory, usageFlags);
+      new Buffer(ctx->device, buffer, bufferMemory, usageFlags, hostVisible);
+  bufferModule->setUpload(upload);
   return bufferModule;
 
 #endif
 }
 
 struct Texture *Renderer::createImage(const struct TextureInfo &info) {
+  MAI_VK_PROFILE_SCOPE("Renderer::createImage");
   VkFormat format_ = getFormat(info.format);
 
-  VkDeviceSize imageSize = info.dimensions.width * info.dimensions.height * 4;
+  const uint32_t width = info.dimensions.width;
+  const uint32_t height = info.dimensions.height;
+  uint32_t mipLevels = 1;
+  if (info.usage == MAI::Sampled_Bit)
+    mipLevels = info.mipLevels ? std::min(info.mipLevels,
+                                          getMipLevelCount(width, height))
+                               : getMipLevelCount(width, height);
+  const bool blitMips = mipLevels > 1 && !info.mipData;
   uint32_t layerCount = 1;
 
   ImageDesc imageInfo = {
@@ -1300,15 +1806,17 @@ struct Texture *Renderer::createImage(const struct TextureInfo &info) {
               .height = info.dimensions.height,
               .depth = info.dimensions.depth,
           },
+      .mipLevel = mipLevels,
       .format = format_,
       .tiling = VK_IMAGE_TILING_OPTIMAL,
       .usage = info.usage != Sampled_Bit ? getImageUsage(info.usage)
                                          : getImageUsage(info.usage) |
                                                VK_IMAGE_USAGE_TRANSFER_DST_BIT,
   };
+  if (blitMips)
+    imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
   if (info.type == MAI::TextureType_Cube) {
-    imageSize *= sizeof(float) * 6;
     layerCount = 6;
     imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
     imageInfo.arrayLayers = 6;
@@ -1317,79 +1825,21 @@ struct Texture *Renderer::createImage(const struct TextureInfo &info) {
 #ifdef MAI_USE_VMA
   VkImage image;
   VmaAllocation allocation;
-
   ctx->createImage(imageInfo, image, allocation);
-
-  if (info.usage == MAI::Sampled_Bit) {
-    if (!info.data)
-      throw std::runtime_error("texture have no data to it");
-
-    VkBuffer stagingBuffer;
-    VmaAllocation stagingAllocation;
-    VmaAllocationInfo stagingAllocInfo;
-
-    ctx->createBuffer(
-        {
-            .size = imageSize,
-            .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            .allocflags =
-                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-                VMA_ALLOCATION_CREATE_MAPPED_BIT,
-            .memoryUsage = VMA_MEMORY_USAGE_AUTO,
-        },
-        stagingBuffer, stagingAllocation, stagingAllocInfo);
-    memcpy(stagingAllocInfo.pMappedData, info.data, imageSize);
-
-    ctx->transitionImageLayout(image, format_, VK_IMAGE_LAYOUT_UNDEFINED,
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               layerCount);
-    ctx->copyBuffeToImage(stagingBuffer, image,
-                          static_cast<uint32_t>(info.dimensions.width),
-                          static_cast<uint32_t>(info.dimensions.height),
-                          info.type == MAI::TextureType_Cube);
-    ctx->transitionImageLayout(
-        image, format_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount);
-    vmaDestroyBuffer(ctx->allocator, stagingBuffer, stagingAllocation);
-  }
 #else
   VkImage image;
   VkDeviceMemory imageMemory;
   ctx->createImage(imageInfo, image, imageMemory);
+#endif
 
+  UploadTicket upload;
   if (info.usage == MAI::Sampled_Bit) {
-    if (!info.data)
+    if (!info.data && !info.mipData)
       throw std::runtime_error("texture have no data to it");
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-    ctx->createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      stagingBuffer, stagingMemory);
-    void *data;
-    vkMapMemory(ctx->device, stagingMemory, 0, imageSize, 0, &data);
-    memcpy(data, info.data, static_cast<size_t>(imageSize));
-    vkUnmapMemory(ctx->device, stagingMemory);
-    ctx->transitionImageLayout(image, format_, VK_IMAGE_LAYOUT_UNDEFINED,
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               layerCount);
-
-    ctx->copyBuffeToImage(stagingBuffer, image,
-                          static_cast<uint32_t>(info.dimensions.width),
-                          static_cast<uint32_t>(info.dimensions.height),
-                          info.type == MAI::TextureType_Cube);
-
-    ctx->transitionImageLayout(
-        image, format_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount);
-
-    vkDestroyBuffer(ctx->device, stagingBuffer, nullptr);
-    vkFreeMemory(ctx->device, stagingMemory, nullptr);
+    upload =
+        ctx->uploads->uploadImage(image, format_, info, layerCount, mipLevels);
   }
 
-#endif
-
   VkImageView imageView = VK_NULL_HANDLE;
   VkSampler sampler = VK_NULL_HANDLE;
 
@@ -1403,6 +1853,7 @@ struct Texture *Renderer::createImage(const struct TextureInfo &info) {
             .format = getFormat(info.format),
             .viewType = VK_IMAGE_VIEW_TYPE_2D,
             .aspect = aspect,
+            .levelCount = mipLevels,
         },
         image, imageView);
 
@@ -1423,6 +1874,7 @@ struct Texture *Renderer::createImage(const struct TextureInfo &info) {
             .viewType = VK_IMAGE_VIEW_TYPE_CUBE,
             .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
             .layerCount = 6,
+            .levelCount = mipLevels,
         },
         image, imageView);
     ctx->createSampler(
@@ -1444,29 +1896,49 @@ struct Texture *Renderer::createImage(const struct TextureInfo &info) {
   Texture *texture =
       new Texture(ctx->device, image, imageMemory, imageView, sampler, format_);
 #endif
+  texture->setUpload(upload);
 
   if (info.usage == MAI::Attachment_Bit || !defaults.defaultDescriptorPool ||
       !info.updateDescriptor)
     return texture;
 
-  if (info.type == MAI::TextureType_2D) {
-    lastTextureCount++;
-    assert(lastTextureCount < MAX_TEXTURES);
-    texture->setTextureIndex(lastTextureCount);
-
-    ctx->updateDescriptorImageWrite(texture->getImageView(),
-                                    texture->getSampler(), lastTextureCount);
-  } else if (info.type == MAI::TextureType_Cube) {
-    lastCubemapCount++;
+  if (info.type == MAI::TextureType_2D)
+    texture->setTextureIndex(writeBindlessSlot(texture, false));
+  else if (info.type == MAI::TextureType_Cube)
+    texture->setTextureIndex(writeBindlessSlot(texture, true), true);
 
-    assert(lastCubemapCount < MAX_TEXTURES);
-    texture->setTextureIndex(lastCubemapCount);
+  return texture;
+}
 
-    ctx->updateDescriptorImageWrite(
-        texture->getImageView(), texture->getSampler(), lastCubemapCount, true);
+uint32_t Renderer::writeBindlessSlot(Texture *texture, bool isCubemap) {
+  // vkUpdateDescriptorSets needs the sets externally synchronized too
+  std::lock_guard<std::mutex> lock(descriptorMutex);
+  std::vector<uint32_t> &freed =
+      isCubemap ? freeCubemapSlots : freeTextureSlots;
+  uint32_t slot;
+  if (!freed.empty()) {
+    slot = freed.back();
+    freed.pop_back();
+  } else {
+    uint32_t &last = isCubemap ? lastCubemapCount : lastTextureCount;
+    if (last + 1 >= MAX_TEXTURES)
+      throw std::runtime_error("out of bindless texture slots");
+    slot = ++last;
   }
+  ctx->updateDescriptorImageWrite(texture->getImageView(),
+                                  texture->getSampler(), slot, isCubemap);
+  return slot;
+}
 
-  return texture;
+void Renderer::releaseBindlessSlot(Texture *texture) {
+  // attachments and textures created without a descriptor have no slot.
+  // The descriptor is left as is until the slot is handed out again, the
+  // bindings are partially bound so a slot nothing samples may be stale
+  if (texture->getIndex() == (uint32_t)-1)
+    return;
+  std::lock_guard<std::mutex> lock(descriptorMutex);
+  (texture->isCubemap() ? freeCubemapSlots : freeTextureSlots)
+      .push_back(texture->getIndex());
 }
 
 struct Descriptor *
@@ -1658,7 +2130,7 @@ void CommandBuffer::cmdBeginRendering(const struct BeginInfo &info) {
       .imageView = ctx->swapChainImageViews[ctx->imageIndex],
       .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
       .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_NONE,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = clearColor,
   };
 
@@ -1691,12 +2163,30 @@ void CommandBuffer::cmdEndRendering() {
 
   vkCmdEndRendering(ctx->commandBuffers[ctx->frameIndex]);
 
-  ctx->transition_image_layout(
-      VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-      {}, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-      VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
-      ctx->swapChainImages[ctx->imageIndex]);
+  if (ctx->headless)
+    ctx->transition_image_layout(
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        ctx->swapChainImages[ctx->imageIndex]);
+  else
+    ctx->transition_image_layout(
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        {}, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+        ctx->swapChainImages[ctx->imageIndex]);
+
+  if (ctx->timestampPool != VK_NULL_HANDLE) {
+    if (ctx->gpuZoneStack.size() != 1) {
+      std::cerr << "gpu zones left open at the end of the frame" << std::endl;
+      assert(false);
+    }
+    while (!ctx->gpuZoneStack.empty())
+      ctx->endGpuZone();
+  }
   vkEndCommandBuffer(ctx->commandBuffers[ctx->frameIndex]);
 
   lastBindPipline = nullptr;
@@ -1705,6 +2195,7 @@ void CommandBuffer::cmdEndRendering() {
 void CommandBuffer::bindPipeline(Pipeline *pipeline, Descriptor *descriptor) {
   assert(pipeline->getPipeline() != VK_NULL_HANDLE);
   lastBindPipline = pipeline;
+  lastBindComputePipeline = nullptr;
   if (lastBindPipline != nullptr) {
     vkCmdBindPipeline(ctx->commandBuffers[ctx->frameIndex],
                       VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -1723,7 +2214,9 @@ void CommandBuffer::bindPipeline(Pipeline *pipeline, Descriptor *descriptor) {
 
 void CommandBuffer::bindComputePipeline(Pipeline *pipeline) {
   assert(pipeline->getPipeline() != VK_NULL_HANDLE);
+  // push constants go to the pipeline that was bound last
   lastBindComputePipeline = pipeline;
+  lastBindPipline = nullptr;
   if (lastBindComputePipeline != nullptr) {
     vkCmdBindPipeline(ctx->commandBuffers[ctx->frameIndex],
                       VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -1764,6 +2257,34 @@ void CommandBuffer::cmdDrawIndex(uint32_t indexCount, uint32_t instanceCount,
                    instanceCount, firstIndex, vertexOffset, firstInstance);
 }
 
+void CommandBuffer::cmdDrawIndirect(Buffer *buffer, VkDeviceSize offset,
+                                    uint32_t drawCount, uint32_t stride) {
+  assert(lastBindPipline);
+  assert(buffer->getBufferUsage() & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  vkCmdDrawIndirect(ctx->commandBuffers[ctx->frameIndex], buffer->getBuffer(),
+                    offset, drawCount, stride);
+}
+
+void CommandBuffer::cmdDrawIndexedIndirect(Buffer *buffer, VkDeviceSize offset,
+                                           uint32_t drawCount,
+                                           uint32_t stride) {
+  assert(lastBindPipline);
+  assert(buffer->getBufferUsage() & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  vkCmdDrawIndexedIndirect(ctx->commandBuffers[ctx->frameIndex],
+                           buffer->getBuffer(), offset, drawCount, stride);
+}
+
+void CommandBuffer::cmdDrawIndexedIndirectCount(
+    Buffer *buffer, VkDeviceSize offset, Buffer *countBuffer,
+    VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride) {
+  assert(lastBindPipline);
+  assert(buffer->getBufferUsage() & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  assert(countBuffer->getBufferUsage() & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+  vkCmdDrawIndexedIndirectCount(
+      ctx->commandBuffers[ctx->frameIndex], buffer->getBuffer(), offset,
+      countBuffer->getBuffer(), countOffset, maxDrawCount, stride);
+}
+
 void CommandBuffer::cmdBindDepthState(const struct DepthState &depthInfo) {
   VkCommandBuffer &commandBuffer = ctx->commandBuffers[ctx->frameIndex];
   vkCmdSetDepthWriteEnable(commandBuffer, depthInfo.depthWriteEnable);
@@ -1815,203 +2336,280 @@ void CommandBuffer::cmdDispatchThreadGroups(
                 info.depth);
 }
 
-void CommandBuffer::update(struct Buffer *buffer, const void *data,
-                           size_t size) {
-  VkBufferUsageFlags usage = buffer->getBufferUsage();
-  VkCommandBuffer &commandBuffer = ctx->commandBuffers[ctx->frameIndex];
-
-  VkResult result;
-  VkAccessFlags2 bufAccessMask;
-  if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
-    bufAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
-  if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
-    bufAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
-  if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
-    bufAccessMask = VK_ACCESS_INDEX_READ_BIT;
-  if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
-    bufAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
-  if (usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
-    bufAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
-
-#ifdef MAI_USE_VMA
-    if (vmaCopyMemoryToAllocation(ctx->allocator, data, buffer->getAllocation(),
-                                  0, size) != VK_SUCCESS)
-      throw std::runtime_error("failed to update host visible buffer");
-#else
-    void *mappedData;
-    vkMapMemory(ctx->device, buffer->getBufferMem(), 0, size, 0, &mappedData);
-    memcpy(mappedData, data, size);
-    vkUnmapMemory(ctx->device, buffer->getBufferMem());
-#endif
+void CommandBuffer::cmdCopyBuffer(Buffer *src, Buffer *dst, VkDeviceSize size,
+                                  VkDeviceSize srcOffset,
+                                  VkDeviceSize dstOffset) {
+  VkBufferCopy copyRegion{
+      .srcOffset = srcOffset,
+      .dstOffset = dstOffset,
+      .size = size,
+  };
+  vkCmdCopyBuffer(ctx->commandBuffers[ctx->frameIndex], src->getBuffer(),
+                  dst->getBuffer(), 1, &copyRegion);
+}
 
-    VkBufferMemoryBarrier bufMemBarrier = {
-        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    bufMemBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
-    bufMemBarrier.dstAccessMask = bufAccessMask;
-    bufMemBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    bufMemBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    bufMemBarrier.buffer = buffer->getBuffer();
-    bufMemBarrier.offset = 0;
-    bufMemBarrier.size = VK_WHOLE_SIZE;
-
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_HOST_BIT,
-                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 1,
-                         &bufMemBarrier, 0, nullptr);
-
-  } else if (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) {
-#ifdef MAI_USE_VMA
-    BufferDesc bufferInfo{
-        .size = size,
-        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        .allocflags =
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT |
-            VMA_ALLOCATION_CREATE_MAPPED_BIT,
-        .memoryUsage = VMA_MEMORY_USAGE_AUTO,
-    };
+void CommandBuffer::cmdFillBuffer(Buffer *buffer, VkDeviceSize offset,
+                                  VkDeviceSize size, uint32_t data) {
+  vkCmdFillBuffer(ctx->commandBuffers[ctx->frameIndex], buffer->getBuffer(),
+                  offset, size, data);
+}
 
-    VkBuffer stagingBuf;
-    VmaAllocation stagingAlloc;
-    VmaAllocationInfo stagingAllocInfo;
-    ctx->createBuffer(bufferInfo, stagingBuf, stagingAlloc, stagingAllocInfo);
+void CommandBuffer::cmdBufferBarrier(Buffer *buffer,
+                                     VkPipelineStageFlags2 srcStage,
+                                     VkAccessFlags2 srcAccess,
+                                     VkPipelineStageFlags2 dstStage,
+                                     VkAccessFlags2 dstAccess) {
+  VkBufferMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = buffer->getBuffer(),
+      .offset = 0,
+      .size = VK_WHOLE_SIZE,
+  };
+  VkDependencyInfo dependencyInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .bufferMemoryBarrierCount = 1,
+      .pBufferMemoryBarriers = &barrier,
+  };
 
-    vmaCopyMemoryToAllocation(ctx->allocator, data, stagingAlloc, 0, size);
+  vkCmdPipelineBarrier2(ctx->commandBuffers[ctx->frameIndex], &dependencyInfo);
+}
 
-    ctx->copyBuffer(stagingBuf, buffer->getBuffer(), size);
+void CommandBuffer::cmdBeginGpuZone(const char *name) {
+  if (ctx->timestampPool != VK_NULL_HANDLE)
+    ctx->beginGpuZone(name);
+}
 
-    vmaDestroyBuffer(ctx->allocator, stagingBuf, stagingAlloc);
+void CommandBuffer::cmdEndGpuZone() {
+  if (ctx->timestampPool != VK_NULL_HANDLE)
+    ctx->endGpuZone();
+}
 
+void CommandBuffer::update(struct Buffer *buffer, const void *data,
+                           size_t size) {
+  if (buffer->isHostVisible()) {
+    // the submit makes the write visible to the frame
+#ifdef MAI_USE_VMA
+    ctx->updateBuffer(buffer->getAllocation(), size, data);
 #else
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-    ctx->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                      stagingBuffer, stagingMemory);
-
-    void *mappedData;
-    vkMapMemory(ctx->device, stagingMemory, 0, size, 0, &mappedData);
-    memcpy(mappedData, data, size);
-    vkUnmapMemory(ctx->device, stagingMemory);
-
-    ctx->copyBuffer(stagingBuffer, buffer->getBuffer(), size);
-
-    vkDestroyBuffer(ctx->device, stagingBuffer, nullptr);
-    vkFreeMemory(ctx->device, stagingMemory, nullptr);
+    ctx->updateBuffer(buffer->getBufferMem(), size, data);
 #endif
-
-    VkBufferMemoryBarrier bufMemBarrier2 = {
-        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
-    bufMemBarrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    bufMemBarrier2.dstAccessMask = bufAccessMask;
-    bufMemBarrier2.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    bufMemBarrier2.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    bufMemBarrier2.buffer = buffer->getBuffer();
-    bufMemBarrier2.offset = 0;
-    bufMemBarrier2.size = VK_WHOLE_SIZE;
-
-    // Make sure copying from staging buffer to the actual buffer has finished
-    // by inserting a buffer memory barrier.
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 1,
-                         &bufMemBarrier2, 0, nullptr);
+    return;
   }
+
+  VkDeviceSize offset;
+  const StagingBuffer staging = ctx->allocateFrameStaging(size, offset);
+  memcpy(staging.mapped + offset, data, size);
+  ctx->flushStagingBuffer(staging, offset, size);
+
+  VkBufferCopy region = {
+      .srcOffset = offset,
+      .dstOffset = 0,
+      .size = size,
+  };
+  vkCmdCopyBuffer(ctx->getUpdateCommandBuffer(), staging.buffer,
+                  buffer->getBuffer(), 1, &region);
 }
 
 void CommandBuffer::update(struct Texture *texture,
                            const struct TextureRangeDesc &range,
                            const void *data, uint32_t bufferRowLength) {
-  const VkRect2D imageRegion = {
-      .offset = {.x = range.offset.x, .y = range.offset.y},
-      .extent = {.width = range.extent.width, .height = range.extent.height},
+  // RGBA8 rows bufferRowLength texels apart, the last one ends with the range
+  const VkDeviceSize imageSize =
+      (static_cast<VkDeviceSize>(bufferRowLength) * (range.extent.height - 1) +
+       range.extent.width) *
+      4;
+
+  VkDeviceSize offset;
+  const StagingBuffer staging = ctx->allocateFrameStaging(imageSize, offset);
+  memcpy(staging.mapped + offset, data, static_cast<size_t>(imageSize));
+  ctx->flushStagingBuffer(staging, offset, imageSize);
+
+  VkCommandBuffer commandBuffer = ctx->getUpdateCommandBuffer();
+  // the rest of the image is kept, earlier frames may still sample it
+  VkImageMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+      .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = texture->getImage(),
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .baseMipLevel = 0,
+              .levelCount = 1,
+              .baseArrayLayer = 0,
+              .layerCount = 1,
+          },
   };
-  VkDeviceSize imageSize = bufferRowLength * range.extent.height * 4;
-  uint32_t layerCount = 1;
+  recordBarrier(commandBuffer, barrier);
 
-#ifdef MAI_USE_VMA
-  VkBuffer stagingBuffer;
-  VmaAllocation stagingAllocation;
-  VmaAllocationInfo stagingAllocInfo;
+  VkBufferImageCopy region = {
+      .bufferOffset = offset,
+      .bufferRowLength = bufferRowLength,
+      .imageSubresource =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .mipLevel = 0,
+              .baseArrayLayer = 0,
+              .layerCount = 1,
+          },
+      .imageOffset = range.offset,
+      .imageExtent = {range.extent.width, range.extent.height, 1},
+  };
+  vkCmdCopyBufferToImage(commandBuffer, staging.buffer, texture->getImage(),
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-  ctx->createBuffer(
-      {
-          .size = imageSize,
-          .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-          .allocflags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-                        VMA_ALLOCATION_CREATE_MAPPED_BIT,
-          .memoryUsage = VMA_MEMORY_USAGE_AUTO,
-      },
-      stagingBuffer, stagingAllocation, stagingAllocInfo);
-  memcpy(stagingAllocInfo.pMappedData, data, imageSize);
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  recordBarrier(commandBuffer, barrier);
+}
 
-  ctx->transitionImageLayout(texture->getImage(), VK_FORMAT_R8G8B8A8_SRGB,
-                             VK_IMAGE_LAYOUT_UNDEFINED,
-                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerCount);
+void Renderer::waitDeviceIdle() {
+  ctx->uploads->flush();
+  vkDeviceWaitIdle(ctx->device);
+}
 
-  ctx->copyBuffeToImage(stagingBuffer, texture->getImage(), imageRegion,
-                        bufferRowLength);
+void Renderer::flushUploads() { ctx->uploads->flush(); }
 
-  ctx->transitionImageLayout(texture->getImage(), VK_FORMAT_R8G8B8A8_SRGB,
-                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                             layerCount);
+void Renderer::deferDelete(Buffer *buffer) {
+  if (buffer)
+    deferDelete([buffer] { delete buffer; });
+}
 
-  vmaDestroyBuffer(ctx->allocator, stagingBuffer, stagingAllocation);
-#else
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingMemory;
+void Renderer::deferDelete(Texture *texture) {
+  if (texture)
+    deferDelete([this, texture] {
+      releaseBindlessSlot(texture);
+      delete texture;
+    });
+}
 
-  ctx->createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                    stagingBuffer, stagingMemory);
+void Renderer::deferDelete(Pipeline *pipeline) {
+  if (pipeline)
+    deferDelete([pipeline] { delete pipeline; });
+}
 
-  void *ptr;
-  vkMapMemory(ctx->device, stagingMemory, 0, imageSize, 0, &ptr);
-  memcpy(ptr, data, static_cast<size_t>(imageSize));
-  vkUnmapMemory(ctx->device, stagingMemory);
-  ctx->transitionImageLayout(texture->getImage(), VK_FORMAT_R8G8B8A8_SRGB,
-                             VK_IMAGE_LAYOUT_UNDEFINED,
-                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layerCount);
-
-  ctx->copyBuffeToImage(stagingBuffer, texture->getImage(), imageRegion,
-                        bufferRowLength);
-
-  ctx->transitionImageLayout(texture->getImage(), VK_FORMAT_R8G8B8A8_SRGB,
-                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                             layerCount);
-
-  vkDestroyBuffer(ctx->device, stagingBuffer, nullptr);
-  vkFreeMemory(ctx->device, stagingMemory, nullptr);
-#endif
+void Renderer::deferDelete(std::function<void()> destroy) {
+  std::lock_guard<std::mutex> lock(ctx->deletionMutex);
+  ctx->deletionQueue.push_back({std::move(destroy), ctx->frameCount});
+}
+
+void Renderer::flushDeferredDeletes() {
+  waitDeviceIdle();
+  ctx->runDeferredDeletes(true);
 }
 
-void Renderer::waitDeviceIdle() { vkDeviceWaitIdle(ctx->device); }
+bool Renderer::isUploadComplete(UploadTicket ticket) {
+  return ctx->uploads->isComplete(ticket);
+}
+
+void Renderer::waitUpload(UploadTicket ticket) { ctx->uploads->wait(ticket); }
+
+UploadTicket Renderer::uploadBuffer(Buffer *buffer, const void *data,
+                                    VkDeviceSize size,
+                                    VkDeviceSize dstOffset) {
+  return ctx->uploads->uploadBuffer(buffer->getBuffer(), data, size,
+                                    dstOffset);
+}
+
+void Renderer::copyBuffer(Buffer *src, Buffer *dst,
+                          const VkBufferCopy *regions, uint32_t regionCount) {
+  // submitted even without regions, returning still means the queue and
+  // the uploads are done with both buffers
+  VkCommandBuffer commandBuffer = ctx->beginSingleCommandBuffer();
+  if (regionCount)
+    vkCmdCopyBuffer(commandBuffer, src->getBuffer(), dst->getBuffer(),
+                    regionCount, regions);
+  ctx->endSingleCommandBuffer(commandBuffer);
+}
 
 void Renderer::submit() {
+  MAI_VK_PROFILE_SCOPE("Renderer::submit");
   uint32_t frameIndex = ctx->frameIndex;
 
-  VkSemaphore waitSemaphore[] = {ctx->imageAvailableSemaphore[frameIndex]};
+  // the frame can use anything uploaded up to now
+  const uint64_t uploadValue = ctx->uploads->flush();
+  VkSemaphore uploadTimeline = ctx->uploads->getTimeline();
+
+  // updates recorded while rendering run ahead of the frame
+  VkCommandBuffer frameCommandBuffers[] = {ctx->endUpdateCommandBuffer(),
+                                           ctx->commandBuffers[frameIndex]};
+  const uint32_t firstCommandBuffer =
+      frameCommandBuffers[0] == VK_NULL_HANDLE ? 1 : 0;
+
+  if (ctx->headless) {
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &uploadValue,
+    };
+    VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfo,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &uploadTimeline,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 2 - firstCommandBuffer,
+        .pCommandBuffers = frameCommandBuffers + firstCommandBuffer,
+    };
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (vkQueueSubmit(ctx->graphicsQueue, 1, &submitInfo,
+                        ctx->drawFences[frameIndex]) != VK_SUCCESS)
+        throw std::runtime_error("faile to submit to the queue");
+    }
+
+    ctx->lastSubmittedFrame = frameIndex;
+    ctx->frameIndex = (ctx->frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+    return;
+  }
+
+  VkSemaphore waitSemaphore[] = {ctx->imageAvailableSemaphore[frameIndex],
+                                 uploadTimeline};
 
   VkSemaphore signalSemaphore[] = {ctx->renderFinishSemaphore[ctx->imageIndex]};
-  VkCommandBuffer &commandBuffer = ctx->commandBuffers[frameIndex];
 
   VkPipelineStageFlags waitStages[] = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+  };
+  // the binary semaphore's value is ignored
+  const uint64_t waitValues[] = {0, uploadValue};
+  VkTimelineSemaphoreSubmitInfo timelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .waitSemaphoreValueCount = 2,
+      .pWaitSemaphoreValues = waitValues,
   };
 
   VkSubmitInfo submitInfo = {
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .waitSemaphoreCount = 1,
+      .pNext = &timelineInfo,
+      .waitSemaphoreCount = 2,
       .pWaitSemaphores = waitSemaphore,
       .pWaitDstStageMask = waitStages,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBuffer,
+      .commandBufferCount = 2 - firstCommandBuffer,
+      .pCommandBuffers = frameCommandBuffers + firstCommandBuffer,
       .signalSemaphoreCount = 1,
       .pSignalSemaphores = signalSemaphore,
   };
 
+  std::unique_lock<std::mutex> lock(mtx);
   if (vkQueueSubmit(ctx->graphicsQueue, 1, &submitInfo,
                     ctx->drawFences[frameIndex]) != VK_SUCCESS)
     throw std::runtime_error("faile to submit to the queue");
@@ -2027,7 +2625,9 @@ void Renderer::submit() {
       .pImageIndices = &ctx->imageIndex,
   };
   bool framedResized = false;
+  MAI_VK_PROFILE_SCOPE("vkQueuePresentKHR");
   VkResult result = vkQueuePresentKHR(ctx->presentQueue, &presentInfo);
+  lock.unlock();
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
       framedResized) {
     framedResized = false;
@@ -2035,9 +2635,86 @@ void Renderer::submit() {
   } else if (result != VK_SUCCESS)
     throw std::runtime_error("failed to present swap chain image");
 
+  ctx->lastSubmittedFrame = frameIndex;
   ctx->frameIndex = (ctx->frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+void Renderer::readbackFrame(std::vector<uint8_t> &pixels) {
+  if (!ctx->headless)
+    throw std::runtime_error("frame readback needs a headless renderer");
+
+  // offscreen images are indexed by frame, see acquireSwapChainIndex
+  const uint32_t frame = ctx->lastSubmittedFrame;
+  if (vkWaitForFences(ctx->device, 1, &ctx->drawFences[frame], VK_TRUE,
+                      UINT64_MAX) != VK_SUCCESS)
+    throw std::runtime_error("failed to wait for draw fence");
+
+  const VkExtent2D extent = ctx->swapChainExtent;
+  const VkDeviceSize size = extent.width * extent.height * 4;
+  pixels.resize(size);
+
+  VkBufferImageCopy region{
+      .bufferOffset = 0,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .mipLevel = 0,
+              .baseArrayLayer = 0,
+              .layerCount = 1,
+          },
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {extent.width, extent.height, 1},
+  };
+
+#ifdef MAI_USE_VMA
+  VkBuffer readbackBuffer;
+  VmaAllocation readbackAllocation;
+  VmaAllocationInfo readbackAllocInfo;
+  ctx->createBuffer(
+      {
+          .size = size,
+          .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          .allocflags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                        VMA_ALLOCATION_CREATE_MAPPED_BIT,
+          .memoryUsage = VMA_MEMORY_USAGE_AUTO,
+      },
+      readbackBuffer, readbackAllocation, readbackAllocInfo);
+
+  VkCommandBuffer commandBuffer = ctx->beginSingleCommandBuffer();
+  vkCmdCopyImageToBuffer(commandBuffer, ctx->swapChainImages[frame],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer,
+                         1, &region);
+  ctx->endSingleCommandBuffer(commandBuffer);
+
+  vmaInvalidateAllocation(ctx->allocator, readbackAllocation, 0, size);
+  memcpy(pixels.data(), readbackAllocInfo.pMappedData, size);
+  vmaDestroyBuffer(ctx->allocator, readbackBuffer, readbackAllocation);
+#else
+  VkBuffer readbackBuffer;
+  VkDeviceMemory readbackMemory;
+  ctx->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    readbackBuffer, readbackMemory);
+
+  VkCommandBuffer commandBuffer = ctx->beginSingleCommandBuffer();
+  vkCmdCopyImageToBuffer(commandBuffer, ctx->swapChainImages[frame],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer,
+                         1, &region);
+  ctx->endSingleCommandBuffer(commandBuffer);
+
+  void *data;
+  vkMapMemory(ctx->device, readbackMemory, 0, size, 0, &data);
+  memcpy(pixels.data(), data, static_cast<size_t>(size));
+  vkUnmapMemory(ctx->device, readbackMemory);
+
+  vkDestroyBuffer(ctx->device, readbackBuffer, nullptr);
+  vkFreeMemory(ctx->device, readbackMemory, nullptr);
+#endif
+}
+
 uint64_t Renderer::gpuAddress(struct Buffer *buffer) {
   VkBufferDeviceAddressInfo addrInfo{
       .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
@@ -2108,12 +2785,66 @@ Renderer *initVulkanWithSwapChain(GLFWwindow *window, const char *appName,
   return ren;
 }
 
-VulkanContext::VulkanContext(GLFWwindow *window, const char *name,
-                             const struct RendererDefault &defaults)
-    : window(window), appName(name), defaults(defaults) {
-  createInstance();
-  setupDebugger();
-  createSurfaceKHR();
+Renderer *initVulkanHeadless(const WindowInfo &info,
+                             const struct RendererDefault &defaults) {
+  assert(info.width && info.height);
+
+  VulkanContext *ctx = new VulkanContext(info, defaults);
+  Renderer *ren = new Renderer(ctx, defaults);
+
+  return ren;
+}
+
+VkDeviceSize getTextureSize(TextureFormat format, uint32_t width,
+                            uint32_t height) {
+  const VkDeviceSize texels = static_cast<VkDeviceSize>(width) * height;
+  switch (format) {
+  case Format_Z_F32:
+    return texels * sizeof(float);
+  case Format_RGBA_S8:
+    return texels * 4;
+  case Format_RGBA_F32:
+    return texels * 4 * sizeof(float);
+  case Format_RGBA_F16:
+    return texels * 4 * sizeof(uint16_t);
+  case Format_B10G11R11_UF:
+    return texels * sizeof(uint32_t);
+  case Format_BC7_S:
+  case Format_BC5:
+  case Format_BC6H_UF:
+    return static_cast<VkDeviceSize>((width + 3) / 4) * ((height + 3) / 4) *
+           16;
+  }
+  assert(false);
+  return 0;
+}
+
+uint32_t getMipLevelCount(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+    levels++;
+  return levels;
+}
+
+void copyTextureLevels(uint8_t *dst, const struct TextureInfo &info,
+                       uint32_t layerCount, uint32_t levelCount) {
+  for (uint32_t level = 0; level < levelCount; level++) {
+    const size_t size = static_cast<size_t>(
+        getTextureSize(info.format,
+                       std::max(1u, info.dimensions.width >> level),
+                       std::max(1u, info.dimensions.height >> level)) *
+        layerCount);
+    memcpy(dst, info.mipData ? info.mipData[level] : info.data, size);
+    dst += size;
+  }
+}
+
+VulkanContext::VulkanContext(GLFWwindow *window, const char *name,
+                             const struct RendererDefault &defaults)
+    : window(window), appName(name), defaults(defaults) {
+  createInstance();
+  setupDebugger();
+  createSurfaceKHR();
   pickPhysicalDevice();
   createLogicalDevice();
 #ifdef MAI_USE_VMA
@@ -2127,6 +2858,41 @@ VulkanContext::VulkanContext(GLFWwindow *window, const char *name,
 
   createCommandPool();
   createCommandBuffer();
+  createTimestampPool();
+  createPipelineCache();
+  createFrameStaging();
+  uploads = new UploadManager(this, defaults.uploadStagingSize);
+
+  if (defaults.defaultDescriptorPool) {
+    createDescriptorPool();
+    createDescriptorSetLayout();
+    createDescriptorSets();
+  }
+}
+
+VulkanContext::VulkanContext(const struct WindowInfo &info,
+                             const struct RendererDefault &defaults)
+    : appName(info.appName), headless(true), defaults(defaults) {
+  swapChainExtent = {info.width, info.height};
+
+  createInstance();
+  setupDebugger();
+  pickPhysicalDevice();
+  createLogicalDevice();
+#ifdef MAI_USE_VMA
+  createVmaAllocation();
+#endif
+
+  createOffscreenImages();
+
+  createSyncObj();
+
+  createCommandPool();
+  createCommandBuffer();
+  createTimestampPool();
+  createPipelineCache();
+  createFrameStaging();
+  uploads = new UploadManager(this, defaults.uploadStagingSize);
 
   if (defaults.defaultDescriptorPool) {
     createDescriptorPool();
@@ -2147,7 +2913,7 @@ void VulkanContext::createInstance() {
   if (enableValidation && !checkValidation())
     throw std::runtime_error("validation layer requested but not available");
 
-  auto extensions = getRequiredExtensions();
+  auto extensions = getRequiredExtensions(headless);
 
   VkInstanceCreateInfo createInfo{
       .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -2198,8 +2964,13 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
         (queueFamilyProperties[i].queueFlags & VK_QUEUE_COMPUTE_BIT))
       indices.graphcisFamily = i;
 
+    // without a surface there is nothing to present to, the graphics queue
+    // doubles as the present queue
     VkBool32 supported = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &supported);
+    if (surface == VK_NULL_HANDLE)
+      supported = indices.graphcisFamily.has_value();
+    else
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &supported);
 
     if (supported)
       indices.presentFamily = i;
@@ -2208,6 +2979,26 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device,
       break;
   }
 
+  // a family without graphics is usually a DMA engine that copies while the
+  // graphics queue renders. It has to copy whole mip levels, so any image
+  // transfer granularity but 1x1x1 rules it out
+  int transferScore = 0;
+  for (uint32_t i = 0; i < queueFamiliesCount; i++) {
+    const VkQueueFamilyProperties &family = queueFamilyProperties[i];
+    const VkExtent3D &granularity = family.minImageTransferGranularity;
+    if (!(family.queueFlags & VK_QUEUE_TRANSFER_BIT) ||
+        (family.queueFlags & VK_QUEUE_GRAPHICS_BIT) || granularity.width != 1 ||
+        granularity.height != 1 || granularity.depth != 1)
+      continue;
+    const int score = family.queueFlags & VK_QUEUE_COMPUTE_BIT ? 1 : 2;
+    if (score > transferScore) {
+      transferScore = score;
+      indices.transferFamily = i;
+    }
+  }
+  if (!indices.transferFamily.has_value())
+    indices.transferFamily = indices.graphcisFamily;
+
   return indices;
 }
 
@@ -2217,7 +3008,8 @@ void VulkanContext::createSurfaceKHR() {
     throw std::runtime_error("failed to create window surface");
 }
 
-bool isDeviceSuitable(VkPhysicalDevice device) {
+bool isDeviceSuitable(VkPhysicalDevice device,
+                      const std::vector<const char *> &deviceExtensions) {
   uint32_t extensionCount;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        nullptr);
@@ -2255,7 +3047,8 @@ void VulkanContext::pickPhysicalDevice() {
   vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
 
   for (uint32_t i = 0; i < deviceCount; i++)
-    if (isDeviceSuitable(devices[i])) {
+    if (isDeviceSuitable(devices[i], headless ? headlessDeviceExtensions
+                                              : deviceExtensions)) {
       physicalDevice = devices[i];
       break;
     }
@@ -2268,7 +3061,8 @@ void VulkanContext::createLogicalDevice() {
   indices = findQueueFamilies(physicalDevice, surface);
 
   std::set<uint32_t> uniqueQueueFamilies = {indices.graphcisFamily.value(),
-                                            indices.presentFamily.value()};
+                                            indices.presentFamily.value(),
+                                            indices.transferFamily.value()};
   std::vector<VkDeviceQueueCreateInfo> deviceQueueInfos;
   float queuePriority = 0.5f;
 
@@ -2280,33 +3074,41 @@ void VulkanContext::createLogicalDevice() {
         .pQueuePriorities = &queuePriority,
     });
 
-  VkPhysicalDeviceBufferDeviceAddressFeatures bda{
-      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
-      .bufferDeviceAddress = VK_TRUE,
-  };
-
-  VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{
-      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
-      .pNext = &bda,
+  // the 1.2 feature struct can't be chained together with the per extension
+  // ones it replaces
+  VkPhysicalDeviceVulkan12Features vulkan12Features{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .drawIndirectCount = VK_TRUE,
+      .descriptorIndexing = VK_TRUE,
       .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
       .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
       .descriptorBindingPartiallyBound = VK_TRUE,
       .descriptorBindingVariableDescriptorCount = VK_TRUE,
       .runtimeDescriptorArray = VK_TRUE,
+      .scalarBlockLayout = VK_TRUE,
+      .timelineSemaphore = VK_TRUE,
+      .bufferDeviceAddress = VK_TRUE,
   };
 
+  VkPhysicalDeviceFeatures supported;
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supported);
+  textureCompressionBC = supported.textureCompressionBC == VK_TRUE;
+
   VkPhysicalDeviceFeatures deviceFeatures{
       .geometryShader = VK_TRUE,
       .tessellationShader = VK_TRUE,
+      .multiDrawIndirect = VK_TRUE,
+      .drawIndirectFirstInstance = VK_TRUE,
       .depthBiasClamp = VK_TRUE,
       .fillModeNonSolid = VK_TRUE,
       .samplerAnisotropy = VK_TRUE,
+      .textureCompressionBC = supported.textureCompressionBC,
   };
 
   VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatues = {
       .sType =
           VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
-      .pNext = &indexingFeatures,
+      .pNext = &vulkan12Features,
       .extendedDynamicState = true,
   };
 
@@ -2323,13 +3125,16 @@ void VulkanContext::createLogicalDevice() {
       .features = deviceFeatures,
   };
 
+  const std::vector<const char *> &extensions =
+      headless ? headlessDeviceExtensions : deviceExtensions;
+
   VkDeviceCreateInfo createInfo{
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
       .pNext = &deviceFeatures2,
       .queueCreateInfoCount = static_cast<uint32_t>(deviceQueueInfos.size()),
       .pQueueCreateInfos = deviceQueueInfos.data(),
-      .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
-      .ppEnabledExtensionNames = deviceExtensions.data(),
+      .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
+      .ppEnabledExtensionNames = extensions.data(),
   };
 
   if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) !=
@@ -2338,6 +3143,7 @@ void VulkanContext::createLogicalDevice() {
 
   vkGetDeviceQueue(device, indices.graphcisFamily.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
 }
 
 #ifdef MAI_USE_VMA
@@ -2437,6 +3243,51 @@ void VulkanContext::cleanupSwapChain() {
   vkDestroySwapchainKHR(device, swapChain, nullptr);
 }
 
+void VulkanContext::createOffscreenImages() {
+  swapChainFormat = VK_FORMAT_R8G8B8A8_SRGB;
+  swapChainColoSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+  minImageCount = MAX_FRAMES_IN_FLIGHT;
+
+  // one color target per frame in flight, so a frame can be read back while
+  // the next one is recorded
+  swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+#ifdef MAI_USE_VMA
+  offscreenAllocations.resize(MAX_FRAMES_IN_FLIGHT);
+#else
+  offscreenMemory.resize(MAX_FRAMES_IN_FLIGHT);
+#endif
+
+  for (size_t i = 0; i < swapChainImages.size(); i++)
+    createImage(
+        {
+            .type = VK_IMAGE_TYPE_2D,
+            .extent = {swapChainExtent.width, swapChainExtent.height, 1},
+            .format = swapChainFormat,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        },
+#ifdef MAI_USE_VMA
+        swapChainImages[i], offscreenAllocations[i]);
+#else
+        swapChainImages[i], offscreenMemory[i]);
+#endif
+
+  createSwapChainImageViews();
+}
+
+void VulkanContext::cleanupOffscreenImages() {
+  for (size_t i = 0; i < swapChainImages.size(); i++) {
+    vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+#ifdef MAI_USE_VMA
+    vmaDestroyImage(allocator, swapChainImages[i], offscreenAllocations[i]);
+#else
+    vkDestroyImage(device, swapChainImages[i], nullptr);
+    vkFreeMemory(device, offscreenMemory[i], nullptr);
+#endif
+  }
+}
+
 void VulkanContext::recreateSwapChain() {
   vkDeviceWaitIdle(device);
   cleanupSwapChain();
@@ -2497,6 +3348,78 @@ void VulkanContext::createCommandBuffer() {
     throw std::runtime_error("failed to allocate command buffer");
 }
 
+void VulkanContext::createTimestampPool() {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  uint32_t queueFamiliesCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamiliesCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilyProperties(
+      queueFamiliesCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamiliesCount,
+                                           queueFamilyProperties.data());
+
+  if (!properties.limits.timestampComputeAndGraphics ||
+      queueFamilyProperties[indices.graphcisFamily.value()]
+              .timestampValidBits == 0) {
+    std::cerr << "timestamp queries are not supported, gpu timings disabled"
+              << std::endl;
+    return;
+  }
+
+  timestampPeriod = properties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo poolInfo{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = MAX_FRAMES_IN_FLIGHT * MAX_GPU_ZONES * 2,
+  };
+
+  if (vkCreateQueryPool(device, &poolInfo, nullptr, &timestampPool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create timestamp query pool");
+}
+
+void VulkanContext::beginGpuZone(const char *name) {
+  std::vector<GpuZoneRecord> &zones = gpuZones[frameIndex];
+  if (zones.size() == MAX_GPU_ZONES) {
+    // out of queries, keep the stack balanced but don't time it
+    gpuZoneStack.push_back(UINT32_MAX);
+    return;
+  }
+
+  const uint32_t query =
+      frameIndex * MAX_GPU_ZONES * 2 + static_cast<uint32_t>(zones.size()) * 2;
+  zones.emplace_back(GpuZoneRecord{
+      .name = name,
+      .depth = static_cast<uint32_t>(gpuZoneStack.size()),
+      .query = query,
+  });
+  gpuZoneStack.push_back(query);
+
+  vkCmdWriteTimestamp2(commandBuffers[frameIndex],
+                       VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, timestampPool,
+                       query);
+}
+
+void VulkanContext::endGpuZone() {
+  if (gpuZoneStack.empty()) {
+    std::cerr << "endGpuZone without a matching beginGpuZone" << std::endl;
+    assert(false);
+    return;
+  }
+
+  const uint32_t query = gpuZoneStack.back();
+  gpuZoneStack.pop_back();
+  if (query == UINT32_MAX)
+    return;
+
+  vkCmdWriteTimestamp2(commandBuffers[frameIndex],
+                       VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, timestampPool,
+                       query + 1);
+}
+
 void VulkanContext::createDescriptorPool() {
   VkDescriptorPoolSize poolSize[] = {
       {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT},
@@ -2598,6 +3521,30 @@ void VulkanContext::createDescriptorSets() {
   if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) !=
       VK_SUCCESS)
     throw std::runtime_error("failed to allocate descriptor set");
+
+  // texture indices start at 1, slot 0 holds a trilinear repeat sampler
+  createSampler(
+      {
+          .minFilter = MAI::Linear,
+          .magFilter = MAI::Linear,
+          .mipMap = SamplerMipmap::Mode_Linear,
+      },
+      defaultSampler);
+  const VkDescriptorImageInfo samplerInfo{
+      .sampler = defaultSampler,
+  };
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    const VkWriteDescriptorSet write{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSets[i],
+        .dstBinding = 1,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .pImageInfo = &samplerInfo,
+    };
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
 }
 
 uint32_t VulkanContext::findMemoryType(uint32_t typeFilter,
@@ -2633,8 +3580,21 @@ VkCommandBuffer VulkanContext::beginSingleCommandBuffer() {
 
 void VulkanContext::endSingleCommandBuffer(VkCommandBuffer commandBuffer) {
   vkEndCommandBuffer(commandBuffer);
+  // the commands may touch resources whose uploads are still in flight
+  const uint64_t uploadValue = uploads->flush();
+  VkSemaphore uploadTimeline = uploads->getTimeline();
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkTimelineSemaphoreSubmitInfo timelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .waitSemaphoreValueCount = 1,
+      .pWaitSemaphoreValues = &uploadValue,
+  };
   VkSubmitInfo submitInfo{
       .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = &timelineInfo,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &uploadTimeline,
+      .pWaitDstStageMask = &waitStage,
       .commandBufferCount = 1,
       .pCommandBuffers = &commandBuffer,
   };
@@ -2648,7 +3608,8 @@ void VulkanContext::endSingleCommandBuffer(VkCommandBuffer commandBuffer) {
 void VulkanContext::transitionImageLayout(VkImage image, VkFormat format,
                                           VkImageLayout oldLayout,
                                           VkImageLayout newLayout,
-                                          uint32_t layerCount) {
+                                          uint32_t layerCount,
+                                          uint32_t levelCount) {
   VkCommandBuffer commandBuffer = beginSingleCommandBuffer();
   VkImageMemoryBarrier barrier = {
       .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
@@ -2661,7 +3622,7 @@ void VulkanContext::transitionImageLayout(VkImage image, VkFormat format,
           {
               .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
               .baseMipLevel = 0,
-              .levelCount = 1,
+              .levelCount = levelCount,
               .baseArrayLayer = 0,
               .layerCount = layerCount,
           },
@@ -2694,54 +3655,132 @@ void VulkanContext::transitionImageLayout(VkImage image, VkFormat format,
   endSingleCommandBuffer(commandBuffer);
 }
 
-void VulkanContext::copyBuffeToImage(VkBuffer buffer, VkImage image,
-                                     uint32_t width, uint32_t height,
-                                     bool isCube) {
+void VulkanContext::recordCopyBufferToImage(
+    VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize bufferOffset,
+    VkImage image, TextureFormat format, uint32_t width, uint32_t height,
+    uint32_t layerCount, uint32_t levelCount) {
+  std::vector<VkBufferImageCopy> regions;
+  VkDeviceSize offset = bufferOffset;
+  for (uint32_t level = 0; level < levelCount; level++) {
+    const uint32_t levelWidth = std::max(1u, width >> level);
+    const uint32_t levelHeight = std::max(1u, height >> level);
+    const VkDeviceSize layerSize =
+        getTextureSize(format, levelWidth, levelHeight);
+    for (uint32_t layer = 0; layer < layerCount; layer++) {
+      regions.emplace_back(VkBufferImageCopy{
+          .bufferOffset = offset,
+          .bufferRowLength = 0,
+          .bufferImageHeight = 0,
+          .imageSubresource =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .mipLevel = level,
+                  .baseArrayLayer = layer,
+                  .layerCount = 1,
+              },
+          .imageOffset = {0, 0, 0},
+          .imageExtent = {levelWidth, levelHeight, 1},
+      });
+      offset += layerSize;
+    }
+  }
 
-  VkCommandBuffer commandBuffer = beginSingleCommandBuffer();
+  vkCmdCopyBufferToImage(commandBuffer, buffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(regions.size()),
+                         regions.data());
+}
+
+VkFilter VulkanContext::getMipmapFilter(VkFormat format) {
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+  const VkFormatFeatureFlags blitBits =
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+  if ((properties.optimalTilingFeatures & blitBits) != blitBits)
+    throw std::runtime_error("image format can't be blitted into mipmaps");
+  // 32 bit float formats don't have to support linear filtering
+  return properties.optimalTilingFeatures &
+                 VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+             ? VK_FILTER_LINEAR
+             : VK_FILTER_NEAREST;
+}
+
+void VulkanContext::recordMipmaps(VkCommandBuffer commandBuffer, VkImage image,
+                                  VkFilter filter, uint32_t width,
+                                  uint32_t height, uint32_t layerCount,
+                                  uint32_t levelCount) {
+  VkImageMemoryBarrier barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = image,
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .levelCount = 1,
+              .baseArrayLayer = 0,
+              .layerCount = layerCount,
+          },
+  };
 
-  if (!isCube) {
-    VkBufferImageCopy region{
-        .bufferOffset = 0,
-        .bufferRowLength = 0,
-        .bufferImageHeight = 0,
-        .imageSubresource =
+  int32_t mipWidth = static_cast<int32_t>(width);
+  int32_t mipHeight = static_cast<int32_t>(height);
+  for (uint32_t level = 1; level < levelCount; level++) {
+    // the previous level is complete, read it for this one
+    barrier.subresourceRange.baseMipLevel = level - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    const int32_t nextWidth = std::max(1, mipWidth / 2);
+    const int32_t nextHeight = std::max(1, mipHeight / 2);
+    VkImageBlit blit = {
+        .srcSubresource =
             {
                 .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .mipLevel = 0,
+                .mipLevel = level - 1,
                 .baseArrayLayer = 0,
-                .layerCount = 1,
+                .layerCount = layerCount,
             },
-        .imageOffset = {0, 0, 0},
-        .imageExtent = {width, height, 1},
+        .srcOffsets = {{0, 0, 0}, {mipWidth, mipHeight, 1}},
+        .dstSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = layerCount,
+            },
+        .dstOffsets = {{0, 0, 0}, {nextWidth, nextHeight, 1}},
     };
+    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   filter);
 
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  } else {
-    std::array<VkBufferImageCopy, 6> regions{};
-    VkDeviceSize faceSize = width * height * 4 * sizeof(float);
-    for (uint32_t face = 0; face < 6; face++) {
-      regions[face].bufferOffset = face * faceSize;
-      regions[face].bufferRowLength = 0;
-      regions[face].bufferImageHeight = 0;
-
-      regions[face].imageSubresource = {
-          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-          .mipLevel = 0,
-          .baseArrayLayer = face,
-          .layerCount = 1,
-      };
-      regions[face].imageOffset = {0, 0, 0};
-      regions[face].imageExtent = {width, height, 1};
-    }
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
 
-    vkCmdCopyBufferToImage(
-        commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        static_cast<uint32_t>(regions.size()), regions.data());
+    mipWidth = nextWidth;
+    mipHeight = nextHeight;
   }
 
-  endSingleCommandBuffer(commandBuffer);
+  // the last level was only ever written
+  barrier.subresourceRange.baseMipLevel = levelCount - 1;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
 }
 
 void VulkanContext::copyBuffeToImage(VkBuffer buffer, VkImage image,
@@ -2890,7 +3929,7 @@ VulkanContext::createPipelineLayout(uint32_t pushConstantSize,
 VkPipeline
 VulkanContext::createGraphicePipeline(VkGraphicsPipelineCreateInfo &info) {
   VkPipeline pipeline;
-  if (vkCreateGraphicsPipelines(device, nullptr, 1, &info, nullptr,
+  if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &info, nullptr,
                                 &pipeline) != VK_SUCCESS)
     throw std::runtime_error("failed to create graphics pipeline");
 
@@ -2918,38 +3957,13 @@ void VulkanContext::createBuffer(const struct BufferDesc &info,
                       &allocation, &allocInfo) != VK_SUCCESS)
     throw std::runtime_error("failed to create buffer usage");
 }
-void VulkanContext::updateBuffer(VkBufferUsageFlags usage, VkBuffer &buffer,
-                                 VmaAllocation &alloc, size_t size,
+void VulkanContext::updateBuffer(VmaAllocation &alloc, size_t size,
                                  const void *data) {
   if (!data)
     throw std::runtime_error("buffer data is empty");
 
-  if (usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
-    if (vmaCopyMemoryToAllocation(allocator, data, alloc, 0, size) !=
-        VK_SUCCESS)
-      throw std::runtime_error("failed to update host visible buffer");
-  } else if (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) {
-    BufferDesc bufferInfo{
-        .size = size,
-        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        .allocflags =
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_ALLOW_TRANSFER_INSTEAD_BIT |
-            VMA_ALLOCATION_CREATE_MAPPED_BIT,
-        .memoryUsage = VMA_MEMORY_USAGE_AUTO,
-    };
-
-    VkBuffer stagingBuf;
-    VmaAllocation stagingAlloc;
-    VmaAllocationInfo stagingAllocInfo;
-    createBuffer(bufferInfo, stagingBuf, stagingAlloc, stagingAllocInfo);
-
-    vmaCopyMemoryToAllocation(allocator, data, stagingAlloc, 0, size);
-
-    copyBuffer(stagingBuf, buffer, size);
-
-    vmaDestroyBuffer(allocator, stagingBuf, stagingAlloc);
-  }
+  if (vmaCopyMemoryToAllocation(allocator, data, alloc, 0, size) != VK_SUCCESS)
+    throw std::runtime_error("failed to update host visible buffer");
 }
 
 void VulkanContext::createImage(const struct ImageDesc &info, VkImage &image,
@@ -3019,35 +4033,17 @@ void VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
   vkBindBufferMemory(device, buffer, bufferMemory, 0);
 }
 
-void VulkanContext::updateBuffer(VkBufferUsageFlags usage, VkBuffer &buffer,
-                                 VkDeviceMemory &deviceMemory, size_t size,
+void VulkanContext::updateBuffer(VkDeviceMemory &deviceMemory, size_t size,
                                  const void *bufferData) {
 
   if (!bufferData)
     throw std::runtime_error("buffer data is empty");
 
-  if (usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
-    void *data;
-    vkMapMemory(device, deviceMemory, 0, size, 0, &data);
-    memcpy(data, bufferData, static_cast<size_t>(size));
-    vkUnmapMemory(device, deviceMemory);
-  } else if (VK_BUFFER_USAGE_TRANSFER_DST_BIT) {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                 stagingBuffer, stagingMemory);
-    void *data;
-    vkMapMemory(device, stagingMemory, 0, size, 0, &data);
-    memcpy(data, bufferData, static_cast<size_t>(size));
-    vkUnmapMemory(device, stagingMemory);
-
-    copyBuffer(stagingBuffer, buffer, size);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingMemory, nullptr);
-  }
+  void *data;
+  if (vkMapMemory(device, deviceMemory, 0, size, 0, &data) != VK_SUCCESS)
+    throw std::runtime_error("failed to map host visible buffer");
+  memcpy(data, bufferData, static_cast<size_t>(size));
+  vkUnmapMemory(device, deviceMemory);
 }
 
 void VulkanContext::createImage(const struct ImageDesc &info, VkImage &image,
@@ -3098,7 +4094,7 @@ void VulkanContext::createImageView(const struct ImageViewDesc &info,
           {
               .aspectMask = info.aspect,
               .baseMipLevel = 0,
-              .levelCount = 1,
+              .levelCount = info.levelCount,
               .baseArrayLayer = 0,
               .layerCount = info.layerCount,
           },
@@ -3125,6 +4121,7 @@ void VulkanContext::createSampler(const struct SamplerDesc &samplerInfo,
       .anisotropyEnable = VK_TRUE,
       .maxAnisotropy = properties.limits.maxSamplerAnisotropy,
       .compareOp = getCompareOp(samplerInfo.depthCompareOp),
+      .maxLod = samplerInfo.maxLod,
   };
   samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
   samplerCreateInfo.compareEnable = samplerInfo.depthCompareEnabled;
@@ -3147,13 +4144,627 @@ void VulkanContext::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer,
   endSingleCommandBuffer(commandBuffer);
 }
 
+StagingBuffer VulkanContext::createStagingBuffer(VkDeviceSize size) {
+  StagingBuffer staging;
+#ifdef MAI_USE_VMA
+  VmaAllocationInfo allocInfo;
+  createBuffer(
+      {
+          .size = size,
+          .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+          .allocflags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+                        VMA_ALLOCATION_CREATE_MAPPED_BIT,
+          .memoryUsage = VMA_MEMORY_USAGE_AUTO,
+      },
+      staging.buffer, staging.allocation, allocInfo);
+  staging.mapped = static_cast<uint8_t *>(allocInfo.pMappedData);
+#else
+  createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               staging.buffer, staging.memory);
+  void *data;
+  vkMapMemory(device, staging.memory, 0, size, 0, &data);
+  staging.mapped = static_cast<uint8_t *>(data);
+#endif
+  return staging;
+}
+
+void VulkanContext::destroyStagingBuffer(StagingBuffer &staging) {
+#ifdef MAI_USE_VMA
+  vmaDestroyBuffer(allocator, staging.buffer, staging.allocation);
+#else
+  vkDestroyBuffer(device, staging.buffer, nullptr);
+  vkFreeMemory(device, staging.memory, nullptr);
+#endif
+  staging = {};
+}
+
+void VulkanContext::flushStagingBuffer(const StagingBuffer &staging,
+                                       VkDeviceSize offset, VkDeviceSize size) {
+#ifdef MAI_USE_VMA
+  // no-op unless VMA picked non coherent memory
+  vmaFlushAllocation(allocator, staging.allocation, offset, size);
+#endif
+}
+
+void VulkanContext::createPipelineCache() {
+  if (!defaults.enablePipelineCache)
+    return;
+
+  std::vector<char> data;
+  if (defaults.pipelineCachePath) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    data = readPipelineCacheFile(defaults.pipelineCachePath, properties);
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = data.size(),
+      .pInitialData = data.empty() ? nullptr : data.data(),
+  };
+  if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create pipeline cache");
+}
+
+void VulkanContext::savePipelineCache() {
+  if (pipelineCache == VK_NULL_HANDLE || !defaults.pipelineCachePath)
+    return;
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) !=
+      VK_SUCCESS)
+    return;
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) !=
+      VK_SUCCESS)
+    return;
+  data.resize(size);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  const PipelineCacheFileHeader header{
+      .magic = PIPELINE_CACHE_MAGIC,
+      .driverVersion = properties.driverVersion,
+      .dataSize = data.size(),
+      .dataHash = hashPipelineCacheData(data.data(), data.size()),
+  };
+
+  // written next to it and renamed, a crash can't leave half a cache
+  const std::string path = defaults.pipelineCachePath;
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(data.data(), data.size());
+    if (!file) {
+      std::cerr << "failed to write pipeline cache " << tmpPath << std::endl;
+      return;
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    std::cerr << "failed to write pipeline cache " << path << std::endl;
+}
+
+void VulkanContext::createFrameStaging() {
+  frameStagingSize = defaults.frameStagingSize;
+  frameStaging = createStagingBuffer(frameStagingSize * MAX_FRAMES_IN_FLIGHT);
+
+  updateCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+  VkCommandBufferAllocateInfo allocInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = commandPool,
+      .commandBufferCount = MAX_FRAMES_IN_FLIGHT,
+  };
+  if (vkAllocateCommandBuffers(device, &allocInfo,
+                               updateCommandBuffers.data()) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate update command buffer");
+}
+
+StagingBuffer VulkanContext::allocateFrameStaging(VkDeviceSize size,
+                                                  VkDeviceSize &offset) {
+  const VkDeviceSize start =
+      (frameStagingOffset + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1);
+  if (start + size > frameStagingSize) {
+    frameStagingOverflow[frameIndex].push_back(createStagingBuffer(size));
+    offset = 0;
+    return frameStagingOverflow[frameIndex].back();
+  }
+  frameStagingOffset = start + size;
+  offset = frameIndex * frameStagingSize + start;
+  return frameStaging;
+}
+
+VkCommandBuffer VulkanContext::getUpdateCommandBuffer() {
+  VkCommandBuffer commandBuffer = updateCommandBuffers[frameIndex];
+  if (updatesRecorded)
+    return commandBuffer;
+
+  VkCommandBufferBeginInfo beginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to begin update command buffer");
+  // earlier frames may still use what gets overwritten
+  recordBarrier(commandBuffer,
+                VkMemoryBarrier2{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                    .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+                    .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+                    .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                });
+  updatesRecorded = true;
+  return commandBuffer;
+}
+
+VkCommandBuffer VulkanContext::endUpdateCommandBuffer() {
+  if (!updatesRecorded)
+    return VK_NULL_HANDLE;
+
+  VkCommandBuffer commandBuffer = updateCommandBuffers[frameIndex];
+  recordBarrier(commandBuffer,
+                VkMemoryBarrier2{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+                    .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+                    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                    .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT |
+                                     VK_ACCESS_2_MEMORY_WRITE_BIT,
+                });
+  vkEndCommandBuffer(commandBuffer);
+  updatesRecorded = false;
+  return commandBuffer;
+}
+
+VkSemaphore createTimelineSemaphore(VkDevice device) {
+  VkSemaphoreTypeCreateInfo typeInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo semaphoreInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeInfo,
+  };
+  VkSemaphore semaphore;
+  if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create timeline semaphore");
+  return semaphore;
+}
+
+void waitTimelineSemaphore(VkDevice device, VkSemaphore semaphore,
+                           uint64_t value) {
+  VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &semaphore,
+      .pValues = &value,
+  };
+  if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+    throw std::runtime_error("failed to wait for timeline semaphore");
+}
+
+VkCommandPool createUploadCommandPool(VkDevice device, uint32_t family) {
+  VkCommandPoolCreateInfo poolInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = family,
+  };
+  VkCommandPool pool;
+  if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create upload command pool");
+  return pool;
+}
+
+VkCommandBuffer beginUploadCommandBuffer(VkDevice device, VkCommandPool pool) {
+  VkCommandBufferAllocateInfo allocInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+  };
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to allocate upload command buffer");
+
+  VkCommandBufferBeginInfo beginInfo{
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  return commandBuffer;
+}
+
+void recordBarrier(VkCommandBuffer commandBuffer,
+                   const VkMemoryBarrier2 &barrier) {
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+}
+
+void recordBarrier(VkCommandBuffer commandBuffer,
+                   const VkBufferMemoryBarrier2 &barrier) {
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .bufferMemoryBarrierCount = 1,
+      .pBufferMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+}
+
+void recordBarrier(VkCommandBuffer commandBuffer,
+                   const VkImageMemoryBarrier2 &barrier) {
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+}
+
+UploadManager::UploadManager(VulkanContext *ctx, VkDeviceSize stagingSize)
+    : ctx(ctx), ringSize(stagingSize) {
+  graphicsPool = createUploadCommandPool(ctx->device,
+                                         ctx->indices.graphcisFamily.value());
+  if (ctx->indices.transferFamily != ctx->indices.graphcisFamily) {
+    transferPool = createUploadCommandPool(
+        ctx->device, ctx->indices.transferFamily.value());
+    transferTimeline = createTimelineSemaphore(ctx->device);
+  }
+  uploadTimeline = createTimelineSemaphore(ctx->device);
+  ring = ctx->createStagingBuffer(ringSize);
+}
+
+UploadManager::~UploadManager() {
+  std::lock_guard<std::mutex> lock(mutex);
+  // a batch that was never flushed was never needed, the resources it
+  // copies into may already be gone
+  for (StagingBuffer &staging : recording.dedicated)
+    ctx->destroyStagingBuffer(staging);
+  recording = {};
+
+  if (submittedValue)
+    waitTimelineSemaphore(ctx->device, uploadTimeline, submittedValue);
+  retireBatches();
+
+  ctx->destroyStagingBuffer(ring);
+  vkDestroySemaphore(ctx->device, uploadTimeline, nullptr);
+  if (separateTransfer()) {
+    vkDestroySemaphore(ctx->device, transferTimeline, nullptr);
+    vkDestroyCommandPool(ctx->device, transferPool, nullptr);
+  }
+  vkDestroyCommandPool(ctx->device, graphicsPool, nullptr);
+}
+
+UploadTicket UploadManager::uploadBuffer(VkBuffer buffer, const void *data,
+                                         VkDeviceSize size,
+                                         VkDeviceSize dstOffset) {
+  MAI_VK_PROFILE_SCOPE("UploadManager::uploadBuffer");
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize offset;
+  const StagingBuffer staging = reserve(size, offset);
+  memcpy(staging.mapped + offset, data, static_cast<size_t>(size));
+  ctx->flushStagingBuffer(staging, offset, size);
+
+  Batch &batch = openBatch();
+  VkBufferCopy region = {
+      .srcOffset = offset,
+      .dstOffset = dstOffset,
+      .size = size,
+  };
+  if (!separateTransfer()) {
+    vkCmdCopyBuffer(batch.graphicsCmd, staging.buffer, buffer, 1, &region);
+    return {batch.value};
+  }
+
+  vkCmdCopyBuffer(batch.transferCmd, staging.buffer, buffer, 1, &region);
+  // released by the transfer queue, acquired by the graphics queue
+  VkBufferMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .srcQueueFamilyIndex = ctx->indices.transferFamily.value(),
+      .dstQueueFamilyIndex = ctx->indices.graphcisFamily.value(),
+      .buffer = buffer,
+      .offset = dstOffset,
+      .size = size,
+  };
+  recordBarrier(batch.transferCmd, barrier);
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.srcAccessMask = VK_ACCESS_2_NONE;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+  recordBarrier(batch.graphicsCmd, barrier);
+  return {batch.value};
+}
+
+UploadTicket UploadManager::uploadImage(VkImage image, VkFormat format,
+                                        const struct TextureInfo &info,
+                                        uint32_t layerCount,
+                                        uint32_t mipLevels) {
+  MAI_VK_PROFILE_SCOPE("UploadManager::uploadImage");
+  const uint32_t width = info.dimensions.width;
+  const uint32_t height = info.dimensions.height;
+  const bool blitMips = mipLevels > 1 && !info.mipData;
+  const uint32_t uploadLevels = info.mipData ? mipLevels : 1;
+  // throws before anything is recorded
+  const VkFilter filter =
+      blitMips ? ctx->getMipmapFilter(format) : VK_FILTER_LINEAR;
+
+  VkDeviceSize size = 0;
+  for (uint32_t level = 0; level < uploadLevels; level++)
+    size += getTextureSize(info.format, std::max(1u, width >> level),
+                           std::max(1u, height >> level)) *
+            layerCount;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize offset;
+  const StagingBuffer staging = reserve(size, offset);
+  copyTextureLevels(staging.mapped + offset, info, layerCount, uploadLevels);
+  ctx->flushStagingBuffer(staging, offset, size);
+
+  Batch &batch = openBatch();
+  VkCommandBuffer copyCmd =
+      separateTransfer() ? batch.transferCmd : batch.graphicsCmd;
+  VkImageMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+      .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = image,
+      .subresourceRange =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .baseMipLevel = 0,
+              .levelCount = mipLevels,
+              .baseArrayLayer = 0,
+              .layerCount = layerCount,
+          },
+  };
+  recordBarrier(copyCmd, barrier);
+  ctx->recordCopyBufferToImage(copyCmd, staging.buffer, offset, image,
+                               info.format, width, height, layerCount,
+                               uploadLevels);
+
+  // blits need the graphics queue, the chain stays TRANSFER_DST for them
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+  barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = blitMips ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+                               : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  if (separateTransfer()) {
+    // released by the transfer queue, the acquire below repeats the layouts
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.dstAccessMask = VK_ACCESS_2_NONE;
+    barrier.srcQueueFamilyIndex = ctx->indices.transferFamily.value();
+    barrier.dstQueueFamilyIndex = ctx->indices.graphcisFamily.value();
+    recordBarrier(batch.transferCmd, barrier);
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+  }
+  if (separateTransfer() || !blitMips) {
+    barrier.dstStageMask = blitMips ? VK_PIPELINE_STAGE_2_BLIT_BIT
+                                    : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = blitMips ? VK_ACCESS_2_TRANSFER_READ_BIT |
+                                           VK_ACCESS_2_TRANSFER_WRITE_BIT
+                                     : VK_ACCESS_2_SHADER_READ_BIT;
+    recordBarrier(batch.graphicsCmd, barrier);
+  }
+  if (blitMips)
+    ctx->recordMipmaps(batch.graphicsCmd, image, filter, width, height,
+                       layerCount, mipLevels);
+  return {batch.value};
+}
+
+uint64_t UploadManager::flush() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (recording.value)
+    submitBatch();
+  retireBatches();
+  return submittedValue;
+}
+
+bool UploadManager::isComplete(UploadTicket ticket) {
+  uint64_t completed;
+  vkGetSemaphoreCounterValue(ctx->device, uploadTimeline, &completed);
+  return completed >= ticket.value;
+}
+
+void UploadManager::wait(UploadTicket ticket) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ticket.value > submittedValue && recording.value)
+      submitBatch();
+  }
+  MAI_VK_PROFILE_SCOPE("wait upload");
+  waitTimelineSemaphore(ctx->device, uploadTimeline, ticket.value);
+}
+
+StagingBuffer UploadManager::reserve(VkDeviceSize size, VkDeviceSize &offset) {
+  retireBatches();
+  if (size > ringSize) {
+    StagingBuffer staging = ctx->createStagingBuffer(size);
+    openBatch().dedicated.push_back(staging);
+    offset = 0;
+    return staging;
+  }
+
+  while (!reserveRing(size, offset)) {
+    // the ring is full, give back the part of the oldest batch
+    MAI_VK_PROFILE_SCOPE("wait upload ring");
+    if (recording.usesRing)
+      submitBatch();
+    waitTimelineSemaphore(ctx->device, uploadTimeline, pending.front().value);
+    retireBatches();
+  }
+  Batch &batch = openBatch();
+  batch.usesRing = true;
+  batch.ringEnd = ringHead;
+  return ring;
+}
+
+bool UploadManager::reserveRing(VkDeviceSize size, VkDeviceSize &offset) {
+  const VkDeviceSize start =
+      (ringHead + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1);
+  // head == tail only when the ring is empty, a wrap has to stop short of
+  // the tail to keep it that way
+  if (ringHead >= ringTail) {
+    if (start + size <= ringSize)
+      offset = start;
+    else if (size < ringTail)
+      offset = 0;
+    else
+      return false;
+  } else if (start + size < ringTail)
+    offset = start;
+  else
+    return false;
+
+  ringHead = offset + size;
+  return true;
+}
+
+UploadManager::Batch &UploadManager::openBatch() {
+  if (recording.value)
+    return recording;
+
+  recording.value = nextValue++;
+  recording.graphicsCmd = beginUploadCommandBuffer(ctx->device, graphicsPool);
+  if (separateTransfer())
+    recording.transferCmd =
+        beginUploadCommandBuffer(ctx->device, transferPool);
+  return recording;
+}
+
+void UploadManager::submitBatch() {
+  MAI_VK_PROFILE_SCOPE("UploadManager::submitBatch");
+  VkCommandBufferSubmitInfo transferCmdInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .commandBuffer = recording.transferCmd,
+  };
+  VkSemaphoreSubmitInfo transferSignal = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = transferTimeline,
+      .value = recording.value,
+      .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+  };
+  VkSubmitInfo2 transferSubmit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .commandBufferInfoCount = 1,
+      .pCommandBufferInfos = &transferCmdInfo,
+      .signalSemaphoreInfoCount = 1,
+      .pSignalSemaphoreInfos = &transferSignal,
+  };
+
+  VkCommandBufferSubmitInfo graphicsCmdInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .commandBuffer = recording.graphicsCmd,
+  };
+  VkSemaphoreSubmitInfo uploadSignal = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = uploadTimeline,
+      .value = recording.value,
+      .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+  };
+  VkSubmitInfo2 graphicsSubmit = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .commandBufferInfoCount = 1,
+      .pCommandBufferInfos = &graphicsCmdInfo,
+      .signalSemaphoreInfoCount = 1,
+      .pSignalSemaphoreInfos = &uploadSignal,
+  };
+  if (separateTransfer()) {
+    // the acquire barriers wait for the copies on the transfer queue
+    graphicsSubmit.waitSemaphoreInfoCount = 1;
+    graphicsSubmit.pWaitSemaphoreInfos = &transferSignal;
+    vkEndCommandBuffer(recording.transferCmd);
+  }
+  vkEndCommandBuffer(recording.graphicsCmd);
+
+  {
+    // the transfer queue may be the present queue
+    std::lock_guard<std::mutex> lock(mtx);
+    if (separateTransfer() &&
+        vkQueueSubmit2(ctx->transferQueue, 1, &transferSubmit,
+                       VK_NULL_HANDLE) != VK_SUCCESS)
+      throw std::runtime_error("failed to submit uploads to transfer queue");
+    if (vkQueueSubmit2(ctx->graphicsQueue, 1, &graphicsSubmit,
+                       VK_NULL_HANDLE) != VK_SUCCESS)
+      throw std::runtime_error("failed to submit uploads");
+  }
+
+  submittedValue = recording.value;
+  pending.push_back(std::move(recording));
+  recording = {};
+}
+
+void UploadManager::retireBatches() {
+  uint64_t completed = 0;
+  if (!pending.empty())
+    vkGetSemaphoreCounterValue(ctx->device, uploadTimeline, &completed);
+
+  while (!pending.empty() && pending.front().value <= completed) {
+    Batch &batch = pending.front();
+    vkFreeCommandBuffers(ctx->device, graphicsPool, 1, &batch.graphicsCmd);
+    if (batch.transferCmd != VK_NULL_HANDLE)
+      vkFreeCommandBuffers(ctx->device, transferPool, 1, &batch.transferCmd);
+    for (StagingBuffer &staging : batch.dedicated)
+      ctx->destroyStagingBuffer(staging);
+    if (batch.usesRing)
+      ringTail = batch.ringEnd;
+    pending.pop_front();
+  }
+
+  // nothing lives in the ring, start over at the front of it
+  if (!recording.usesRing &&
+      std::none_of(pending.begin(), pending.end(),
+                   [](const Batch &batch) { return batch.usesRing; }))
+    ringHead = ringTail = 0;
+}
+
 void VulkanContext::acquireSwapChainIndex() {
-  if (vkWaitForFences(device, 1, &drawFences[frameIndex], VK_TRUE,
-                      UINT64_MAX) != VK_SUCCESS)
-    throw std::runtime_error("failed to wait for draw fence");
+  {
+    MAI_VK_PROFILE_SCOPE("wait draw fence");
+    if (vkWaitForFences(device, 1, &drawFences[frameIndex], VK_TRUE,
+                        UINT64_MAX) != VK_SUCCESS)
+      throw std::runtime_error("failed to wait for draw fence");
+  }
 
   vkResetFences(device, 1, &drawFences[frameIndex]);
 
+  // the slot's staging is free again
+  for (StagingBuffer &staging : frameStagingOverflow[frameIndex])
+    destroyStagingBuffer(staging);
+  frameStagingOverflow[frameIndex].clear();
+  frameStagingOffset = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(deletionMutex);
+    frameCount++;
+  }
+  runDeferredDeletes(false);
+
+  if (headless) {
+    imageIndex = frameIndex;
+    return;
+  }
+
+  MAI_VK_PROFILE_SCOPE("vkAcquireNextImageKHR");
   VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
                                           imageAvailableSemaphore[frameIndex],
                                           nullptr, &imageIndex);
@@ -3161,15 +4772,49 @@ void VulkanContext::acquireSwapChainIndex() {
     recreateSwapChain();
 }
 
+void VulkanContext::runDeferredDeletes(bool all) {
+  // destroy runs unlocked, it may queue deletes of its own
+  std::vector<std::function<void()>> ready;
+  {
+    std::lock_guard<std::mutex> lock(deletionMutex);
+    while (!deletionQueue.empty() &&
+           (all || deletionQueue.front().frame + MAX_FRAMES_IN_FLIGHT <=
+                       frameCount)) {
+      ready.emplace_back(std::move(deletionQueue.front().destroy));
+      deletionQueue.pop_front();
+    }
+  }
+  for (std::function<void()> &destroy : ready)
+    destroy();
+}
+
 VulkanContext::~VulkanContext() {
+  if (!deletionQueue.empty()) {
+    vkDeviceWaitIdle(device);
+    runDeferredDeletes(true);
+  }
+  delete uploads;
+  destroyStagingBuffer(frameStaging);
+  for (std::vector<StagingBuffer> &overflow : frameStagingOverflow)
+    for (StagingBuffer &staging : overflow)
+      destroyStagingBuffer(staging);
 
   if (defaults.defaultDescriptorPool) {
+    vkDestroySampler(device, defaultSampler, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
   }
 
   vkDestroyCommandPool(device, commandPool, nullptr);
 
+  if (timestampPool != VK_NULL_HANDLE)
+    vkDestroyQueryPool(device, timestampPool, nullptr);
+
+  if (pipelineCache != VK_NULL_HANDLE) {
+    savePipelineCache();
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+  }
+
   for (size_t i = 0; i != MAX_FRAMES_IN_FLIGHT; i++) {
     vkDestroySemaphore(device, imageAvailableSemaphore[i], nullptr);
     vkDestroyFence(device, drawFences[i], nullptr);
@@ -3178,13 +4823,17 @@ VulkanContext::~VulkanContext() {
   for (size_t i = 0; i != swapChainImages.size(); i++)
     vkDestroySemaphore(device, renderFinishSemaphore[i], nullptr);
 
-  cleanupSwapChain();
+  if (headless)
+    cleanupOffscreenImages();
+  else
+    cleanupSwapChain();
 #ifdef MAI_USE_VMA
   vmaDestroyAllocator(allocator);
 #endif
 
   vkDestroyDevice(device, nullptr);
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  if (surface != VK_NULL_HANDLE)
+    vkDestroySurfaceKHR(instance, surface, nullptr);
   DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 
   vkDestroyInstance(instance, nullptr);
@@ -3209,13 +4858,14 @@ bool checkValidation() {
   return true;
 }
 
-std::vector<const char *> getRequiredExtensions() {
-  uint32_t glfwExtensionsCount = 0;
-  const char **glfwExtensions =
-      glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
-
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionsCount);
+std::vector<const char *> getRequiredExtensions(bool headless) {
+  std::vector<const char *> extensions;
+  if (!headless) {
+    uint32_t glfwExtensionsCount = 0;
+    const char **glfwExtensions =
+        glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionsCount);
+  }
   if (enableValidation)
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
@@ -3349,52 +4999,88 @@ MAI::ShaderStage getShaderStageFromFile(const char *filename) {
   assert(false);
 }
 
-std::string readShaderFile(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (!file) {
-    std::cerr << filename << std::endl;
-    assert(false);
+// appends filename to code a line at a time, stack holds the files being
+// included to catch include cycles
+bool appendShaderFile(const std::string &filename, std::string &code,
+                      std::vector<std::string> &stack,
+                      std::vector<std::string> *includes) {
+  if (std::find(stack.begin(), stack.end(), filename) != stack.end()) {
+    std::cerr << "shader include cycle at " << filename << std::endl;
+    return false;
   }
-  fseek(file, 0L, SEEK_END);
-  const size_t bytesinfile = ftell(file);
-  fseek(file, 0L, SEEK_SET);
-
-  char *buffer = (char *)alloca(bytesinfile + 1);
-  const size_t bytesread = fread(buffer, 1, bytesinfile, file);
-  fclose(file);
-
-  buffer[bytesread] = 0;
-
-  static constexpr unsigned char BOM[] = {0xEF, 0xBB, 0xBF};
-
-  if (bytesread > 3) {
-    if (!memcmp(buffer, BOM, 3))
-      memset(buffer, ' ', 3);
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "can't open shader " << filename << std::endl;
+    return false;
   }
-
-  std::string code(buffer);
-
-  while (code.find("#include ") != code.npos) {
-    const auto pos = code.find("#include ");
-    const auto p1 = code.find('<', pos);
-    const auto p2 = code.find('>', pos);
-    if (p1 == code.npos || p2 == code.npos || p2 <= p1) {
-      assert(false);
-      return std::string();
+  stack.emplace_back(filename);
+
+  const std::string dir = filename.substr(0, filename.find_last_of("/\\") + 1);
+  static constexpr char BOM[] = "\xEF\xBB\xBF";
+  std::string line;
+  bool first = true;
+  while (std::getline(file, line)) {
+    if (first && line.compare(0, 3, BOM) == 0)
+      line.replace(0, 3, "   ");
+    first = false;
+
+    const size_t pos = line.find_first_not_of(" \t");
+    if (pos == line.npos || line.compare(pos, 9, "#include ") != 0) {
+      code.append(line).push_back('\n');
+      continue;
     }
-    const std::string name = code.substr(p1 + 1, p2 - p1 - 1);
-    std::string dir = filename;
-    size_t last_dir = dir.find_last_of("/\\");
-    dir = dir.substr(0, last_dir);
-    dir += "/";
-
-    const std::string include = readShaderFile((dir + name).c_str());
-    code.replace(pos, p2 - pos + 1, include.c_str());
+    const size_t p1 = line.find('<', pos);
+    const size_t p2 = line.find('>', pos);
+    if (p1 == line.npos || p2 == line.npos || p2 <= p1) {
+      std::cerr << "bad include in " << filename << ": " << line << std::endl;
+      return false;
+    }
+    const std::string include = dir + line.substr(p1 + 1, p2 - p1 - 1);
+    if (includes &&
+        std::find(includes->begin(), includes->end(), include) ==
+            includes->end())
+      includes->emplace_back(include);
+    if (!appendShaderFile(include, code, stack, includes))
+      return false;
   }
+  stack.pop_back();
+  return true;
+}
 
+std::string readShaderFile(const char *filename,
+                           std::vector<std::string> *includes) {
+  std::string code;
+  std::vector<std::string> stack;
+  if (!appendShaderFile(filename, code, stack, includes))
+    code.clear();
   return code;
 }
 
+VkPhysicalDeviceLimits getMinimumDeviceLimits() {
+  return {
+      .maxUniformBufferRange = 16384,
+      .maxVertexInputAttributes = 16,
+      .maxVertexOutputComponents = 64,
+      .maxTessellationControlPerVertexInputComponents = 64,
+      .maxTessellationControlPerVertexOutputComponents = 64,
+      .maxTessellationEvaluationInputComponents = 64,
+      .maxTessellationEvaluationOutputComponents = 64,
+      .maxGeometryInputComponents = 64,
+      .maxGeometryOutputComponents = 64,
+      .maxGeometryOutputVertices = 256,
+      .maxGeometryTotalOutputComponents = 1024,
+      .maxFragmentInputComponents = 64,
+      .maxComputeWorkGroupCount = {65535, 65535, 65535},
+      .maxComputeWorkGroupSize = {128, 128, 64},
+      .maxViewports = 16,
+      .minTexelOffset = -8,
+      .maxTexelOffset = 7,
+      .maxClipDistances = 8,
+      .maxCullDistances = 8,
+      .maxCombinedClipAndCullDistances = 8,
+  };
+}
+
 std::vector<char> readShaderBinaryFile(const char *filename) {
   std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
@@ -3412,6 +5098,50 @@ std::vector<char> readShaderBinaryFile(const char *filename) {
   return buffer;
 }
 
+uint64_t hashPipelineCacheData(const char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ull;
+  return hash;
+}
+
+std::vector<char>
+readPipelineCacheFile(const char *path,
+                      const VkPhysicalDeviceProperties &properties) {
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file.is_open())
+    return {};
+
+  const size_t fileSize = (size_t)file.tellg();
+  PipelineCacheFileHeader header;
+  if (fileSize < sizeof(header))
+    return {};
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (header.magic != PIPELINE_CACHE_MAGIC ||
+      header.driverVersion != properties.driverVersion ||
+      header.dataSize != fileSize - sizeof(header) ||
+      header.dataSize < sizeof(VkPipelineCacheHeaderVersionOne))
+    return {};
+
+  std::vector<char> data(header.dataSize);
+  file.read(data.data(), data.size());
+  if (!file || hashPipelineCacheData(data.data(), data.size()) !=
+                   header.dataHash)
+    return {};
+
+  // the header the driver wrote, it has to be for this very device
+  VkPipelineCacheHeaderVersionOne driverHeader;
+  memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+  if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      driverHeader.vendorID != properties.vendorID ||
+      driverHeader.deviceID != properties.deviceID ||
+      memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0)
+    return {};
+  return data;
+}
+
 VkShaderStageFlags getShaderStage(MAIFlags stage) {
   VkShaderStageFlags stages = 0;
   if (stage & Vert)
@@ -3557,6 +5287,16 @@ VkFormat getFormat(TextureFormat format) {
     return VK_FORMAT_R8G8B8A8_SRGB;
   case MAI::Format_RGBA_F32:
     return VK_FORMAT_R32G32B32A32_SFLOAT;
+  case MAI::Format_BC7_S:
+    return VK_FORMAT_BC7_SRGB_BLOCK;
+  case MAI::Format_BC5:
+    return VK_FORMAT_BC5_UNORM_BLOCK;
+  case MAI::Format_BC6H_UF:
+    return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+  case MAI::Format_RGBA_F16:
+    return VK_FORMAT_R16G16B16A16_SFLOAT;
+  case MAI::Format_B10G11R11_UF:
+    return VK_FORMAT_B10G11R11_UFLOAT_PACK32;
   }
   assert(false);
 }
@@ -3863,13 +5603,16 @@ glslang_stage_t getGLSLangShaderStage(ShaderStage stage) {
   assert(false);
 }
 
-void compileShaderGlslang(ShaderStage stage, const char *code,
+bool compileShaderGlslang(ShaderStage stage, const char *code,
                           std::vector<uint8_t> *outSPIRV,
                           const glslang_resource_t *glslLangResource) {
   if (!outSPIRV) {
     std::cerr << "outSpriv is null" << std::endl;
     assert(false);
   }
+  // shaders can be compiled on several threads once this ran
+  static std::once_flag glslangProcess;
+  std::call_once(glslangProcess, glslang_initialize_process);
 
   const glslang_input_t input = {
       .language = GLSLANG_SOURCE_GLSL,
@@ -3894,7 +5637,8 @@ void compileShaderGlslang(ShaderStage stage, const char *code,
     printf("  %s\n", glslang_shader_get_info_log(shader));
     printf("  %s\n", glslang_shader_get_info_debug_log(shader));
     std::cout << code << std::endl;
-    assert(false);
+    glslang_shader_delete(shader);
+    return false;
   }
 
   if (!glslang_shader_parse(shader, &input)) {
@@ -3902,7 +5646,8 @@ void compileShaderGlslang(ShaderStage stage, const char *code,
     printf("  %s\n", glslang_shader_get_info_log(shader));
     printf("  %s\n", glslang_shader_get_info_debug_log(shader));
     std::cout << glslang_shader_get_preprocessed_code(shader) << std::endl;
-    assert(false);
+    glslang_shader_delete(shader);
+    return false;
   }
 
   glslang_program_t *program = glslang_program_create();
@@ -3913,7 +5658,9 @@ void compileShaderGlslang(ShaderStage stage, const char *code,
     std::cerr << "Shader linking failed:\n" << std::endl;
     printf("  %s\n", glslang_program_get_info_log(program));
     printf("  %s\n", glslang_program_get_info_debug_log(program));
-    assert(false);
+    glslang_program_delete(program);
+    glslang_shader_delete(shader);
+    return false;
   }
 
   glslang_spv_options_t options = {
@@ -3942,6 +5689,81 @@ void compileShaderGlslang(ShaderStage stage, const char *code,
 
   glslang_program_delete(program);
   glslang_shader_delete(shader);
+  return true;
+}
+
+// bump when the compile options above change, old entries stop matching
+constexpr uint64_t SHADER_CACHE_VERSION = 1;
+
+uint64_t hashShaderSource(ShaderStage stage, const std::string &code,
+                          const glslang_resource_t &resource) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++)
+      hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  };
+  mix(&SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION));
+  mix(&stage, sizeof(stage));
+  mix(code.data(), code.size());
+  // limits is the last member, the padding after it isn't hashed
+  mix(&resource,
+      offsetof(glslang_resource_t, limits) + sizeof(resource.limits));
+  return hash;
+}
+
+std::vector<uint8_t> compileShaderCached(const char *cacheDir,
+                                         ShaderStage stage,
+                                         const std::string &code,
+                                         const glslang_resource_t &resource) {
+  std::vector<uint8_t> spirv;
+  if (!cacheDir) {
+    if (!compileShaderGlslang(stage, code.c_str(), &spirv, &resource))
+      spirv.clear();
+    return spirv;
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.spv",
+           (unsigned long long)hashShaderSource(stage, code, resource));
+  const std::string path = std::string(cacheDir) + "/" + name;
+  {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+      spirv.resize((size_t)file.tellg());
+      file.seekg(0);
+      file.read(reinterpret_cast<char *>(spirv.data()), spirv.size());
+      // anything but whole words starting with the SPIR-V magic is rebuilt
+      uint32_t magic = 0;
+      if (spirv.size() >= sizeof(magic))
+        memcpy(&magic, spirv.data(), sizeof(magic));
+      if (file && spirv.size() % 4 == 0 && magic == 0x07230203)
+        return spirv;
+      spirv.clear();
+    }
+  }
+
+  if (!compileShaderGlslang(stage, code.c_str(), &spirv, &resource))
+    return {};
+
+  // threads compiling the same shader each write their own temp file
+  std::error_code error;
+  std::filesystem::create_directories(cacheDir, error);
+  const std::string tmpPath =
+      path + "." +
+      std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) +
+      ".tmp";
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(spirv.data()), spirv.size());
+    if (!file) {
+      std::cerr << "failed to write shader cache " << tmpPath << std::endl;
+      return spirv;
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    std::cerr << "failed to write shader cache " << path << std::endl;
+  return spirv;
 }
 #endif
 }; // namespace MAI
@@ -0,0 +1,70 @@
+#pragma once
+#include "fileMapping.h"
+#include "model.h"
+#include <string>
+#include <vector>
+
+// Cooked .maimesh files, what Model keeps from an Assimp import stored next
+// to the source so later launches map it instead of importing again.
+//
+// layout: MeshCacheHeader, meshes, vertices, indices, then textureCount
+// texture names as a uint32_t length followed by the characters
+constexpr uint32_t MESH_CACHE_MAGIC = 0x4853454d; // "MESH"
+// bump when the import flags or the processing in Model change
+constexpr uint32_t MESH_CACHE_VERSION = 2;
+constexpr const char *MESH_CACHE_FILE = "model.maimesh";
+
+struct MeshCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;
+  // stampMeshSources of the sources the hash was last checked against
+  uint64_t sourceStamp;
+  // guard against struct layout changes between builds
+  uint32_t meshSize;
+  uint32_t vertexSize;
+  uint32_t meshCount;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t textureCount;
+};
+
+// hash of the names and contents of every file in the asset directory
+// except the cache itself, textures/ isn't included
+uint64_t hashMeshSources(const std::string &dir);
+// hash of the names, sizes and modification times of the same files, cheap
+// enough for every launch. The contents are only hashed when it changes
+uint64_t stampMeshSources(const std::string &dir);
+
+bool writeMeshCache(const std::string &path, uint64_t sourceHash,
+                    uint64_t sourceStamp,
+                    const std::vector<Mesh> &meshes,
+                    const std::vector<Vertex> &vertices,
+                    const std::vector<uint32_t> &indices,
+                    const std::vector<std::string> &textures);
+
+// read only mapping of a cache file, the arrays point into the mapping and
+// stay valid until close()
+struct MeshCacheView {
+  MeshCacheView() = default;
+  MeshCacheView(const MeshCacheView &) = delete;
+  MeshCacheView &operator=(const MeshCacheView &) = delete;
+  ~MeshCacheView() { close(); }
+
+  // false when the file is missing, truncated, from another version or
+  // was cooked from different sources than the ones in dir. When only the
+  // stamp differs the sources are hashed, and the cache takes the new
+  // stamp if they didn't change
+  bool open(const std::string &path, uint64_t sourceStamp,
+            const std::string &dir);
+  void close();
+
+  const MeshCacheHeader *header = nullptr;
+  const Mesh *meshes = nullptr;
+  const Vertex *vertices = nullptr;
+  const uint32_t *indices = nullptr;
+  std::vector<std::string> textures;
+
+private:
+  MappedFile file;
+};
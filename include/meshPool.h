@@ -0,0 +1,107 @@
+#pragma once
+#include "mai_vk.h"
+#include <atomic>
+#include <glm/glm.hpp>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Every model's vertices and indices live in two shared device arenas, so
+// all of them draw with one vertex address and one bound index buffer.
+// Models own (offset, count) ranges of the arenas handed out by a free list,
+// the arenas grow when a range doesn't fit and are packed again once
+// unloads leave enough holes behind.
+
+constexpr uint32_t MESH_POOL_VERTICES = 1u << 20;
+constexpr uint32_t MESH_POOL_INDICES = 1u << 22;
+
+struct Vertex {
+  glm::vec3 pos;
+  glm::vec2 uv;
+  glm::vec3 norm;
+};
+
+// best fit free list over [0, capacity), freed ranges merge with their
+// neighbours
+struct RangeAllocator {
+  void reset(uint32_t capacity);
+  // zero sized ranges always succeed at offset 0
+  bool allocate(uint32_t count, uint32_t &offset);
+  void free(uint32_t offset, uint32_t count);
+
+  uint32_t getCapacity() const { return capacity; }
+  uint32_t getUsed() const { return used; }
+  // end of the last allocated range
+  uint32_t getHighWater() const;
+
+private:
+  void insert(uint32_t offset, uint32_t count);
+  void erase(std::map<uint32_t, uint32_t>::iterator it);
+
+  uint32_t capacity = 0;
+  uint32_t used = 0;
+  // offset -> count, and count -> offset for the best fit lookup
+  std::map<uint32_t, uint32_t> byOffset;
+  std::multimap<uint32_t, uint32_t> bySize;
+};
+
+struct MeshRange {
+  uint32_t firstVertex = 0;
+  uint32_t vertexCount = 0;
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+};
+
+typedef uint32_t MeshHandle;
+constexpr MeshHandle INVALID_MESH = ~0u;
+
+struct MeshPool {
+  MeshPool(MAI::Renderer *ren, uint32_t vertexCapacity = MESH_POOL_VERTICES,
+           uint32_t indexCapacity = MESH_POOL_INDICES);
+  ~MeshPool();
+
+  // copies the data into the arenas, indices stay relative to the range's
+  // first vertex. Safe to call from several loader threads
+  MeshHandle allocate(const Vertex *vertices, uint32_t vertexCount,
+                      const uint32_t *indices, uint32_t indexCount);
+  void free(MeshHandle handle);
+  // ranges move when the arenas grow or get packed, read them again after
+  // getGeneration() changes
+  MeshRange getRange(MeshHandle handle);
+  uint32_t getGeneration() const { return generation.load(); }
+
+  // packs the ranges when holes take more than a quarter of the used part
+  // of an arena, blocks on the GPU. Returns true when ranges moved
+  bool defragment();
+
+  // draws commandCount commands from indirect, starting at firstCommand.
+  // Commands index the arenas directly so any number of models can share
+  // one call. Instance ids are read from visibleAddress, their data from
+  // instancesAddress
+  void draw(MAI::CommandBuffer *buff, glm::mat4 proj, glm::mat4 view,
+            uint64_t instancesAddress, uint64_t visibleAddress,
+            MAI::Buffer *indirect, uint32_t firstCommand,
+            uint32_t commandCount);
+
+private:
+  struct Slot {
+    MeshRange range;
+    bool live = false;
+  };
+
+  MeshHandle allocateSlot();
+  bool fragmented(const RangeAllocator &arena) const;
+  void relocate(uint32_t vertexCapacity, uint32_t indexCapacity);
+  MAI::Buffer *createArena(VkDeviceSize size, MAIFlags usage);
+
+  MAI::Renderer *ren_ = nullptr;
+  std::mutex mutex;
+  MAI::Buffer *vertexBuffer = nullptr;
+  MAI::Buffer *indexBuffer = nullptr;
+  uint64_t vertexAddress = 0;
+  RangeAllocator vertexArena;
+  RangeAllocator indexArena;
+  std::vector<Slot> slots;
+  std::vector<MeshHandle> freeSlots;
+  std::atomic<uint32_t> generation = 0;
+};
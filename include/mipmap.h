@@ -0,0 +1,19 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// CPU mip generation for textures cooked at import time, the GPU can't blit
+// into block compressed images so their chains are built here before the
+// encoders run. Both filters are a 2x2 box, odd sizes drop the last
+// row/column like the GPU blit does.
+
+inline uint32_t mipSize(uint32_t size, uint32_t level) {
+  return std::max(1u, size >> level);
+}
+
+// srgb averages in linear space, matching a blit of an _SRGB image
+std::vector<uint8_t> downsampleRGBA8(const uint8_t *src, uint32_t width,
+                                     uint32_t height, bool srgb);
+std::vector<float> downsampleRGBAF32(const float *src, uint32_t width,
+                                     uint32_t height);
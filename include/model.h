@@ -1,6 +1,9 @@
 #pragma once
+#include "bvh.h"
+#include "jobSystem.h"
 #include "mai_config.h"
 #include "mai_vk.h"
+#include "meshPool.h"
 #include <assimp/cimport.h>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
@@ -12,38 +15,70 @@ enum ModelType : uint8_t {
   OBJ = 0x04,
 };
 
-struct Vertex {
-  glm::vec3 pos;
-  glm::vec2 uv;
-  glm::vec3 norm;
-};
-
+// range of a mesh inside the model's range of the mesh pool
 struct Mesh {
-  MAI::Buffer *vertexBuffer;
-  MAI::Buffer *indexBuffer;
+  uint32_t firstIndex;
   uint32_t indicesSize;
+  int32_t vertexOffset;
+  // index into the model's materials
+  uint32_t material;
+  // model space bounds, xyz center and w radius
+  glm::vec4 sphere;
+  AABB aabb;
 };
 
 struct Model {
-  Model(MAI::Renderer *ren, const char *filename);
+  // textures are loaded as jobs, the constructor waits for them. Without
+  // upload the vertices stay on the CPU until uploadMeshes, so a model can
+  // be imported while frames use the mesh pool
+  Model(MAI::Renderer *ren, MeshPool *pool, JobSystem *jobs,
+        const char *filename, bool upload = true);
   ~Model();
 
-  void draw(MAI::CommandBuffer *buff, glm::mat4 proj, glm::mat4 view,
-            glm::mat4 model = glm::mat4(1.0f));
+  // false when the directory has no model or it failed to import
+  bool isLoaded() const { return loaded_; }
+  // can grow the mesh pool, not while a frame is being recorded
+  void uploadMeshes();
+
+  // one indexed draw per mesh, all of them instanced the same way. The
+  // commands point into the mesh pool and are drawn with MeshPool::draw
+  void appendDrawCommands(std::vector<MAI::DrawIndexedIndirectCommand> &cmds,
+                          uint32_t firstInstance,
+                          uint32_t instanceCount) const;
+  uint32_t getMeshCount() const { return (uint32_t)meshes.size(); }
+  const std::vector<Mesh> &getMeshes() const { return meshes; }
+  // model space bounds of every mesh
+  const AABB &getBounds() const { return bounds; }
+  // model space triangles of every mesh, for picking
+  const TriangleBVH &getTriangles() const { return triangles; }
+  uint32_t getTextureIndex() const;
 
   std::string name;
   uint32_t id;
 
 private:
   MAI::Renderer *ren_ = nullptr;
+  MeshPool *pool_ = nullptr;
   std::vector<Mesh> meshes;
+  AABB bounds;
+  TriangleBVH triangles;
+  MeshHandle meshHandle = INVALID_MESH;
+  // filled while processing the scene, uploaded once into the mesh pool.
+  // Empty when the model came from the mesh cache and was uploaded
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
   std::vector<MAI::Texture *> textures;
   std::vector<std::string> loaded;
+  // diffuse texture file name per material, empty when it has none
+  std::vector<std::string> materials;
   ModelType type;
   const char *filename;
+  bool upload_ = true;
+  bool loaded_ = false;
 
-  void loadTextures(const aiMaterial *mat, aiTextureType type,
-                    const char *dir = nullptr);
+  void createBuffers(const Vertex *vertexData, uint32_t vertexCount,
+                     const uint32_t *indexData, uint32_t indexCount);
+  void loadTextures(JobSystem *jobs);
   void processNodes(const aiNode *node, const aiScene *scene);
   void processMeshes(const aiMesh *mesh, const aiScene *scene);
 };
@@ -0,0 +1,92 @@
+#pragma once
+#include "jobSystem.h"
+#include "mai_vk.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compiles pipelines on the job system and hands out one pipeline per
+// description. Descriptions are hashed, so every renderer asking for the
+// same shaders and state shares a pipeline instead of building its own.
+// The registry owns the pipelines, they live until it's destroyed. When
+// shaders change on disk it rebuilds the pipelines using them and swaps the
+// new ones in between frames, so the pointers handed out stay valid.
+
+// shaders by path, they are compiled on the worker that builds the
+// pipeline. The shaders of info are ignored, what its pointers point to
+// is copied and doesn't have to outlive request
+struct GraphicsPipelineDesc {
+  const char *vert = nullptr;
+  const char *frag = nullptr;
+  MAI::PipelineInfo info = {};
+};
+
+struct ComputePipelineDesc {
+  const char *comp = nullptr;
+  MAI::ComputePipelineInfo info = {};
+};
+
+// what a pipeline is built from, defined in pipelineRegistry.cpp
+struct PipelineSource;
+
+// a pipeline compiled or being compiled
+struct PipelineEntry {
+  JobHandle job;
+  MAI::Pipeline *pipeline = nullptr;
+  PipelineSource *source = nullptr;
+  // the last rebuild, they run one after another
+  JobHandle reloadJob;
+};
+
+struct PipelineRegistry {
+  PipelineRegistry(MAI::Renderer *ren, JobSystem *jobs);
+  ~PipelineRegistry();
+
+  // returns right away, the pipeline is compiled on a worker unless an
+  // identical description was requested before
+  PipelineEntry *request(const GraphicsPipelineDesc &desc);
+  PipelineEntry *request(const ComputePipelineDesc &desc);
+  // waits for the compile, running other jobs in the meantime
+  MAI::Pipeline *get(PipelineEntry *entry);
+
+  // rebuilds on workers the pipelines whose shaders include one of the
+  // changed files. Shaders loaded from spvs are rebuilt from the GLSL they
+  // were compiled from, spvs/x.fspv from x.frag. A pipeline whose shaders
+  // don't compile any more is left as it was
+  void reloadShaders(const std::vector<std::string> &changed);
+  // once a frame before recording, never blocks. Swaps the rebuilt
+  // pipelines in, the replaced ones go to the renderer's deferred deletes
+  void update();
+
+  uint32_t getPipelineCount();
+  // requests answered with an existing pipeline
+  uint32_t getSharedCount() const { return shared; }
+  uint32_t getReloadCount() const { return reloads; }
+
+private:
+  struct ReloadedPipeline {
+    PipelineEntry *entry;
+    MAI::Pipeline *pipeline;
+  };
+
+  // nullptr when hash wasn't requested yet, called with the lock held
+  PipelineEntry *find(uint64_t hash);
+  PipelineEntry *insert(uint64_t hash, PipelineSource *source);
+  void rebuild(PipelineEntry *entry, const std::vector<std::string> &changed);
+
+  MAI::Renderer *ren_;
+  JobSystem *jobs_;
+  std::mutex mutex;
+  std::unordered_map<uint64_t, PipelineEntry *> entries;
+  std::atomic<uint32_t> shared = 0;
+
+  // rebuilt pipelines waiting for update, at most one per entry
+  std::mutex reloadMutex;
+  std::vector<ReloadedPipeline> reloaded;
+  uint32_t reloads = 0;
+};
+
+uint64_t hashPipelineDesc(const GraphicsPipelineDesc &desc);
+uint64_t hashPipelineDesc(const ComputePipelineDesc &desc);
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Bulk conversions between the texel formats images go through on their way
+// to the GPU. count is in components, an RGBA row of w texels is 4 * w.
+// The 8 bit kernels and the sRGB encode use SSE2, sRGB decode is a table
+// lookup per byte. Half floats use F16C when the CPU has it (picked at
+// runtime) and fall back to the bit tricks below.
+
+// IEEE half, round to nearest even, overflow goes to infinity
+uint16_t packHalf(float value);
+float unpackHalf(uint16_t value);
+
+// bytes to [0, 1] and back, rounded and clamped
+void convertU8ToF32(const uint8_t *src, float *dst, size_t count);
+void convertF32ToU8(const float *src, uint8_t *dst, size_t count);
+void convertF32ToF16(const float *src, uint16_t *dst, size_t count);
+void convertF16ToF32(const uint16_t *src, float *dst, size_t count);
+// RGBA texels to B10G11R11_UFLOAT, alpha is dropped, negatives and NaN go
+// to 0 and anything past the largest finite value clamps to it
+void convertF32ToB10G11R11(const float *rgba, uint32_t *dst, size_t texels);
+
+// sRGB bytes to linear floats and back. With comp 4 every fourth component
+// is alpha and converted linearly, other values treat them all as color
+void decodeSrgb(const uint8_t *src, float *dst, size_t count,
+                uint32_t comp = 4);
+void encodeSrgb(const float *src, uint8_t *dst, size_t count,
+                uint32_t comp = 4);
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// compile-time kill switch, set through the MAI_ENABLE_PROFILER cmake option
+#ifndef MAI_PROFILER
+#define MAI_PROFILER 1
+#endif
+
+namespace Profiler {
+
+// events kept per thread before the oldest ones get overwritten
+constexpr uint32_t RING_CAPACITY = 1 << 16;
+
+uint64_t now();
+// zones are only recorded while enabled, off by default
+void setEnabled(bool enabled);
+bool isEnabled();
+void setThreadName(const char *name);
+// name has to outlive the dump, string literals and __func__ are fine
+void record(const char *name, uint64_t beginNs, uint64_t endNs);
+// writes every recorded zone as Chrome trace-event JSON (Perfetto,
+// chrome://tracing), call it while the other threads are idle
+bool dump(const std::string &path);
+
+struct Scope {
+  Scope(const char *name)
+      : name(name), active(isEnabled()), begin(active ? now() : 0) {}
+  ~Scope() {
+    if (active)
+      record(name, begin, now());
+  }
+
+private:
+  const char *name;
+  bool active;
+  uint64_t begin;
+};
+
+} // namespace Profiler
+
+#if MAI_PROFILER
+#define MAI_PROFILE_CONCAT_(a, b) a##b
+#define MAI_PROFILE_CONCAT(a, b) MAI_PROFILE_CONCAT_(a, b)
+#define MAI_PROFILE_SCOPE(name)                                                \
+  Profiler::Scope MAI_PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#define MAI_PROFILE_FUNCTION() MAI_PROFILE_SCOPE(__func__)
+#define MAI_PROFILE_THREAD(name) Profiler::setThreadName(name)
+#else
+#define MAI_PROFILE_SCOPE(name)
+#define MAI_PROFILE_FUNCTION()
+#define MAI_PROFILE_THREAD(name)
+#endif
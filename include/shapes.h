@@ -1,5 +1,6 @@
 #pragma once
 
+#include "bvh.h"
 #include "mai_config.h"
 #include "mai_vk.h"
 #include <string>
@@ -13,6 +14,10 @@ struct ShapeModule {
   MAI::Buffer *vertBuff = nullptr;
   MAI::Buffer *indexBuff = nullptr;
   uint32_t indicesSize;
+  // model space bounding sphere, xyz center and w radius
+  glm::vec4 sphere;
+  AABB aabb;
+  TriangleBVH triangles;
 };
 
 struct Shapes {
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "jobSystem.h"
 #include "mai_config.h"
 #include "mai_vk.h"
+#include "pipelineRegistry.h"
 
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
@@ -9,7 +11,12 @@
 struct Cubemap {
   std::string name;
   uint32_t id;
-  MAI::Texture *tex;
+  MAI::Texture *tex = nullptr;
+  // baked image based lighting, see envBaker.h
+  MAI::Texture *irradiance = nullptr;
+  MAI::Texture *specular = nullptr;
+  // roughness of specular level i is i / (specularLevels - 1)
+  uint32_t specularLevels = 0;
 };
 
 struct DrawInfo {
@@ -22,17 +29,27 @@ struct DrawInfo {
 };
 
 struct Skybox {
-  Skybox(MAI::Renderer *ren, VkFormat format = VK_FORMAT_UNDEFINED);
+  // every hdr is decoded, converted and uploaded as a chain of jobs.
+  // hdrFormat stores the cubes when the device has no BC6H, RGBA_F16 keeps
+  // the alpha and more precision at twice the size of B10G11R11
+  Skybox(MAI::Renderer *ren, JobSystem *jobs, PipelineRegistry *pipelines,
+         VkFormat format = VK_FORMAT_UNDEFINED,
+         MAI::TextureFormat hdrFormat = MAI::Format_B10G11R11_UF);
   ~Skybox();
 
   void draw(const DrawInfo &info);
   const std::vector<Cubemap> &getSkyboxInfo() { return cubemaps; }
+  // the skybox being drawn, its lighting goes with it
+  const Cubemap &getCurrent() { return cubemaps[currSkybox.back()]; }
+  MAI::Texture *getBrdfLut() { return brdfLut; }
 
   void guiWidgets();
 
 private:
   MAI::Renderer *ren_;
+  // owned by the PipelineRegistry
   MAI::Pipeline *pipeline_ = nullptr;
   std::vector<Cubemap> cubemaps;
+  MAI::Texture *brdfLut = nullptr;
   std::vector<int> currSkybox{0};
 };
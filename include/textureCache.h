@@ -0,0 +1,65 @@
+#pragma once
+#include "ktx2.h"
+#include <string>
+
+// Sampled textures are cooked to block compressed KTX2 files next to their
+// source image (<source>.ktx2) the first time they are loaded, later loads
+// upload the cached blocks as they are. Caches hold the full mip chain.
+//
+// bump when an encoder changes so old caches get re-cooked
+constexpr uint32_t TEXTURE_CACHE_VERSION = 2;
+constexpr const char *TEXTURE_CACHE_EXTENSION = ".ktx2";
+
+enum TextureKind : uint8_t {
+  // sRGB color, BC7
+  TextureKind_Color,
+  // tangent space normals, BC5 keeps x and y so z is rebuilt when sampled
+  TextureKind_Normal,
+};
+
+// cache files (and their temporaries) living in the asset directories
+bool isTextureCache(const std::string &path);
+
+// hash of the source file and the format it is cooked to
+uint64_t hashTextureSource(const std::string &path,
+                           MAI::TextureFormat format);
+
+// creates the texture from a cache with every level it holds
+MAI::Texture *createTexture(MAI::Renderer *ren, const Ktx2View &view);
+
+// An image on its way through the load stages, which loaders run as
+// separate jobs: decode maps a valid cache or reads the source pixels,
+// convert builds and encodes the mip chain when there was no cache, and
+// upload creates the texture. Only upload touches the renderer
+struct TextureLoad {
+  TextureLoad(const std::string &path, TextureKind kind, bool compress);
+  ~TextureLoad();
+  TextureLoad(const TextureLoad &) = delete;
+  TextureLoad &operator=(const TextureLoad &) = delete;
+
+  std::string path;
+  TextureKind kind;
+  bool compress;
+  MAI::TextureFormat format;
+  // only hashed when compress, nothing else checks it
+  uint64_t sourceHash = 0;
+  // decode found a valid cache, convert and the pixels are skipped
+  bool cached = false;
+  Ktx2View cache;
+  uint8_t *pixels = nullptr;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // encoded chain, level 0 first
+  std::vector<std::vector<uint8_t>> levels;
+};
+
+// false when the image can't be read
+bool decodeTexture(TextureLoad &load);
+void convertTexture(TextureLoad &load);
+MAI::Texture *uploadTexture(MAI::Renderer *ren, TextureLoad &load);
+
+// loads an 8 bit image through the cache, falls back to uncompressed RGBA
+// when the device has no BC support. nullptr when the image can't be read.
+// All three stages on the calling thread
+MAI::Texture *loadCachedTexture(MAI::Renderer *ren, const std::string &path,
+                                TextureKind kind);
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// CPU block compressors used when cooking textures. Every 4x4 block becomes
+// 16 bytes, edges of sizes that aren't a multiple of 4 are clamped.
+//
+// BC7 uses mode 6 only (one subset, RGBA 7.7.7.7 endpoints with p-bits),
+// BC5 packs the red and green channels as two BC4 blocks and BC6H uses
+// mode 11 (one region, 10 bit unsigned endpoints).
+
+constexpr uint32_t BC_BLOCK_SIZE = 16;
+
+// size of a width x height image in blocks
+inline uint32_t bcBlocksX(uint32_t width) { return (width + 3) / 4; }
+inline uint32_t bcBlocksY(uint32_t height) { return (height + 3) / 4; }
+
+// rgba is 4 bytes per pixel
+std::vector<uint8_t> encodeBC7(const uint8_t *rgba, uint32_t width,
+                               uint32_t height);
+// only red and green of the 4 byte pixels are kept, for normal maps
+std::vector<uint8_t> encodeBC5(const uint8_t *rgba, uint32_t width,
+                               uint32_t height);
+// rgba is 4 floats per pixel, alpha is dropped and negatives clamp to 0
+std::vector<uint8_t> encodeBC6H(const float *rgba, uint32_t width,
+                                uint32_t height);
+
+uint16_t floatToHalf(float value);
@@ -1,8 +1,12 @@
 #pragma once
+#include "fileWatcher.h"
+#include "jobSystem.h"
 #include "mai_config.h"
 #include "mai_vk.h"
 #include <cassert>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 struct TextureModel {
@@ -20,8 +24,17 @@ struct TextureModel {
 };
 
 struct Textures {
-  Textures(MAI::Renderer *ren);
+  // every file is decoded, converted and uploaded as a chain of jobs
+  Textures(MAI::Renderer *ren, JobSystem *jobs);
   ~Textures();
+
+  // reloads the files changed on disk, new texture sets included
+  void watch();
+  // once a frame before recording. Starts loading the changed files on jobs
+  // and swaps in the textures done, the replaced ones go to the renderer's
+  // deferred deletes. True when textures changed, their bindless indices
+  // with them
+  bool update();
   std::vector<TextureModel> &getTextures() { return textures; }
   TextureModel *getTextureModel(uint32_t id) {
     for (auto &tm : textures)
@@ -31,6 +44,21 @@ struct Textures {
   };
 
 private:
+  struct LoadedTexture {
+    std::string set;
+    std::string file;
+    MAI::Texture *texture;
+  };
+
+  void reload(const std::string &path);
+
   MAI::Renderer *ren_;
+  JobSystem *jobs_;
   std::vector<TextureModel> textures;
+
+  FileWatcher *watcher = nullptr;
+  // last load of each file, loads of one run in order
+  std::unordered_map<std::string, JobHandle> loads;
+  std::mutex loadMutex;
+  std::vector<LoadedTexture> loaded;
 };
@@ -9,25 +9,44 @@ struct Vertex {
 		float nx, ny, nz;
 };
 
+struct Instance {
+		mat4 model;
+		float tiling;
+		uint textId;
+		uint pad0, pad1;
+};
+
 layout(buffer_reference, scalar) readonly buffer Vertices{
 		Vertex in_Vertices[];
 };
 
+layout(buffer_reference, scalar) readonly buffer Instances{
+		Instance in_Instances[];
+};
+
+// instance ids that survived culling, indexed by gl_InstanceIndex
+layout(buffer_reference, scalar) readonly buffer Visible{
+		uint ids[];
+};
+
 layout(push_constant) uniform PerFrameData{
 		mat4 proj;
 		mat4 view;
-		mat4 model;
-		uint textId;
 		Vertices vertx;
+		Instances instances;
+		Visible visible;
 }pc;
 
 layout(location = 0) out vec2 uv;
 layout(location = 1) out vec3 norm;
+layout(location = 2) flat out uint textId;
 
 void main () {
   Vertex vtx = pc.vertx.in_Vertices[gl_VertexIndex];
-	gl_Position = pc.proj * pc.view * pc.model * vec4(vtx.x, vtx.y, vtx.z, 1.0f);
+  Instance inst = pc.instances.in_Instances[pc.visible.ids[gl_InstanceIndex]];
+	gl_Position = pc.proj * pc.view * inst.model * vec4(vtx.x, vtx.y, vtx.z, 1.0f);
 	uv = vec2(vtx.u, vtx.v);
 	norm = vec3(vtx.nx, vtx.ny, vtx.nz);
+	textId = inst.textId;
 }
 
@@ -5,18 +5,12 @@
 layout(set = 0, binding = 0) uniform texture2D kTextures2D[];
 layout(set = 0, binding = 1) uniform sampler kSamplers[];
 
-layout(push_constant) uniform PerFrameData{
-		mat4 proj;
-		mat4 view;
-		mat4 model;
-		float tiling;
-		uint textId;
-}pc;
-
 layout(location = 0) out vec4 out_FragColor;
 
 layout(location = 0) in vec3 fragWorldPos;
 layout(location = 1) in vec3 fragWorldNormal;
+layout(location = 2) flat in float tiling;
+layout(location = 3) flat in uint textId;
 
 vec4 textureBindless2D(uint textureid, uint samplerid, vec2 uv) {
     return texture(nonuniformEXT(sampler2D(kTextures2D[textureid], kSamplers[samplerid])), uv);
@@ -31,13 +25,13 @@ void main () {
 		blend /= (blend.x + blend.y + blend.z);
 
 
-		vec2 uvX = fragWorldPos.yz * pc.tiling; // project along x
-		vec2 uvY = fragWorldPos.xz * pc.tiling; // project along x
-		vec2 uvZ = fragWorldPos.xy * pc.tiling; // project along x
+		vec2 uvX = fragWorldPos.yz * tiling; // project along x
+		vec2 uvY = fragWorldPos.xz * tiling; // project along x
+		vec2 uvZ = fragWorldPos.xy * tiling; // project along x
 
-		vec4 texX = textureBindless2D(pc.textId, 0, uvX);
-		vec4 texY = textureBindless2D(pc.textId, 0, uvY);
-		vec4 texZ = textureBindless2D(pc.textId, 0, uvZ);
+		vec4 texX = textureBindless2D(textId, 0, uvX);
+		vec4 texY = textureBindless2D(textId, 0, uvY);
+		vec4 texZ = textureBindless2D(textId, 0, uvZ);
 
 		vec4 finalColor = texX * blend.x 
 				+ texY * blend.y + texZ * blend.z;
@@ -7,21 +7,38 @@ struct Vertex {
 		float x,y,z, face;
 };
 
+struct Instance {
+		mat4 model;
+		float tiling;
+		uint textId;
+		uint pad0, pad1;
+};
+
 layout(buffer_reference, scalar) readonly buffer Vertices{
 		Vertex in_Vertices[];
 };
 
+layout(buffer_reference, scalar) readonly buffer Instances{
+		Instance in_Instances[];
+};
+
+// instance ids that survived culling, indexed by gl_InstanceIndex
+layout(buffer_reference, scalar) readonly buffer Visible{
+		uint ids[];
+};
+
 layout(push_constant) uniform PerFrameData{
 		mat4 proj;
 		mat4 view;
-		mat4 model;
-		float tiling;
-		uint textId;
 		Vertices vertx;
+		Instances instances;
+		Visible visible;
 }pc;
 
 layout(location = 0) out vec3 fragWorldPos;
 layout(location = 1) out vec3 fragWorldNormal;
+layout(location = 2) flat out float tiling;
+layout(location = 3) flat out uint textId;
 
 vec3 normals[6] = vec3[](
 				vec3(0.0f, 0.0f, 1.0f),
@@ -34,13 +51,16 @@ vec3 normals[6] = vec3[](
 
 void main () {
   Vertex vtx = pc.vertx.in_Vertices[gl_VertexIndex];
-	vec4 worldPos  = pc.model * vec4(vtx.x, vtx.y, vtx.z, 1.0f);
+  Instance inst = pc.instances.in_Instances[pc.visible.ids[gl_InstanceIndex]];
+	vec4 worldPos  = inst.model * vec4(vtx.x, vtx.y, vtx.z, 1.0f);
 	gl_Position = pc.proj * pc.view * worldPos;
 
 	vec3 norm = normals[int(vtx.face)];
 
 
-	fragWorldNormal = mat3(transpose(inverse(pc.model))) *norm; 
+	fragWorldNormal = mat3(transpose(inverse(inst.model))) *norm; 
 	fragWorldPos = worldPos.xyz;
+	tiling = inst.tiling;
+	textId = inst.textId;
 
 }
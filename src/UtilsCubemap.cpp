@@ -1,8 +1,21 @@
 #include "UtilsCubemap.h"
+#include "jobSystem.h"
 #include <algorithm>
 #include <glm/ext.hpp>
 #include <glm/glm.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CUBEMAP_SSE
+#endif
+
+// the AVX2 path is picked at runtime, the rest of the build stays baseline
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CUBEMAP_AVX2
+#endif
+
 using glm::ivec2;
 using glm::vec2;
 using glm::vec3;
@@ -51,37 +64,48 @@ Bitmap convertEquirectangularMapToVerticalCross(const Bitmap &b) {
   const int clampW = b.w_ - 1;
   const int clampH = b.h_ - 1;
 
-  for (int face = 0; face != 6; face++) {
-    for (int i = 0; i != faceSize; i++) {
-      for (int j = 0; j != faceSize; j++) {
-        const vec3 P = faceCoordsToXYZ(i, j, face, faceSize);
-        const float R = hypot(P.x, P.y);
-        const float theta = atan2(P.y, P.x);
-        const float phi = atan2(P.z, R);
-        //	float point source coordinates
-        const float Uf = float(2.0f * faceSize * (theta + M_PI) / M_PI);
-        const float Vf = float(2.0f * faceSize * (M_PI / 2.0f - phi) / M_PI);
-        // 4-samples for bilinear interpolation
-        const int U1 = std::clamp(int(floor(Uf)), 0, clampW);
-        const int V1 = std::clamp(int(floor(Vf)), 0, clampH);
-        const int U2 = std::clamp(U1 + 1, 0, clampW);
-        const int V2 = std::clamp(V1 + 1, 0, clampH);
-        // fractional part
-        const float s = Uf - U1;
-        const float t = Vf - V1;
-        // fetch 4-samples
-        const vec4 A = b.getPixel(U1, V1);
-        const vec4 B = b.getPixel(U2, V1);
-        const vec4 C = b.getPixel(U1, V2);
-        const vec4 D = b.getPixel(U2, V2);
-        // bilinear interpolation
-        const vec4 color = A * (1 - s) * (1 - t) + B * (s) * (1 - t) +
-                           C * (1 - s) * t + D * (s) * (t);
-        result.setPixel(i + kFaceOffsets[face].x, j + kFaceOffsets[face].y,
-                        color);
-      }
-    };
-  }
+  // one loop per format, the texels are read and written in place
+  b.visit([&](auto src) {
+    using T = std::remove_const_t<typename decltype(src)::Type>;
+    constexpr int comp = decltype(src)::COMP;
+    const BitmapView<T, comp> dst = result.view<T, comp>();
+    for (int face = 0; face != 6; face++) {
+      for (int i = 0; i != faceSize; i++) {
+        for (int j = 0; j != faceSize; j++) {
+          const vec3 P = faceCoordsToXYZ(i, j, face, faceSize);
+          const float R = hypot(P.x, P.y);
+          const float theta = atan2(P.y, P.x);
+          const float phi = atan2(P.z, R);
+          //	float point source coordinates
+          const float Uf = float(2.0f * faceSize * (theta + M_PI) / M_PI);
+          const float Vf =
+              float(2.0f * faceSize * (M_PI / 2.0f - phi) / M_PI);
+          // 4-samples for bilinear interpolation
+          const int U1 = std::clamp(int(floor(Uf)), 0, clampW);
+          const int V1 = std::clamp(int(floor(Vf)), 0, clampH);
+          const int U2 = std::clamp(U1 + 1, 0, clampW);
+          const int V2 = std::clamp(V1 + 1, 0, clampH);
+          // fractional part
+          const float s = Uf - U1;
+          const float t = Vf - V1;
+          // fetch 4-samples
+          const T *A = src.pixel(U1, V1);
+          const T *B = src.pixel(U2, V1);
+          const T *C = src.pixel(U1, V2);
+          const T *D = src.pixel(U2, V2);
+          // bilinear interpolation
+          T *color =
+              dst.pixel(i + kFaceOffsets[face].x, j + kFaceOffsets[face].y);
+          for (int c = 0; c != comp; c++)
+            color[c] = storeComponent<T>(
+                loadComponent(A[c]) * (1 - s) * (1 - t) +
+                loadComponent(B[c]) * (s) * (1 - t) +
+                loadComponent(C[c]) * (1 - s) * t +
+                loadComponent(D[c]) * (s) * (t));
+        }
+      };
+    }
+  });
 
   return result;
 }
@@ -164,3 +188,255 @@ Bitmap convertVerticalCrossToCubeMapFaces(const Bitmap &b) {
 
   return cubemap;
 }
+
+namespace {
+
+constexpr float PI_F = 3.14159265358979f;
+
+// face of the vertical cross every cube face is cut from, the last one is
+// stored rotated by 180 degrees there
+struct FaceSource {
+  int crossFace;
+  bool flip;
+};
+const FaceSource kFaceSources[6] = {
+    {3, false}, {1, false}, {4, false}, {5, false}, {2, false}, {0, true},
+};
+
+// faceCoordsToXYZ of every cross face as P = a * A + b * B + c
+struct FaceBasis {
+  float a[3];
+  float b[3];
+  float c[3];
+};
+const FaceBasis kCrossBases[6] = {
+    {{0, 1, 0}, {0, 0, 1}, {-1, -1, -1}},
+    {{1, 0, 0}, {0, 0, -1}, {-1, -1, 1}},
+    {{0, 1, 0}, {0, 0, -1}, {1, -1, 1}},
+    {{-1, 0, 0}, {0, 0, -1}, {1, 1, 1}},
+    {{0, 1, 0}, {1, 0, 0}, {-1, -1, 1}},
+    {{0, 1, 0}, {-1, 0, 0}, {1, -1, -1}},
+};
+
+// odd minimax polynomial for atan on [-1, 1], 1e-5 radians off at most
+constexpr float ATAN_C1 = 0.99997726f;
+constexpr float ATAN_C3 = -0.33262347f;
+constexpr float ATAN_C5 = 0.19354346f;
+constexpr float ATAN_C7 = -0.11643287f;
+constexpr float ATAN_C9 = 0.05265332f;
+constexpr float ATAN_C11 = -0.01172120f;
+
+float fastAtan2(float y, float x) {
+  const float ax = std::fabs(x);
+  const float ay = std::fabs(y);
+  const float hi = std::max(ax, ay);
+  const float t = hi > 0.0f ? std::min(ax, ay) / hi : 0.0f;
+  const float t2 = t * t;
+  float r = ATAN_C11;
+  r = r * t2 + ATAN_C9;
+  r = r * t2 + ATAN_C7;
+  r = r * t2 + ATAN_C5;
+  r = r * t2 + ATAN_C3;
+  r = r * t2 + ATAN_C1;
+  r *= t;
+  if (ay > ax)
+    r = PI_F * 0.5f - r;
+  if (x < 0.0f)
+    r = PI_F - r;
+  return y < 0.0f ? -r : r;
+}
+
+struct EquirectSampler {
+  const float *data;
+  int w;
+  int h;
+  int faceSize;
+  // equirect texels per radian
+  float scale;
+};
+
+void fetchBilinear(const EquirectSampler &s, int u1, int v1, float fu,
+                   float fv, float *dst) {
+  const int u2 = std::min(u1 + 1, s.w - 1);
+  const int v2 = std::min(v1 + 1, s.h - 1);
+  const float *row1 = s.data + (size_t)v1 * s.w * 4;
+  const float *row2 = s.data + (size_t)v2 * s.w * 4;
+  const float wa = (1.0f - fu) * (1.0f - fv);
+  const float wb = fu * (1.0f - fv);
+  const float wc = (1.0f - fu) * fv;
+  const float wd = fu * fv;
+#ifdef CUBEMAP_SSE
+  // one texel is one register
+  __m128 sum = _mm_mul_ps(_mm_loadu_ps(row1 + u1 * 4), _mm_set1_ps(wa));
+  sum = _mm_add_ps(sum,
+                   _mm_mul_ps(_mm_loadu_ps(row1 + u2 * 4), _mm_set1_ps(wb)));
+  sum = _mm_add_ps(sum,
+                   _mm_mul_ps(_mm_loadu_ps(row2 + u1 * 4), _mm_set1_ps(wc)));
+  sum = _mm_add_ps(sum,
+                   _mm_mul_ps(_mm_loadu_ps(row2 + u2 * 4), _mm_set1_ps(wd)));
+  _mm_storeu_ps(dst, sum);
+#else
+  for (int c = 0; c < 4; c++)
+    dst[c] = row1[u1 * 4 + c] * wa + row1[u2 * 4 + c] * wb +
+             row2[u1 * 4 + c] * wc + row2[u2 * 4 + c] * wd;
+#endif
+}
+
+void sampleTexel(const EquirectSampler &s, const FaceBasis &basis, float A,
+                 float B, float *dst) {
+  float P[3];
+  for (int k = 0; k < 3; k++)
+    P[k] = basis.a[k] * A + (basis.b[k] * B + basis.c[k]);
+  const float R = std::sqrt(P[0] * P[0] + P[1] * P[1]);
+  const float theta = fastAtan2(P[1], P[0]);
+  const float phi = fastAtan2(P[2], R);
+  const float Uf = s.scale * (theta + PI_F);
+  const float Vf = s.scale * (PI_F * 0.5f - phi);
+  const int U1 = std::clamp(int(std::floor(Uf)), 0, s.w - 1);
+  const int V1 = std::clamp(int(std::floor(Vf)), 0, s.h - 1);
+  fetchBilinear(s, U1, V1, Uf - U1, Vf - V1, dst);
+}
+
+#ifdef CUBEMAP_AVX2
+bool hasAVX2() {
+  static const bool supported =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return supported;
+}
+
+__attribute__((target("avx2,fma"))) __m256
+fastAtan2AVX2(__m256 y, __m256 x) {
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 ax = _mm256_andnot_ps(signMask, x);
+  const __m256 ay = _mm256_andnot_ps(signMask, y);
+  const __m256 hi = _mm256_max_ps(ax, ay);
+  const __m256 lo = _mm256_min_ps(ax, ay);
+  // lo is 0 too when hi is, anything but 0 keeps the division finite
+  const __m256 t = _mm256_div_ps(
+      lo, _mm256_blendv_ps(hi, _mm256_set1_ps(1.0f),
+                           _mm256_cmp_ps(hi, zero, _CMP_EQ_OQ)));
+  const __m256 t2 = _mm256_mul_ps(t, t);
+  __m256 r = _mm256_set1_ps(ATAN_C11);
+  r = _mm256_fmadd_ps(r, t2, _mm256_set1_ps(ATAN_C9));
+  r = _mm256_fmadd_ps(r, t2, _mm256_set1_ps(ATAN_C7));
+  r = _mm256_fmadd_ps(r, t2, _mm256_set1_ps(ATAN_C5));
+  r = _mm256_fmadd_ps(r, t2, _mm256_set1_ps(ATAN_C3));
+  r = _mm256_fmadd_ps(r, t2, _mm256_set1_ps(ATAN_C1));
+  r = _mm256_mul_ps(r, t);
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI_F * 0.5f), r),
+                       _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI_F), r),
+                       _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+  return _mm256_blendv_ps(r, _mm256_sub_ps(zero, r),
+                          _mm256_cmp_ps(y, zero, _CMP_LT_OQ));
+}
+
+// eight texels of a row at a time, returns how many were written
+__attribute__((target("avx2,fma"))) int
+convertRowAVX2(const EquirectSampler &s, const FaceBasis &basis, float B,
+               bool flip, float *dst) {
+  const int n = s.faceSize;
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 faceSize = _mm256_set1_ps(float(n));
+  __m256 a[3], c[3];
+  for (int k = 0; k < 3; k++) {
+    a[k] = _mm256_set1_ps(basis.a[k]);
+    c[k] = _mm256_set1_ps(basis.b[k] * B + basis.c[k]);
+  }
+  const __m256 scale = _mm256_set1_ps(s.scale);
+  const __m256i maxU = _mm256_set1_epi32(s.w - 1);
+  const __m256i maxV = _mm256_set1_epi32(s.h - 1);
+  const __m256i zeroI = _mm256_setzero_si256();
+
+  alignas(32) int U1[8], V1[8];
+  alignas(32) float fu[8], fv[8];
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32(i), lanes);
+    if (flip)
+      index = _mm256_sub_epi32(_mm256_set1_epi32(n - 1), index);
+    const __m256 A = _mm256_div_ps(
+        _mm256_mul_ps(two, _mm256_cvtepi32_ps(index)), faceSize);
+    const __m256 px = _mm256_add_ps(_mm256_mul_ps(a[0], A), c[0]);
+    const __m256 py = _mm256_add_ps(_mm256_mul_ps(a[1], A), c[1]);
+    const __m256 pz = _mm256_add_ps(_mm256_mul_ps(a[2], A), c[2]);
+    const __m256 R =
+        _mm256_sqrt_ps(_mm256_fmadd_ps(px, px, _mm256_mul_ps(py, py)));
+    const __m256 theta = fastAtan2AVX2(py, px);
+    const __m256 phi = fastAtan2AVX2(pz, R);
+    const __m256 Uf =
+        _mm256_mul_ps(scale, _mm256_add_ps(theta, _mm256_set1_ps(PI_F)));
+    const __m256 Vf = _mm256_mul_ps(
+        scale, _mm256_sub_ps(_mm256_set1_ps(PI_F * 0.5f), phi));
+    const __m256i u = _mm256_min_epi32(
+        _mm256_max_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(Uf)), zeroI),
+        maxU);
+    const __m256i v = _mm256_min_epi32(
+        _mm256_max_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(Vf)), zeroI),
+        maxV);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(U1), u);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(V1), v);
+    _mm256_store_ps(fu, _mm256_sub_ps(Uf, _mm256_cvtepi32_ps(u)));
+    _mm256_store_ps(fv, _mm256_sub_ps(Vf, _mm256_cvtepi32_ps(v)));
+    // fetchBilinear is SSE code, avoid the AVX to SSE transition stalls
+    _mm256_zeroupper();
+    for (int l = 0; l < 8; l++)
+      fetchBilinear(s, U1[l], V1[l], fu[l], fv[l], dst + (i + l) * 4);
+  }
+  return i;
+}
+#endif
+
+void convertRow(const EquirectSampler &s, int face, int j, float *dst) {
+  const FaceSource &source = kFaceSources[face];
+  const FaceBasis &basis = kCrossBases[source.crossFace];
+  const int n = s.faceSize;
+  const float B = 2.0f * float(source.flip ? n - 1 - j : j) / n;
+  int i = 0;
+#ifdef CUBEMAP_AVX2
+  if (hasAVX2())
+    i = convertRowAVX2(s, basis, B, source.flip, dst);
+#endif
+  for (; i < n; i++) {
+    const float A = 2.0f * float(source.flip ? n - 1 - i : i) / n;
+    sampleTexel(s, basis, A, B, dst + i * 4);
+  }
+}
+
+}; // namespace
+
+Bitmap convertEquirectangularMapToCubeMapFaces(const Bitmap &b,
+                                               JobSystem *jobs) {
+  if (b.type_ != eBitmapType_2D)
+    return Bitmap();
+  if (b.fmt_ != eBitmapFormat_Float || b.comp_ != 4)
+    return convertVerticalCrossToCubeMapFaces(
+        convertEquirectangularMapToVerticalCross(b));
+
+  const int faceSize = b.w_ / 4;
+  Bitmap cubemap(faceSize, faceSize, 6, 4, eBitmapFormat_Float);
+  cubemap.type_ = eBitmapType_Cube;
+
+  const EquirectSampler sampler{
+      .data = b.view<float, 4>().data,
+      .w = b.w_,
+      .h = b.h_,
+      .faceSize = faceSize,
+      .scale = 2.0f * faceSize / PI_F,
+  };
+  float *dst = cubemap.view<float, 4>().data;
+  // rows of every face one after the other, the layout of the result
+  auto convertRows = [&](uint32_t begin, uint32_t end) {
+    for (uint32_t row = begin; row < end; row++)
+      convertRow(sampler, row / faceSize, row % faceSize,
+                 dst + (size_t)row * faceSize * 4);
+  };
+  const uint32_t rowCount = 6 * faceSize;
+  if (jobs)
+    jobs->parallelFor(rowCount, 16, convertRows);
+  else
+    convertRows(0, rowCount);
+  return cubemap;
+}
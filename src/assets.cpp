@@ -1,33 +1,35 @@
 #include "assets.h"
+#include "meshCache.h"
+#include "profiler.h"
+#include "textureCache.h"
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
-#include <mutex>
-#include <thread>
+#include <iostream>
 namespace fs = std::filesystem;
 
-namespace {
-uint32_t count = 0;
-std::mutex mtx;
-}; // namespace
+Assets::Assets(MAI::Renderer *ren, JobSystem *jobs)
+    : ren_(ren), jobs_(jobs) {
+  MAI_PROFILE_FUNCTION();
+  meshPool = new MeshPool(ren);
 
-void loadModel(MAI::Renderer *ren, std::string dir,
-               std::vector<Model *> &models) {
-  Model *md = new Model(ren, dir.c_str());
-  std::lock_guard<std::mutex> lock(mtx);
-  md->id = count;
-  models.emplace_back(md);
-  count++;
-}
-
-Assets::Assets(MAI::Renderer *ren, VkFormat format) : ren_(ren) {
-
-  // assets load
-  std::vector<std::jthread> threads;
+  // normalized like the paths reloads find them by
   std::string path = RESOURCES_PATH "assets";
-  for (const auto &entry : fs::directory_iterator(path)) {
-    std::string str = entry.path();
-    threads.emplace_back(loadModel, ren, str, std::ref(models));
-  }
-  preparePipeline(format);
+  for (const auto &entry : fs::directory_iterator(path))
+    dirs.emplace_back(entry.path().lexically_normal());
+
+  // ids follow the directory order, every job fills its own entry
+  models.resize(dirs.size());
+  std::vector<JobHandle> loads;
+  for (size_t i = 0; i < dirs.size(); i++)
+    loads.emplace_back(jobs->submit([this, ren, jobs, i, dir = dirs[i]] {
+      MAI_PROFILE_SCOPE("loadModel");
+      Model *md = new Model(ren, meshPool, jobs, dir.c_str());
+      assert(md->isLoaded());
+      md->id = (uint32_t)i;
+      models[i] = md;
+    }));
+  jobs->wait(loads);
 }
 
 // void Assets::drawModels(MAI::CommandBuffer *buffer, glm::mat4 proj,
@@ -49,21 +51,97 @@ std::vector<ModelInfo> Assets::getModelInfos() {
   return infos;
 }
 
+void Assets::watch() {
+  if (!watcher)
+    watcher = new FileWatcher(RESOURCES_PATH "assets", true);
+}
+
+bool Assets::getModelDir(const std::string &path, std::string &dir) const {
+  const fs::path file(path);
+  const std::string name = file.filename().string();
+  if (name.compare(0, strlen(MESH_CACHE_FILE), MESH_CACHE_FILE) == 0 ||
+      isTextureCache(name))
+    return false;
+
+  const fs::path root = fs::path(RESOURCES_PATH "assets").lexically_normal();
+  const fs::path relative = file.lexically_normal().lexically_relative(root);
+  // files directly in assets/ belong to no model
+  if (std::distance(relative.begin(), relative.end()) < 2)
+    return false;
+  dir = (root / *relative.begin()).string();
+  return true;
+}
+
+void Assets::import(const std::string &dir) {
+  JobHandle &last = imports[dir];
+  last = jobs_->submit(
+      [this, dir] {
+        MAI_PROFILE_SCOPE("reloadModel");
+        Model *md = new Model(ren_, meshPool, jobs_, dir.c_str(), false);
+        if (!md->isLoaded()) {
+          std::cerr << "keeping the old model of " << dir << std::endl;
+          delete md;
+          return;
+        }
+        std::lock_guard<std::mutex> lock(importMutex);
+        imported.push_back({dir, md});
+      },
+      {last});
+}
+
+bool Assets::update() {
+  // the ranges of replaced models are packed once they add up
+  if (rangesFreed.exchange(false))
+    meshPool->defragment();
+
+  if (watcher) {
+    std::vector<std::string> changed;
+    std::string dir;
+    for (const std::string &path : watcher->poll())
+      if (getModelDir(path, dir) &&
+          std::find(changed.begin(), changed.end(), dir) == changed.end())
+        changed.emplace_back(dir);
+    for (const std::string &it : changed)
+      import(it);
+  }
+
+  std::vector<ImportedModel> ready;
+  {
+    std::lock_guard<std::mutex> lock(importMutex);
+    ready.swap(imported);
+  }
+  for (ImportedModel &it : ready) {
+    // between frames, growing the pool can't pull buffers from under one
+    it.model->uploadMeshes();
+    auto found = std::find(dirs.begin(), dirs.end(), it.dir);
+    if (found == dirs.end()) {
+      it.model->id = (uint32_t)models.size();
+      models.emplace_back(it.model);
+      dirs.emplace_back(it.dir);
+    } else {
+      Model *&model = models[found - dirs.begin()];
+      it.model->id = model->id;
+      // its mesh pool ranges can't be handed out while frames draw them
+      ren_->deferDelete([this, old = model] {
+        delete old;
+        rangesFreed = true;
+      });
+      model = it.model;
+    }
+    std::cout << "reloaded " << it.dir << std::endl;
+  }
+  return !ready.empty();
+}
+
 Assets::~Assets() {
+  for (auto &it : imports)
+    jobs_->wait(it.second);
+  for (auto &it : imported)
+    delete it.model;
+  // replaced models still queued free their ranges into meshPool
+  ren_->flushDeferredDeletes();
+  delete watcher;
   for (auto &it : models)
     delete it;
-  delete pipeline_;
-}
-
-void Assets::preparePipeline(VkFormat format) {
-  MAI::Shader *vert = ren_->createShader(SHADERS_PATH "spvs/model.vspv");
-  MAI::Shader *frag = ren_->createShader(SHADERS_PATH "spvs/model.fspv");
-  pipeline_ = ren_->createPipeline({
-      .vert = vert,
-      .frag = frag,
-      .depthFormat = format,
-      .cullMode = MAI::CullMode::Back,
-  });
-  delete vert;
-  delete frag;
+  delete meshPool;
 }
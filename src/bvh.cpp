@@ -0,0 +1,445 @@
+#include "bvh.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_SSE 1
+#else
+#define BVH_SSE 0
+#endif
+
+namespace {
+constexpr uint32_t SAH_BINS = 16;
+constexpr uint32_t MAX_LEAF_SIZE = 4;
+// traversal stacks are fixed size, past this depth nodes are split by count
+constexpr uint32_t MAX_SAH_DEPTH = 48;
+constexpr uint32_t MAX_STACK = 128;
+// cost of visiting a node relative to testing one primitive
+constexpr float TRAVERSAL_COST = 1.0f;
+}; // namespace
+
+AABB AABB::transformed(const glm::mat4 &m) const {
+  if (empty())
+    return *this;
+
+  // Arvo, transform the center and the extents separately
+  const glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+  const glm::vec3 e = (max - min) * 0.5f;
+  const glm::mat3 a = glm::mat3(m);
+  const glm::vec3 extent = glm::abs(a[0]) * e.x + glm::abs(a[1]) * e.y +
+                           glm::abs(a[2]) * e.z;
+
+  AABB box;
+  box.min = c - extent;
+  box.max = c + extent;
+  return box;
+}
+
+bool intersectRayAABB(const glm::vec3 &origin, const glm::vec3 &invDir,
+                      const AABB &box, float maxT, float &tNear) {
+#if BVH_SSE
+  // the w lane carries the [0, maxT] ray interval through the same min/max
+  const __m128 o = _mm_setr_ps(origin.x, origin.y, origin.z, 0.0f);
+  const __m128 inv = _mm_setr_ps(invDir.x, invDir.y, invDir.z, 1.0f);
+  const __m128 lo = _mm_setr_ps(box.min.x, box.min.y, box.min.z, 0.0f);
+  const __m128 hi = _mm_setr_ps(box.max.x, box.max.y, box.max.z, maxT);
+  const __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, o), inv);
+  const __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, o), inv);
+  __m128 tmin = _mm_min_ps(t0, t1);
+  __m128 tmax = _mm_max_ps(t0, t1);
+
+  // horizontal max of tmin and min of tmax
+  tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(2, 3, 0, 1)));
+  tmin = _mm_max_ps(tmin, _mm_shuffle_ps(tmin, tmin, _MM_SHUFFLE(1, 0, 3, 2)));
+  tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, _MM_SHUFFLE(2, 3, 0, 1)));
+  tmax = _mm_min_ps(tmax, _mm_shuffle_ps(tmax, tmax, _MM_SHUFFLE(1, 0, 3, 2)));
+
+  tNear = _mm_cvtss_f32(tmin);
+  return _mm_comile_ss(tmin, tmax);
+#else
+  const glm::vec3 t0 = (box.min - origin) * invDir;
+  const glm::vec3 t1 = (box.max - origin) * invDir;
+  const glm::vec3 tmin = glm::min(t0, t1);
+  const glm::vec3 tmax = glm::max(t0, t1);
+
+  tNear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+  const float tFar = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, maxT));
+  return tNear <= tFar;
+#endif
+}
+
+float intersectRayTriangle(const glm::vec3 &origin, const glm::vec3 &dir,
+                           const glm::vec3 &v0, const glm::vec3 &v1,
+                           const glm::vec3 &v2) {
+  const glm::vec3 e1 = v1 - v0;
+  const glm::vec3 e2 = v2 - v0;
+  const glm::vec3 p = glm::cross(dir, e2);
+  const float det = glm::dot(e1, p);
+  // both faces count, only rays parallel to the triangle miss
+  if (det == 0.0f)
+    return -1.0f;
+
+  const float invDet = 1.0f / det;
+  const glm::vec3 s = origin - v0;
+  const float u = glm::dot(s, p) * invDet;
+  if (u < 0.0f || u > 1.0f)
+    return -1.0f;
+
+  const glm::vec3 q = glm::cross(s, e1);
+  const float v = glm::dot(dir, q) * invDet;
+  if (v < 0.0f || u + v > 1.0f)
+    return -1.0f;
+
+  return glm::dot(e2, q) * invDet;
+}
+
+void extractFrustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6]) {
+  const glm::mat4 &m = viewProj;
+  const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+  const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+  const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+  const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  planes[0] = row3 + row0;
+  planes[1] = row3 - row0;
+  planes[2] = row3 + row1;
+  planes[3] = row3 - row1;
+  planes[4] = row3 + row2;
+  planes[5] = row3 - row2;
+  for (uint32_t i = 0; i < 6; i++)
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+bool intersectFrustumAABB(const glm::vec4 planes[6], const AABB &box) {
+  for (uint32_t i = 0; i < 6; i++) {
+    const glm::vec4 &p = planes[i];
+    // corner furthest along the plane normal
+    const glm::vec3 v(p.x >= 0.0f ? box.max.x : box.min.x,
+                      p.y >= 0.0f ? box.max.y : box.min.y,
+                      p.z >= 0.0f ? box.max.z : box.min.z);
+    if (glm::dot(glm::vec3(p), v) + p.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+struct BVH::BuildPrim {
+  AABB box;
+  glm::vec3 center;
+  uint32_t id;
+};
+
+void BVH::build(const std::vector<AABB> &boxes) {
+  boxes_ = boxes;
+  nodes_.clear();
+  primIds_.clear();
+  leafOf_.assign(boxes.size(), UINT32_MAX);
+  builtArea = 0.0f;
+
+  std::vector<BuildPrim> prims;
+  prims.reserve(boxes.size());
+  for (uint32_t i = 0; i < boxes.size(); i++)
+    if (!boxes[i].empty())
+      prims.emplace_back(BuildPrim{
+          .box = boxes[i],
+          .center = boxes[i].center(),
+          .id = i,
+      });
+  if (prims.empty())
+    return;
+
+  nodes_.reserve(prims.size() * 2);
+  nodes_.emplace_back(Node{
+      .left = 0,
+      .count = (uint32_t)prims.size(),
+  });
+  subdivide(0, prims, 0);
+  builtArea = nodes_[0].box.area();
+
+  primIds_.resize(prims.size());
+  for (uint32_t i = 0; i < prims.size(); i++)
+    primIds_[i] = prims[i].id;
+}
+
+void BVH::subdivide(uint32_t nodeIdx, std::vector<BuildPrim> &prims,
+                    uint32_t depth) {
+  const uint32_t first = nodes_[nodeIdx].left;
+  const uint32_t count = nodes_[nodeIdx].count;
+
+  AABB bounds, centerBounds;
+  for (uint32_t i = first; i < first + count; i++) {
+    bounds.grow(prims[i].box);
+    centerBounds.grow(prims[i].center);
+  }
+  nodes_[nodeIdx].box = bounds;
+
+  auto makeLeaf = [&]() {
+    for (uint32_t i = first; i < first + count; i++)
+      leafOf_[prims[i].id] = nodeIdx;
+  };
+
+  if (count <= 1) {
+    makeLeaf();
+    return;
+  }
+
+  // binned SAH over the centroid bounds, all three axes in one pass
+  struct Bin {
+    AABB box;
+    uint32_t count = 0;
+  } bins[3][SAH_BINS];
+  glm::vec3 scale(0.0f);
+  for (int axis = 0; axis < 3; axis++) {
+    const float extent = centerBounds.max[axis] - centerBounds.min[axis];
+    if (extent > 0.0f)
+      scale[axis] = SAH_BINS / extent;
+  }
+  for (uint32_t i = first; i < first + count; i++) {
+    const glm::vec3 rel = (prims[i].center - centerBounds.min) * scale;
+    for (int axis = 0; axis < 3; axis++) {
+      Bin &bin = bins[axis][std::min(SAH_BINS - 1, (uint32_t)rel[axis])];
+      bin.box.grow(prims[i].box);
+      bin.count++;
+    }
+  }
+
+  int bestAxis = -1;
+  uint32_t bestSplit = 0;
+  float bestCost = FLT_MAX;
+  for (int axis = 0; axis < 3; axis++) {
+    if (scale[axis] == 0.0f)
+      continue;
+
+    // sweep from both sides to get the cost of every split plane
+    float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+    uint32_t leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+    AABB leftBox, rightBox;
+    uint32_t leftSum = 0, rightSum = 0;
+    for (uint32_t i = 0; i < SAH_BINS - 1; i++) {
+      leftSum += bins[axis][i].count;
+      leftCount[i] = leftSum;
+      leftBox.grow(bins[axis][i].box);
+      leftArea[i] = leftBox.area();
+
+      rightSum += bins[axis][SAH_BINS - 1 - i].count;
+      rightCount[SAH_BINS - 2 - i] = rightSum;
+      rightBox.grow(bins[axis][SAH_BINS - 1 - i].box);
+      rightArea[SAH_BINS - 2 - i] = rightBox.area();
+    }
+
+    for (uint32_t i = 0; i < SAH_BINS - 1; i++) {
+      const float cost =
+          leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = i;
+      }
+    }
+  }
+
+  const float leafCost = (float)count;
+  const float splitCost =
+      bestAxis >= 0
+          ? TRAVERSAL_COST + bestCost / std::max(bounds.area(), FLT_MIN)
+          : FLT_MAX;
+  if (count <= MAX_LEAF_SIZE && leafCost <= splitCost) {
+    makeLeaf();
+    return;
+  }
+
+  uint32_t mid;
+  if (bestAxis >= 0 && depth < MAX_SAH_DEPTH) {
+    const float lo = centerBounds.min[bestAxis];
+    const float axisScale = scale[bestAxis];
+    auto it = std::partition(
+        prims.begin() + first, prims.begin() + first + count,
+        [&](const BuildPrim &prim) {
+          const float rel = (prim.center[bestAxis] - lo) * axisScale;
+          return std::min(SAH_BINS - 1, (uint32_t)rel) <= bestSplit;
+        });
+    mid = (uint32_t)(it - prims.begin());
+  } else {
+    // all centers coincide, split by count
+    mid = first + count / 2;
+  }
+  if (mid == first || mid == first + count)
+    mid = first + count / 2;
+
+  const uint32_t left = (uint32_t)nodes_.size();
+  nodes_.emplace_back(Node{
+      .left = first,
+      .count = mid - first,
+      .parent = nodeIdx,
+  });
+  nodes_.emplace_back(Node{
+      .left = mid,
+      .count = first + count - mid,
+      .parent = nodeIdx,
+  });
+  nodes_[nodeIdx].left = left;
+  nodes_[nodeIdx].count = 0;
+
+  subdivide(left, prims, depth + 1);
+  subdivide(left + 1, prims, depth + 1);
+}
+
+void BVH::updateBounds(uint32_t nodeIdx) {
+  Node &node = nodes_[nodeIdx];
+  node.box = AABB();
+  if (node.count > 0) {
+    for (uint32_t i = node.left; i < node.left + node.count; i++)
+      node.box.grow(boxes_[primIds_[i]]);
+  } else {
+    node.box.grow(nodes_[node.left].box);
+    node.box.grow(nodes_[node.left + 1].box);
+  }
+}
+
+bool BVH::refit(uint32_t id, const AABB &box) {
+  if (id >= boxes_.size() || leafOf_[id] == UINT32_MAX)
+    return false;
+
+  boxes_[id] = box;
+  for (uint32_t n = leafOf_[id]; n != UINT32_MAX; n = nodes_[n].parent)
+    updateBounds(n);
+  return true;
+}
+
+bool BVH::needsRebuild() const {
+  return !nodes_.empty() && nodes_[0].box.area() > builtArea * 2.0f;
+}
+
+void BVH::queryFrustum(const glm::vec4 planes[6],
+                       std::vector<uint32_t> &out) const {
+  if (nodes_.empty())
+    return;
+
+  uint32_t stack[MAX_STACK];
+  uint32_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = nodes_[stack[--top]];
+    if (!intersectFrustumAABB(planes, node.box))
+      continue;
+    if (node.count > 0) {
+      for (uint32_t i = node.left; i < node.left + node.count; i++)
+        if (intersectFrustumAABB(planes, boxes_[primIds_[i]]))
+          out.emplace_back(primIds_[i]);
+    } else {
+      stack[top++] = node.left;
+      stack[top++] = node.left + 1;
+    }
+  }
+}
+
+void BVH::queryRange(const AABB &range, std::vector<uint32_t> &out) const {
+  if (nodes_.empty())
+    return;
+
+  uint32_t stack[MAX_STACK];
+  uint32_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = nodes_[stack[--top]];
+    if (!node.box.overlaps(range))
+      continue;
+    if (node.count > 0) {
+      for (uint32_t i = node.left; i < node.left + node.count; i++)
+        if (boxes_[primIds_[i]].overlaps(range))
+          out.emplace_back(primIds_[i]);
+    } else {
+      stack[top++] = node.left;
+      stack[top++] = node.left + 1;
+    }
+  }
+}
+
+RayHit BVH::raycast(
+    const glm::vec3 &origin, const glm::vec3 &dir, float maxT,
+    const std::function<float(uint32_t id, float maxT)> &intersect) const {
+  RayHit hit;
+  hit.t = maxT;
+  if (nodes_.empty())
+    return hit;
+
+  const glm::vec3 invDir = 1.0f / dir;
+  float tNear;
+  if (!intersectRayAABB(origin, invDir, nodes_[0].box, hit.t, tNear))
+    return hit;
+
+  struct Entry {
+    uint32_t node;
+    float t;
+  } stack[MAX_STACK];
+  uint32_t top = 0;
+  stack[top++] = {0, tNear};
+  while (top > 0) {
+    const Entry entry = stack[--top];
+    if (entry.t > hit.t)
+      continue;
+
+    const Node &node = nodes_[entry.node];
+    if (node.count > 0) {
+      for (uint32_t i = node.left; i < node.left + node.count; i++) {
+        const uint32_t id = primIds_[i];
+        if (!intersectRayAABB(origin, invDir, boxes_[id], hit.t, tNear))
+          continue;
+        const float t = intersect ? intersect(id, hit.t) : tNear;
+        if (t >= 0.0f && t < hit.t) {
+          hit.t = t;
+          hit.id = id;
+        }
+      }
+      continue;
+    }
+
+    // push the far child first so the near one is popped next
+    float t0, t1;
+    const bool hit0 =
+        intersectRayAABB(origin, invDir, nodes_[node.left].box, hit.t, t0);
+    const bool hit1 =
+        intersectRayAABB(origin, invDir, nodes_[node.left + 1].box, hit.t, t1);
+    if (hit0 && hit1) {
+      if (t0 <= t1) {
+        stack[top++] = {node.left + 1, t1};
+        stack[top++] = {node.left, t0};
+      } else {
+        stack[top++] = {node.left, t0};
+        stack[top++] = {node.left + 1, t1};
+      }
+    } else if (hit0) {
+      stack[top++] = {node.left, t0};
+    } else if (hit1) {
+      stack[top++] = {node.left + 1, t1};
+    }
+  }
+  if (hit.id == UINT32_MAX)
+    hit.t = FLT_MAX;
+  return hit;
+}
+
+void TriangleBVH::build(std::vector<glm::vec3> positions,
+                        std::vector<uint32_t> indices) {
+  positions_ = std::move(positions);
+  indices_ = std::move(indices);
+
+  std::vector<AABB> boxes(triangleCount());
+  for (uint32_t i = 0; i < boxes.size(); i++) {
+    boxes[i].grow(positions_[indices_[i * 3 + 0]]);
+    boxes[i].grow(positions_[indices_[i * 3 + 1]]);
+    boxes[i].grow(positions_[indices_[i * 3 + 2]]);
+  }
+  bvh_.build(boxes);
+}
+
+float TriangleBVH::raycast(const glm::vec3 &origin, const glm::vec3 &dir,
+                           float maxT) const {
+  const RayHit hit =
+      bvh_.raycast(origin, dir, maxT, [&](uint32_t id, float) {
+        return intersectRayTriangle(origin, dir, positions_[indices_[id * 3]],
+                                    positions_[indices_[id * 3 + 1]],
+                                    positions_[indices_[id * 3 + 2]]);
+      });
+  return hit.id == UINT32_MAX ? -1.0f : hit.t;
+}
@@ -1,15 +1,25 @@
 #include "entities.h"
 #include "json.hpp"
 #include "maiApp.h"
+#include "profiler.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <glm/ext.hpp>
 #include <iostream>
 #include <string>
-#include <thread>
 
 using json = nlohmann::json;
 
+glm::mat4 entityTransform(const EntityData &data) {
+  glm::mat4 model = glm::mat4(1.0f);
+  model = glm::translate(model, data.pos);
+  model = glm::scale(model, data.scale);
+  // model = glm::toMat4(glm::quat(data.rotate));
+  return model;
+}
+
 std::string entityCacheStr =
     "entiyId = %d, addId = %d, type = %s, textureId = %d, tiling = "
     "%f, pos = [%f, %f, %f], "
@@ -17,112 +27,385 @@ std::string entityCacheStr =
 
 std::string entityCacheFile = RESOURCES_PATH "entity.json";
 
-Entities::Entities(MAI::Renderer *ren, GLFWwindow *window, VkFormat formt)
+Entities::Entities(MAI::Renderer *ren, JobSystem *jobs,
+                   PipelineRegistry *pipelines, GLFWwindow *window,
+                   VkFormat formt)
     : ren_(ren), window(window), format(formt) {
-  std::thread t1([&]() { assets = new Assets(ren, formt); });
-  std::thread t2([&] { textures = new Textures(ren); });
-  std::thread t3([&] { shapes = new Shapes(ren, formt); });
-  t2.join();
-  t1.join();
-  t3.join();
-
-  preparePipelines();
+  MAI_PROFILE_FUNCTION();
+  JobHandle loadAssets = jobs->submit([&] { assets = new Assets(ren, jobs); });
+  JobHandle loadTextures =
+      jobs->submit([&] { textures = new Textures(ren, jobs); });
+  JobHandle loadShapes = jobs->submit([&] { shapes = new Shapes(ren, formt); });
+  // waiting on the pipelines runs the loads in the meantime
+  preparePipelines(pipelines);
+  jobs->wait({loadAssets, loadTextures, loadShapes});
+
   loadEntity();
 }
 
-void Entities::preparePipelines() {
-  MAI::Shader *vert = ren_->createShader(SHADERS_PATH "spvs/model.vspv");
-  MAI::Shader *frag = ren_->createShader(SHADERS_PATH "spvs/model.fspv");
-  pipeline_ = ren_->createPipeline({
-      .vert = vert,
-      .frag = frag,
-      .depthFormat = format,
-      .cullMode = MAI::CullMode::Back,
+void Entities::preparePipelines(PipelineRegistry *pipelines) {
+  // all three compile at once, get only waits for the slowest
+  PipelineEntry *model = pipelines->request({
+      .vert = SHADERS_PATH "model.vert",
+      .frag = SHADERS_PATH "model.frag",
+      .info = {.depthFormat = format, .cullMode = MAI::CullMode::Back},
   });
-  delete vert;
-  delete frag;
-
-  vert = ren_->createShader(SHADERS_PATH "spvs/shap.vspv");
-  frag = ren_->createShader(SHADERS_PATH "spvs/shap.fspv");
-  ShapePipeline_ = ren_->createPipeline({
-      .vert = vert,
-      .frag = frag,
-      .depthFormat = format,
-      .cullMode = MAI::CullMode::Back,
+  PipelineEntry *shape = pipelines->request({
+      .vert = SHADERS_PATH "shap.vert",
+      .frag = SHADERS_PATH "shap.frag",
+      .info = {.depthFormat = format, .cullMode = MAI::CullMode::Back},
   });
-  delete vert;
-  delete frag;
+  PipelineEntry *cull = pipelines->request({.comp = SHADERS_PATH "cull.comp"});
+
+  pipeline_ = pipelines->get(model);
+  ShapePipeline_ = pipelines->get(shape);
+  cullPipeline_ = pipelines->get(cull);
+}
+
+void Entities::watchResources() {
+  assets->watch();
+  textures->watch();
+}
+
+void Entities::cull(const EntityCullInfo &info) {
+  MAI_PROFILE_FUNCTION();
+
+  // reloaded models and textures have new meshes and bindless indices
+  const bool assetsChanged = assets->update();
+  if (textures->update() || assetsChanged)
+    instancesDirty = true;
+
+  // draw commands hold mesh pool offsets, which move when it's packed
+  if (instancesDirty ||
+      meshGeneration != assets->getMeshPool()->getGeneration())
+    rebuildInstances();
+
+  culled = uploadInstances();
+  if (!culled)
+    return;
+
+  MAI::CommandBuffer *buff = info.buff;
+  MAI::GpuZone zone(buff, "cull");
+
+  // reset the draws to zero instances, cull.comp counts them back up
+  buff->cmdCopyBuffer(culled->commands.buffer, culled->draws.buffer,
+                      drawCommands.size() *
+                          sizeof(MAI::DrawIndexedIndirectCommand));
+  buff->cmdBufferBarrier(culled->draws.buffer, VK_PIPELINE_STAGE_2_COPY_BIT,
+                         VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                         VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                         VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                             VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  struct PushConstant {
+    glm::vec4 planes[6];
+    uint64_t instances;
+    uint64_t items;
+    uint64_t bounds;
+    uint64_t draws;
+    uint64_t visible;
+    uint32_t itemCount;
+    uint32_t cullEnabled;
+  } pc{
+      .instances = ren_->gpuAddress(culled->instances.buffer),
+      .items = ren_->gpuAddress(culled->items.buffer),
+      .bounds = ren_->gpuAddress(culled->bounds.buffer),
+      .draws = ren_->gpuAddress(culled->draws.buffer),
+      .visible = ren_->gpuAddress(culled->visible.buffer),
+      .itemCount = (uint32_t)cullItems.size(),
+      .cullEnabled = frustumCulling,
+  };
+  extractFrustumPlanes(info.proj * info.view, pc.planes);
+
+  buff->bindComputePipeline(cullPipeline_);
+  buff->cmdPushConstant(&pc);
+  buff->cmdDispatchThreadGroups({.width = (pc.itemCount + 63) / 64});
+
+  buff->cmdBufferBarrier(culled->draws.buffer,
+                         VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                         VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                         VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+                         VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+  buff->cmdBufferBarrier(culled->visible.buffer,
+                         VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                         VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                         VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                         VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
 }
 
 void Entities::draw(EntityDrawInfo info) {
+  MAI_PROFILE_FUNCTION();
 
   drawInfo_ = info;
   MAI::CommandBuffer *buff = info.buff;
-  for (auto &entity : entities) {
-    EntityData &data = entity.entityData;
-    if (data.disable)
-      continue;
 
-    // transformation
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, data.pos);
-    model = glm::scale(model, data.scale);
-    // model = glm::toMat4(glm::quat(data.rotate));
-
-    // draw
-    if (entity.type == ASSET) {
-      buff->bindPipeline(pipeline_);
-      Model *md = assets->getModel(entity.addId);
-      md->draw(buff, info.proj, info.view, model);
-
-    } else if (entity.type == SHAPE) {
-      buff->bindPipeline(ShapePipeline_);
-      ShapeModule *sm = shapes->getShapeModule(entity.addId);
-      TextureModel *tm = textures->getTextureModel(entity.entityData.textureId);
-      struct PushConstant {
-        glm::mat4 proj;
-        glm::mat4 view;
-        glm::mat4 model;
-        float tiling;
-        uint32_t tex;
-        uint64_t vertx;
-      } pc{
-          .proj = info.proj,
-          .view = info.view,
-          .model = model,
-          .tiling = data.tiling,
-          .tex = tm != nullptr ? tm->diffuse->getIndex() : 0,
-          .vertx = ren_->gpuAddress(sm->vertBuff),
-      };
-
-      buff->cmdPushConstant(&pc);
-      buff->bindIndexBuffer(sm->indexBuff, 0, MAI::IndexType::Uint16);
-      buff->cmdDrawIndex(sm->indicesSize);
+  if (culled) {
+    const uint64_t instancesAddress = ren_->gpuAddress(culled->instances.buffer);
+    const uint64_t visibleAddress = ren_->gpuAddress(culled->visible.buffer);
+    MAI::Pipeline *bound = nullptr;
+
+    for (size_t b = 0; b < batches.size(); b++) {
+      const InstanceBatch &batch = batches[b];
+      MAI::Pipeline *pipeline = batch.type == ASSET ? pipeline_ : ShapePipeline_;
+      if (pipeline != bound) {
+        buff->bindPipeline(pipeline);
+        bound = pipeline;
+      }
+
+      if (batch.type == ASSET) {
+        // every model lives in the mesh pool, batches are sorted by type so
+        // all of them are one draw
+        uint32_t commandCount = batch.commandCount;
+        while (b + 1 < batches.size() && batches[b + 1].type == ASSET)
+          commandCount += batches[++b].commandCount;
+        assets->getMeshPool()->draw(buff, info.proj, info.view,
+                                    instancesAddress, visibleAddress,
+                                    culled->draws.buffer, batch.firstCommand,
+                                    commandCount);
+
+      } else if (batch.type == SHAPE) {
+        ShapeModule *sm = shapes->getShapeModule(batch.addId);
+        struct PushConstant {
+          glm::mat4 proj;
+          glm::mat4 view;
+          uint64_t vertx;
+          uint64_t instances;
+          uint64_t visible;
+        } pc{
+            .proj = info.proj,
+            .view = info.view,
+            .vertx = ren_->gpuAddress(sm->vertBuff),
+            .instances = instancesAddress,
+            .visible = visibleAddress,
+        };
+
+        buff->cmdPushConstant(&pc);
+        buff->bindIndexBuffer(sm->indexBuff, 0, MAI::IndexType::Uint16);
+        buff->cmdDrawIndexedIndirect(
+            culled->draws.buffer,
+            batch.firstCommand * sizeof(MAI::DrawIndexedIndirectCommand),
+            batch.commandCount);
+      }
     }
+    culled = nullptr;
   }
+  checkMouseClick();
   undoCheck();
 }
 
-void Entities::checkMouseClick() {
-  MouseState state = drawInfo_.mouse_state;
-  if (!state.pressedLeft)
+void Entities::rebuildInstances() {
+  MAI_PROFILE_FUNCTION();
+
+  // group by mesh so every (type, addId) pair is one instanced draw
+  std::vector<const Entity *> visible;
+  for (const auto &entity : entities)
+    if (!entity.entityData.disable)
+      visible.emplace_back(&entity);
+  std::stable_sort(visible.begin(), visible.end(),
+                   [](const Entity *a, const Entity *b) {
+                     if (a->type != b->type)
+                       return a->type < b->type;
+                     return a->addId < b->addId;
+                   });
+
+  instances.clear();
+  batches.clear();
+  drawCommands.clear();
+  commandBounds.clear();
+  cullItems.clear();
+  for (const Entity *entity : visible) {
+    const EntityData &data = entity->entityData;
+
+    const glm::mat4 model = entityTransform(data);
+
+    uint32_t tex = 0;
+    if (entity->type == ASSET) {
+      tex = assets->getModel(entity->addId)->getTextureIndex();
+    } else if (entity->type == SHAPE) {
+      TextureModel *tm = textures->getTextureModel(data.textureId);
+      // sets added while running may not have their diffuse loaded yet
+      tex = tm && tm->diffuse ? tm->diffuse->getIndex() : 0;
+    }
+
+    if (batches.empty() || batches.back().type != entity->type ||
+        batches.back().addId != entity->addId)
+      batches.emplace_back(InstanceBatch{
+          .type = entity->type,
+          .addId = entity->addId,
+          .firstInstance = (uint32_t)instances.size(),
+          .instanceCount = 0,
+      });
+    batches.back().instanceCount++;
+
+    instances.emplace_back(InstanceData{
+        .model = model,
+        .tiling = data.tiling,
+        .tex = tex,
+    });
+  }
+
+  // instance counts are final now, emit the indirect commands per batch.
+  // Every command gets its own instanceCount sized range of visible ids
+  uint32_t visibleOffset = 0;
+  for (auto &batch : batches) {
+    batch.firstCommand = (uint32_t)drawCommands.size();
+    if (batch.type == ASSET) {
+      Model *md = assets->getModel(batch.addId);
+      md->appendDrawCommands(drawCommands, 0, 0);
+      for (const Mesh &mesh : md->getMeshes())
+        commandBounds.emplace_back(mesh.sphere);
+    } else if (batch.type == SHAPE) {
+      ShapeModule *sm = shapes->getShapeModule(batch.addId);
+      drawCommands.emplace_back(MAI::DrawIndexedIndirectCommand{
+          .indexCount = sm->indicesSize,
+          .instanceCount = 0,
+      });
+      commandBounds.emplace_back(sm->sphere);
+    }
+    batch.commandCount = (uint32_t)drawCommands.size() - batch.firstCommand;
+
+    for (uint32_t c = batch.firstCommand; c < drawCommands.size(); c++) {
+      drawCommands[c].firstInstance = visibleOffset;
+      visibleOffset += batch.instanceCount;
+      for (uint32_t i = 0; i < batch.instanceCount; i++)
+        cullItems.emplace_back(CullItem{
+            .command = c,
+            .instance = batch.firstInstance + i,
+        });
+    }
+  }
+
+  updateBVH();
+
+  meshGeneration = assets->getMeshPool()->getGeneration();
+  instancesVersion++;
+  instancesDirty = false;
+}
+
+void Entities::updateBVH() {
+  MAI_PROFILE_FUNCTION();
+
+  std::vector<AABB> boxes(entities.size());
+  for (uint32_t i = 0; i < entities.size(); i++) {
+    const Entity &entity = entities[i];
+    const EntityData &data = entity.entityData;
+    if (data.disable)
+      continue;
+
+    const glm::mat4 model = entityTransform(data);
+    if (entity.type == ASSET)
+      boxes[i] = assets->getModel(entity.addId)->getBounds().transformed(model);
+    else if (entity.type == SHAPE)
+      boxes[i] = shapes->getShapeModule(entity.addId)->aabb.transformed(model);
+  }
+
+  bool rebuild = boxes.size() != entityBounds.size();
+  for (uint32_t i = 0; i < boxes.size() && !rebuild; i++) {
+    const AABB &a = boxes[i];
+    const AABB &b = entityBounds[i];
+    if (a.min == b.min && a.max == b.max)
+      continue;
+    // an entity got enabled or disabled, its id isn't in the tree
+    if (a.empty() || !bvh.refit(i, a))
+      rebuild = true;
+  }
+
+  entityBounds = std::move(boxes);
+  if (rebuild || bvh.needsRebuild())
+    bvh.build(entityBounds);
+}
+
+void Entities::reserveBuffer(SlotBuffer &slot, uint32_t size, MAIFlags usage,
+                             MAI::BufferStorage storage) {
+  if (slot.capacity >= size)
     return;
 
-  int width, height;
-  glfwGetFramebufferSize(window, &width, &height);
+  delete slot.buffer;
+  slot.buffer = ren_->createBuffer({
+      .usage = usage,
+      .storage = storage,
+      .size = size,
+  });
+  slot.capacity = size;
+}
 
-  float x = (2.0f * state.pos.x) / width;
-  float y = 1.0f - (2.0f * state.pos.y) / height;
-  float z = 1.0f;
+void Entities::uploadBuffer(SlotBuffer &slot, const void *data, uint32_t size,
+                            MAIFlags usage) {
+  reserveBuffer(slot, size, usage, MAI::HostVisible);
+  memcpy(ren_->getMappedPtr(slot.buffer, size), data, size);
+  ren_->flushMappedMemeory(slot.buffer, 0, size);
+}
 
-  // NDC -> view space
-  glm::vec4 rayClip = glm::vec4(x, y, -1.0f, 1.0f);
-  glm::vec4 rayEye = glm::inverse(drawInfo_.proj) * rayClip;
-  rayEye = glm::vec4(rayEye.x, rayEye.y, -1.0f, 0.0f);
+Entities::InstanceFrame *Entities::uploadInstances() {
+  if (instances.empty())
+    return nullptr;
+
+  // the slot's previous frame has finished, so its buffers are free to write
+  InstanceFrame &slot = instanceFrames_[ren_->getFrameIndex()];
+  if (slot.version == instancesVersion)
+    return &slot;
+
+  const uint32_t commandsSize =
+      drawCommands.size() * sizeof(MAI::DrawIndexedIndirectCommand);
+  const uint32_t itemsSize = cullItems.size() * sizeof(CullItem);
+
+  uploadBuffer(slot.instances, instances.data(),
+               instances.size() * sizeof(InstanceData), MAI::StorageBuffer);
+  uploadBuffer(slot.commands, drawCommands.data(), commandsSize,
+               MAI::StorageBuffer);
+  uploadBuffer(slot.bounds, commandBounds.data(),
+               commandBounds.size() * sizeof(glm::vec4), MAI::StorageBuffer);
+  uploadBuffer(slot.items, cullItems.data(), itemsSize, MAI::StorageBuffer);
+
+  reserveBuffer(slot.draws, commandsSize, MAI::IndirectBuffer,
+                MAI::StorageType_Device);
+  // one visible id per cull item at most
+  reserveBuffer(slot.visible, cullItems.size() * sizeof(uint32_t),
+                MAI::StorageBuffer, MAI::StorageType_Device);
+
+  slot.version = instancesVersion;
+  return &slot;
+}
 
-  // View space -> world space
-  glm::vec3 rayWorld =
-      glm::normalize(glm::vec3(glm::inverse(drawInfo_.view) * rayEye));
+void Entities::checkMouseClick() {
+  MouseState state = drawInfo_.mouse_state;
+  // pick once per press, holding the button drags the camera
+  const bool clicked = state.pressedLeft && !mouseWasPressed;
+  mouseWasPressed = state.pressedLeft;
+  if (!clicked || ImGui::GetIO().WantCaptureMouse)
+    return;
+
+  MAI_PROFILE_FUNCTION();
+
+  // mouse pos is [0, 1] with y up, the projection flips y for Vulkan
+  const float x = 2.0f * state.pos.x - 1.0f;
+  const float y = 1.0f - 2.0f * state.pos.y;
+
+  // far plane point -> world space, the ray starts at the camera
+  const glm::mat4 invViewProj = glm::inverse(drawInfo_.proj * drawInfo_.view);
+  const glm::vec4 farPoint = invViewProj * glm::vec4(x, y, 1.0f, 1.0f);
+  const glm::vec3 origin = drawInfo_.cameraPos;
+  const glm::vec3 rayWorld =
+      glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+
+  // entity boxes first, then the triangles of every entity the ray enters
+  // closer than the best hit so far
+  auto intersectTriangles = [&](uint32_t id, float maxT) {
+    // model space ray, dir isn't renormalized so t stays in world units
+    const Entity &entity = entities[id];
+    const glm::mat4 inv = glm::inverse(entityTransform(entity.entityData));
+    const glm::vec3 o = glm::vec3(inv * glm::vec4(origin, 1.0f));
+    const glm::vec3 d = glm::vec3(inv * glm::vec4(rayWorld, 0.0f));
+    if (entity.type == ASSET)
+      return assets->getModel(entity.addId)->getTriangles().raycast(o, d, maxT);
+    return shapes->getShapeModule(entity.addId)->triangles.raycast(o, d, maxT);
+  };
+  const RayHit hit =
+      pickTriangles ? bvh.raycast(origin, rayWorld, FLT_MAX, intersectTriangles)
+                    : bvh.raycast(origin, rayWorld);
+
+  if (hit.id != UINT32_MAX)
+    currentEntity = entities[hit.id].id;
 }
 
 void Entities::undoCheck() {
@@ -131,6 +414,9 @@ void Entities::undoCheck() {
   if (actions.empty())
     return;
 
+  if (mods[0] || mods[1])
+    instancesDirty = true;
+
   if (mods[0]) {
 
     if (currAction < 0)
@@ -221,6 +507,7 @@ void Entities::saveEntity() {
 void Entities::resetEntity() {
   entities.clear();
   actions.clear();
+  instancesDirty = true;
 }
 
 void Entities::loadEntity() {
@@ -252,9 +539,12 @@ void Entities::loadEntity() {
     entities.emplace_back(entity);
   }
   file.close();
+  instancesDirty = true;
 }
 
 void Entities::actionAdd(uint32_t id, ActionType type, EntityData data) {
+  // every add and edit goes through here right before it is applied
+  instancesDirty = true;
   if (actions.empty() || currAction == actions.size() - 1) {
     actions.emplace_back(Action{
         .type = type,
@@ -274,6 +564,9 @@ void Entities::actionAdd(uint32_t id, ActionType type, EntityData data) {
 }
 
 void Entities::guiWidget() {
+  ImGui::Checkbox("Frustum culling", &frustumCulling);
+  ImGui::Checkbox("Pick triangles", &pickTriangles);
+
   // assets
   auto models = assets->getModelInfos();
   ImGui::NewLine();
@@ -383,6 +676,8 @@ void Entities::entityWidget() {
     ImVec2 size = ImVec2(100, 100);
     auto texturesInfos = textures->getTextures();
     for (auto &it : texturesInfos) {
+      if (!it.diffuse)
+        continue;
       if (ImGui::ImageButton(it.name.c_str(), it.diffuse->getIndex(), size)) {
         actionAdd(entity->id, ENTITY, entity->entityData);
         data.textureId = it.id;
@@ -396,9 +691,15 @@ void Entities::entityWidget() {
 }
 
 Entities::~Entities() {
+  for (auto &it : instanceFrames_) {
+    delete it.instances.buffer;
+    delete it.commands.buffer;
+    delete it.bounds.buffer;
+    delete it.items.buffer;
+    delete it.draws.buffer;
+    delete it.visible.buffer;
+  }
   delete assets;
   delete textures;
-  delete pipeline_;
-  delete ShapePipeline_;
   delete shapes;
 }
@@ -0,0 +1,481 @@
+#include "envBaker.h"
+#include "UtilsCubemap.h"
+#include "jobSystem.h"
+#include "ktx2.h"
+#include "mipmap.h"
+#include "profiler.h"
+#include "stbi_image.h"
+#include "textureCache.h"
+#include "textureCompress.h"
+
+#include <cmath>
+
+namespace {
+constexpr float PI_F = 3.14159265358979f;
+// GGX samples per texel of a specular level, the source mips hide the
+// undersampling
+constexpr uint32_t SPECULAR_SAMPLES = 128;
+constexpr uint32_t BRDF_LUT_SAMPLES = 512;
+// faces are projected on SH at this size at most
+constexpr uint32_t SH_SOURCE_SIZE = 64;
+
+void runRows(JobSystem *jobs, uint32_t count, uint32_t grain,
+             const std::function<void(uint32_t, uint32_t)> &fn) {
+  if (jobs)
+    jobs->parallelFor(count, grain, fn);
+  else
+    fn(0, count);
+}
+
+// texel centre of a face to its direction, the Vulkan cube face selection
+// run backwards
+glm::vec3 texelDirection(uint32_t face, uint32_t x, uint32_t y,
+                         uint32_t size) {
+  const float s = 2.0f * (x + 0.5f) / size - 1.0f;
+  const float t = 2.0f * (y + 0.5f) / size - 1.0f;
+  switch (face) {
+  case 0:
+    return glm::normalize(glm::vec3(1.0f, -t, -s));
+  case 1:
+    return glm::normalize(glm::vec3(-1.0f, -t, s));
+  case 2:
+    return glm::normalize(glm::vec3(s, 1.0f, t));
+  case 3:
+    return glm::normalize(glm::vec3(s, -1.0f, -t));
+  case 4:
+    return glm::normalize(glm::vec3(s, -t, 1.0f));
+  default:
+    return glm::normalize(glm::vec3(-s, -t, -1.0f));
+  }
+}
+
+// direction to face and [0, 1] coordinates, the way the sampler picks them
+uint32_t directionToFace(const glm::vec3 &dir, float &u, float &v) {
+  const glm::vec3 a = glm::abs(dir);
+  uint32_t face;
+  float sc, tc, ma;
+  if (a.x >= a.y && a.x >= a.z) {
+    face = dir.x > 0.0f ? 0 : 1;
+    sc = dir.x > 0.0f ? -dir.z : dir.z;
+    tc = -dir.y;
+    ma = a.x;
+  } else if (a.y >= a.z) {
+    face = dir.y > 0.0f ? 2 : 3;
+    sc = dir.x;
+    tc = dir.y > 0.0f ? dir.z : -dir.z;
+    ma = a.y;
+  } else {
+    face = dir.z > 0.0f ? 4 : 5;
+    sc = dir.z > 0.0f ? dir.x : -dir.x;
+    tc = -dir.y;
+    ma = a.z;
+  }
+  u = 0.5f * (sc / ma + 1.0f);
+  v = 0.5f * (tc / ma + 1.0f);
+  return face;
+}
+
+// box filtered chain of the source faces, sampled trilinearly by direction.
+// Edges clamp to their own face, the seams are below what the prefilter
+// blurs anyway
+struct CubeChain {
+  CubeChain(const Bitmap &faces) {
+    size = (uint32_t)faces.w_;
+    const float *src = faces.view<float, 4>().data;
+    levels.emplace_back(src, src + (size_t)6 * size * size * 4);
+    for (uint32_t level = 1; mipSize(size, level - 1) > 1; level++) {
+      const uint32_t prevSize = mipSize(size, level - 1);
+      const uint32_t levelSize = mipSize(size, level);
+      const size_t prevFace = (size_t)prevSize * prevSize * 4;
+      std::vector<float> next;
+      next.reserve((size_t)6 * levelSize * levelSize * 4);
+      for (uint32_t face = 0; face < 6; face++) {
+        const std::vector<float> mip = downsampleRGBAF32(
+            levels.back().data() + face * prevFace, prevSize, prevSize);
+        next.insert(next.end(), mip.begin(), mip.end());
+      }
+      levels.emplace_back(std::move(next));
+    }
+  }
+
+  glm::vec3 fetch(uint32_t level, uint32_t face, float u, float v) const {
+    const uint32_t levelSize = mipSize(size, level);
+    const float *data =
+        levels[level].data() + (size_t)face * levelSize * levelSize * 4;
+    const float x = std::clamp(u * levelSize - 0.5f, 0.0f, levelSize - 1.0f);
+    const float y = std::clamp(v * levelSize - 0.5f, 0.0f, levelSize - 1.0f);
+    const uint32_t x0 = (uint32_t)x;
+    const uint32_t y0 = (uint32_t)y;
+    const uint32_t x1 = std::min(x0 + 1, levelSize - 1);
+    const uint32_t y1 = std::min(y0 + 1, levelSize - 1);
+    const float fx = x - x0;
+    const float fy = y - y0;
+    auto texel = [&](uint32_t tx, uint32_t ty) {
+      const float *p = data + ((size_t)ty * levelSize + tx) * 4;
+      return glm::vec3(p[0], p[1], p[2]);
+    };
+    const glm::vec3 top = texel(x0, y0) * (1.0f - fx) + texel(x1, y0) * fx;
+    const glm::vec3 bottom =
+        texel(x0, y1) * (1.0f - fx) + texel(x1, y1) * fx;
+    return top * (1.0f - fy) + bottom * fy;
+  }
+
+  glm::vec3 sample(const glm::vec3 &dir, float lod) const {
+    float u, v;
+    const uint32_t face = directionToFace(dir, u, v);
+    lod = std::clamp(lod, 0.0f, (float)levels.size() - 1.0f);
+    const uint32_t level = (uint32_t)lod;
+    const float f = lod - level;
+    const glm::vec3 c = fetch(level, face, u, v);
+    if (f == 0.0f)
+      return c;
+    return c * (1.0f - f) + fetch(level + 1, face, u, v) * f;
+  }
+
+  uint32_t size;
+  std::vector<std::vector<float>> levels;
+};
+
+glm::vec2 hammersley(uint32_t i, uint32_t count) {
+  uint32_t bits = i;
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return glm::vec2((float)i / count, bits * 2.3283064365386963e-10f);
+}
+
+// GGX half vector around +z, alpha is roughness squared
+glm::vec3 importanceSampleGGX(const glm::vec2 &xi, float alpha) {
+  const float phi = 2.0f * PI_F * xi.x;
+  const float cosTheta =
+      std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+  const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+  return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi),
+                   cosTheta);
+}
+
+float distributionGGX(float NdotH, float alpha) {
+  const float a2 = alpha * alpha;
+  const float d = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+  return a2 / (PI_F * d * d);
+}
+
+// Smith with the k of image based lighting
+float geometrySmith(float NdotV, float NdotL, float alpha) {
+  const float k = alpha / 2.0f;
+  return NdotV / (NdotV * (1.0f - k) + k) * NdotL / (NdotL * (1.0f - k) + k);
+}
+
+struct LobeSample {
+  // around +z
+  glm::vec3 dir;
+  float weight;
+  float lod;
+};
+
+// the samples are the same for every texel with n = v = r, only their
+// frame changes. Each one reads the mip whose texels cover its solid angle
+std::vector<LobeSample> buildLobe(float roughness, uint32_t sourceSize) {
+  const float alpha = roughness * roughness;
+  const float texelSolidAngle = 4.0f * PI_F / (6.0f * sourceSize * sourceSize);
+  std::vector<LobeSample> lobe;
+  for (uint32_t i = 0; i < SPECULAR_SAMPLES; i++) {
+    const glm::vec3 h = importanceSampleGGX(hammersley(i, SPECULAR_SAMPLES),
+                                            alpha);
+    const glm::vec3 l(2.0f * h.z * h.x, 2.0f * h.z * h.y,
+                      2.0f * h.z * h.z - 1.0f);
+    if (l.z <= 0.0f)
+      continue;
+    // pdf of l is D * n.h / (4 v.h), and v.h = n.h here
+    const float pdf = distributionGGX(h.z, alpha) / 4.0f;
+    const float sampleSolidAngle = 1.0f / (SPECULAR_SAMPLES * pdf + 1e-4f);
+    lobe.emplace_back(LobeSample{
+        .dir = l,
+        .weight = l.z,
+        .lod = 0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f,
+    });
+  }
+  return lobe;
+}
+
+void writeTexel(float *dst, const glm::vec3 &c) {
+  dst[0] = c.x;
+  dst[1] = c.y;
+  dst[2] = c.z;
+  dst[3] = 1.0f;
+}
+
+// the 9 coefficients of the radiance, solid angle weighted
+struct SH9 {
+  glm::vec3 c[9];
+};
+
+void shBasis(const glm::vec3 &d, float out[9]) {
+  out[0] = 0.282095f;
+  out[1] = 0.488603f * d.y;
+  out[2] = 0.488603f * d.z;
+  out[3] = 0.488603f * d.x;
+  out[4] = 1.092548f * d.x * d.y;
+  out[5] = 1.092548f * d.y * d.z;
+  out[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+  out[7] = 1.092548f * d.x * d.z;
+  out[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+SH9 projectSH9(const CubeChain &chain, JobSystem *jobs) {
+  uint32_t level = 0;
+  while (mipSize(chain.size, level) > SH_SOURCE_SIZE)
+    level++;
+  const uint32_t size = mipSize(chain.size, level);
+  const float *data = chain.levels[level].data();
+
+  SH9 faceSums[6] = {};
+  runRows(jobs, 6, 1, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t face = begin; face < end; face++)
+      for (uint32_t y = 0; y < size; y++)
+        for (uint32_t x = 0; x < size; x++) {
+          const float s = 2.0f * (x + 0.5f) / size - 1.0f;
+          const float t = 2.0f * (y + 0.5f) / size - 1.0f;
+          const float d = 1.0f + s * s + t * t;
+          const float solidAngle =
+              4.0f / (size * size * d * std::sqrt(d));
+          const float *p = data + (((size_t)face * size + y) * size + x) * 4;
+          const glm::vec3 radiance(p[0], p[1], p[2]);
+          float basis[9];
+          shBasis(texelDirection(face, x, y, size), basis);
+          for (uint32_t i = 0; i < 9; i++)
+            faceSums[face].c[i] += radiance * (basis[i] * solidAngle);
+        }
+  });
+  SH9 sh = {};
+  for (const SH9 &sum : faceSums)
+    for (uint32_t i = 0; i < 9; i++)
+      sh.c[i] += sum.c[i];
+  return sh;
+}
+}; // namespace
+
+EnvCube bakeIrradiance(const Bitmap &faces, JobSystem *jobs) {
+  MAI_PROFILE_FUNCTION();
+  const CubeChain chain(faces);
+  const SH9 sh = projectSH9(chain, jobs);
+  // cosine lobe convolution per band, then / pi for the lambert term
+  constexpr float band[9] = {1.0f,        2.0f / 3.0f, 2.0f / 3.0f,
+                             2.0f / 3.0f, 0.25f,       0.25f,
+                             0.25f,       0.25f,       0.25f};
+
+  const uint32_t size = ENV_IRRADIANCE_SIZE;
+  EnvCube cube{.size = size};
+  cube.levels.emplace_back((size_t)6 * size * size * 4);
+  float *dst = cube.levels[0].data();
+  runRows(jobs, 6 * size, 16, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t row = begin; row < end; row++)
+      for (uint32_t x = 0; x < size; x++) {
+        float basis[9];
+        shBasis(texelDirection(row / size, x, row % size, size), basis);
+        glm::vec3 irradiance(0.0f);
+        for (uint32_t i = 0; i < 9; i++)
+          irradiance += sh.c[i] * (band[i] * basis[i]);
+        writeTexel(dst + ((size_t)row * size + x) * 4,
+                   glm::max(irradiance, glm::vec3(0.0f)));
+      }
+  });
+  return cube;
+}
+
+EnvCube bakeSpecular(const Bitmap &faces, JobSystem *jobs) {
+  MAI_PROFILE_FUNCTION();
+  const CubeChain chain(faces);
+  const uint32_t size = std::min(chain.size, ENV_SPECULAR_SIZE);
+  const uint32_t levelCount =
+      std::min(ENV_SPECULAR_LEVELS, MAI::getMipLevelCount(size, size));
+  // the mirror level reads the source at its own resolution
+  const float baseLod = std::log2((float)chain.size / size);
+
+  EnvCube cube{.size = size};
+  cube.levels.resize(levelCount);
+  for (uint32_t level = 0; level < levelCount; level++) {
+    const uint32_t levelSize = mipSize(size, level);
+    const float roughness =
+        levelCount > 1 ? (float)level / (levelCount - 1) : 0.0f;
+    const std::vector<LobeSample> lobe =
+        level ? buildLobe(roughness, chain.size) : std::vector<LobeSample>{};
+    cube.levels[level].resize((size_t)6 * levelSize * levelSize * 4);
+    float *dst = cube.levels[level].data();
+    runRows(jobs, 6 * levelSize, 4, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t row = begin; row < end; row++)
+        for (uint32_t x = 0; x < levelSize; x++) {
+          const glm::vec3 n =
+              texelDirection(row / levelSize, x, row % levelSize, levelSize);
+          float *texel = dst + ((size_t)row * levelSize + x) * 4;
+          if (lobe.empty()) {
+            writeTexel(texel, chain.sample(n, baseLod));
+            continue;
+          }
+          const glm::vec3 up = std::fabs(n.z) < 0.999f
+                                   ? glm::vec3(0.0f, 0.0f, 1.0f)
+                                   : glm::vec3(1.0f, 0.0f, 0.0f);
+          const glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+          const glm::vec3 bitangent = glm::cross(n, tangent);
+          glm::vec3 sum(0.0f);
+          float weight = 0.0f;
+          for (const LobeSample &s : lobe) {
+            const glm::vec3 l =
+                tangent * s.dir.x + bitangent * s.dir.y + n * s.dir.z;
+            sum += chain.sample(l, s.lod) * s.weight;
+            weight += s.weight;
+          }
+          writeTexel(texel, sum / weight);
+        }
+    });
+  }
+  return cube;
+}
+
+std::vector<float> bakeBrdfLut(uint32_t size, JobSystem *jobs) {
+  MAI_PROFILE_FUNCTION();
+  std::vector<float> lut((size_t)size * size * 2);
+  runRows(jobs, size, 8, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t y = begin; y < end; y++) {
+      const float alpha = std::pow((y + 0.5f) / size, 2.0f);
+      for (uint32_t x = 0; x < size; x++) {
+        const float NdotV = (x + 0.5f) / size;
+        const glm::vec3 v(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+        float scale = 0.0f;
+        float bias = 0.0f;
+        for (uint32_t i = 0; i < BRDF_LUT_SAMPLES; i++) {
+          const glm::vec3 h =
+              importanceSampleGGX(hammersley(i, BRDF_LUT_SAMPLES), alpha);
+          const float VdotH = glm::dot(v, h);
+          const glm::vec3 l = h * (2.0f * VdotH) - v;
+          if (l.z <= 0.0f || VdotH <= 0.0f)
+            continue;
+          const float visibility = geometrySmith(NdotV, l.z, alpha) * VdotH /
+                                   (h.z * NdotV);
+          const float fresnel = std::pow(1.0f - VdotH, 5.0f);
+          scale += (1.0f - fresnel) * visibility;
+          bias += fresnel * visibility;
+        }
+        float *dst = lut.data() + ((size_t)y * size + x) * 2;
+        dst[0] = scale / BRDF_LUT_SAMPLES;
+        dst[1] = bias / BRDF_LUT_SAMPLES;
+      }
+    }
+  });
+  return lut;
+}
+
+std::vector<std::vector<uint8_t>> encodeEnvCube(const EnvCube &cube,
+                                                JobSystem *jobs) {
+  MAI_PROFILE_FUNCTION();
+  const uint32_t levelCount = (uint32_t)cube.levels.size();
+  std::vector<std::vector<uint8_t>> faceLevels(6 * levelCount);
+  runRows(jobs, 6 * levelCount, 1, [&](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; i++) {
+      const uint32_t level = i / 6;
+      const uint32_t size = mipSize(cube.size, level);
+      faceLevels[i] = encodeBC6H(cube.levels[level].data() +
+                                     (size_t)(i % 6) * size * size * 4,
+                                 size, size);
+    }
+  });
+  std::vector<std::vector<uint8_t>> levels(levelCount);
+  for (uint32_t i = 0; i < 6 * levelCount; i++)
+    levels[i / 6].insert(levels[i / 6].end(), faceLevels[i].begin(),
+                         faceLevels[i].end());
+  return levels;
+}
+
+std::vector<uint8_t> encodeBrdfLut(const std::vector<float> &lut,
+                                   uint32_t size) {
+  std::vector<uint8_t> rgba((size_t)size * size * 4);
+  for (size_t i = 0; i < (size_t)size * size; i++) {
+    rgba[i * 4 + 0] =
+        (uint8_t)std::lround(std::clamp(lut[i * 2], 0.0f, 1.0f) * 255.0f);
+    rgba[i * 4 + 1] =
+        (uint8_t)std::lround(std::clamp(lut[i * 2 + 1], 0.0f, 1.0f) * 255.0f);
+    rgba[i * 4 + 3] = 255;
+  }
+  return encodeBC5(rgba.data(), size, size);
+}
+
+uint64_t hashEnvSource(uint64_t cubeHash) {
+  const uint32_t salt[4] = {ENV_BAKE_VERSION, ENV_IRRADIANCE_SIZE,
+                            ENV_SPECULAR_SIZE, ENV_SPECULAR_LEVELS};
+  return hashBytes(salt, sizeof(salt), cubeHash);
+}
+
+uint64_t hashBrdfLut() {
+  const uint32_t salt[3] = {ENV_BAKE_VERSION, ENV_BRDF_LUT_SIZE,
+                            BRDF_LUT_SAMPLES};
+  return hashBytes(salt, sizeof(salt));
+}
+
+bool writeEnvCube(const std::string &path, uint64_t sourceHash,
+                  const EnvCube &cube,
+                  const std::vector<std::vector<uint8_t>> &levels) {
+  return writeKtx2(path,
+                   {
+                       .format = MAI::Format_BC6H_UF,
+                       .width = cube.size,
+                       .height = cube.size,
+                       .faceCount = 6,
+                       .levelCount = (uint32_t)levels.size(),
+                       .sourceHash = sourceHash,
+                   },
+                   levels);
+}
+
+bool writeBrdfLut(const std::string &path, const std::vector<uint8_t> &blocks) {
+  return writeKtx2(path,
+                   {
+                       .format = MAI::Format_BC5,
+                       .width = ENV_BRDF_LUT_SIZE,
+                       .height = ENV_BRDF_LUT_SIZE,
+                       .sourceHash = hashBrdfLut(),
+                   },
+                   {blocks});
+}
+
+bool cookEnvironment(const std::string &path, JobSystem *jobs, bool force) {
+  MAI_PROFILE_FUNCTION();
+  const uint64_t sourceHash =
+      hashEnvSource(hashTextureSource(path, MAI::Format_BC6H_UF));
+  if (!force) {
+    Ktx2View irradiance, specular;
+    if (irradiance.open(path + ENV_IRRADIANCE_EXTENSION, sourceHash) &&
+        specular.open(path + ENV_SPECULAR_EXTENSION, sourceHash))
+      return true;
+  }
+
+  int w, h;
+  float *img = stbi_loadf(path.c_str(), &w, &h, nullptr, 4);
+  if (!img)
+    return false;
+  const Bitmap faces = convertEquirectangularMapToCubeMapFaces(
+      Bitmap(w, h, 4, eBitmapFormat_Float, img), jobs);
+  stbi_image_free(img);
+
+  const EnvCube irradiance = bakeIrradiance(faces, jobs);
+  const EnvCube specular = bakeSpecular(faces, jobs);
+  const bool irradianceWritten =
+      writeEnvCube(path + ENV_IRRADIANCE_EXTENSION, sourceHash, irradiance,
+                   encodeEnvCube(irradiance, jobs));
+  const bool specularWritten =
+      writeEnvCube(path + ENV_SPECULAR_EXTENSION, sourceHash, specular,
+                   encodeEnvCube(specular, jobs));
+  return irradianceWritten && specularWritten;
+}
+
+bool cookBrdfLut(const std::string &path, JobSystem *jobs, bool force) {
+  MAI_PROFILE_FUNCTION();
+  if (!force) {
+    Ktx2View view;
+    if (view.open(path, hashBrdfLut()))
+      return true;
+  }
+  return writeBrdfLut(path, encodeBrdfLut(bakeBrdfLut(ENV_BRDF_LUT_SIZE, jobs),
+                                          ENV_BRDF_LUT_SIZE));
+}
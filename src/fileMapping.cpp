@@ -0,0 +1,47 @@
+#include "fileMapping.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string &path) {
+  close();
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *mapping =
+        mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      data = static_cast<const uint8_t *>(mapping);
+      size = (size_t)st.st_size;
+    }
+  }
+  ::close(fd);
+  return data != nullptr;
+}
+
+void MappedFile::close() {
+  if (data)
+    munmap(const_cast<uint8_t *>(data), size);
+  data = nullptr;
+  size = 0;
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint64_t hashFile(const std::string &path, uint64_t hash) {
+  MappedFile file;
+  if (!file.open(path))
+    return hash;
+  return hashBytes(file.data, file.size, hash);
+}
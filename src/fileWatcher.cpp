@@ -0,0 +1,96 @@
+#include "fileWatcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+void addChanged(std::vector<std::string> &changed, std::string path) {
+  if (std::find(changed.begin(), changed.end(), path) == changed.end())
+    changed.emplace_back(std::move(path));
+}
+}; // namespace
+
+FileWatcher::FileWatcher(const std::string &dir, bool recursive)
+    : recursive_(recursive) {
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "inotify unavailable: " << strerror(errno) << std::endl;
+    return;
+  }
+  addWatch(dir.empty() || dir.back() == '/' ? dir : dir + "/", nullptr);
+  if (dirs.empty()) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+FileWatcher::~FileWatcher() {
+  if (fd >= 0)
+    close(fd);
+}
+
+void FileWatcher::addWatch(const std::string &dir,
+                           std::vector<std::string> *changed) {
+  uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+  if (recursive_)
+    mask |= IN_CREATE;
+  const int wd = inotify_add_watch(fd, dir.c_str(), mask);
+  if (wd < 0) {
+    std::cerr << "can't watch " << dir << ": " << strerror(errno)
+              << std::endl;
+    return;
+  }
+  dirs[wd] = dir;
+  if (!recursive_)
+    return;
+
+  std::error_code error;
+  for (const auto &entry : fs::directory_iterator(dir, error)) {
+    if (entry.is_directory())
+      addWatch(entry.path().string() + "/", changed);
+    else if (changed && entry.is_regular_file())
+      addChanged(*changed, entry.path().string());
+  }
+}
+
+std::vector<std::string> FileWatcher::poll() {
+  std::vector<std::string> changed;
+  if (fd < 0)
+    return changed;
+
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    const ssize_t size = read(fd, buffer, sizeof(buffer));
+    // EAGAIN once the queue is empty
+    if (size <= 0)
+      break;
+    for (ssize_t offset = 0; offset < size;) {
+      const inotify_event *event =
+          reinterpret_cast<const inotify_event *>(buffer + offset);
+      offset += sizeof(inotify_event) + event->len;
+      if (event->mask & IN_IGNORED) {
+        dirs.erase(event->wd);
+        continue;
+      }
+      auto it = dirs.find(event->wd);
+      if (it == dirs.end() || !event->len)
+        continue;
+      const std::string path = it->second + event->name;
+      if (event->mask & IN_ISDIR) {
+        if (recursive_ && event->mask & (IN_CREATE | IN_MOVED_TO))
+          addWatch(path + "/", &changed);
+        continue;
+      }
+      // created files are reported once they're closed
+      if (!(event->mask & IN_CREATE))
+        addChanged(changed, path);
+    }
+  }
+  return changed;
+}
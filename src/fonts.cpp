@@ -5,9 +5,10 @@
 
 #include "stbi_image.h"
 
-FontRenderer::FontRenderer(MAI::Renderer *ren, uint32_t width, uint32_t height,
-                           VkFormat format)
-    : ren_(ren), screenWidht(width), screenHeight(height), format(format) {
+FontRenderer::FontRenderer(MAI::Renderer *ren, PipelineRegistry *pipelines,
+                           uint32_t width, uint32_t height, VkFormat format)
+    : ren_(ren), pipelines_(pipelines), screenWidht(width),
+      screenHeight(height), format(format) {
   loadFonts();
   loadResources();
 }
@@ -78,21 +79,20 @@ void FontRenderer::loadResources() {
       .usage = MAI::Sampled_Bit,
   });
 
-  vert_ = ren_->createShader(SHADERS_PATH "spvs/font.vspv");
-  frag_ = ren_->createShader(SHADERS_PATH "spvs/font.fspv");
-  pipeline_ = ren_->createPipeline({
-      .vert = vert_,
-      .frag = frag_,
-      .color =
+  pipeline_ = pipelines_->get(pipelines_->request({
+      .vert = SHADERS_PATH "spvs/font.vspv",
+      .frag = SHADERS_PATH "spvs/font.fspv",
+      .info =
           {
-              .blendEnable = true,
-              .srcColorBlend = MAI::Src_Alpha,
-              .dstColorBlend = MAI::Minus_Src_Alpha,
+              .color =
+                  {
+                      .blendEnable = true,
+                      .srcColorBlend = MAI::Src_Alpha,
+                      .dstColorBlend = MAI::Minus_Src_Alpha,
+                  },
+              .depthFormat = format,
           },
-      .depthFormat = format,
-  });
-  delete vert_;
-  delete frag_;
+  }));
 }
 
 void FontRenderer::populateVertices(const char *text,
@@ -158,7 +158,8 @@ void FontRenderer::drawDynamicText(MAI::CommandBuffer *buff, const char *text,
 
   } else {
     if (it->second.vertices_size != vertices2.size()) {
-      garbeBuffers.push_back(it->second.buffer);
+      // frames in flight may still draw the old text
+      ren_->deferDelete(it->second.buffer);
       vertBuffer = ren_->createBuffer({
           .usage = MAI::StorageBuffer,
           .storage = MAI::StorageType_Device,
@@ -214,16 +215,9 @@ void FontRenderer::draw(MAI::CommandBuffer *buff) {
   stopInserting = true;
 }
 
-void FontRenderer::clearGarbge() {
-  for (auto &it : garbeBuffers)
-    delete it;
-  garbeBuffers.clear();
-}
-
 FontRenderer::~FontRenderer() {
   for (auto &it : dynamicBuffers)
     delete it.second.buffer;
   delete buffer_;
-  delete pipeline_;
   delete texture;
 }
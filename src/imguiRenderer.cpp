@@ -1,4 +1,5 @@
 #include "imguiRenderer.h"
+#include "profiler.h"
 #include <iostream>
 
 struct ImGuiRendererImpl {
@@ -7,12 +8,7 @@ struct ImGuiRendererImpl {
 
 void ImGuiRenderer::createPipeline() {
   const uint32_t nonLinearColorSpace = 1u;
-  MAI::Shader *vert_ = ren_->createShader(SHADERS_PATH "spvs/imgui.vspv");
-  MAI::Shader *frag_ = ren_->createShader(SHADERS_PATH "spvs/imgui.fspv");
-
   MAI::PipelineInfo info = {
-      .vert = vert_,
-      .frag = frag_,
       .specInfo =
           {
               .enteries = {{.constantID = 0,
@@ -31,9 +27,11 @@ void ImGuiRenderer::createPipeline() {
   if ((format & VK_FORMAT_UNDEFINED) == 0) {
     info.depthFormat = format;
   }
-  pipeline_ = ren_->createPipeline(info);
-  delete vert_;
-  delete frag_;
+  pipelineEntry_ = pipelines_->request({
+      .vert = SHADERS_PATH "spvs/imgui.vspv",
+      .frag = SHADERS_PATH "spvs/imgui.fspv",
+      .info = info,
+  });
 }
 
 void ImGuiRenderer::beginFrame(const MAI::Dimissions &dim) {
@@ -43,13 +41,16 @@ void ImGuiRenderer::beginFrame(const MAI::Dimissions &dim) {
   io.IniFilename = nullptr;
 
   if (!pipeline_)
-    createPipeline();
+    pipeline_ = pipelines_->get(pipelineEntry_);
 
-  ImGui_ImplGlfw_NewFrame();
+  // headless apps have no platform backend, imgui keeps its default delta
+  if (window)
+    ImGui_ImplGlfw_NewFrame();
   ImGui::NewFrame();
 }
 
 void ImGuiRenderer::endFrame(MAI::CommandBuffer *buff) {
+  MAI_PROFILE_FUNCTION();
   ImGui::EndFrame();
   ImGui::Render();
 
@@ -119,8 +120,9 @@ void ImGuiRenderer::endFrame(MAI::CommandBuffer *buff) {
   DrawableData &drawableData = drawables_[frameIndex];
   frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
 
+  // a frame in flight may still read the old buffers
   if (drawableData.numAllocateIndices_ < dd->TotalIdxCount) {
-    delete drawableData.ib_;
+    ren_->deferDelete(drawableData.ib_);
     drawableData.ib_ = ren_->createBuffer({
         .usage = MAI::IndexBuffer,
         .storage = MAI::HostVisible,
@@ -130,7 +132,7 @@ void ImGuiRenderer::endFrame(MAI::CommandBuffer *buff) {
   }
 
   if (drawableData.numAllocateVertices_ < dd->TotalVtxCount) {
-    delete drawableData.vb_;
+    ren_->deferDelete(drawableData.vb_);
     drawableData.vb_ = ren_->createBuffer({
         .usage = MAI::StorageBuffer,
         .storage = MAI::HostVisible,
@@ -205,10 +207,11 @@ void ImGuiRenderer::endFrame(MAI::CommandBuffer *buff) {
   }
 }
 
-ImGuiRenderer::ImGuiRenderer(MAI::Renderer *ren, GLFWwindow *win,
-                             VkFormat format, float fontSize)
-    : ren_(ren), window(win), fontSize(fontSize), pimpl_(new ImGuiRendererImpl),
-      format(format) {
+ImGuiRenderer::ImGuiRenderer(MAI::Renderer *ren, PipelineRegistry *pipelines,
+                             GLFWwindow *win, VkFormat format, float fontSize)
+    : ren_(ren), pipelines_(pipelines), window(win), fontSize(fontSize),
+      pimpl_(new ImGuiRendererImpl), format(format) {
+  createPipeline();
   ImGui::CreateContext();
   ImGuiIO &io = ImGui::GetIO();
   io.BackendRendererName = "imgui-mai";
@@ -217,7 +220,8 @@ ImGuiRenderer::ImGuiRenderer(MAI::Renderer *ren, GLFWwindow *win,
   io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
   io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
 
-  ImGui_ImplGlfw_InitForOther(window, window ? true : false);
+  if (window)
+    ImGui_ImplGlfw_InitForOther(window, true);
 }
 
 ImGuiRenderer::~ImGuiRenderer() {
@@ -228,7 +232,7 @@ ImGuiRenderer::~ImGuiRenderer() {
   for (auto &it : pimpl_->textures_)
     delete it;
 
-  delete pipeline_;
-  ImGui_ImplGlfw_Shutdown();
+  if (window)
+    ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
 }
@@ -0,0 +1,171 @@
+#include "jobSystem.h"
+#include "profiler.h"
+#include <algorithm>
+
+struct Job {
+  std::function<void()> fn;
+  // dependencies still running, plus one while submit is adding them
+  std::atomic<uint32_t> unfinished = 1;
+  std::atomic<bool> done = false;
+  // guards done against jobs being added to continuations
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Job>> continuations;
+};
+
+namespace {
+// pool and queue of the worker running on this thread, -1 outside any pool
+thread_local JobSystem *currentSystem = nullptr;
+thread_local int32_t currentIndex = -1;
+}; // namespace
+
+bool JobHandle::isDone() const {
+  return !job || job->done.load(std::memory_order_acquire);
+}
+
+JobSystem::JobSystem(uint32_t workerCount) {
+  if (workerCount == 0) {
+    const uint32_t hardware = std::thread::hardware_concurrency();
+    workerCount = hardware > 1 ? hardware - 1 : 1;
+  }
+  for (uint32_t i = 0; i < workerCount; i++)
+    queues.emplace_back(std::make_unique<Queue>());
+  for (uint32_t i = 0; i < workerCount; i++)
+    workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &it : workers)
+    it.join();
+}
+
+void JobSystem::workerLoop(uint32_t index) {
+  MAI_PROFILE_THREAD("job worker");
+  currentSystem = this;
+  currentIndex = (int32_t)index;
+  while (true) {
+    if (runOne(currentIndex))
+      continue;
+    // queued work is drained before stopping
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock, [&] { return stopping || queued.load() > 0; });
+    if (stopping && queued.load() == 0)
+      return;
+  }
+}
+
+JobHandle JobSystem::submit(std::function<void()> fn,
+                            const std::vector<JobHandle> &deps) {
+  std::shared_ptr<Job> job = std::make_shared<Job>();
+  job->fn = std::move(fn);
+  for (const JobHandle &dep : deps) {
+    if (!dep.valid())
+      continue;
+    std::lock_guard<std::mutex> lock(dep.job->mutex);
+    if (dep.job->done.load())
+      continue;
+    job->unfinished++;
+    dep.job->continuations.emplace_back(job);
+  }
+  if (job->unfinished.fetch_sub(1) == 1)
+    schedule(job);
+  return {job};
+}
+
+void JobSystem::schedule(std::shared_ptr<Job> job) {
+  // workers keep what they spawn, it's likely to touch the same data
+  const uint32_t index = currentSystem == this
+                             ? (uint32_t)currentIndex
+                             : nextQueue.fetch_add(1) % queues.size();
+  {
+    std::lock_guard<std::mutex> lock(queues[index]->mutex);
+    queues[index]->jobs.emplace_back(std::move(job));
+  }
+  queued++;
+  {
+    // a worker checking queued under the lock can't miss this notify
+    std::lock_guard<std::mutex> lock(sleepMutex);
+  }
+  wake.notify_one();
+}
+
+std::shared_ptr<Job> JobSystem::pop(int32_t index) {
+  std::shared_ptr<Job> job;
+  const uint32_t count = (uint32_t)queues.size();
+  if (index >= 0) {
+    Queue &own = *queues[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.jobs.empty()) {
+      job = std::move(own.jobs.back());
+      own.jobs.pop_back();
+      return job;
+    }
+  }
+  // steal the oldest job, the one furthest from what its owner works on
+  const uint32_t start = index >= 0 ? (uint32_t)index + 1 : 0;
+  for (uint32_t i = 0; i < count; i++) {
+    Queue &victim = *queues[(start + i) % count];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.front());
+      victim.jobs.pop_front();
+      return job;
+    }
+  }
+  return job;
+}
+
+bool JobSystem::runOne(int32_t index) {
+  std::shared_ptr<Job> job = pop(index);
+  if (!job)
+    return false;
+  queued--;
+  job->fn();
+  finish(job);
+  return true;
+}
+
+void JobSystem::finish(const std::shared_ptr<Job> &job) {
+  std::vector<std::shared_ptr<Job>> continuations;
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->done.store(true, std::memory_order_release);
+    continuations.swap(job->continuations);
+  }
+  // handles can outlive the job by a lot, don't keep its captures around
+  job->fn = nullptr;
+  for (auto &next : continuations)
+    if (next->unfinished.fetch_sub(1) == 1)
+      schedule(std::move(next));
+}
+
+void JobSystem::wait(const JobHandle &handle) {
+  const int32_t index = currentSystem == this ? currentIndex : -1;
+  while (!handle.isDone())
+    if (!runOne(index))
+      std::this_thread::yield();
+}
+
+void JobSystem::wait(const std::vector<JobHandle> &handles) {
+  for (const JobHandle &handle : handles)
+    wait(handle);
+}
+
+void JobSystem::parallelFor(
+    uint32_t count, uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)> &fn) {
+  if (count == 0)
+    return;
+  grain = std::max(grain, 1u);
+  std::vector<JobHandle> chunks;
+  for (uint32_t begin = grain; begin < count; begin += grain) {
+    const uint32_t end = std::min(begin + grain, count);
+    chunks.emplace_back(submit([&fn, begin, end] { fn(begin, end); }));
+  }
+  fn(0, std::min(grain, count));
+  wait(chunks);
+}
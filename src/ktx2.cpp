@@ -0,0 +1,271 @@
+#include "ktx2.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr uint8_t KTX2_IDENTIFIER[12] = {0xAB, 'K',  'T',  'X', ' ',  '2',
+                                         '0',  0xBB, '\r', '\n', 0x1A, '\n'};
+
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80);
+
+struct Ktx2LevelIndex {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+// Khronos data format descriptor values for the formats we cook
+struct FormatInfo {
+  VkFormat vkFormat;
+  uint8_t colorModel;
+  uint8_t transfer;
+  // one sample per channel stored in the 128 bit block
+  uint32_t sampleCount;
+  uint8_t channels[2];
+  uint8_t qualifiers;
+  uint32_t upper;
+};
+
+constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+constexpr uint8_t KHR_DF_SAMPLE_FLOAT = 0x80;
+
+bool getFormatInfo(MAI::TextureFormat format, FormatInfo &info) {
+  switch (format) {
+  case MAI::Format_BC7_S:
+    info = {VK_FORMAT_BC7_SRGB_BLOCK, 134, KHR_DF_TRANSFER_SRGB, 1, {0}, 0,
+            UINT32_MAX};
+    return true;
+  case MAI::Format_BC5:
+    info = {VK_FORMAT_BC5_UNORM_BLOCK,
+            132,
+            KHR_DF_TRANSFER_LINEAR,
+            2,
+            {0, 1},
+            0,
+            UINT32_MAX};
+    return true;
+  case MAI::Format_BC6H_UF:
+    info = {VK_FORMAT_BC6H_UFLOAT_BLOCK,
+            133,
+            KHR_DF_TRANSFER_LINEAR,
+            1,
+            {0},
+            KHR_DF_SAMPLE_FLOAT,
+            0x3F800000}; // 1.0f
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::vector<uint32_t> buildDfd(const FormatInfo &info) {
+  const uint32_t blockSize = 24 + 16 * info.sampleCount;
+  std::vector<uint32_t> dfd;
+  dfd.emplace_back(4 + blockSize);
+  // vendor Khronos, basic descriptor type
+  dfd.emplace_back(0);
+  dfd.emplace_back(2 | blockSize << 16);
+  dfd.emplace_back(info.colorModel | KHR_DF_PRIMARIES_BT709 << 8 |
+                   info.transfer << 16);
+  // 4x4x1x1 texel blocks of 16 bytes
+  dfd.emplace_back(3 | 3 << 8);
+  dfd.emplace_back(16);
+  dfd.emplace_back(0);
+  const uint32_t bits = 128 / info.sampleCount;
+  for (uint32_t i = 0; i < info.sampleCount; i++) {
+    dfd.emplace_back(i * bits | (bits - 1) << 16 |
+                     (uint32_t)(info.channels[i] | info.qualifiers) << 24);
+    dfd.emplace_back(0);
+    dfd.emplace_back(0);
+    dfd.emplace_back(info.upper);
+  }
+  return dfd;
+}
+
+std::vector<uint8_t> buildKvd(uint64_t sourceHash) {
+  const size_t keySize = strlen(KTX2_SOURCE_HASH_KEY) + 1;
+  const uint32_t length = (uint32_t)(keySize + sizeof(sourceHash));
+  std::vector<uint8_t> kvd(sizeof(length) + ((length + 3) & ~3u));
+  memcpy(kvd.data(), &length, sizeof(length));
+  memcpy(kvd.data() + sizeof(length), KTX2_SOURCE_HASH_KEY, keySize);
+  memcpy(kvd.data() + sizeof(length) + keySize, &sourceHash,
+         sizeof(sourceHash));
+  return kvd;
+}
+
+size_t alignUp(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+}; // namespace
+
+bool writeKtx2(const std::string &path, const Ktx2Desc &desc,
+               const std::vector<std::vector<uint8_t>> &levels) {
+  FormatInfo info;
+  if (!getFormatInfo(desc.format, info) || levels.size() != desc.levelCount)
+    return false;
+
+  const std::vector<uint32_t> dfd = buildDfd(info);
+  const std::vector<uint8_t> kvd = buildKvd(desc.sourceHash);
+
+  Ktx2Header header{
+      .vkFormat = (uint32_t)info.vkFormat,
+      .typeSize = 1,
+      .pixelWidth = desc.width,
+      .pixelHeight = desc.height,
+      .pixelDepth = 0,
+      .layerCount = 0,
+      .faceCount = desc.faceCount,
+      .levelCount = desc.levelCount,
+      .supercompressionScheme = 0,
+      .sgdByteOffset = 0,
+      .sgdByteLength = 0,
+  };
+  memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+  size_t offset = sizeof(header) + levels.size() * sizeof(Ktx2LevelIndex);
+  header.dfdByteOffset = (uint32_t)offset;
+  header.dfdByteLength = (uint32_t)(dfd.size() * sizeof(uint32_t));
+  offset += header.dfdByteLength;
+  header.kvdByteOffset = (uint32_t)offset;
+  header.kvdByteLength = (uint32_t)kvd.size();
+  offset += header.kvdByteLength;
+
+  // the spec stores the smallest mip first, each aligned to the block size
+  std::vector<Ktx2LevelIndex> index(levels.size());
+  for (size_t i = levels.size(); i-- > 0;) {
+    offset = alignUp(offset, 16);
+    index[i] = {
+        .byteOffset = offset,
+        .byteLength = levels[i].size(),
+        .uncompressedByteLength = levels[i].size(),
+    };
+    offset += levels[i].size();
+  }
+
+  const std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (!file)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && fwrite(index.data(), sizeof(Ktx2LevelIndex), index.size(),
+                    file) == index.size();
+  ok = ok && fwrite(dfd.data(), sizeof(uint32_t), dfd.size(), file) ==
+                 dfd.size();
+  ok = ok && fwrite(kvd.data(), 1, kvd.size(), file) == kvd.size();
+  const uint8_t padding[16] = {};
+  for (size_t i = levels.size(); i-- > 0;) {
+    const size_t pad = index[i].byteOffset - (size_t)ftell(file);
+    ok = ok && fwrite(padding, 1, pad, file) == pad;
+    ok = ok && fwrite(levels[i].data(), 1, levels[i].size(), file) ==
+                   levels[i].size();
+  }
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Ktx2View::open(const std::string &path, uint64_t sourceHash) {
+  close();
+  if (!file.open(path))
+    return false;
+
+  Ktx2Header header;
+  if (file.size < sizeof(header)) {
+    close();
+    return false;
+  }
+  memcpy(&header, file.data, sizeof(header));
+
+  const MAI::TextureFormat formats[] = {MAI::Format_BC7_S, MAI::Format_BC5,
+                                        MAI::Format_BC6H_UF};
+  FormatInfo info{};
+  bool known = false;
+  for (MAI::TextureFormat format : formats)
+    if (getFormatInfo(format, info) &&
+        (uint32_t)info.vkFormat == header.vkFormat) {
+      desc.format = format;
+      known = true;
+      break;
+    }
+
+  const size_t indexSize = (size_t)header.levelCount * sizeof(Ktx2LevelIndex);
+  if (!known ||
+      memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) ||
+      header.supercompressionScheme != 0 || header.layerCount > 1 ||
+      header.pixelDepth > 1 ||
+      (header.faceCount != 1 && header.faceCount != 6) ||
+      header.levelCount == 0 || indexSize > file.size - sizeof(header) ||
+      header.kvdByteOffset > file.size ||
+      header.kvdByteLength > file.size - header.kvdByteOffset) {
+    close();
+    return false;
+  }
+
+  // the only key we write, anything else means it isn't ours
+  const std::vector<uint8_t> kvd = buildKvd(sourceHash);
+  if (header.kvdByteLength != kvd.size() ||
+      memcmp(file.data + header.kvdByteOffset, kvd.data(), kvd.size())) {
+    close();
+    return false;
+  }
+
+  desc.width = header.pixelWidth;
+  desc.height = header.pixelHeight;
+  desc.faceCount = header.faceCount;
+  desc.levelCount = header.levelCount;
+  desc.sourceHash = sourceHash;
+
+  for (uint32_t i = 0; i < header.levelCount; i++) {
+    Ktx2LevelIndex entry;
+    memcpy(&entry, file.data + sizeof(header) + i * sizeof(entry),
+           sizeof(entry));
+    const uint32_t width = std::max(1u, desc.width >> i);
+    const uint32_t height = std::max(1u, desc.height >> i);
+    const uint64_t expected =
+        MAI::getTextureSize(desc.format, width, height) * desc.faceCount;
+    if (entry.byteOffset > file.size ||
+        entry.byteLength > file.size - entry.byteOffset ||
+        entry.byteLength != expected) {
+      close();
+      return false;
+    }
+    levels.emplace_back(Level{
+        .data = file.data + entry.byteOffset,
+        .size = entry.byteLength,
+    });
+  }
+  return true;
+}
+
+void Ktx2View::close() {
+  file.close();
+  levels.clear();
+  desc = {};
+}
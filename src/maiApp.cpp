@@ -1,5 +1,7 @@
 #include "maiApp.h"
 #include "imgui.h"
+#include "profiler.h"
+#include <cassert>
 
 MouseState mouseState;
 
@@ -12,15 +14,29 @@ bool firstMouse = true;
 float lastX = 0.0f;
 float lastY = 0.0f;
 
-MaiApp::MaiApp() {
+MaiApp::MaiApp(bool headless) : headless(headless) {
+  jobs = new JobSystem();
   camera = new Camera(glm::vec3(0.0f, 0.0f, 3.0f));
   windowInfo = {
       .width = 1200,
       .height = 800,
       .appName = "SandBox",
   };
-  window = MAI::initWindow(windowInfo);
-  ren = MAI::initVulkanWithSwapChain(window, windowInfo.appName);
+
+  // the driver's compiled pipelines and the SPIR-V of GLSL shaders are
+  // kept between runs
+  const MAI::RendererDefault defaults = {
+      .enablePipelineCache = true,
+      .pipelineCachePath = RESOURCES_PATH "pipeline.cache",
+      .shaderCachePath = SHADERS_PATH "spvs/cache",
+  };
+  if (headless) {
+    ren = MAI::initVulkanHeadless(windowInfo, defaults);
+  } else {
+    window = MAI::initWindow(windowInfo);
+    ren = MAI::initVulkanWithSwapChain(window, windowInfo.appName, defaults);
+  }
+  pipelines = new PipelineRegistry(ren, jobs);
 
   depthTexture = ren->createImage({
       .type = MAI::TextureType_2D,
@@ -29,13 +45,17 @@ MaiApp::MaiApp() {
       .usage = MAI::Attachment_Bit,
   });
 
-  setMouseConfig();
+  if (!headless) {
+    shaderWatcher = new FileWatcher(SHADERS_PATH);
+    setMouseConfig();
 
-  glfwSetKeyCallback(window, setKeyboardConfig);
+    glfwSetKeyCallback(window, setKeyboardConfig);
 
-  glfwSetWindowUserPointer(window, this);
+    glfwSetWindowUserPointer(window, this);
+  }
 
-  imgui = new ImGuiRenderer(ren, window, depthTexture->getDeptFormat());
+  imgui =
+      new ImGuiRenderer(ren, pipelines, window, depthTexture->getDeptFormat());
 }
 
 void MaiApp::setMouseConfig() {
@@ -116,15 +136,16 @@ void MaiApp::updateMouseMovement() {
 void MaiApp::run(DrawFrameFunc drawFrame, DrawFrameFunc beforeDraw,
                  DrawFrameFunc afterDraw) {
   double timeStamp = glfwGetTime();
-  FPS fps;
 
   while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+    {
+      MAI_PROFILE_SCOPE("glfwPollEvents");
+      glfwPollEvents();
+    }
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
     if (!width || !height)
       continue;
-    float ratio = width / (float)height;
     const double newTimeStamp = glfwGetTime();
     deltaSecond = static_cast<float>(newTimeStamp - timeStamp);
     timeStamp = newTimeStamp;
@@ -133,53 +154,131 @@ void MaiApp::run(DrawFrameFunc drawFrame, DrawFrameFunc beforeDraw,
     mouse_state = mouseState;
     updateMouseMovement();
 
-    fps.tick(deltaSecond);
-    currentFPS = fps.currentFPS_;
+    renderFrame(width, height, deltaSecond, drawFrame, beforeDraw, afterDraw);
+  }
+  ren->waitDeviceIdle();
+}
+
+void MaiApp::runHeadless(uint32_t frameCount, float deltaSecond,
+                         DrawFrameFunc drawFrame, DrawFrameFunc beforeDraw,
+                         DrawFrameFunc afterDraw) {
+  assert(headless);
+  ::deltaSecond = deltaSecond;
+
+  for (uint32_t i = 0; i < frameCount; i++)
+    renderFrame(windowInfo.width, windowInfo.height, deltaSecond, drawFrame,
+                beforeDraw, afterDraw);
+
+  ren->waitDeviceIdle();
+}
+
+void MaiApp::renderFrame(uint32_t width, uint32_t height, float deltaSecond,
+                         DrawFrameFunc &drawFrame, DrawFrameFunc &beforeDraw,
+                         DrawFrameFunc &afterDraw) {
+  MAI_PROFILE_SCOPE("frame");
+  using Clock = std::chrono::steady_clock;
+  auto toMs = [](Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+
+  float ratio = width / (float)height;
+
+  fps.tick(deltaSecond);
+  currentFPS = fps.currentFPS_;
 
-    MAI::CommandBuffer *buff = ren->acquireCommandBuffer();
+  // between frames, so swapped pipelines are never mid command buffer
+  if (shaderWatcher)
+    pipelines->reloadShaders(shaderWatcher->poll());
+  pipelines->update();
+
+  const Clock::time_point frameStart = Clock::now();
+  MAI::CommandBuffer *buff = ren->acquireCommandBuffer();
+  const Clock::time_point acquired = Clock::now();
+  {
+    MAI_PROFILE_SCOPE("beforeDraw");
     beforeDraw(buff, width, height, ratio, deltaSecond);
-    // draw
-    buff->cmdBeginRendering({.texture = depthTexture});
-    imgui->beginFrame({(uint32_t)width, (uint32_t)height});
+  }
+  // draw
+  buff->cmdBeginRendering({.texture = depthTexture});
+  imgui->beginFrame({width, height});
+  {
+    MAI_PROFILE_SCOPE("drawFrame");
     drawFrame(buff, width, height, ratio, deltaSecond);
-    // fps
-    {
-      if (const ImGuiViewport *v = ImGui::GetMainViewport()) {
-        ImGui::SetNextWindowPos(
-            {v->WorkPos.x + v->WorkSize.x - 15.0f, v->WorkPos.y + 15.0f},
-            ImGuiCond_Always, {1.0f, 0.0f});
-      }
-      ImGui::SetNextWindowBgAlpha(0.30f);
-      ImGui::SetNextWindowSize(
-          ImVec2(ImGui::CalcTextSize("FPS : _______").x, 0));
-      if (ImGui::Begin("##FPS", nullptr,
-                       ImGuiWindowFlags_NoDecoration |
-                           ImGuiWindowFlags_AlwaysAutoResize |
-                           ImGuiWindowFlags_NoSavedSettings |
-                           ImGuiWindowFlags_NoFocusOnAppearing |
-                           ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoMove)) {
-        ImGui::Text("FPS : %i", (int)currentFPS);
-        ImGui::Text("Ms  : %.1f", 1000.0 / currentFPS);
-        ImGui::End();
-      }
+  }
+  // fps
+  {
+    if (const ImGuiViewport *v = ImGui::GetMainViewport()) {
+      ImGui::SetNextWindowPos(
+          {v->WorkPos.x + v->WorkSize.x - 15.0f, v->WorkPos.y + 15.0f},
+          ImGuiCond_Always, {1.0f, 0.0f});
+    }
+    ImGui::SetNextWindowBgAlpha(0.30f);
+    ImGui::SetNextWindowSize(ImVec2(ImGui::CalcTextSize("FPS : _______").x, 0));
+    if (ImGui::Begin("##FPS", nullptr,
+                     ImGuiWindowFlags_NoDecoration |
+                         ImGuiWindowFlags_AlwaysAutoResize |
+                         ImGuiWindowFlags_NoSavedSettings |
+                         ImGuiWindowFlags_NoFocusOnAppearing |
+                         ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoMove)) {
+      ImGui::Text("FPS : %i", (int)currentFPS);
+      ImGui::Text("Ms  : %.1f", 1000.0 / currentFPS);
+      ImGui::End();
+    }
+  }
+  // gpu zones
+  if (!ren->getGpuZones().empty()) {
+    if (const ImGuiViewport *v = ImGui::GetMainViewport()) {
+      ImGui::SetNextWindowPos(
+          {v->WorkPos.x + v->WorkSize.x - 15.0f, v->WorkPos.y + 90.0f},
+          ImGuiCond_Always, {1.0f, 0.0f});
+    }
+    ImGui::SetNextWindowBgAlpha(0.30f);
+    if (ImGui::Begin("##GPU", nullptr,
+                     ImGuiWindowFlags_NoDecoration |
+                         ImGuiWindowFlags_AlwaysAutoResize |
+                         ImGuiWindowFlags_NoSavedSettings |
+                         ImGuiWindowFlags_NoFocusOnAppearing |
+                         ImGuiWindowFlags_NoNav | ImGuiWindowFlags_NoMove)) {
+      for (const MAI::GpuZoneResult &zone : ren->getGpuZones())
+        ImGui::Text("%*s%-12s %6.3f ms", zone.depth * 2, "", zone.name,
+                    zone.ms);
+      ImGui::End();
     }
-    // ending
+  }
+  // ending
+  {
+    MAI::GpuZone zone(buff, "imgui");
     imgui->endFrame(buff);
-    buff->cmdEndRendering();
-    ren->submit();
+  }
+  buff->cmdEndRendering();
+  const Clock::time_point recorded = Clock::now();
+  ren->submit();
+  const Clock::time_point submitted = Clock::now();
+
+  frameTimings = {
+      .cpuMs = toMs(recorded - acquired),
+      .waitMs = toMs(acquired - frameStart),
+      .submitMs = toMs(submitted - recorded),
+  };
+  {
+    MAI_PROFILE_SCOPE("afterDraw");
     afterDraw(buff, width, height, ratio, deltaSecond);
-    delete buff;
-    undoMods[0] = false;
-    undoMods[1] = false;
   }
-  ren->waitDeviceIdle();
+  delete buff;
+  undoMods[0] = false;
+  undoMods[1] = false;
 }
 
 MaiApp::~MaiApp() {
   delete imgui;
+  delete shaderWatcher;
+  delete pipelines;
   delete camera;
   delete depthTexture;
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  if (window) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
   delete ren;
+  delete jobs;
 }
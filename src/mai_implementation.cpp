@@ -1,4 +1,6 @@
 #define MAI_IMPLEMENTATION
 #define VMA_IMPLEMENTATION
 #include "mai_config.h"
+#include "profiler.h"
+#define MAI_VK_PROFILE_SCOPE(name) MAI_PROFILE_SCOPE(name)
 #include "mai_vk.h"
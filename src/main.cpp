@@ -1,23 +1,59 @@
 #include "entities.h"
 #include "maiApp.h"
+#include "profiler.h"
 #include "skybox.h"
 #include <fonts.h>
 
 #include <assimp/cimport.h>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 #include "stbi_image.h"
 #include "textures.h"
 
-int main() {
-  MaiApp *mai = new MaiApp();
+void writePPM(const char *path, const std::vector<uint8_t> &rgba,
+              uint32_t width, uint32_t height) {
+  std::ofstream file(path, std::ios::binary);
+  file << "P6\n" << width << " " << height << "\n255\n";
+  for (size_t i = 0; i < (size_t)width * height; i++)
+    file.write(reinterpret_cast<const char *>(&rgba[i * 4]), 3);
+}
+
+// usage: game [--headless <frames> [output.ppm]] [--trace <trace.json>]
+int main(int argc, char **argv) {
+  bool headless = false;
+  uint32_t headlessFrames = 1;
+  const char *headlessOutput = nullptr;
+  const char *tracePath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--headless")) {
+      headless = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        headlessFrames = atoi(argv[++i]);
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        headlessOutput = argv[++i];
+    } else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+      tracePath = argv[++i];
+  }
+
+  if (tracePath) {
+    MAI_PROFILE_THREAD("main");
+    Profiler::setEnabled(true);
+  }
+
+  MaiApp *mai = new MaiApp(headless);
   VkFormat format = mai->depthTexture->getDeptFormat();
 
-  Skybox *skybox = new Skybox(mai->ren, format);
+  Skybox *skybox = new Skybox(mai->ren, mai->jobs, mai->pipelines, format);
 
-  Entities *entities = new Entities(mai->ren, mai->window, format);
+  Entities *entities = new Entities(mai->ren, mai->jobs, mai->pipelines,
+                                    mai->window, format);
+  if (!headless)
+    entities->watchResources();
 
   int currentAssets = 0;
 
@@ -31,15 +67,19 @@ int main() {
 
     const glm::mat4 view = mai->camera->GetViewMatrix();
 
-    skybox->draw({
-        .buff = buff,
-        .ratio = ratio,
-        .proj = p,
-        .view = view,
-        .cameraPos = mai->camera->Position,
-    });
+    {
+      MAI::GpuZone zone(buff, "skybox");
+      skybox->draw({
+          .buff = buff,
+          .ratio = ratio,
+          .proj = p,
+          .view = view,
+          .cameraPos = mai->camera->Position,
+      });
+    }
 
     {
+      MAI::GpuZone zone(buff, "entities");
       buff->cmdBindDepthState({
           .depthWriteEnable = true,
           .compareOp = MAI::CompareOp::Less,
@@ -81,12 +121,33 @@ int main() {
   };
 
   auto beforeDraw = [&](MAI::CommandBuffer *buff, uint32_t width,
-                        uint32_t height, float ratio, float deltaSecond) {};
+                        uint32_t height, float ratio, float deltaSecond) {
+    glm::mat4 p = glm::perspective(glm::radians(60.0f), ratio, 0.1f, 1000.0f);
+    p[1][1] *= -1;
+    entities->cull({
+        .buff = buff,
+        .proj = p,
+        .view = mai->camera->GetViewMatrix(),
+    });
+  };
 
   auto afterDraw = [&](MAI::CommandBuffer *buff, uint32_t width,
                        uint32_t height, float ratio, float deltaSecond) {};
 
-  mai->run(draw, beforeDraw, afterDraw);
+  if (headless) {
+    mai->runHeadless(headlessFrames, 1.0f / 60.0f, draw, beforeDraw,
+                     afterDraw);
+    if (headlessOutput) {
+      std::vector<uint8_t> pixels;
+      mai->ren->readbackFrame(pixels);
+      writePPM(headlessOutput, pixels, mai->windowInfo.width,
+               mai->windowInfo.height);
+    }
+  } else
+    mai->run(draw, beforeDraw, afterDraw);
+
+  if (tracePath && !Profiler::dump(tracePath))
+    std::cerr << "failed to write trace " << tracePath << std::endl;
 
   delete entities;
   delete skybox;
@@ -0,0 +1,163 @@
+#include "meshCache.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace {
+// directory order isn't stable, sorted by name
+std::vector<fs::path> listMeshSources(const std::string &dir) {
+  std::vector<fs::path> files;
+  for (const auto &entry : fs::directory_iterator(dir))
+    if (entry.is_regular_file() && entry.path().filename() != MESH_CACHE_FILE)
+      files.emplace_back(entry.path());
+  std::sort(files.begin(), files.end());
+  return files;
+}
+}; // namespace
+
+uint64_t hashMeshSources(const std::string &dir) {
+  uint64_t hash = HASH_SEED;
+  for (const auto &file : listMeshSources(dir)) {
+    const std::string name = file.filename().string();
+    hash = hashBytes(name.data(), name.size(), hash);
+    hash = hashFile(file.string(), hash);
+  }
+  return hash;
+}
+
+uint64_t stampMeshSources(const std::string &dir) {
+  uint64_t hash = HASH_SEED;
+  std::error_code error;
+  for (const auto &file : listMeshSources(dir)) {
+    const std::string name = file.filename().string();
+    const uint64_t stamp[2] = {
+        (uint64_t)fs::file_size(file, error),
+        (uint64_t)fs::last_write_time(file, error).time_since_epoch().count(),
+    };
+    hash = hashBytes(name.data(), name.size(), hash);
+    hash = hashBytes(stamp, sizeof(stamp), hash);
+  }
+  return hash;
+}
+
+bool writeMeshCache(const std::string &path, uint64_t sourceHash,
+                    uint64_t sourceStamp,
+                    const std::vector<Mesh> &meshes,
+                    const std::vector<Vertex> &vertices,
+                    const std::vector<uint32_t> &indices,
+                    const std::vector<std::string> &textures) {
+  const MeshCacheHeader header{
+      .magic = MESH_CACHE_MAGIC,
+      .version = MESH_CACHE_VERSION,
+      .sourceHash = sourceHash,
+      .sourceStamp = sourceStamp,
+      .meshSize = sizeof(Mesh),
+      .vertexSize = sizeof(Vertex),
+      .meshCount = (uint32_t)meshes.size(),
+      .vertexCount = (uint32_t)vertices.size(),
+      .indexCount = (uint32_t)indices.size(),
+      .textureCount = (uint32_t)textures.size(),
+  };
+
+  // written under a temporary name so a crash never leaves a torn cache
+  const std::string tmp = path + ".tmp";
+  FILE *file = fopen(tmp.c_str(), "wb");
+  if (!file)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && fwrite(meshes.data(), sizeof(Mesh), meshes.size(), file) ==
+                 meshes.size();
+  ok = ok && fwrite(vertices.data(), sizeof(Vertex), vertices.size(),
+                    file) == vertices.size();
+  ok = ok && fwrite(indices.data(), sizeof(uint32_t), indices.size(),
+                    file) == indices.size();
+  for (const auto &texture : textures) {
+    const uint32_t length = (uint32_t)texture.size();
+    ok = ok && fwrite(&length, sizeof(length), 1, file) == 1;
+    ok = ok && fwrite(texture.data(), 1, length, file) == length;
+  }
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool MeshCacheView::open(const std::string &path, uint64_t sourceStamp,
+                         const std::string &dir) {
+  close();
+  if (!file.open(path))
+    return false;
+
+  const uint8_t *data = file.data;
+  const uint8_t *end = data + file.size;
+  header = reinterpret_cast<const MeshCacheHeader *>(data);
+  if (file.size < sizeof(MeshCacheHeader) ||
+      header->magic != MESH_CACHE_MAGIC ||
+      header->version != MESH_CACHE_VERSION ||
+      header->meshSize != sizeof(Mesh) ||
+      header->vertexSize != sizeof(Vertex)) {
+    close();
+    return false;
+  }
+  if (header->sourceStamp != sourceStamp) {
+    if (header->sourceHash != hashMeshSources(dir)) {
+      close();
+      return false;
+    }
+    // touched but not changed, a failed write only costs another hash
+    if (FILE *stamp = fopen(path.c_str(), "r+b")) {
+      fseek(stamp, offsetof(MeshCacheHeader, sourceStamp), SEEK_SET);
+      fwrite(&sourceStamp, sizeof(sourceStamp), 1, stamp);
+      fclose(stamp);
+    }
+  }
+
+  const size_t arraysSize = (size_t)header->meshCount * sizeof(Mesh) +
+                            (size_t)header->vertexCount * sizeof(Vertex) +
+                            (size_t)header->indexCount * sizeof(uint32_t);
+  const uint8_t *ptr = data + sizeof(MeshCacheHeader);
+  if (arraysSize > (size_t)(end - ptr)) {
+    close();
+    return false;
+  }
+  meshes = reinterpret_cast<const Mesh *>(ptr);
+  ptr += header->meshCount * sizeof(Mesh);
+  vertices = reinterpret_cast<const Vertex *>(ptr);
+  ptr += header->vertexCount * sizeof(Vertex);
+  indices = reinterpret_cast<const uint32_t *>(ptr);
+  ptr += header->indexCount * sizeof(uint32_t);
+
+  for (uint32_t i = 0; i < header->textureCount; i++) {
+    uint32_t length;
+    if (sizeof(length) > (size_t)(end - ptr)) {
+      close();
+      return false;
+    }
+    memcpy(&length, ptr, sizeof(length));
+    ptr += sizeof(length);
+    if (length > (size_t)(end - ptr)) {
+      close();
+      return false;
+    }
+    textures.emplace_back(reinterpret_cast<const char *>(ptr), length);
+    ptr += length;
+  }
+  return true;
+}
+
+void MeshCacheView::close() {
+  file.close();
+  header = nullptr;
+  meshes = nullptr;
+  vertices = nullptr;
+  indices = nullptr;
+  textures.clear();
+}
@@ -0,0 +1,252 @@
+#include "meshPool.h"
+#include "profiler.h"
+#include <algorithm>
+
+void RangeAllocator::reset(uint32_t capacity) {
+  this->capacity = capacity;
+  used = 0;
+  byOffset.clear();
+  bySize.clear();
+  if (capacity)
+    insert(0, capacity);
+}
+
+bool RangeAllocator::allocate(uint32_t count, uint32_t &offset) {
+  if (count == 0) {
+    offset = 0;
+    return true;
+  }
+  auto fit = bySize.lower_bound(count);
+  if (fit == bySize.end())
+    return false;
+
+  const uint32_t blockOffset = fit->second;
+  const uint32_t blockCount = fit->first;
+  erase(byOffset.find(blockOffset));
+  // allocations take the front of the block so a fresh arena packs them
+  if (blockCount > count)
+    insert(blockOffset + count, blockCount - count);
+  used += count;
+  offset = blockOffset;
+  return true;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count) {
+  if (count == 0)
+    return;
+  used -= count;
+
+  auto next = byOffset.lower_bound(offset);
+  if (next != byOffset.end() && next->first == offset + count) {
+    count += next->second;
+    erase(next);
+  }
+  next = byOffset.lower_bound(offset);
+  if (next != byOffset.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      count += prev->second;
+      erase(prev);
+    }
+  }
+  insert(offset, count);
+}
+
+uint32_t RangeAllocator::getHighWater() const {
+  if (byOffset.empty())
+    return capacity;
+  const auto &last = *byOffset.rbegin();
+  return last.first + last.second == capacity ? last.first : capacity;
+}
+
+void RangeAllocator::insert(uint32_t offset, uint32_t count) {
+  byOffset.emplace(offset, count);
+  bySize.emplace(count, offset);
+}
+
+void RangeAllocator::erase(std::map<uint32_t, uint32_t>::iterator it) {
+  auto range = bySize.equal_range(it->second);
+  for (auto size = range.first; size != range.second; size++)
+    if (size->second == it->first) {
+      bySize.erase(size);
+      break;
+    }
+  byOffset.erase(it);
+}
+
+MeshPool::MeshPool(MAI::Renderer *ren, uint32_t vertexCapacity,
+                   uint32_t indexCapacity)
+    : ren_(ren) {
+  vertexBuffer =
+      createArena(vertexCapacity * sizeof(Vertex), MAI::StorageBuffer);
+  indexBuffer =
+      createArena(indexCapacity * sizeof(uint32_t), MAI::IndexBuffer);
+  vertexAddress = ren_->gpuAddress(vertexBuffer);
+  vertexArena.reset(vertexCapacity);
+  indexArena.reset(indexCapacity);
+}
+
+MeshPool::~MeshPool() {
+  delete vertexBuffer;
+  delete indexBuffer;
+}
+
+MAI::Buffer *MeshPool::createArena(VkDeviceSize size, MAIFlags usage) {
+  return ren_->createBuffer({
+      .usage = usage,
+      .storage = MAI::StorageType_Device,
+      .size = size,
+  });
+}
+
+MeshHandle MeshPool::allocate(const Vertex *vertices, uint32_t vertexCount,
+                              const uint32_t *indices, uint32_t indexCount) {
+  MAI_PROFILE_FUNCTION();
+  std::lock_guard<std::mutex> lock(mutex);
+
+  MeshRange range{.vertexCount = vertexCount, .indexCount = indexCount};
+  const bool vertexFit = vertexArena.allocate(vertexCount, range.firstVertex);
+  const bool indexFit = indexArena.allocate(indexCount, range.firstIndex);
+  if (!vertexFit || !indexFit) {
+    if (vertexFit)
+      vertexArena.free(range.firstVertex, vertexCount);
+    if (indexFit)
+      indexArena.free(range.firstIndex, indexCount);
+    // packing leaves all the free space in one block at the end
+    const uint32_t vertexCapacity =
+        vertexFit ? vertexArena.getCapacity()
+                  : std::max(vertexArena.getCapacity() * 2,
+                             vertexArena.getUsed() + vertexCount);
+    const uint32_t indexCapacity =
+        indexFit ? indexArena.getCapacity()
+                 : std::max(indexArena.getCapacity() * 2,
+                            indexArena.getUsed() + indexCount);
+    relocate(vertexCapacity, indexCapacity);
+    vertexArena.allocate(vertexCount, range.firstVertex);
+    indexArena.allocate(indexCount, range.firstIndex);
+  }
+
+  if (vertexCount)
+    ren_->uploadBuffer(vertexBuffer, vertices, vertexCount * sizeof(Vertex),
+                       range.firstVertex * sizeof(Vertex));
+  if (indexCount)
+    ren_->uploadBuffer(indexBuffer, indices, indexCount * sizeof(uint32_t),
+                       range.firstIndex * sizeof(uint32_t));
+
+  const MeshHandle handle = allocateSlot();
+  slots[handle] = Slot{.range = range, .live = true};
+  return handle;
+}
+
+MeshHandle MeshPool::allocateSlot() {
+  if (freeSlots.empty()) {
+    slots.emplace_back();
+    return (MeshHandle)slots.size() - 1;
+  }
+  const MeshHandle handle = freeSlots.back();
+  freeSlots.pop_back();
+  return handle;
+}
+
+void MeshPool::free(MeshHandle handle) {
+  if (handle == INVALID_MESH)
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  Slot &slot = slots[handle];
+  vertexArena.free(slot.range.firstVertex, slot.range.vertexCount);
+  indexArena.free(slot.range.firstIndex, slot.range.indexCount);
+  slot = {};
+  freeSlots.emplace_back(handle);
+}
+
+MeshRange MeshPool::getRange(MeshHandle handle) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return slots[handle].range;
+}
+
+bool MeshPool::fragmented(const RangeAllocator &arena) const {
+  const uint32_t highWater = arena.getHighWater();
+  return highWater - arena.getUsed() > highWater / 4;
+}
+
+bool MeshPool::defragment() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!fragmented(vertexArena) && !fragmented(indexArena))
+    return false;
+  relocate(vertexArena.getCapacity(), indexArena.getCapacity());
+  return true;
+}
+
+void MeshPool::relocate(uint32_t vertexCapacity, uint32_t indexCapacity) {
+  MAI_PROFILE_FUNCTION();
+  MAI::Buffer *vertices =
+      createArena(vertexCapacity * sizeof(Vertex), MAI::StorageBuffer);
+  MAI::Buffer *indices =
+      createArena(indexCapacity * sizeof(uint32_t), MAI::IndexBuffer);
+  vertexArena.reset(vertexCapacity);
+  indexArena.reset(indexCapacity);
+
+  std::vector<VkBufferCopy> vertexCopies;
+  std::vector<VkBufferCopy> indexCopies;
+  for (Slot &slot : slots) {
+    if (!slot.live)
+      continue;
+    MeshRange &range = slot.range;
+    uint32_t firstVertex, firstIndex;
+    vertexArena.allocate(range.vertexCount, firstVertex);
+    indexArena.allocate(range.indexCount, firstIndex);
+    if (range.vertexCount)
+      vertexCopies.emplace_back(VkBufferCopy{
+          .srcOffset = range.firstVertex * sizeof(Vertex),
+          .dstOffset = firstVertex * sizeof(Vertex),
+          .size = range.vertexCount * sizeof(Vertex),
+      });
+    if (range.indexCount)
+      indexCopies.emplace_back(VkBufferCopy{
+          .srcOffset = range.firstIndex * sizeof(uint32_t),
+          .dstOffset = firstIndex * sizeof(uint32_t),
+          .size = range.indexCount * sizeof(uint32_t),
+      });
+    range.firstVertex = firstVertex;
+    range.firstIndex = firstIndex;
+  }
+
+  // waits on pending uploads into the old arenas and on every frame
+  // submitted so far, nothing reads them after this
+  ren_->copyBuffer(vertexBuffer, vertices, vertexCopies.data(),
+                   (uint32_t)vertexCopies.size());
+  ren_->copyBuffer(indexBuffer, indices, indexCopies.data(),
+                   (uint32_t)indexCopies.size());
+  delete vertexBuffer;
+  delete indexBuffer;
+  vertexBuffer = vertices;
+  indexBuffer = indices;
+  vertexAddress = ren_->gpuAddress(vertexBuffer);
+  generation++;
+}
+
+void MeshPool::draw(MAI::CommandBuffer *buff, glm::mat4 proj, glm::mat4 view,
+                    uint64_t instancesAddress, uint64_t visibleAddress,
+                    MAI::Buffer *indirect, uint32_t firstCommand,
+                    uint32_t commandCount) {
+  struct PushConstant {
+    glm::mat4 proj;
+    glm::mat4 view;
+    uint64_t vertices;
+    uint64_t instances;
+    uint64_t visible;
+  } pc{
+      .proj = proj,
+      .view = view,
+      .vertices = vertexAddress,
+      .instances = instancesAddress,
+      .visible = visibleAddress,
+  };
+
+  buff->cmdPushConstant(&pc);
+  buff->bindIndexBuffer(indexBuffer, 0, MAI::IndexType::Uint32);
+  buff->cmdDrawIndexedIndirect(
+      indirect, firstCommand * sizeof(MAI::DrawIndexedIndirectCommand),
+      commandCount);
+}
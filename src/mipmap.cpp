@@ -0,0 +1,109 @@
+#include "mipmap.h"
+#include "pixelConvert.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MIPMAP_SSE
+#endif
+
+namespace {
+
+// one row of 2x2 boxes, one texel is one register
+void downsampleRowF32(const float *row0, const float *row1, uint32_t width,
+                      uint32_t outWidth, float *dst) {
+  for (uint32_t x = 0; x < outWidth; x++) {
+    const uint32_t x0 = 2 * x * 4;
+    const uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+#ifdef MIPMAP_SSE
+    const __m128 sum = _mm_add_ps(
+        _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+        _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+    _mm_storeu_ps(dst + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+    for (uint32_t c = 0; c < 4; c++)
+      dst[x * 4 + c] =
+          (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+#endif
+  }
+}
+
+void downsampleRowLinear(const uint8_t *row0, const uint8_t *row1,
+                         uint32_t width, uint32_t outWidth, uint8_t *dst) {
+  uint32_t x = 0;
+#ifdef MIPMAP_SSE
+  // two output texels from four input texels of each row
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(2);
+  for (; x + 2 <= outWidth && 2 * x + 4 <= width; x += 2) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8));
+    const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                     _mm_unpacklo_epi8(b, zero));
+    const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                     _mm_unpackhi_epi8(b, zero));
+    __m128i sum = _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)),
+                                     _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + x * 4),
+                     _mm_packus_epi16(sum, zero));
+  }
+#endif
+  for (; x < outWidth; x++) {
+    const uint32_t x0 = 2 * x * 4;
+    const uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+    for (uint32_t c = 0; c < 4; c++)
+      dst[x * 4 + c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                                  row1[x1 + c] + 2) >>
+                                 2);
+  }
+}
+
+}; // namespace
+
+std::vector<uint8_t> downsampleRGBA8(const uint8_t *src, uint32_t width,
+                                     uint32_t height, bool srgb) {
+  const uint32_t outWidth = mipSize(width, 1);
+  const uint32_t outHeight = mipSize(height, 1);
+  std::vector<uint8_t> out((size_t)outWidth * outHeight * 4);
+  // srgb rows are filtered as linear floats, through the pixelConvert
+  // kernels both ways
+  std::vector<float> rows, filtered;
+  if (srgb) {
+    rows.resize((size_t)width * 4 * 2);
+    filtered.resize((size_t)outWidth * 4);
+  }
+  for (uint32_t y = 0; y < outHeight; y++) {
+    const uint8_t *row0 = src + (size_t)2 * y * width * 4;
+    const uint8_t *row1 =
+        src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+    uint8_t *dst = out.data() + (size_t)y * outWidth * 4;
+    if (!srgb) {
+      downsampleRowLinear(row0, row1, width, outWidth, dst);
+      continue;
+    }
+    float *linear0 = rows.data();
+    float *linear1 = rows.data() + (size_t)width * 4;
+    decodeSrgb(row0, linear0, (size_t)width * 4);
+    decodeSrgb(row1, linear1, (size_t)width * 4);
+    downsampleRowF32(linear0, linear1, width, outWidth, filtered.data());
+    encodeSrgb(filtered.data(), dst, (size_t)outWidth * 4);
+  }
+  return out;
+}
+
+std::vector<float> downsampleRGBAF32(const float *src, uint32_t width,
+                                     uint32_t height) {
+  const uint32_t outWidth = mipSize(width, 1);
+  const uint32_t outHeight = mipSize(height, 1);
+  std::vector<float> out((size_t)outWidth * outHeight * 4);
+  for (uint32_t y = 0; y < outHeight; y++) {
+    const float *row0 = src + (size_t)2 * y * width * 4;
+    const float *row1 =
+        src + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+    downsampleRowF32(row0, row1, width, outWidth,
+                     out.data() + (size_t)y * outWidth * 4);
+  }
+  return out;
+}
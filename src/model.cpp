@@ -1,12 +1,13 @@
 #include "model.h"
+#include "meshCache.h"
+#include "profiler.h"
+#include "textureCache.h"
 #include <filesystem>
 
 namespace fs = std::filesystem;
 
 #include <iostream>
 
-#include "stbi_image.h"
-
 #define flags                                                                  \
   aiProcess_Triangulate | aiProcess_JoinIdenticalVertices |                    \
       aiProcess_GenNormals | aiProcess_CalcTangentSpace |                      \
@@ -20,8 +21,17 @@ std::string setName(const char *filename) {
   return name;
 }
 
-Model::Model(MAI::Renderer *ren, const char *filename)
-    : ren_(ren), filename(filename) {
+std::string textureName(const aiMaterial *mat, aiTextureType type) {
+  aiString str;
+  mat->GetTexture(type, 0, &str);
+  std::string name = str.data;
+  std::replace(name.begin(), name.end(), '\\', '/');
+  return name.substr(name.find_last_of('/') + 1);
+}
+
+Model::Model(MAI::Renderer *ren, MeshPool *pool, JobSystem *jobs,
+             const char *filename, bool upload)
+    : ren_(ren), pool_(pool), filename(filename), upload_(upload) {
   name = setName(filename);
   std::string file;
   for (const auto &entry : fs::directory_iterator(filename)) {
@@ -44,23 +54,85 @@ Model::Model(MAI::Renderer *ren, const char *filename)
   if (file.empty()) {
     std::cerr << "no asset found" << std::endl;
     std::cerr << "path: " << filename << std::endl;
-    assert(false);
+    return;
   }
 
-  const aiScene *scene = aiImportFile(file.c_str(), flags);
-  if (!scene) {
-    std::cout << "failed to load assert at path: " << filename << std::endl;
-    assert(false);
+  // Assimp only runs when the cooked file is missing or the sources changed
+  const std::string cachePath = std::string(filename) + "/" + MESH_CACHE_FILE;
+  const uint64_t sourceStamp = stampMeshSources(filename);
+  MeshCacheView cache;
+  if (cache.open(cachePath, sourceStamp, filename)) {
+    MAI_PROFILE_SCOPE("mesh cache");
+    meshes.assign(cache.meshes, cache.meshes + cache.header->meshCount);
+    materials = cache.textures;
+    for (const auto &mesh : meshes)
+      bounds.grow(mesh.aabb);
+    createBuffers(cache.vertices, cache.header->vertexCount, cache.indices,
+                  cache.header->indexCount);
+    cache.close();
+  } else {
+    MAI_PROFILE_SCOPE("aiImportFile");
+    const aiScene *scene = aiImportFile(file.c_str(), flags);
+    if (!scene) {
+      std::cout << "failed to load assert at path: " << filename << std::endl;
+      return;
+    }
+
+    processNodes(scene->mRootNode, scene);
+    for (uint32_t i = 0; i < scene->mNumMaterials; i++)
+      materials.emplace_back(
+          textureName(scene->mMaterials[i], aiTextureType_DIFFUSE));
+    aiReleaseImport(scene);
+
+    if (!writeMeshCache(cachePath, hashMeshSources(filename), sourceStamp,
+                        meshes, vertices, indices, materials))
+      std::cerr << "failed to write mesh cache " << cachePath << std::endl;
+
+    createBuffers(vertices.data(), (uint32_t)vertices.size(), indices.data(),
+                  (uint32_t)indices.size());
+    if (upload_) {
+      vertices.clear();
+      vertices.shrink_to_fit();
+      indices.clear();
+      indices.shrink_to_fit();
+    }
   }
 
-  processNodes(scene->mRootNode, scene);
+  loadTextures(jobs);
+  loaded_ = true;
+}
 
-  for (uint32_t i = 0; i < scene->mNumMaterials; i++) {
-    const aiMaterial *mat = scene->mMaterials[i];
-    loadTextures(mat, aiTextureType_DIFFUSE, filename);
+void Model::createBuffers(const Vertex *vertexData, uint32_t vertexCount,
+                          const uint32_t *indexData, uint32_t indexCount) {
+  if (upload_)
+    meshHandle =
+        pool_->allocate(vertexData, vertexCount, indexData, indexCount);
+  else if (vertexData != vertices.data()) {
+    // the mesh cache is unmapped before uploadMeshes
+    vertices.assign(vertexData, vertexData + vertexCount);
+    indices.assign(indexData, indexData + indexCount);
   }
 
-  aiReleaseImport(scene);
+  // keep the positions on the CPU for picking, indices made absolute
+  std::vector<glm::vec3> positions(vertexCount);
+  for (uint32_t i = 0; i < vertexCount; i++)
+    positions[i] = vertexData[i].pos;
+  std::vector<uint32_t> pickIndices(indexCount);
+  for (const auto &mesh : meshes)
+    for (uint32_t i = mesh.firstIndex; i < mesh.firstIndex + mesh.indicesSize;
+         i++)
+      pickIndices[i] = indexData[i] + mesh.vertexOffset;
+  triangles.build(std::move(positions), std::move(pickIndices));
+}
+
+void Model::uploadMeshes() {
+  assert(meshHandle == INVALID_MESH);
+  meshHandle = pool_->allocate(vertices.data(), (uint32_t)vertices.size(),
+                               indices.data(), (uint32_t)indices.size());
+  vertices.clear();
+  vertices.shrink_to_fit();
+  indices.clear();
+  indices.shrink_to_fit();
 }
 
 void Model::processNodes(const aiNode *node, const aiScene *scene) {
@@ -73,9 +145,10 @@ void Model::processNodes(const aiNode *node, const aiScene *scene) {
 }
 
 void Model::processMeshes(const aiMesh *mesh, const aiScene *scene) {
-  std::vector<Vertex> vertices;
-  std::vector<uint32_t> indices;
+  const uint32_t firstIndex = (uint32_t)indices.size();
+  const int32_t vertexOffset = (int32_t)vertices.size();
 
+  AABB aabb;
   for (size_t i = 0; i != mesh->mNumVertices; i++) {
     const aiVector3D p = mesh->mVertices[i];
     const aiVector3D t =
@@ -86,96 +159,82 @@ void Model::processMeshes(const aiMesh *mesh, const aiScene *scene) {
         .uv = glm::vec2(t.x, t.y),
         .norm = glm::vec3(n.x, n.y, n.z),
     });
+    aabb.grow(glm::vec3(p.x, p.y, p.z));
   }
 
   for (size_t i = 0; i < mesh->mNumFaces; i++)
     for (size_t j = 0; j != 3; j++)
       indices.emplace_back(mesh->mFaces[i].mIndices[j]);
 
-  MAI::Buffer *vertBuff = ren_->createBuffer({
-      .usage = MAI::StorageBuffer,
-      .storage = MAI::StorageType_Device,
-      .size = sizeof(Vertex) * vertices.size(),
-      .data = vertices.data(),
-  });
-  MAI::Buffer *indexBuff = ren_->createBuffer({
-      .usage = MAI::IndexBuffer,
-      .storage = MAI::StorageType_Device,
-      .size = sizeof(uint32_t) * indices.size(),
-      .data = indices.data(),
-  });
+  bounds.grow(aabb);
 
   meshes.emplace_back(Mesh{
-      .vertexBuffer = vertBuff,
-      .indexBuffer = indexBuff,
-      .indicesSize = (uint32_t)indices.size(),
+      .firstIndex = firstIndex,
+      .indicesSize = (uint32_t)indices.size() - firstIndex,
+      .vertexOffset = vertexOffset,
+      .material = mesh->mMaterialIndex,
+      .sphere = glm::vec4(aabb.center(),
+                          glm::length(aabb.max - aabb.min) * 0.5f),
+      .aabb = aabb,
   });
 }
 
-void Model::draw(MAI::CommandBuffer *buff, glm::mat4 proj, glm::mat4 view,
-                 glm::mat4 model) {
-  struct PushConstant {
-    glm::mat4 proj;
-    glm::mat4 view;
-    glm::mat4 model;
-    uint32_t textId;
-    uint64_t vertices;
-  } pc{
-      .proj = proj,
-      .view = view,
-      .model = model,
-  };
-  if (!textures.empty())
-    pc.textId = textures[0]->getIndex();
-
-  for (auto &it : meshes) {
-    pc.vertices = ren_->gpuAddress(it.vertexBuffer);
-    buff->cmdPushConstant(&pc);
-    buff->bindIndexBuffer(it.indexBuffer, 0, MAI::IndexType::Uint32);
-    buff->cmdDrawIndex(it.indicesSize);
-  }
+void Model::appendDrawCommands(
+    std::vector<MAI::DrawIndexedIndirectCommand> &cmds, uint32_t firstInstance,
+    uint32_t instanceCount) const {
+  const MeshRange range = pool_->getRange(meshHandle);
+  for (const auto &it : meshes)
+    cmds.emplace_back(MAI::DrawIndexedIndirectCommand{
+        .indexCount = it.indicesSize,
+        .instanceCount = instanceCount,
+        .firstIndex = range.firstIndex + it.firstIndex,
+        .vertexOffset = (int32_t)range.firstVertex + it.vertexOffset,
+        .firstInstance = firstInstance,
+    });
 }
 
-void Model::loadTextures(const aiMaterial *mat, aiTextureType type,
-                         const char *dir) {
-
-  aiString str;
-  mat->GetTexture(type, 0, &str);
-  std::string name = str.data;
-  std::replace(name.begin(), name.end(), '\\', '/');
-  name = name.substr(name.find_last_of('/') + 1);
-
-  std::string path = dir;
-  path += "/textures/";
-  path += name;
+uint32_t Model::getTextureIndex() const {
+  return textures.empty() ? 0 : textures[0]->getIndex();
+}
 
-  for (auto &it : loaded)
-    if (it == path)
-      return;
+void Model::loadTextures(JobSystem *jobs) {
+  std::vector<std::string> paths;
+  for (const auto &it : materials) {
+    if (it.empty())
+      continue;
+    const std::string path = std::string(filename) + "/textures/" + it;
+    if (std::find(paths.begin(), paths.end(), path) == paths.end())
+      paths.emplace_back(path);
+  }
 
-  int w, h, comp;
-  const stbi_uc *pixels = stbi_load(path.c_str(), &w, &h, &comp, 4);
-  if (!pixels) {
-    return;
+  // one chain of jobs per texture, kept in material order
+  std::vector<MAI::Texture *> results(paths.size(), nullptr);
+  std::vector<JobHandle> uploads;
+  const bool compress = ren_->supportsBlockCompression();
+  for (size_t i = 0; i < paths.size(); i++) {
+    TextureLoad *load = new TextureLoad(paths[i], TextureKind_Color, compress);
+    JobHandle decode = jobs->submit([load] { decodeTexture(*load); });
+    JobHandle convert =
+        jobs->submit([load] { convertTexture(*load); }, {decode});
+    uploads.emplace_back(jobs->submit(
+        [this, load, &results, i] {
+          results[i] = uploadTexture(ren_, *load);
+          delete load;
+        },
+        {convert}));
   }
-  MAI::Texture *texture = ren_->createImage({
-      .type = MAI::TextureType_2D,
-      .format = MAI::Format_RGBA_S8,
-      .dimensions = {(uint32_t)w, (uint32_t)h},
-      .data = pixels,
-      .usage = MAI::Sampled_Bit,
-  });
-  stbi_image_free((void *)pixels);
-  loaded.emplace_back(path);
-  textures.emplace_back(texture);
+  jobs->wait(uploads);
+
+  for (size_t i = 0; i < paths.size(); i++)
+    if (results[i]) {
+      loaded.emplace_back(paths[i]);
+      textures.emplace_back(results[i]);
+    }
 }
 
 Model::~Model() {
-  if (!textures.empty())
-    for (auto &it : textures)
-      delete it;
-  for (auto &it : meshes) {
-    delete it.vertexBuffer;
-    delete it.indexBuffer;
-  }
+  // reloads replace models, the bindless slots have to come back
+  for (auto &it : textures)
+    ren_->deferDelete(it);
+  pool_->free(meshHandle);
 }
@@ -0,0 +1,292 @@
+#include "pipelineRegistry.h"
+#include "fileMapping.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+
+namespace fs = std::filesystem;
+
+// the copies of everything a description points to, for the workers
+struct PipelineSource {
+  bool compute = false;
+  // vert and frag, or comp
+  std::vector<std::string> shaders;
+  MAI::PipelineInfo info = {};
+  MAI::ComputePipelineInfo computeInfo = {};
+  MAI::VertexInput vertexInput;
+  std::vector<uint8_t> specData;
+};
+
+namespace {
+template <typename T> uint64_t hashValue(const T &value, uint64_t hash) {
+  return hashBytes(&value, sizeof(value), hash);
+}
+
+uint64_t hashString(const char *str, uint64_t hash) {
+  // the terminator keeps "ab" + "c" apart from "a" + "bc"
+  return str ? hashBytes(str, strlen(str) + 1, hash) : hashValue(0, hash);
+}
+
+// field by field, padding would make identical descriptions hash apart
+uint64_t hashVertexInput(const MAI::VertexInput *input, uint64_t hash) {
+  if (!input)
+    return hashValue(0, hash);
+  for (const MAI::VertexAttribute &attribute : input->attributes) {
+    hash = hashValue(attribute.binding, hash);
+    hash = hashValue(attribute.location, hash);
+    hash = hashValue(attribute.format, hash);
+    hash = hashValue(attribute.offset, hash);
+  }
+  hash = hashValue(input->inputBinding.binding, hash);
+  hash = hashValue(input->inputBinding.stride, hash);
+  return hashValue(input->inputBinding.input, hash);
+}
+
+uint64_t hashSpecInfo(const MAI::SpecInfo &spec, uint64_t hash) {
+  for (const MAI::SpecialMapEntries &entry : spec.enteries) {
+    hash = hashValue(entry.constantID, hash);
+    hash = hashValue(entry.size, hash);
+  }
+  if (spec.enteries.empty())
+    return hash;
+  return hashBytes(spec.data, spec.dataSize, hash);
+}
+
+void copySpecData(MAI::SpecInfo &spec, std::vector<uint8_t> &data) {
+  if (spec.enteries.empty())
+    return;
+  const uint8_t *src = static_cast<const uint8_t *>(spec.data);
+  data.assign(src, src + spec.dataSize);
+  spec.data = data.data();
+}
+
+// shaders[i] is the file the i-th shader of source is read from
+MAI::Pipeline *buildPipeline(MAI::Renderer *ren, const PipelineSource &source,
+                             const std::vector<std::string> &shaders) {
+  MAI_PROFILE_SCOPE("compile pipeline");
+  std::vector<std::unique_ptr<MAI::Shader>> modules;
+  for (const std::string &shader : shaders)
+    modules.emplace_back(ren->createShader(shader.c_str()));
+
+  if (source.compute) {
+    MAI::ComputePipelineInfo info = source.computeInfo;
+    info.comp = modules[0].get();
+    return ren->createComputePipeline(info);
+  }
+  MAI::PipelineInfo info = source.info;
+  info.vert = modules[0].get();
+  info.frag = modules[1].get();
+  return ren->createPipeline(info);
+}
+
+std::string normalizePath(const std::string &path) {
+  return fs::path(path).lexically_normal().string();
+}
+
+// the GLSL a shader was compiled from, spvs/x.fspv comes from x.frag
+std::string getShaderSource(const std::string &path) {
+  static constexpr const char *extensions[][2] = {
+      {".vspv", ".vert"},   {".fspv", ".frag"},   {".gspv", ".geom"},
+      {".tespv", ".tese"}, {".tcspv", ".tesc"}, {".cspv", ".comp"},
+  };
+  const fs::path file(path);
+  for (const auto &extension : extensions) {
+    if (file.extension() != extension[0])
+      continue;
+    fs::path dir = file.parent_path();
+    if (dir.filename() == "spvs")
+      dir = dir.parent_path();
+    return normalizePath((dir / file.stem()).string() + extension[1]);
+  }
+  return normalizePath(path);
+}
+
+bool contains(const std::vector<std::string> &paths, const std::string &path) {
+  return std::find(paths.begin(), paths.end(), path) != paths.end();
+}
+}; // namespace
+
+uint64_t hashPipelineDesc(const GraphicsPipelineDesc &desc) {
+  const MAI::PipelineInfo &info = desc.info;
+  uint64_t hash = hashString(desc.vert, HASH_SEED);
+  hash = hashString(desc.frag, hash);
+  hash = hashVertexInput(info.vertexInput, hash);
+  hash = hashSpecInfo(info.specInfo, hash);
+  hash = hashValue(info.color.blendEnable, hash);
+  if (info.color.blendEnable) {
+    hash = hashValue(info.color.srcColorBlend, hash);
+    hash = hashValue(info.color.dstColorBlend, hash);
+  }
+  hash = hashValue(info.depthFormat, hash);
+  hash = hashValue(info.setLayout, hash);
+  hash = hashValue(info.cullMode, hash);
+  hash = hashValue(info.topology, hash);
+  hash = hashValue(info.polygon, hash);
+  hash = hashValue(info.pushConstantSize, hash);
+  return hashValue(info.patchControllPoints, hash);
+}
+
+uint64_t hashPipelineDesc(const ComputePipelineDesc &desc) {
+  uint64_t hash = hashString(desc.comp, HASH_SEED);
+  hash = hashSpecInfo(desc.info.specInfo, hash);
+  return hashValue(desc.info.pushConstantSize, hash);
+}
+
+PipelineRegistry::PipelineRegistry(MAI::Renderer *ren, JobSystem *jobs)
+    : ren_(ren), jobs_(jobs) {}
+
+PipelineRegistry::~PipelineRegistry() {
+  for (auto &it : entries) {
+    jobs_->wait(it.second->job);
+    jobs_->wait(it.second->reloadJob);
+  }
+  for (ReloadedPipeline &pending : reloaded)
+    delete pending.pipeline;
+  for (auto &it : entries) {
+    delete it.second->pipeline;
+    delete it.second->source;
+    delete it.second;
+  }
+}
+
+PipelineEntry *PipelineRegistry::find(uint64_t hash) {
+  auto it = entries.find(hash);
+  if (it == entries.end())
+    return nullptr;
+  shared++;
+  return it->second;
+}
+
+PipelineEntry *PipelineRegistry::insert(uint64_t hash, PipelineSource *source) {
+  PipelineEntry *entry = new PipelineEntry;
+  entry->source = source;
+  entry->job = jobs_->submit([ren = ren_, entry] {
+    entry->pipeline =
+        buildPipeline(ren, *entry->source, entry->source->shaders);
+  });
+  entries.emplace(hash, entry);
+  return entry;
+}
+
+PipelineEntry *PipelineRegistry::request(const GraphicsPipelineDesc &desc) {
+  assert(desc.vert && desc.frag);
+  const uint64_t hash = hashPipelineDesc(desc);
+  // entries are only seen with their job submitted, get needs no lock
+  std::lock_guard<std::mutex> lock(mutex);
+  if (PipelineEntry *entry = find(hash))
+    return entry;
+
+  PipelineSource *source = new PipelineSource{
+      .shaders = {desc.vert, desc.frag},
+      .info = desc.info,
+  };
+  if (desc.info.vertexInput) {
+    source->vertexInput = *desc.info.vertexInput;
+    source->info.vertexInput = &source->vertexInput;
+  }
+  copySpecData(source->info.specInfo, source->specData);
+  return insert(hash, source);
+}
+
+PipelineEntry *PipelineRegistry::request(const ComputePipelineDesc &desc) {
+  assert(desc.comp);
+  const uint64_t hash = hashPipelineDesc(desc);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (PipelineEntry *entry = find(hash))
+    return entry;
+
+  PipelineSource *source = new PipelineSource{
+      .compute = true,
+      .shaders = {desc.comp},
+      .computeInfo = desc.info,
+  };
+  source->computeInfo.vertexInput = nullptr;
+  copySpecData(source->computeInfo.specInfo, source->specData);
+  return insert(hash, source);
+}
+
+MAI::Pipeline *PipelineRegistry::get(PipelineEntry *entry) {
+  jobs_->wait(entry->job);
+  return entry->pipeline;
+}
+
+void PipelineRegistry::rebuild(PipelineEntry *entry,
+                               const std::vector<std::string> &changed) {
+  // the includes are looked up again, an edit may have changed them
+  std::vector<std::string> sources;
+  bool affected = false;
+  for (const std::string &shader : entry->source->shaders) {
+    sources.emplace_back(getShaderSource(shader));
+    // a SPIR-V shader shipped without its GLSL
+    if (!fs::exists(sources.back()))
+      return;
+    std::vector<std::string> includes;
+    MAI::readShaderFile(sources.back().c_str(), &includes);
+    affected = affected || contains(changed, sources.back());
+    for (const std::string &include : includes)
+      affected = affected || contains(changed, normalizePath(include));
+  }
+  if (!affected || !entry->pipeline)
+    return;
+
+  MAI::Pipeline *pipeline = nullptr;
+  try {
+    pipeline = buildPipeline(ren_, *entry->source, sources);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << ", keeping the old pipeline" << std::endl;
+    return;
+  }
+  std::cout << "reloaded " << sources.front() << std::endl;
+
+  std::lock_guard<std::mutex> lock(reloadMutex);
+  for (ReloadedPipeline &pending : reloaded) {
+    if (pending.entry != entry)
+      continue;
+    // update didn't take the previous one yet, it was never used
+    delete pending.pipeline;
+    pending.pipeline = pipeline;
+    return;
+  }
+  reloaded.push_back({entry, pipeline});
+}
+
+void PipelineRegistry::reloadShaders(const std::vector<std::string> &changed) {
+  if (changed.empty())
+    return;
+  auto paths = std::make_shared<std::vector<std::string>>();
+  for (const std::string &path : changed)
+    paths->emplace_back(normalizePath(path));
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &it : entries) {
+    PipelineEntry *entry = it.second;
+    entry->reloadJob =
+        jobs_->submit([this, entry, paths] { rebuild(entry, *paths); },
+                      {entry->job, entry->reloadJob});
+  }
+}
+
+void PipelineRegistry::update() {
+  std::vector<ReloadedPipeline> ready;
+  {
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    ready.swap(reloaded);
+  }
+  for (ReloadedPipeline &pending : ready) {
+    // the entry keeps its pipeline object, the old Vulkan objects retire
+    // in the one that was built
+    pending.entry->pipeline->swap(*pending.pipeline);
+    ren_->deferDelete(pending.pipeline);
+    reloads++;
+  }
+}
+
+uint32_t PipelineRegistry::getPipelineCount() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return (uint32_t)entries.size();
+}
@@ -0,0 +1,354 @@
+#include "pixelConvert.h"
+#include "Bitmap.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PIXEL_SSE
+#endif
+
+// the F16C path is picked at runtime, the rest of the build stays baseline
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PIXEL_F16C
+#endif
+
+namespace {
+
+uint32_t floatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// linear values at or below 2^-13 encode to 0
+constexpr uint32_t SRGB_MIN_EXPONENT = 127 - 13;
+constexpr uint32_t SRGB_BUCKETS = 13 * 8;
+
+struct SrgbTables {
+  float toLinear[256];
+  float toUnit[256];
+  // linear to sRGB in buckets of an eighth of an octave from 2^-13 to 1,
+  // the curve is within half a step of a line inside each
+  float base[SRGB_BUCKETS];
+  float slope[SRGB_BUCKETS];
+
+  static double encode(double l) {
+    return 255.0 * (l <= 0.0031308 ? l * 12.92
+                                   : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055);
+  }
+
+  SrgbTables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      const double c = i / 255.0;
+      toLinear[i] = (float)(c <= 0.04045 ? c / 12.92
+                                         : std::pow((c + 0.055) / 1.055, 2.4));
+      toUnit[i] = (float)c;
+    }
+    for (uint32_t i = 0; i < SRGB_BUCKETS; i++) {
+      const uint32_t bucket = (SRGB_MIN_EXPONENT << 23) + (i << 20);
+      const double lo = bitsFloat(bucket);
+      const double hi = bitsFloat(bucket + (1 << 20));
+      const double y0 = encode(lo);
+      const double dy = encode(hi) - y0;
+      // the curve is concave, move the chord up by half its largest gap
+      double gap = 0.0;
+      for (uint32_t s = 1; s < 64; s++) {
+        const double t = s / 64.0;
+        gap = std::max(gap, encode(lo + (hi - lo) * t) - (y0 + dy * t));
+      }
+      base[i] = (float)(y0 + gap * 0.5);
+      slope[i] = (float)dy;
+    }
+  }
+};
+
+const SrgbTables &srgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+uint8_t encodeSrgbOne(const SrgbTables &tables, float value) {
+  if (!(value > bitsFloat(SRGB_MIN_EXPONENT << 23)))
+    return 0;
+  if (value >= 1.0f)
+    return 255;
+  const uint32_t bits = floatBits(value);
+  const uint32_t bucket = (bits >> 20) - (SRGB_MIN_EXPONENT << 3);
+  const float t = (bits & 0xFFFFF) * (1.0f / 1048576.0f);
+  return (uint8_t)(tables.base[bucket] + tables.slope[bucket] * t + 0.5f);
+}
+
+// matches the SSE path, round to nearest even and NaN to 0
+uint8_t unitToU8(float value) {
+  if (!(value > 0.0f))
+    return 0;
+  return (uint8_t)std::nearbyint(std::min(value * 255.0f, 255.0f));
+}
+
+#ifdef PIXEL_SSE
+// unitToU8 of four values
+__m128i unitToU8x4(__m128 value) {
+  const __m128 scale = _mm_set1_ps(255.0f);
+  // max puts NaN to 0 as its second operand wins
+  const __m128 v = _mm_max_ps(_mm_mul_ps(value, scale), _mm_setzero_ps());
+  return _mm_cvtps_epi32(_mm_min_ps(v, scale));
+}
+
+// encodeSrgbOne of four values, only the table loads are scalar
+__m128i encodeSrgbx4(const SrgbTables &tables, __m128 value) {
+  const __m128 low = _mm_castsi128_ps(_mm_set1_epi32(SRGB_MIN_EXPONENT << 23));
+  const __m128 one = _mm_set1_ps(1.0f);
+  // NaN fails both compares and ends up 0
+  const __m128i inside = _mm_castps_si128(_mm_cmpgt_ps(value, low));
+  const __m128i above = _mm_castps_si128(_mm_cmpge_ps(value, one));
+  // clamped into the buckets, lanes outside are replaced below
+  const __m128i bits = _mm_castps_si128(_mm_min_ps(
+      _mm_max_ps(value, low), _mm_castsi128_ps(_mm_set1_epi32(0x3F7FFFFF))));
+  alignas(16) int32_t bucket[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(bucket),
+                  _mm_sub_epi32(_mm_srli_epi32(bits, 20),
+                                _mm_set1_epi32(SRGB_MIN_EXPONENT << 3)));
+  const __m128 base =
+      _mm_setr_ps(tables.base[bucket[0]], tables.base[bucket[1]],
+                  tables.base[bucket[2]], tables.base[bucket[3]]);
+  const __m128 slope =
+      _mm_setr_ps(tables.slope[bucket[0]], tables.slope[bucket[1]],
+                  tables.slope[bucket[2]], tables.slope[bucket[3]]);
+  const __m128 t =
+      _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(bits, _mm_set1_epi32(0xFFFFF))),
+                 _mm_set1_ps(1.0f / 1048576.0f));
+  const __m128i code = _mm_cvttps_epi32(_mm_add_ps(
+      _mm_add_ps(base, _mm_mul_ps(slope, t)), _mm_set1_ps(0.5f)));
+  return _mm_or_si128(_mm_and_si128(above, _mm_set1_epi32(255)),
+                      _mm_andnot_si128(above, _mm_and_si128(inside, code)));
+}
+
+// sixteen int32 lanes in 0-255 to bytes
+void storeU8x16(uint8_t *dst, const __m128i words[4]) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                   _mm_packus_epi16(_mm_packs_epi32(words[0], words[1]),
+                                    _mm_packs_epi32(words[2], words[3])));
+}
+#endif
+
+// unsigned float with a 5 bit exponent, rounded to nearest even
+uint32_t packUnsignedFloat(float value, uint32_t mantissaBits) {
+  if (!(value > 0.0f))
+    return 0;
+  const uint32_t maxCode = 30u << mantissaBits | ((1u << mantissaBits) - 1);
+  uint32_t bits = floatBits(value);
+  if (bits >= 0x47800000)
+    return maxCode;
+  if (bits < 0x38800000)
+    return (uint32_t)std::nearbyint(value *
+                                    (float)(1u << (14 + mantissaBits)));
+  const uint32_t shift = 23 - mantissaBits;
+  const uint32_t odd = bits >> shift & 1;
+  bits += ((uint32_t)(15 - 127) << 23) + (1u << (shift - 1)) - 1 + odd;
+  return std::min(bits >> shift, maxCode);
+}
+
+#ifdef PIXEL_F16C
+bool hasF16C() {
+  static const bool supported = __builtin_cpu_supports("f16c");
+  return supported;
+}
+
+__attribute__((target("avx,f16c"))) size_t
+convertF32ToF16F16C(const float *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(dst + i),
+        _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+  return i;
+}
+
+__attribute__((target("avx,f16c"))) size_t
+convertF16ToF32F16C(const uint16_t *src, float *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm256_storeu_ps(dst + i,
+                     _mm256_cvtph_ps(_mm_loadu_si128(
+                         reinterpret_cast<const __m128i *>(src + i))));
+  return i;
+}
+#endif
+}; // namespace
+
+uint16_t packHalf(float value) {
+  uint32_t bits = floatBits(value);
+  const uint16_t sign = (uint16_t)(bits >> 16 & 0x8000);
+  bits &= 0x7FFFFFFF;
+  // 2^16, anything from here rounds to infinity, NaN stays NaN
+  if (bits >= 0x47800000)
+    return sign | (bits > 0x7F800000 ? 0x7E00 : 0x7C00);
+  // below 2^-14 the half is subnormal, adding 0.5 lines the mantissa up
+  // with its bits and rounds it on the way
+  if (bits < 0x38800000)
+    return sign | (uint16_t)(floatBits(bitsFloat(bits) + 0.5f) - 0x3F000000);
+  // rebias the exponent, the odd bit makes the rounding go to even
+  const uint32_t odd = bits >> 13 & 1;
+  bits += ((uint32_t)(15 - 127) << 23) + 0xFFF + odd;
+  return sign | (uint16_t)(bits >> 13);
+}
+
+float unpackHalf(uint16_t value) {
+  const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+  const uint32_t exponent = value >> 10 & 0x1F;
+  const uint32_t mantissa = value & 0x3FF;
+  if (exponent == 0) {
+    const float magnitude = mantissa * (1.0f / 16777216.0f);
+    return sign ? -magnitude : magnitude;
+  }
+  if (exponent == 31)
+    return bitsFloat(sign | 0x7F800000 | mantissa << 13);
+  return bitsFloat(sign | (exponent + 127 - 15) << 23 | mantissa << 13);
+}
+
+void convertU8ToF32(const uint8_t *src, float *dst, size_t count) {
+  size_t i = 0;
+#ifdef PIXEL_SSE
+  const __m128i zero = _mm_setzero_si128();
+  // a division rounds like the tables, a reciprocal doesn't
+  const __m128 scale = _mm_set1_ps(255.0f);
+  for (; i + 16 <= count; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    const __m128i words[4] = {
+        _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+        _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+    for (uint32_t j = 0; j < 4; j++)
+      _mm_storeu_ps(dst + i + j * 4,
+                    _mm_div_ps(_mm_cvtepi32_ps(words[j]), scale));
+  }
+#endif
+  const SrgbTables &tables = srgbTables();
+  for (; i < count; i++)
+    dst[i] = tables.toUnit[src[i]];
+}
+
+void convertF32ToU8(const float *src, uint8_t *dst, size_t count) {
+  size_t i = 0;
+#ifdef PIXEL_SSE
+  __m128i words[4];
+  for (; i + 16 <= count; i += 16) {
+    for (uint32_t j = 0; j < 4; j++)
+      words[j] = unitToU8x4(_mm_loadu_ps(src + i + j * 4));
+    storeU8x16(dst + i, words);
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = unitToU8(src[i]);
+}
+
+void convertF32ToF16(const float *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+#ifdef PIXEL_F16C
+  if (hasF16C())
+    i = convertF32ToF16F16C(src, dst, count);
+#endif
+  for (; i < count; i++)
+    dst[i] = packHalf(src[i]);
+}
+
+void convertF16ToF32(const uint16_t *src, float *dst, size_t count) {
+  size_t i = 0;
+#ifdef PIXEL_F16C
+  if (hasF16C())
+    i = convertF16ToF32F16C(src, dst, count);
+#endif
+  for (; i < count; i++)
+    dst[i] = unpackHalf(src[i]);
+}
+
+void convertF32ToB10G11R11(const float *rgba, uint32_t *dst, size_t texels) {
+  for (size_t i = 0; i < texels; i++, rgba += 4)
+    dst[i] = packUnsignedFloat(rgba[0], 6) |
+             packUnsignedFloat(rgba[1], 6) << 11 |
+             packUnsignedFloat(rgba[2], 5) << 22;
+}
+
+void decodeSrgb(const uint8_t *src, float *dst, size_t count,
+                uint32_t comp) {
+  const SrgbTables &tables = srgbTables();
+  if (comp != 4) {
+    for (size_t i = 0; i < count; i++)
+      dst[i] = tables.toLinear[src[i]];
+    return;
+  }
+  for (size_t i = 0; i < count; i += 4) {
+    dst[i + 0] = tables.toLinear[src[i + 0]];
+    dst[i + 1] = tables.toLinear[src[i + 1]];
+    dst[i + 2] = tables.toLinear[src[i + 2]];
+    dst[i + 3] = tables.toUnit[src[i + 3]];
+  }
+}
+
+void encodeSrgb(const float *src, uint8_t *dst, size_t count,
+                uint32_t comp) {
+  const SrgbTables &tables = srgbTables();
+  size_t i = 0;
+#ifdef PIXEL_SSE
+  // with comp 4 the last lane of every register is alpha
+  const __m128i alpha =
+      comp == 4 ? _mm_setr_epi32(0, 0, 0, -1) : _mm_setzero_si128();
+  __m128i words[4];
+  for (; i + 16 <= count; i += 16) {
+    for (uint32_t j = 0; j < 4; j++) {
+      const __m128 v = _mm_loadu_ps(src + i + j * 4);
+      words[j] = _mm_or_si128(_mm_and_si128(alpha, unitToU8x4(v)),
+                              _mm_andnot_si128(alpha, encodeSrgbx4(tables, v)));
+    }
+    storeU8x16(dst + i, words);
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = comp == 4 && i % 4 == 3 ? unitToU8(src[i])
+                                     : encodeSrgbOne(tables, src[i]);
+}
+
+Bitmap convertBitmap(const Bitmap &b, eBitmapFormat fmt, bool srgb) {
+  if (b.fmt_ == fmt)
+    return b;
+  if (b.fmt_ != eBitmapFormat_Float && fmt != eBitmapFormat_Float)
+    return convertBitmap(convertBitmap(b, eBitmapFormat_Float, srgb), fmt,
+                         srgb);
+
+  Bitmap result(b.w_, b.h_, b.d_, b.comp_, fmt);
+  result.type_ = b.type_;
+  const size_t count = (size_t)b.w_ * b.h_ * b.d_ * b.comp_;
+  if (fmt == eBitmapFormat_Float) {
+    float *dst = reinterpret_cast<float *>(result.data_.data());
+    if (b.fmt_ == eBitmapFormat_Half)
+      convertF16ToF32(reinterpret_cast<const uint16_t *>(b.data_.data()), dst,
+                      count);
+    else if (srgb)
+      decodeSrgb(b.data_.data(), dst, count, b.comp_);
+    else
+      convertU8ToF32(b.data_.data(), dst, count);
+    return result;
+  }
+
+  const float *src = reinterpret_cast<const float *>(b.data_.data());
+  if (fmt == eBitmapFormat_Half)
+    convertF32ToF16(src, reinterpret_cast<uint16_t *>(result.data_.data()),
+                    count);
+  else if (srgb)
+    encodeSrgb(src, result.data_.data(), count, b.comp_);
+  else
+    convertF32ToU8(src, result.data_.data(), count);
+  return result;
+}
@@ -0,0 +1,126 @@
+#include "profiler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Event {
+  const char *name;
+  uint64_t beginNs;
+  uint64_t endNs;
+};
+
+struct ThreadBuffer {
+  uint32_t tid;
+  std::string name;
+  std::vector<Event> events;
+  // total events written, the ring holds the last RING_CAPACITY of them
+  uint64_t written = 0;
+};
+
+const std::chrono::steady_clock::time_point epoch =
+    std::chrono::steady_clock::now();
+std::atomic<bool> enabled{false};
+
+std::mutex mtx;
+// buffers are owned here so the zones of finished loader threads survive
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+ThreadBuffer &threadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    auto buffer = std::make_shared<ThreadBuffer>();
+    std::lock_guard<std::mutex> lock(mtx);
+    buffer->tid = static_cast<uint32_t>(buffers.size());
+    buffer->name = buffer->tid == 0 ? "main" : "worker";
+    buffers.emplace_back(buffer);
+    return buffer;
+  }();
+  return *buffer;
+}
+
+void writeEscaped(FILE *file, const std::string &str) {
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      fputc('\\', file);
+    fputc(c, file);
+  }
+}
+
+}; // namespace
+
+namespace Profiler {
+
+uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+void setEnabled(bool value) {
+  if (value)
+    threadBuffer();
+  enabled.store(value, std::memory_order_relaxed);
+}
+
+bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+void setThreadName(const char *name) {
+  ThreadBuffer &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(mtx);
+  buffer.name = name;
+}
+
+void record(const char *name, uint64_t beginNs, uint64_t endNs) {
+  ThreadBuffer &buffer = threadBuffer();
+  const Event event{
+      .name = name,
+      .beginNs = beginNs,
+      .endNs = endNs,
+  };
+  if (buffer.events.size() < RING_CAPACITY)
+    buffer.events.emplace_back(event);
+  else
+    buffer.events[buffer.written % RING_CAPACITY] = event;
+  buffer.written++;
+}
+
+bool dump(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+
+  std::lock_guard<std::mutex> lock(mtx);
+  fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (const auto &buffer : buffers) {
+    fprintf(file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"name\":\"",
+            first ? "" : ",\n", buffer->tid);
+    writeEscaped(file, buffer->name);
+    fprintf(file, "\"}}");
+    first = false;
+
+    // oldest event first once the ring has wrapped
+    const size_t count = buffer->events.size();
+    const size_t start = count < RING_CAPACITY ? 0 : buffer->written % count;
+    for (size_t i = 0; i < count; i++) {
+      const Event &event = buffer->events[(start + i) % count];
+      fprintf(file, ",\n{\"name\":\"");
+      writeEscaped(file, event.name);
+      fprintf(file,
+              "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              buffer->tid, event.beginNs * 1e-3,
+              (event.endNs - event.beginNs) * 1e-3);
+    }
+  }
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(file);
+  return true;
+}
+
+} // namespace Profiler
@@ -70,6 +70,17 @@ ShapeModule Shapes::prepareShape(const std::vector<glm::vec4> &vertices,
   });
   shape.indicesSize = (uint32_t)cubeIndices.size();
 
+  for (const auto &v : vertices)
+    shape.aabb.grow(glm::vec3(v));
+  shape.sphere = glm::vec4(shape.aabb.center(),
+                           glm::length(shape.aabb.max - shape.aabb.min) * 0.5f);
+
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++)
+    positions[i] = glm::vec3(vertices[i]);
+  shape.triangles.build(std::move(positions),
+                        std::vector<uint32_t>(indices.begin(), indices.end()));
+
   shape.name = name;
   shape.id = shapeCount;
 
@@ -1,72 +1,332 @@
 #include "imgui.h"
 #include <Bitmap.h>
 #include <UtilsCubemap.h>
+#include <envBaker.h>
 #include <filesystem>
-#include <mutex>
+#include <mipmap.h>
+#include <pixelConvert.h>
+#include <profiler.h>
 #include <skybox.h>
-#include <thread>
+#include <textureCache.h>
+#include <textureCompress.h>
 
 namespace fs = std::filesystem;
 
 #include "stbi_image.h"
 
 namespace {
-uint32_t count = 0;
-std::mutex mtx;
-}; // namespace
+// an hdr on its way through the load stages, see TextureLoad
+struct CubemapLoad {
+  std::string path;
+  bool compress = false;
+  // what the cubes are stored in without BC6H
+  MAI::TextureFormat hdrFormat = MAI::Format_RGBA_F32;
+  // the hashes are only taken when compress
+  uint64_t sourceHash = 0;
+  bool cached = false;
+  Ktx2View cache;
+  // the baked lighting, cached apart from the skybox
+  uint64_t envHash = 0;
+  bool envCached = false;
+  Ktx2View irradianceCache;
+  Ktx2View specularCache;
+  // equirectangular after decode, cube faces after convert
+  Bitmap image;
+  // chains in getFormat(), every face of a level back to back
+  std::vector<std::vector<uint8_t>> levels;
+  EnvCube irradiance;
+  EnvCube specular;
+  std::vector<std::vector<uint8_t>> irradianceLevels;
+  std::vector<std::vector<uint8_t>> specularLevels;
+
+  MAI::TextureFormat getFormat() const {
+    return compress ? MAI::Format_BC6H_UF : hdrFormat;
+  }
+};
+
+// RGBA float texels in an uncompressed hdr format
+std::vector<uint8_t> packHdr(const float *rgba, uint32_t texels,
+                             MAI::TextureFormat format) {
+  std::vector<uint8_t> packed(MAI::getTextureSize(format, texels, 1));
+  switch (format) {
+  case MAI::Format_RGBA_F16:
+    convertF32ToF16(rgba, reinterpret_cast<uint16_t *>(packed.data()),
+                    (size_t)texels * 4);
+    break;
+  case MAI::Format_B10G11R11_UF:
+    convertF32ToB10G11R11(rgba, reinterpret_cast<uint32_t *>(packed.data()),
+                          texels);
+    break;
+  default:
+    assert(format == MAI::Format_RGBA_F32);
+    memcpy(packed.data(), rgba, packed.size());
+  }
+  return packed;
+}
+
+// one level of faces in the format the load uploads
+std::vector<uint8_t> packFace(const CubemapLoad &load, const float *rgba,
+                              uint32_t width, uint32_t height) {
+  return load.compress ? encodeBC6H(rgba, width, height)
+                       : packHdr(rgba, width * height, load.hdrFormat);
+}
+
+std::vector<std::vector<uint8_t>> packEnvCube(JobSystem *jobs,
+                                              const CubemapLoad &load,
+                                              const EnvCube &cube) {
+  if (load.compress)
+    return encodeEnvCube(cube, jobs);
+  std::vector<std::vector<uint8_t>> levels;
+  for (size_t level = 0; level < cube.levels.size(); level++) {
+    const uint32_t size = mipSize(cube.size, (uint32_t)level);
+    levels.emplace_back(packHdr(cube.levels[level].data(), 6 * size * size,
+                                load.hdrFormat));
+  }
+  return levels;
+}
+
+void decodeCubemap(CubemapLoad &load) {
+  MAI_PROFILE_FUNCTION();
+  // without BC support there are no caches to check the hdr against
+  if (load.compress) {
+    MAI_PROFILE_SCOPE("texture cache");
+    load.sourceHash = hashTextureSource(load.path, MAI::Format_BC6H_UF);
+    load.envHash = hashEnvSource(load.sourceHash);
+    load.cached = load.cache.open(load.path + TEXTURE_CACHE_EXTENSION,
+                                  load.sourceHash);
+    load.envCached =
+        load.irradianceCache.open(load.path + ENV_IRRADIANCE_EXTENSION,
+                                  load.envHash) &&
+        load.specularCache.open(load.path + ENV_SPECULAR_EXTENSION,
+                                load.envHash);
+    if (load.cached && load.envCached)
+      return;
+  }
 
-void loadCubemape(MAI::Renderer *ren, std::string dir,
-                  std::vector<Cubemap> &cubemaps) {
   int w, h;
-  const float *img = stbi_loadf(dir.c_str(), &w, &h, nullptr, 4);
+  const float *img;
+  {
+    MAI_PROFILE_SCOPE("stbi_loadf");
+    img = stbi_loadf(load.path.c_str(), &w, &h, nullptr, 4);
+  }
   assert(img);
-  Bitmap in(w, h, 4, eBitmapFormat_Float, img);
-  Bitmap out = convertEquirectangularMapToVerticalCross(in);
+  load.image = Bitmap(w, h, 4, eBitmapFormat_Float, img);
   stbi_image_free((void *)img);
+}
 
-  Bitmap cubemap = convertVerticalCrossToCubeMapFaces(out);
+// bakes the lighting of the faces, cached like the skybox
+void bakeEnvironment(JobSystem *jobs, CubemapLoad &load) {
+  MAI_PROFILE_FUNCTION();
+  load.irradiance = bakeIrradiance(load.image, jobs);
+  load.specular = bakeSpecular(load.image, jobs);
+  load.irradianceLevels = packEnvCube(jobs, load, load.irradiance);
+  load.specularLevels = packEnvCube(jobs, load, load.specular);
+  if (!load.compress)
+    return;
 
-  MAI::Texture *cube = ren->createImage({
+  writeEnvCube(load.path + ENV_IRRADIANCE_EXTENSION, load.envHash,
+               load.irradiance, load.irradianceLevels);
+  writeEnvCube(load.path + ENV_SPECULAR_EXTENSION, load.envHash,
+               load.specular, load.specularLevels);
+}
+
+// converts the equirectangular hdr into cube faces and their chain, BC6H
+// compressed and cached next to the source when the device can sample it
+void convertCubemap(JobSystem *jobs, CubemapLoad &load) {
+  MAI_PROFILE_FUNCTION();
+  if (load.cached && load.envCached)
+    return;
+
+  {
+    MAI_PROFILE_SCOPE("equirectangular to cube faces");
+    load.image = convertEquirectangularMapToCubeMapFaces(load.image, jobs);
+  }
+  if (!load.envCached)
+    bakeEnvironment(jobs, load);
+  if (load.cached)
+    return;
+
+  const uint32_t faceWidth = (uint32_t)load.image.w_;
+  const uint32_t faceHeight = (uint32_t)load.image.h_;
+  const size_t facePixels = (size_t)faceWidth * faceHeight * 4;
+  const float *faces = load.image.view<float, 4>().data;
+  const uint32_t levelCount = MAI::getMipLevelCount(faceWidth, faceHeight);
+  // faces are independent chains, packed in parallel and interleaved after.
+  // Neither BC6H nor B10G11R11 can be blitted so the chain is built here
+  std::vector<std::vector<uint8_t>> faceLevels(6 * levelCount);
+  jobs->parallelFor(6, 1, [&](uint32_t begin, uint32_t end) {
+    MAI_PROFILE_SCOPE("pack face chain");
+    for (uint32_t face = begin; face < end; face++) {
+      std::vector<float> mip;
+      const float *src = faces + face * facePixels;
+      for (uint32_t level = 0; level < levelCount; level++) {
+        const uint32_t mipWidth = mipSize(faceWidth, level);
+        const uint32_t mipHeight = mipSize(faceHeight, level);
+        faceLevels[face * levelCount + level] =
+            packFace(load, src, mipWidth, mipHeight);
+        if (level + 1 < levelCount) {
+          mip = downsampleRGBAF32(src, mipWidth, mipHeight);
+          src = mip.data();
+        }
+      }
+    }
+  });
+  load.levels.resize(levelCount);
+  for (uint32_t level = 0; level < levelCount; level++)
+    for (uint32_t face = 0; face < 6; face++) {
+      const std::vector<uint8_t> &blocks =
+          faceLevels[face * levelCount + level];
+      load.levels[level].insert(load.levels[level].end(), blocks.begin(),
+                                blocks.end());
+    }
+  if (!load.compress)
+    return;
+
+  writeKtx2(load.path + TEXTURE_CACHE_EXTENSION,
+            {
+                .format = MAI::Format_BC6H_UF,
+                .width = faceWidth,
+                .height = faceHeight,
+                .faceCount = 6,
+                .levelCount = levelCount,
+                .sourceHash = load.sourceHash,
+            },
+            load.levels);
+}
+
+// a cube from its cache or from its packed chain
+MAI::Texture *uploadCube(MAI::Renderer *ren, const CubemapLoad &load,
+                         const Ktx2View &cache, bool cached, uint32_t size,
+                         const std::vector<std::vector<uint8_t>> &levels) {
+  if (cached)
+    return createTexture(ren, cache);
+
+  std::vector<const void *> mipData(levels.size());
+  for (size_t level = 0; level < levels.size(); level++)
+    mipData[level] = levels[level].data();
+  return ren->createImage({
       .type = MAI::TextureType_Cube,
-      .format = MAI::Format_RGBA_F32,
-      .dimensions = {(uint32_t)cubemap.w_, (uint32_t)cubemap.h_},
-      .data = cubemap.data_.data(),
+      .format = load.getFormat(),
+      .dimensions = {size, size},
+      .data = mipData[0],
       .usage = MAI::Sampled_Bit,
+      .mipLevels = (uint32_t)mipData.size(),
+      .mipData = mipData.data(),
   });
+}
+
+void uploadCubemap(MAI::Renderer *ren, CubemapLoad &load, Cubemap &cubemap) {
+  MAI_PROFILE_FUNCTION();
+  cubemap.tex = uploadCube(ren, load, load.cache, load.cached,
+                           (uint32_t)load.image.w_, load.levels);
+  cubemap.irradiance =
+      uploadCube(ren, load, load.irradianceCache, load.envCached,
+                 load.irradiance.size, load.irradianceLevels);
+  cubemap.specular = uploadCube(ren, load, load.specularCache, load.envCached,
+                                load.specular.size, load.specularLevels);
+  cubemap.specularLevels = load.envCached
+                               ? load.specularCache.desc.levelCount
+                               : (uint32_t)load.specular.levels.size();
+}
 
-  std::string name = dir;
-  name = name.substr(name.find_last_of('/') + 1);
-  std::size_t pos = name.find_last_of('.');
-  name = name.substr(0, pos);
+// the split sum LUT shared by every skybox, cached in their directory
+MAI::Texture *loadBrdfLut(MAI::Renderer *ren, JobSystem *jobs,
+                          bool compress) {
+  MAI_PROFILE_FUNCTION();
+  const std::string path =
+      std::string(RESOURCES_PATH "skybox/") + ENV_BRDF_LUT_NAME;
+  if (compress) {
+    Ktx2View cache;
+    if (cache.open(path, hashBrdfLut()))
+      return createTexture(ren, cache);
+  }
+
+  const uint32_t size = ENV_BRDF_LUT_SIZE;
+  const std::vector<float> lut = bakeBrdfLut(size, jobs);
+  if (compress) {
+    const std::vector<uint8_t> blocks = encodeBrdfLut(lut, size);
+    writeBrdfLut(path, blocks);
+    return ren->createImage({
+        .type = MAI::TextureType_2D,
+        .format = MAI::Format_BC5,
+        .dimensions = {size, size},
+        .data = blocks.data(),
+        .usage = MAI::Sampled_Bit,
+    });
+  }
 
-  std::lock_guard<std::mutex> lock(mtx);
-  cubemaps.emplace_back(Cubemap{
-      .name = name,
-      .id = count,
-      .tex = cube,
+  // there is no two channel float format, the pairs go up as RGBA halves
+  std::vector<float> rgba((size_t)size * size * 4);
+  for (size_t i = 0; i < (size_t)size * size; i++) {
+    rgba[i * 4 + 0] = lut[i * 2];
+    rgba[i * 4 + 1] = lut[i * 2 + 1];
+    rgba[i * 4 + 3] = 1.0f;
+  }
+  const std::vector<uint8_t> halves =
+      packHdr(rgba.data(), size * size, MAI::Format_RGBA_F16);
+  return ren->createImage({
+      .type = MAI::TextureType_2D,
+      .format = MAI::Format_RGBA_F16,
+      .dimensions = {size, size},
+      .data = halves.data(),
+      .usage = MAI::Sampled_Bit,
   });
-  count++;
 }
+}; // namespace
 
-Skybox::Skybox(MAI::Renderer *ren, VkFormat format) : ren_(ren) {
-  MAI::Shader *vert_ = ren_->createShader(SHADERS_PATH "spvs/skybox.vspv");
-  MAI::Shader *frag_ = ren_->createShader(SHADERS_PATH "spvs/skybox.fspv");
-  pipeline_ = ren_->createPipeline({
-      .vert = vert_,
-      .frag = frag_,
-      .depthFormat = format,
+Skybox::Skybox(MAI::Renderer *ren, JobSystem *jobs,
+               PipelineRegistry *pipelines, VkFormat format,
+               MAI::TextureFormat hdrFormat)
+    : ren_(ren) {
+  MAI_PROFILE_FUNCTION();
+  PipelineEntry *pipeline = pipelines->request({
+      .vert = SHADERS_PATH "spvs/skybox.vspv",
+      .frag = SHADERS_PATH "spvs/skybox.fspv",
+      .info = {.depthFormat = format},
   });
-  delete vert_;
-  delete frag_;
 
-  std::vector<std::jthread> threads;
+  std::vector<std::string> paths;
   std::string path = RESOURCES_PATH "skybox";
   for (const auto &entry : fs::directory_iterator(path)) {
     std::string str = entry.path();
-    threads.emplace_back(loadCubemape, ren, str, std::ref(cubemaps));
+    if (!isTextureCache(str))
+      paths.emplace_back(str);
   }
+  assert(paths.size() != 0);
+
+  // ids follow the directory order, the jobs write into their own entry.
+  // Their slots in the bindless sets are in upload order, createImage hands
+  // them out under a lock
+  cubemaps.resize(paths.size());
+  const bool compress = ren->supportsBlockCompression();
+  std::vector<JobHandle> uploads;
+  uploads.emplace_back(jobs->submit(
+      [this, jobs, compress] { brdfLut = loadBrdfLut(ren_, jobs, compress); }));
+  for (size_t i = 0; i < paths.size(); i++) {
+    std::string name = paths[i];
+    name = name.substr(name.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    Cubemap &cubemap = cubemaps[i];
+    cubemap.name = name;
+    cubemap.id = (uint32_t)i;
 
-  assert(threads.size() != 0);
+    CubemapLoad *load = new CubemapLoad{
+        .path = paths[i],
+        .compress = compress,
+        .hdrFormat = hdrFormat,
+    };
+    JobHandle decode = jobs->submit([load] { decodeCubemap(*load); });
+    JobHandle convert =
+        jobs->submit([jobs, load] { convertCubemap(jobs, *load); }, {decode});
+    uploads.emplace_back(jobs->submit(
+        [ren, load, &cubemap] {
+          uploadCubemap(ren, *load, cubemap);
+          delete load;
+        },
+        {convert}));
+  }
+  jobs->wait(uploads);
+  pipeline_ = pipelines->get(pipeline);
 }
 
 void Skybox::draw(const DrawInfo &info) {
@@ -99,8 +359,11 @@ void Skybox::guiWidgets() {
 }
 
 Skybox::~Skybox() {
-  for (auto &it : cubemaps)
+  for (auto &it : cubemaps) {
     delete it.tex;
+    delete it.irradiance;
+    delete it.specular;
+  }
   cubemaps.clear();
-  delete pipeline_;
+  delete brdfLut;
 }
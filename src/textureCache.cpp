@@ -0,0 +1,147 @@
+#include "textureCache.h"
+#include "mipmap.h"
+#include "profiler.h"
+#include "stbi_image.h"
+#include "textureCompress.h"
+
+bool isTextureCache(const std::string &path) {
+  return path.find(TEXTURE_CACHE_EXTENSION) != std::string::npos;
+}
+
+uint64_t hashTextureSource(const std::string &path,
+                           MAI::TextureFormat format) {
+  const uint32_t salt[2] = {TEXTURE_CACHE_VERSION, format};
+  return hashFile(path, hashBytes(salt, sizeof(salt)));
+}
+
+MAI::Texture *createTexture(MAI::Renderer *ren, const Ktx2View &view) {
+  std::vector<const void *> levels(view.desc.levelCount);
+  for (uint32_t i = 0; i < view.desc.levelCount; i++)
+    levels[i] = view.level(i);
+  return ren->createImage({
+      .type = view.desc.faceCount == 6 ? MAI::TextureType_Cube
+                                       : MAI::TextureType_2D,
+      .format = view.desc.format,
+      .dimensions = {view.desc.width, view.desc.height},
+      .data = levels[0],
+      .usage = MAI::Sampled_Bit,
+      .mipLevels = view.desc.levelCount,
+      .mipData = levels.data(),
+  });
+}
+
+TextureLoad::TextureLoad(const std::string &path, TextureKind kind,
+                         bool compress)
+    : path(path), kind(kind), compress(compress) {
+  format = kind == TextureKind_Normal ? MAI::Format_BC5 : MAI::Format_BC7_S;
+}
+
+TextureLoad::~TextureLoad() {
+  if (pixels)
+    stbi_image_free(pixels);
+}
+
+bool decodeTexture(TextureLoad &load) {
+  MAI_PROFILE_FUNCTION();
+  // without BC support there is no cache to check the source against
+  if (load.compress) {
+    MAI_PROFILE_SCOPE("texture cache");
+    load.sourceHash = hashTextureSource(load.path, load.format);
+    load.cached =
+        load.cache.open(load.path + TEXTURE_CACHE_EXTENSION, load.sourceHash);
+    if (load.cached)
+      return true;
+  }
+
+  int w, h, comp;
+  {
+    MAI_PROFILE_SCOPE("stbi_load");
+    load.pixels = stbi_load(load.path.c_str(), &w, &h, &comp, 4);
+  }
+  if (!load.pixels)
+    return false;
+  load.width = (uint32_t)w;
+  load.height = (uint32_t)h;
+  return true;
+}
+
+void convertTexture(TextureLoad &load) {
+  MAI_PROFILE_FUNCTION();
+  if (!load.compress || !load.pixels)
+    return;
+
+  // the chain is filtered before encoding, blocks can't be blitted
+  const uint32_t levelCount = MAI::getMipLevelCount(load.width, load.height);
+  load.levels.resize(levelCount);
+  {
+    MAI_PROFILE_SCOPE("encode blocks");
+    std::vector<uint8_t> mip;
+    const uint8_t *src = load.pixels;
+    for (uint32_t level = 0; level < levelCount; level++) {
+      const uint32_t mipWidth = mipSize(load.width, level);
+      const uint32_t mipHeight = mipSize(load.height, level);
+      load.levels[level] = load.format == MAI::Format_BC5
+                               ? encodeBC5(src, mipWidth, mipHeight)
+                               : encodeBC7(src, mipWidth, mipHeight);
+      if (level + 1 < levelCount) {
+        mip = downsampleRGBA8(src, mipWidth, mipHeight,
+                              load.kind == TextureKind_Color);
+        src = mip.data();
+      }
+    }
+  }
+  // a failed write only costs another encode next launch
+  writeKtx2(load.path + TEXTURE_CACHE_EXTENSION,
+            {
+                .format = load.format,
+                .width = load.width,
+                .height = load.height,
+                .levelCount = levelCount,
+                .sourceHash = load.sourceHash,
+            },
+            load.levels);
+  stbi_image_free(load.pixels);
+  load.pixels = nullptr;
+}
+
+MAI::Texture *uploadTexture(MAI::Renderer *ren, TextureLoad &load) {
+  MAI_PROFILE_FUNCTION();
+  if (load.cached)
+    return createTexture(ren, load.cache);
+  if (!load.pixels && load.levels.empty())
+    return nullptr;
+
+  if (!load.compress)
+    return ren->createImage({
+        .type = MAI::TextureType_2D,
+        .format = MAI::Format_RGBA_S8,
+        .dimensions = {load.width, load.height},
+        .data = load.pixels,
+        .usage = MAI::Sampled_Bit,
+        .mipLevels = 0,
+    });
+
+  const uint32_t levelCount = (uint32_t)load.levels.size();
+  std::vector<const void *> mipData(levelCount);
+  for (uint32_t level = 0; level < levelCount; level++)
+    mipData[level] = load.levels[level].data();
+  return ren->createImage({
+      .type = MAI::TextureType_2D,
+      .format = load.format,
+      .dimensions = {load.width, load.height},
+      .data = mipData[0],
+      .usage = MAI::Sampled_Bit,
+      .mipLevels = levelCount,
+      .mipData = mipData.data(),
+  });
+}
+
+MAI::Texture *loadCachedTexture(MAI::Renderer *ren, const std::string &path,
+                                TextureKind kind) {
+  MAI_PROFILE_FUNCTION();
+  TextureLoad load(path, kind, ren->supportsBlockCompression());
+  if (!decodeTexture(load))
+    return nullptr;
+  convertTexture(load);
+  return uploadTexture(ren, load);
+}
@@ -0,0 +1,402 @@
+#include "textureCompress.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// interpolation weights of 4 bit indices, shared by BC6H and BC7
+constexpr uint32_t WEIGHTS4[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                   34, 38, 43, 47, 51, 55, 60, 64};
+
+uint32_t interpolate(uint32_t e0, uint32_t e1, uint32_t weight) {
+  return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+// little endian bit stream into one 16 byte block
+struct BlockWriter {
+  uint8_t *out;
+  uint32_t bit = 0;
+
+  void write(uint32_t value, uint32_t bits) {
+    for (uint32_t i = 0; i < bits; i++, bit++)
+      if (value >> i & 1)
+        out[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+  }
+};
+
+// copies the 4x4 block at (bx, by), clamping at the image edges
+template <typename T>
+void fetchBlock(const T *src, uint32_t width, uint32_t height, uint32_t bx,
+                uint32_t by, T block[16][4]) {
+  for (uint32_t y = 0; y < 4; y++)
+    for (uint32_t x = 0; x < 4; x++) {
+      const uint32_t sx = std::min(bx * 4 + x, width - 1);
+      const uint32_t sy = std::min(by * 4 + y, height - 1);
+      memcpy(block[y * 4 + x], src + ((size_t)sy * width + sx) * 4,
+             sizeof(T) * 4);
+    }
+}
+
+// principal axis of the points through power iteration, returns the
+// extremes of their projection on it as two endpoints
+template <uint32_t N>
+void fitEndpoints(const float points[16][N], float e0[N], float e1[N]) {
+  float mean[N] = {};
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < N; c++)
+      mean[c] += points[i][c] / 16.0f;
+
+  float cov[N][N] = {};
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t a = 0; a < N; a++)
+      for (uint32_t b = 0; b < N; b++)
+        cov[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+
+  float axis[N];
+  for (uint32_t c = 0; c < N; c++)
+    axis[c] = 1.0f;
+  for (uint32_t iter = 0; iter < 8; iter++) {
+    float next[N] = {};
+    float length = 0.0f;
+    for (uint32_t a = 0; a < N; a++) {
+      for (uint32_t b = 0; b < N; b++)
+        next[a] += cov[a][b] * axis[b];
+      length = std::max(length, std::abs(next[a]));
+    }
+    if (length == 0.0f)
+      break;
+    for (uint32_t c = 0; c < N; c++)
+      axis[c] = next[c] / length;
+  }
+
+  float tMin = FLT_MAX, tMax = -FLT_MAX;
+  for (uint32_t i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (uint32_t c = 0; c < N; c++)
+      t += (points[i][c] - mean[c]) * axis[c];
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+
+  float lengthSq = 0.0f;
+  for (uint32_t c = 0; c < N; c++)
+    lengthSq += axis[c] * axis[c];
+  const float scale = lengthSq > 0.0f ? 1.0f / lengthSq : 0.0f;
+  for (uint32_t c = 0; c < N; c++) {
+    e0[c] = mean[c] + axis[c] * tMin * scale;
+    e1[c] = mean[c] + axis[c] * tMax * scale;
+  }
+}
+
+// BC7 mode 6 endpoint, 7 bits per channel plus a shared p-bit
+struct Endpoint7 {
+  uint32_t q[4];
+  uint32_t p;
+  uint32_t value(uint32_t c) const { return q[c] << 1 | p; }
+};
+
+Endpoint7 quantizeEndpoint7(const float e[4]) {
+  Endpoint7 best{};
+  float bestError = -1.0f;
+  for (uint32_t p = 0; p < 2; p++) {
+    Endpoint7 candidate{.p = p};
+    float error = 0.0f;
+    for (uint32_t c = 0; c < 4; c++) {
+      const float q = std::round((std::clamp(e[c], 0.0f, 255.0f) - p) / 2.0f);
+      candidate.q[c] = (uint32_t)std::clamp(q, 0.0f, 127.0f);
+      const float d = (float)candidate.value(c) - e[c];
+      error += d * d;
+    }
+    if (bestError < 0.0f || error < bestError) {
+      best = candidate;
+      bestError = error;
+    }
+  }
+  return best;
+}
+
+// picks the closest palette entry for every pixel, returns the total error
+uint32_t selectIndices7(const uint8_t block[16][4], const Endpoint7 &e0,
+                        const Endpoint7 &e1, uint8_t indices[16]) {
+  uint32_t palette[16][4];
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < 4; c++)
+      palette[i][c] = interpolate(e0.value(c), e1.value(c), WEIGHTS4[i]);
+
+  uint32_t total = 0;
+  for (uint32_t p = 0; p < 16; p++) {
+    uint32_t best = UINT32_MAX;
+    for (uint32_t i = 0; i < 16; i++) {
+      uint32_t error = 0;
+      for (uint32_t c = 0; c < 4; c++) {
+        const int d = (int)palette[i][c] - block[p][c];
+        error += d * d;
+      }
+      if (error < best) {
+        best = error;
+        indices[p] = (uint8_t)i;
+      }
+    }
+    total += best;
+  }
+  return total;
+}
+
+// least squares endpoints for fixed indices
+template <uint32_t N, typename T>
+bool refineEndpoints(const T block[16][N], const uint8_t indices[16],
+                     float e0[N], float e1[N]) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[N] = {}, bx[N] = {};
+  for (uint32_t p = 0; p < 16; p++) {
+    const float w = WEIGHTS4[indices[p]] / 64.0f;
+    const float a = 1.0f - w;
+    aa += a * a;
+    ab += a * w;
+    bb += w * w;
+    for (uint32_t c = 0; c < N; c++) {
+      ax[c] += a * (float)block[p][c];
+      bx[c] += w * (float)block[p][c];
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f)
+    return false;
+  for (uint32_t c = 0; c < N; c++) {
+    e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+    e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+  }
+  return true;
+}
+
+void encodeBC7Block(const uint8_t block[16][4], uint8_t *out) {
+  float points[16][4];
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < 4; c++)
+      points[i][c] = block[i][c];
+
+  float f0[4], f1[4];
+  fitEndpoints<4>(points, f0, f1);
+  Endpoint7 e0 = quantizeEndpoint7(f0);
+  Endpoint7 e1 = quantizeEndpoint7(f1);
+  uint8_t indices[16];
+  uint32_t error = selectIndices7(block, e0, e1, indices);
+
+  // one least squares pass, kept only when it helps
+  if (error > 0 && refineEndpoints<4>(block, indices, f0, f1)) {
+    const Endpoint7 r0 = quantizeEndpoint7(f0);
+    const Endpoint7 r1 = quantizeEndpoint7(f1);
+    uint8_t refined[16];
+    const uint32_t refinedError = selectIndices7(block, r0, r1, refined);
+    if (refinedError < error) {
+      e0 = r0;
+      e1 = r1;
+      memcpy(indices, refined, sizeof(indices));
+    }
+  }
+
+  // the first index is stored without its top bit, so it has to be < 8
+  if (indices[0] >= 8) {
+    std::swap(e0, e1);
+    for (auto &index : indices)
+      index = (uint8_t)(15 - index);
+  }
+
+  memset(out, 0, BC_BLOCK_SIZE);
+  BlockWriter writer{.out = out};
+  writer.write(1 << 6, 7);
+  for (uint32_t c = 0; c < 4; c++) {
+    writer.write(e0.q[c], 7);
+    writer.write(e1.q[c], 7);
+  }
+  writer.write(e0.p, 1);
+  writer.write(e1.p, 1);
+  writer.write(indices[0], 3);
+  for (uint32_t i = 1; i < 16; i++)
+    writer.write(indices[i], 4);
+}
+
+// BC4 in the 8 value mode, red0 > red1
+void encodeBC4Block(const uint8_t values[16], uint8_t *out) {
+  uint8_t lo = 255, hi = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    lo = std::min(lo, values[i]);
+    hi = std::max(hi, values[i]);
+  }
+
+  memset(out, 0, 8);
+  out[0] = hi;
+  out[1] = lo;
+  if (hi == lo)
+    return;
+
+  uint32_t palette[8] = {hi, lo};
+  for (uint32_t i = 2; i < 8; i++)
+    palette[i] = ((8 - i) * hi + (i - 1) * lo + 3) / 7;
+
+  BlockWriter writer{.out = out, .bit = 16};
+  for (uint32_t p = 0; p < 16; p++) {
+    uint32_t best = 0, bestError = UINT32_MAX;
+    for (uint32_t i = 0; i < 8; i++) {
+      const uint32_t error = (uint32_t)std::abs((int)palette[i] - values[p]);
+      if (error < bestError) {
+        bestError = error;
+        best = i;
+      }
+    }
+    writer.write(best, 3);
+  }
+}
+
+// BC6H unsigned endpoints are stored as 10 bits and widened to 16 before
+// interpolating, the result times 31/64 is the half float
+uint32_t unquantize6H(uint32_t q) {
+  if (q == 0)
+    return 0;
+  if (q == 1023)
+    return 0xFFFF;
+  return ((q << 16) + 0x8000) >> 10;
+}
+
+uint32_t quantize6H(float value) {
+  return (uint32_t)std::clamp(std::round((value - 32.0f) / 64.0f), 0.0f,
+                              1023.0f);
+}
+
+void encodeBC6HBlock(const float block[16][4], uint8_t *out) {
+  // fit in the widened space, halves are roughly logarithmic so that also
+  // spreads the error evenly over the exposure range
+  uint16_t halves[16][3];
+  float points[16][3];
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < 3; c++) {
+      halves[i][c] = floatToHalf(block[i][c]);
+      points[i][c] = halves[i][c] * 64.0f / 31.0f;
+    }
+
+  float f0[3], f1[3];
+  fitEndpoints<3>(points, f0, f1);
+  uint32_t q0[3], q1[3];
+  for (uint32_t c = 0; c < 3; c++) {
+    q0[c] = quantize6H(f0[c]);
+    q1[c] = quantize6H(f1[c]);
+  }
+
+  uint32_t palette[16][3];
+  for (uint32_t i = 0; i < 16; i++)
+    for (uint32_t c = 0; c < 3; c++)
+      palette[i][c] =
+          interpolate(unquantize6H(q0[c]), unquantize6H(q1[c]), WEIGHTS4[i]) *
+              31 >>
+          6;
+
+  uint8_t indices[16];
+  for (uint32_t p = 0; p < 16; p++) {
+    uint64_t bestError = UINT64_MAX;
+    for (uint32_t i = 0; i < 16; i++) {
+      uint64_t error = 0;
+      for (uint32_t c = 0; c < 3; c++) {
+        const int64_t d = (int64_t)palette[i][c] - halves[p][c];
+        error += d * d;
+      }
+      if (error < bestError) {
+        bestError = error;
+        indices[p] = (uint8_t)i;
+      }
+    }
+  }
+
+  if (indices[0] >= 8) {
+    for (uint32_t c = 0; c < 3; c++)
+      std::swap(q0[c], q1[c]);
+    for (auto &index : indices)
+      index = (uint8_t)(15 - index);
+  }
+
+  memset(out, 0, BC_BLOCK_SIZE);
+  BlockWriter writer{.out = out};
+  writer.write(0x03, 5);
+  for (uint32_t c = 0; c < 3; c++)
+    writer.write(q0[c], 10);
+  for (uint32_t c = 0; c < 3; c++)
+    writer.write(q1[c], 10);
+  writer.write(indices[0], 3);
+  for (uint32_t i = 1; i < 16; i++)
+    writer.write(indices[i], 4);
+}
+
+}; // namespace
+
+uint16_t floatToHalf(float value) {
+  // BC6H here is unsigned, so negatives and NaN become 0
+  if (!(value > 0.0f))
+    return 0;
+  if (value >= 65504.0f)
+    return 0x7BFF;
+
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const int32_t exponent = (int32_t)(bits >> 23 & 0xFF) - 127 + 15;
+  if (exponent <= 0)
+    // subnormal, steps of 2^-24
+    return (uint16_t)std::round(value * 16777216.0f);
+
+  const uint32_t mantissa = bits & 0x7FFFFF;
+  uint32_t half = (uint32_t)exponent << 10 | mantissa >> 13;
+  if (mantissa & 0x1000)
+    half++;
+  return (uint16_t)std::min(half, 0x7BFFu);
+}
+
+std::vector<uint8_t> encodeBC7(const uint8_t *rgba, uint32_t width,
+                               uint32_t height) {
+  std::vector<uint8_t> out((size_t)bcBlocksX(width) * bcBlocksY(height) *
+                           BC_BLOCK_SIZE);
+  uint8_t *dst = out.data();
+  for (uint32_t by = 0; by < bcBlocksY(height); by++)
+    for (uint32_t bx = 0; bx < bcBlocksX(width); bx++) {
+      uint8_t block[16][4];
+      fetchBlock(rgba, width, height, bx, by, block);
+      encodeBC7Block(block, dst);
+      dst += BC_BLOCK_SIZE;
+    }
+  return out;
+}
+
+std::vector<uint8_t> encodeBC5(const uint8_t *rgba, uint32_t width,
+                               uint32_t height) {
+  std::vector<uint8_t> out((size_t)bcBlocksX(width) * bcBlocksY(height) *
+                           BC_BLOCK_SIZE);
+  uint8_t *dst = out.data();
+  for (uint32_t by = 0; by < bcBlocksY(height); by++)
+    for (uint32_t bx = 0; bx < bcBlocksX(width); bx++) {
+      uint8_t block[16][4];
+      fetchBlock(rgba, width, height, bx, by, block);
+      uint8_t red[16], green[16];
+      for (uint32_t i = 0; i < 16; i++) {
+        red[i] = block[i][0];
+        green[i] = block[i][1];
+      }
+      encodeBC4Block(red, dst);
+      encodeBC4Block(green, dst + 8);
+      dst += BC_BLOCK_SIZE;
+    }
+  return out;
+}
+
+std::vector<uint8_t> encodeBC6H(const float *rgba, uint32_t width,
+                                uint32_t height) {
+  std::vector<uint8_t> out((size_t)bcBlocksX(width) * bcBlocksY(height) *
+                           BC_BLOCK_SIZE);
+  uint8_t *dst = out.data();
+  for (uint32_t by = 0; by < bcBlocksY(height); by++)
+    for (uint32_t bx = 0; bx < bcBlocksX(width); bx++) {
+      float block[16][4];
+      fetchBlock(rgba, width, height, bx, by, block);
+      encodeBC6HBlock(block, dst);
+      dst += BC_BLOCK_SIZE;
+    }
+  return out;
+}
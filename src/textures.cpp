@@ -1,81 +1,171 @@
 #include "textures.h"
-#include "stbi_image.h"
+#include "profiler.h"
+#include "textureCache.h"
 #include <algorithm>
 #include <cassert>
 #include <filesystem>
+#include <functional>
 #include <iostream>
-#include <mutex>
-#include <thread>
 
 namespace fs = std::filesystem;
 
 namespace {
-uint32_t count = 1;
-std::mutex mtx;
+// member of tm a file is loaded into, by the name of the file
+MAI::Texture **textureSlot(TextureModel &tm, const std::string &str) {
+  if (str.find("ao") != std::string::npos)
+    return &tm.ao;
+  if (str.find("arm") != std::string::npos)
+    return &tm.arm;
+  if (str.find("diff") != std::string::npos)
+    return &tm.diffuse;
+  if (str.find("disp") != std::string::npos)
+    return &tm.displacement;
+  if (str.find("mask") != std::string::npos)
+    return &tm.mask;
+  if (str.find("nor_dx") != std::string::npos)
+    return &tm.normalDX;
+  if (str.find("nor_gl") != std::string::npos)
+    return &tm.normalGL;
+  if (str.find("rough") != std::string::npos)
+    return &tm.roughness;
+  if (str.find("spec") != std::string::npos)
+    return &tm.specular;
+  return nullptr;
+}
+
+// decode, convert and upload as a chain of jobs after deps, done gets the
+// texture or nullptr when the file can't be read
+JobHandle loadTexture(MAI::Renderer *ren, JobSystem *jobs,
+                      const std::string &path, bool compress,
+                      std::function<void(MAI::Texture *)> done,
+                      const std::vector<JobHandle> &deps = {}) {
+  const TextureKind kind =
+      fs::path(path).filename().string().find("nor_") != std::string::npos
+          ? TextureKind_Normal
+          : TextureKind_Color;
+  TextureLoad *load = new TextureLoad(path, kind, compress);
+  JobHandle decode = jobs->submit([load] { decodeTexture(*load); }, deps);
+  JobHandle convert = jobs->submit([load] { convertTexture(*load); }, {decode});
+  return jobs->submit(
+      [ren, load, done] {
+        done(uploadTexture(ren, *load));
+        delete load;
+      },
+      {convert});
+}
 }; // namespace
-   //
-void loadTextures(MAI::Renderer *ren, std::string dir,
-                  std::vector<TextureModel> &textures) {
-  TextureModel tm;
-  std::string name = dir;
-  std::replace(name.begin(), name.end(), '\\', '/');
-  name = name.substr(name.find_last_of('/') + 1);
-  tm.name = name;
 
-  for (const auto &entry : fs::directory_iterator(dir)) {
-    std::string str = entry.path();
-    int w, h, comp;
-    const stbi_uc *pixels = stbi_load(str.c_str(), &w, &h, &comp, 4);
-    if (!pixels) {
-      std::cerr << "failed to laod texture at " << str << std::endl;
-      assert(false);
-    }
-    MAI::Texture *texture = ren->createImage({
-        .type = MAI::TextureType_2D,
-        .format = MAI::Format_RGBA_S8,
-        .dimensions = {(uint32_t)w, (uint32_t)h},
-        .data = pixels,
-        .usage = MAI::Sampled_Bit,
-    });
-    if (str.find("ao") != std::string::npos)
-      tm.ao = texture;
-    else if (str.find("arm") != std::string::npos)
-      tm.arm = texture;
-    else if (str.find("diff") != std::string::npos)
-      tm.diffuse = texture;
-    else if (str.find("disp") != std::string::npos)
-      tm.displacement = texture;
-    else if (str.find("mask") != std::string::npos)
-      tm.mask = texture;
-    else if (str.find("nor_dx") != std::string::npos)
-      tm.normalDX = texture;
-    else if (str.find("nor_gl") != std::string::npos)
-      tm.normalGL = texture;
-    else if (str.find("rough") != std::string::npos)
-      tm.roughness = texture;
-    else if (str.find("spec") != std::string::npos)
-      tm.specular = texture;
-    else {
-      std::cerr << str << "not exist" << std::endl;
-      assert(false);
+Textures::Textures(MAI::Renderer *ren, JobSystem *jobs)
+    : ren_(ren), jobs_(jobs) {
+  MAI_PROFILE_FUNCTION();
+  std::vector<std::string> dirs;
+  std::string path = RESOURCES_PATH "textures";
+  for (const auto &entry : fs::directory_iterator(path))
+    dirs.emplace_back(entry.path());
+
+  // ids follow the directory order, 0 means no texture. The vector isn't
+  // resized again so the jobs can write into it
+  textures.resize(dirs.size());
+  const bool compress = ren->supportsBlockCompression();
+  std::vector<JobHandle> uploads;
+  for (size_t i = 0; i < dirs.size(); i++) {
+    TextureModel &tm = textures[i];
+    std::string name = dirs[i];
+    std::replace(name.begin(), name.end(), '\\', '/');
+    tm.id = (uint32_t)i + 1;
+    tm.name = name.substr(name.find_last_of('/') + 1);
+
+    for (const auto &entry : fs::directory_iterator(dirs[i])) {
+      std::string str = entry.path();
+      if (isTextureCache(str))
+        continue;
+      MAI::Texture **slot =
+          textureSlot(tm, entry.path().filename().string());
+      if (!slot) {
+        std::cerr << str << "not exist" << std::endl;
+        assert(false);
+        continue;
+      }
+      uploads.emplace_back(
+          loadTexture(ren, jobs, str, compress, [slot, str](MAI::Texture *t) {
+            *slot = t;
+            if (!t) {
+              std::cerr << "failed to laod texture at " << str << std::endl;
+              assert(false);
+            }
+          }));
     }
   }
-  std::lock_guard<std::mutex> lock(mtx);
-  tm.id = count;
-  textures.emplace_back(tm);
-  count++;
+  jobs->wait(uploads);
 }
 
-Textures::Textures(MAI::Renderer *ren) : ren_(ren) {
-  std::vector<std::jthread> threads;
-  std::string path = RESOURCES_PATH "textures";
-  for (const auto &entry : fs::directory_iterator(path)) {
-    std::string str = entry.path();
-    TextureModel tm;
-    threads.emplace_back(loadTextures, ren, str, std::ref(textures));
+void Textures::watch() {
+  if (!watcher)
+    watcher = new FileWatcher(RESOURCES_PATH "textures", true);
+}
+
+void Textures::reload(const std::string &path) {
+  const fs::path file = fs::path(path).lexically_normal();
+  const std::string name = file.filename().string();
+  TextureModel probe;
+  // temporaries editors saved through are renamed away by now
+  if (isTextureCache(name) || !textureSlot(probe, name) || !fs::exists(file))
+    return;
+  // only the files of texture sets, textures/<set>/<file>
+  const fs::path root = fs::path(RESOURCES_PATH "textures").lexically_normal();
+  if (file.parent_path().parent_path() != root)
+    return;
+
+  const std::string set = file.parent_path().filename().string();
+  JobHandle &last = loads[path];
+  last = loadTexture(
+      ren_, jobs_, path, ren_->supportsBlockCompression(),
+      [this, set, name, path](MAI::Texture *texture) {
+        if (!texture) {
+          std::cerr << "keeping the old texture of " << path << std::endl;
+          return;
+        }
+        std::lock_guard<std::mutex> lock(loadMutex);
+        loaded.push_back({set, name, texture});
+      },
+      {last});
+}
+
+bool Textures::update() {
+  if (watcher)
+    for (const std::string &path : watcher->poll())
+      reload(path);
+
+  std::vector<LoadedTexture> ready;
+  {
+    std::lock_guard<std::mutex> lock(loadMutex);
+    ready.swap(loaded);
+  }
+  for (LoadedTexture &it : ready) {
+    auto found = std::find_if(
+        textures.begin(), textures.end(),
+        [&](const TextureModel &tm) { return tm.name == it.set; });
+    if (found == textures.end()) {
+      textures.emplace_back(TextureModel{
+          .id = (uint32_t)textures.size() + 1,
+          .name = it.set,
+      });
+      found = textures.end() - 1;
+    }
+    MAI::Texture **slot = textureSlot(*found, it.file);
+    ren_->deferDelete(*slot);
+    *slot = it.texture;
+    std::cout << "reloaded " << it.set << "/" << it.file << std::endl;
   }
+  return !ready.empty();
 }
+
 Textures::~Textures() {
+  for (auto &it : loads)
+    jobs_->wait(it.second);
+  for (auto &it : loaded)
+    delete it.texture;
+  delete watcher;
   for (auto &it : textures) {
     if (it.ao)
       delete it.ao;
@@ -0,0 +1,77 @@
+#include "envBaker.h"
+#include "jobSystem.h"
+#include "textureCache.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+// Cooks the image based lighting caches of the skyboxes without opening a
+// window, so a fresh checkout or a build machine can have them ready
+// before the game starts. Valid caches are kept unless --force is given.
+//
+// usage: env_bake [--force] [--workers N] [skybox.hdr ...]
+
+namespace fs = std::filesystem;
+
+struct BakeOptions {
+  bool force = false;
+  // 0 is one per hardware thread
+  uint32_t workers = 0;
+  // every hdr in resources/skybox when empty
+  std::vector<std::string> paths;
+};
+
+bool parseOptions(int argc, char **argv, BakeOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "--force"))
+      opts.force = true;
+    else if (!strcmp(argv[i], "--workers") && hasValue)
+      opts.workers = atoi(argv[++i]);
+    else if (argv[i][0] == '-') {
+      std::cerr << "unknown argument " << argv[i] << std::endl;
+      return false;
+    } else
+      opts.paths.emplace_back(argv[i]);
+  }
+  if (opts.paths.empty())
+    for (const auto &entry : fs::directory_iterator(RESOURCES_PATH "skybox"))
+      if (!isTextureCache(entry.path()))
+        opts.paths.emplace_back(entry.path());
+  return true;
+}
+
+int main(int argc, char **argv) {
+  BakeOptions opts;
+  if (!parseOptions(argc, argv, opts))
+    return 2;
+
+  JobSystem jobs(opts.workers);
+  uint32_t failures = 0;
+  const auto begin = std::chrono::steady_clock::now();
+
+  const std::string lutPath =
+      std::string(RESOURCES_PATH "skybox/") + ENV_BRDF_LUT_NAME;
+  if (!cookBrdfLut(lutPath, &jobs, opts.force)) {
+    std::cerr << "failed to write " << lutPath << std::endl;
+    failures++;
+  }
+  for (const std::string &path : opts.paths) {
+    if (!cookEnvironment(path, &jobs, opts.force)) {
+      std::cerr << "failed to cook " << path << std::endl;
+      failures++;
+      continue;
+    }
+    std::cout << path << std::endl;
+  }
+
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+  std::cout << opts.paths.size() << " skyboxes on " << jobs.getWorkerCount()
+            << " workers: " << ms << " ms" << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#include "jobSystem.h"
+#include "mai_config.h"
+#include "mai_vk.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+// Compiles GLSL shaders to SPIR-V ahead of time, so the shaders the game
+// loads from spvs never go through glslang at startup. Includes are
+// resolved like Renderer::createShader does and the limits are the ones
+// every Vulkan device has. The shaders target runs it when a source or an
+// include changed.
+//
+// usage: shaderc [--workers N] [--out dir] [shader.vert ...]
+
+namespace fs = std::filesystem;
+
+struct CompileOptions {
+  // 0 is one per hardware thread
+  uint32_t workers = 0;
+  std::string outDir = SHADERS_PATH "spvs";
+  // every shader in shaders/ when empty
+  std::vector<std::string> paths;
+};
+
+// the extension createShader takes the stage of a SPIR-V file from
+const char *getSpirvExtension(MAI::ShaderStage stage) {
+  switch (stage) {
+  case MAI::Vert:
+    return ".vspv";
+  case MAI::Frag:
+    return ".fspv";
+  case MAI::Geom:
+    return ".gspv";
+  case MAI::Tese:
+    return ".tespv";
+  case MAI::Tece:
+    return ".tcspv";
+  case MAI::Comp:
+    return ".cspv";
+  default:
+    return nullptr;
+  }
+}
+
+bool isShaderSource(const fs::path &path) {
+  const std::string ext = path.extension();
+  return ext == ".vert" || ext == ".frag" || ext == ".geom" ||
+         ext == ".tese" || ext == ".tesc" || ext == ".comp";
+}
+
+bool parseOptions(int argc, char **argv, CompileOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = i + 1 < argc;
+    if (!strcmp(argv[i], "--workers") && hasValue)
+      opts.workers = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--out") && hasValue)
+      opts.outDir = argv[++i];
+    else if (argv[i][0] == '-') {
+      std::cerr << "unknown argument " << argv[i] << std::endl;
+      return false;
+    } else
+      opts.paths.emplace_back(argv[i]);
+  }
+  if (opts.paths.empty())
+    for (const auto &entry : fs::directory_iterator(SHADERS_PATH))
+      if (entry.is_regular_file() && isShaderSource(entry.path()))
+        opts.paths.emplace_back(entry.path());
+  return true;
+}
+
+bool compileShader(const std::string &path, const std::string &outDir,
+                   const glslang_resource_t &resource) {
+  if (!isShaderSource(path)) {
+    std::cerr << path << " isn't a shader source" << std::endl;
+    return false;
+  }
+  const MAI::ShaderStage stage = MAI::getShaderStageFromFile(path.c_str());
+  const std::string code = MAI::readShaderFile(path.c_str());
+  std::vector<uint8_t> spirv;
+  if (code.empty() ||
+      !MAI::compileShaderGlslang(stage, code.c_str(), &spirv, &resource))
+    return false;
+
+  const std::string outPath = outDir + "/" + fs::path(path).stem().string() +
+                              getSpirvExtension(stage);
+  std::ofstream file(outPath, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(spirv.data()), spirv.size());
+  if (!file) {
+    std::cerr << "failed to write " << outPath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  CompileOptions opts;
+  if (!parseOptions(argc, argv, opts))
+    return 2;
+
+  std::error_code error;
+  fs::create_directories(opts.outDir, error);
+  const glslang_resource_t resource =
+      MAI::getGLSLangResources(MAI::getMinimumDeviceLimits());
+
+  JobSystem jobs(opts.workers);
+  std::atomic<uint32_t> failures = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  jobs.parallelFor((uint32_t)opts.paths.size(), 1,
+                   [&](uint32_t first, uint32_t end) {
+                     for (uint32_t i = first; i < end; i++)
+                       if (!compileShader(opts.paths[i], opts.outDir,
+                                          resource)) {
+                         std::cerr << "failed to compile " << opts.paths[i]
+                                   << std::endl;
+                         failures++;
+                       }
+                   });
+
+  const double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+  std::cout << opts.paths.size() << " shaders on " << jobs.getWorkerCount()
+            << " workers: " << ms << " ms" << std::endl;
+  return failures ? 1 : 0;
+}